@@ -13,32 +13,128 @@
 
 #include "Aero.h"
 #include "MainFrm.h"
+#include "TaskPool.h"
+#include "BenchmarkSuite.h"
+#include "EventTrace.h"
 
 CAppModule _Module;
 
-int Run(LPTSTR /*lpstrCmdLine*/ = NULL, int nCmdShow = SW_SHOWDEFAULT)
+// The arguments after a leading command line switch, as UTF-8 - what
+// CNativeFile takes for paths - without the surrounding spaces; false when
+// the line starts with another switch, "/tracefoo" included.
+bool MatchSwitch(LPCTSTR lpstrCmdLine, LPCTSTR lpszSwitch, std::string& arguments)
+{
+	while(*lpstrCmdLine == _T(' '))
+		lpstrCmdLine++;
+	size_t cchSwitch = _tcslen(lpszSwitch);
+	if(_tcsnicmp(lpstrCmdLine, lpszSwitch, cchSwitch) != 0)
+		return false;
+	LPCTSTR p = lpstrCmdLine + cchSwitch;
+	if(*p != 0 && *p != _T(' '))
+		return false;
+	while(*p == _T(' '))
+		p++;
+	CT2W wide(p);
+	LPCWSTR lpszWide = wide;
+	int cch = (int)wcslen(lpszWide);
+	while(cch > 0 && lpszWide[cch - 1] == L' ')
+		cch--;
+	arguments.clear();
+	if(cch == 0)
+		return true;
+	int cb = ::WideCharToMultiByte(CP_UTF8, 0, lpszWide, cch, NULL, 0, NULL, NULL);
+	if(cb > 0) {
+		arguments.resize(cb);
+		::WideCharToMultiByte(CP_UTF8, 0, lpszWide, cch, &arguments[0], cb, NULL, NULL);
+	}
+	return true;
+}
+
+// "/trace <file>" records the list's data callbacks of the session into
+// file, for "/replay".
+int Run(LPTSTR lpstrCmdLine = NULL, int nCmdShow = SW_SHOWDEFAULT)
 {
 	CMessageLoop theLoop;
 	_Module.AddMessageLoop(&theLoop);
 
 	CMainFrame wndMain;
 
-	if(wndMain.CreateEx() == NULL)
 	{
-		ATLTRACE(_T("Main window creation failed!\n"));
-		return 0;
+		Synrc::CTraceScope trace("startup.window", "startup");
+		if(wndMain.CreateEx() == NULL)
+		{
+			ATLTRACE(_T("Main window creation failed!\n"));
+			return 0;
+		}
 	}
 
+	std::string tracePath;
+	Synrc::CListTraceRecorder trace;
+	if(lpstrCmdLine != NULL && MatchSwitch(lpstrCmdLine, _T("/trace"), tracePath) && !tracePath.empty())
+		wndMain.listView->SetTraceRecorder(&trace);
+
 	wndMain.ShowWindow(nCmdShow);
 
 	int nRet = theLoop.Run();
 
+	if(!tracePath.empty())
+		trace.Save(tracePath);
+
 	_Module.RemoveMessageLoop();
 	return nRet;
 }
 
+// "/benchmark [name prefix] [scale=percent]" runs the engine benchmarks
+// instead of the UI and writes one JSON line per case to benchmark.jsonl.
+// With "baseline=<file> [threshold=percent]" it also compares the run with
+// an earlier benchmark.jsonl, writes the verdicts to benchmark-gate.jsonl
+// and exits with 1 when a case regressed, 2 without a readable baseline.
+// "/replay <trace file> [realtime]" replays a "/trace" recording against
+// the benchmark address book and writes its latencies to replay.jsonl.
+bool RunBenchmarks(LPCTSTR lpstrCmdLine, int& nRet)
+{
+	std::string arguments;
+	std::string output;
+	const char* pOutput = NULL;
+	if(MatchSwitch(lpstrCmdLine, _T("/benchmark"), arguments)) {
+		if(Synrc::BenchmarkArguments(arguments).baseline.empty()) {
+			Synrc::RunBenchmarkSuite(arguments, output);
+		}
+		else {
+			std::string report;
+			int regressed = Synrc::RunBenchmarkGate(arguments, output, report);
+			nRet = regressed < 0 ? 2 : regressed > 0 ? 1 : 0;
+			Synrc::CNativeFile file;
+			if(file.Open("benchmark-gate.jsonl", Synrc::CNativeFile::OpenCreate))
+				file.Write(report.data(), report.size());
+		}
+		pOutput = "benchmark.jsonl";
+	}
+	else if(MatchSwitch(lpstrCmdLine, _T("/replay"), arguments)) {
+		Synrc::RunTraceReplay(arguments, output);
+		pOutput = "replay.jsonl";
+	}
+	else {
+		return false;
+	}
+
+	Synrc::CNativeFile file;
+	if(file.Open(pOutput, Synrc::CNativeFile::OpenCreate))
+		file.Write(output.data(), output.size());
+	return true;
+}
+
+// "/chrometrace <file>" writes a timeline of startup and the session to
+// file, for chrome://tracing; Ctrl+Shift+T traces from then on.
 int WINAPI _tWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/, LPTSTR lpstrCmdLine, int nCmdShow)
 {
+	std::string chromeTracePath;
+	Synrc::CEventTracer& tracer = Synrc::CEventTracer::GetDefault();
+	tracer.SetThreadName("ui");
+	if(MatchSwitch(lpstrCmdLine, _T("/chrometrace"), chromeTracePath) && !chromeTracePath.empty())
+		tracer.Start();
+	uint64_t startNs = Synrc::GetTimeNs();
+
 	HRESULT hRes = ::CoInitialize(NULL);
 // If you are running on NT 4.0 or higher you can use the following call instead to 
 // make the EXE free threaded. This means that calls come in on a random RPC thread.
@@ -52,8 +148,20 @@ int WINAPI _tWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/, LPTSTR lp
 
 	hRes = _Module.Init(NULL, hInstance);
 	ATLASSERT(SUCCEEDED(hRes));
+	if(tracer.IsEnabled())
+		tracer.Add("startup.init", "startup", startNs, Synrc::GetTimeNs() - startNs);
+
+	int nRet = 0;
+	if(!RunBenchmarks(lpstrCmdLine, nRet))
+		nRet = Run(lpstrCmdLine, nCmdShow);
 
-	int nRet = Run(lpstrCmdLine, nCmdShow);
+	// background work (search, import, sync) runs on the shared pool; stop it before the module goes
+	Synrc::CTaskPool::ShutdownDefault();
+
+	if(!chromeTracePath.empty()) {
+		tracer.Stop();
+		tracer.Save(chromeTracePath);
+	}
 
 	_Module.Term();
 	::CoUninitialize();
@@ -0,0 +1,713 @@
+// AutoComplete.h
+//
+//  Completions for an address being typed: the contacts whose email
+//  address, display name or a later word of the name ("Sokh" for "Maxim
+//  Sokhatsky") starts with the text, best first. Best is frecency, a use
+//  count that halves every couple of weeks without being touched: a
+//  contact written to daily last month ranks below one written to twice
+//  this morning.
+//
+//  The decay is kept implicit. A score is the log2 of the sum of 2^(t/H)
+//  over the uses, t the time of each and H the half-life, so a use only
+//  ever raises a score and the order of two scores never changes as time
+//  passes. The decayed count itself is 2^(score - now/H).
+//
+//  Keys are primary collation keys, so case and accents do not matter, in
+//  a compressed trie: a node per branch point, its label the key bytes
+//  from the node above. A node with more than MaxCompletions keys below it
+//  keeps the best MaxCompletions contacts of its subtree, so completing a
+//  prefix is a walk down the trie and a copy; smaller subtrees are few
+//  keys and are just walked. A use walks up from the keys of its contact
+//  and moves it up the lists on the way, an edited contact takes its keys
+//  out and puts the new ones in: both touch the path to the root only.
+//
+//  Threading: the trie has its own lock, then the store's. Edits are
+//  applied as the store reports them.
+
+#pragma once
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "Collation.h"
+#include "ContactStore.h"
+#include "EventTrace.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CFrecency - use counts decayed by age, as one number per contact
+// CAutoCompleteTrie - contacts by the starts of their address and name words
+
+namespace Synrc
+{
+
+class CFrecency
+{
+public:
+	enum
+	{
+		HalfLifeSeconds = 14 * 24 * 3600,
+		BaseTime = 1577836800       // 2020-01-01, keeps scores small
+	};
+
+	// the score of a contact never used
+	static float GetNone()
+	{
+		return -FLT_MAX;
+	}
+
+	// seconds since 1970, the times uses are recorded at
+	static uint32_t GetNow()
+	{
+		return (uint32_t)time(NULL);
+	}
+
+	// the score with one more use at time
+	static float AddUse(float score, uint32_t time)
+	{
+		double use = ((double)time - BaseTime) / HalfLifeSeconds;
+		if(score == GetNone())
+			return (float)use;
+		double high = score > use ? score : use;
+		double low = score > use ? use : score;
+		return (float)(high + log(1.0 + pow(2.0, low - high)) / log(2.0));
+	}
+
+	// the uses of the score, each counted as 1 halved per half-life since
+	static double GetCount(float score, uint32_t now)
+	{
+		if(score == GetNone())
+			return 0.0;
+		return pow(2.0, score - ((double)now - BaseTime) / HalfLifeSeconds);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CAutoCompleteTrie - contacts by the starts of their address and name words
+
+struct AutoCompleteStats
+{
+	uint64_t completions;
+	uint64_t uses;
+	uint64_t edits;             // contacts whose keys were replaced
+	uint64_t recomputes;        // lists made again from the subtree after the build
+	uint64_t rebuilds;
+
+	AutoCompleteStats() : completions(0), uses(0), edits(0), recomputes(0), rebuilds(0)
+	{
+	}
+};
+
+class CAutoCompleteTrie : public IContactStoreObserver
+{
+public:
+	enum
+	{
+		MaxCompletions = 10,
+		MaxKeyBytes = 0xFFFF,   // longer keys are cut
+		NoNode = 0xFFFFFFFF
+	};
+
+	CAutoCompleteTrie(CContactStore& store, const CCollator& collator) :
+		m_store(store), m_collator(collator), m_bStale(true), m_bBuilding(false),
+		m_freeEntry(NoNode), m_freeList(NoNode), m_builtNodes(0), m_builtLabels(0)
+	{
+		m_store.AddObserver(this);
+	}
+
+	~CAutoCompleteTrie()
+	{
+		m_store.RemoveObserver(this);
+	}
+
+	void Rebuild()
+	{
+		CAutoLock lock(m_cs);
+		CAutoLock storeLock(m_store.GetLock());
+		Build();
+	}
+
+	// Puts up to count contacts whose address or a name word starts with
+	// text in rows, best first; the best overall for empty text.
+	void Complete(const std::wstring& text, size_t count, std::vector<uint32_t>& rows)
+	{
+		CTraceScope trace("search.complete", "search");
+		rows.clear();
+		if(count > MaxCompletions)
+			count = MaxCompletions;
+		std::string key;
+		m_collator.AppendPrimaryKey(text.data(), text.size(), key);
+
+		CAutoLock lock(m_cs);
+		if(m_bStale) {
+			CAutoLock storeLock(m_store.GetLock());
+			Build();
+		}
+		m_stats.completions++;
+		uint32_t node = FindPrefix(key);
+		if(node == NoNode)
+			return;
+		if(m_nodes[node].list != NoNode) {
+			const uint32_t* pList = &m_lists[m_nodes[node].list];
+			size_t length = pList[0] < count ? pList[0] : count;
+			rows.assign(pList + 1, pList + 1 + length);
+			return;
+		}
+		GatherBest(node, rows);
+		if(rows.size() > count)
+			rows.resize(count);
+	}
+
+	// The contact was used now: written to, called, picked from the list.
+	void RecordUse(uint32_t row, uint32_t time = CFrecency::GetNow())
+	{
+		CAutoLock lock(m_cs);
+		EnsureRow(row);
+		m_stats.uses++;
+		SetScoreLocked(row, CFrecency::AddUse(m_scores[row], time));
+	}
+
+	// a score kept from before, or CFrecency::GetNone() to forget the uses
+	void SetScore(uint32_t row, float score)
+	{
+		CAutoLock lock(m_cs);
+		EnsureRow(row);
+		SetScoreLocked(row, score);
+	}
+
+	float GetScore(uint32_t row)
+	{
+		CAutoLock lock(m_cs);
+		return row < m_scores.size() ? m_scores[row] : CFrecency::GetNone();
+	}
+
+	size_t GetNodeCount()
+	{
+		CAutoLock lock(m_cs);
+		return m_nodes.size();
+	}
+
+	size_t GetMemoryUsage()
+	{
+		CAutoLock lock(m_cs);
+		return m_nodes.capacity() * sizeof(Node) + m_entries.capacity() * sizeof(Entry) + m_labels.capacity() +
+			m_lists.capacity() * sizeof(uint32_t) + m_scores.capacity() * sizeof(float) +
+			m_rowEntries.capacity() * sizeof(uint32_t);
+	}
+
+	AutoCompleteStats GetStats()
+	{
+		CAutoLock lock(m_cs);
+		return m_stats;
+	}
+
+	// implementation of IContactStoreObserver
+	virtual void OnContactChanged(uint32_t row, ContactChange change)
+	{
+		CAutoLock lock(m_cs);
+		if(m_bStale)
+			return;
+		CAutoLock storeLock(m_store.GetLock());
+		switch(change) {
+		case ContactAdded:
+			EnsureRow(row);
+			m_scores[row] = CFrecency::GetNone();
+			RemoveKeys(row);
+			AddKeys(row);
+			break;
+		case ContactUpdated:
+			EnsureRow(row);
+			RemoveKeys(row);
+			AddKeys(row);
+			m_stats.edits++;
+			break;
+		case ContactRemoved:
+			if(row < m_rowEntries.size())
+				RemoveKeys(row);
+			break;
+		case ContactsRemoved:
+			for(uint32_t i = 0; i < m_rowEntries.size(); i++) {
+				if(m_rowEntries[i] != NoNode && !m_store.IsLive(i))
+					RemoveKeys(i);
+			}
+			break;
+		case ContactsCleared:
+			m_bStale = true;
+			break;
+		}
+		// labels and nodes of replaced keys are not reused
+		if(m_nodes.size() > 2 * m_builtNodes + 4096 || m_labels.size() > 2 * m_builtLabels + 65536)
+			m_bStale = true;
+	}
+	// implementation of IContactStoreObserver
+
+private:
+	struct Node
+	{
+		uint32_t labelStart;    // in m_labels
+		uint16_t labelLength;
+		uint8_t first;          // of the label, to find a child without reading labels
+		uint8_t reserved;
+		uint32_t parent;
+		uint32_t firstChild;    // children by first byte
+		uint32_t nextSibling;
+		uint32_t firstEntry;    // keys ending here
+		uint32_t keyCount;      // keys ending here and below
+		uint32_t list;          // in m_lists when keyCount > MaxCompletions
+	};
+
+	// a key of a contact
+	struct Entry
+	{
+		uint32_t row;
+		uint32_t node;
+		uint32_t previousInNode;
+		uint32_t nextInNode;
+		uint32_t nextOfRow;
+	};
+
+	enum { ListSize = MaxCompletions + 1 };    // the length, then the rows
+
+	enum KeyKind
+	{
+		KeyEmail = 1,
+		KeyName = 2,
+		KeyWords = 4,           // the name from its second word on, and so on
+		KeyAll = 7
+	};
+
+	CContactStore& m_store;
+	const CCollator& m_collator;
+	CCritSec m_cs;
+	bool m_bStale;
+	bool m_bBuilding;           // lists are made at the end
+	std::vector<Node> m_nodes;          // the root first
+	std::vector<Entry> m_entries;
+	std::string m_labels;
+	std::vector<uint32_t> m_lists;      // best contacts of the big subtrees, ListSize each
+	std::vector<float> m_scores;        // per row
+	std::vector<uint32_t> m_rowEntries; // per row its first key
+	uint32_t m_freeEntry;
+	uint32_t m_freeList;
+	size_t m_builtNodes;
+	size_t m_builtLabels;
+	std::vector<uint32_t> m_scratch;
+	std::string m_key;
+	AutoCompleteStats m_stats;
+
+	// ranks rows: higher score, then lower row
+	struct BetterRow
+	{
+		const std::vector<float>& scores;
+
+		explicit BetterRow(const std::vector<float>& scores_) : scores(scores_)
+		{
+		}
+
+		bool operator()(uint32_t a, uint32_t b) const
+		{
+			return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+		}
+	};
+
+	bool IsBetter(uint32_t a, uint32_t b) const
+	{
+		return BetterRow(m_scores)(a, b);
+	}
+
+	void EnsureRow(uint32_t row)
+	{
+		if(row >= m_scores.size()) {
+			m_scores.resize(row + 1, CFrecency::GetNone());
+			m_rowEntries.resize(row + 1, NoNode);
+		}
+	}
+
+	void Build()
+	{
+		CTraceScope trace("index.complete", "index");
+		uint32_t count = (uint32_t)m_store.GetRowCount();
+		m_nodes.clear();
+		m_entries.clear();
+		m_labels.clear();
+		m_lists.clear();
+		m_freeEntry = NoNode;
+		m_freeList = NoNode;
+		m_nodes.push_back(MakeNode(0, 0, NoNode));
+		m_scores.resize(count, CFrecency::GetNone());     // uses survive a rebuild
+		m_rowEntries.assign(m_scores.size(), NoNode);
+		m_bBuilding = true;
+		for(int kind = KeyEmail; kind <= KeyWords; kind <<= 1) {
+			for(uint32_t row = 0; row < count; row++) {
+				if(m_store.IsLive(row))
+					AddKeys(row, kind);
+			}
+		}
+		m_bBuilding = false;
+
+		// parents before children, then backwards: children's lists first
+		std::vector<uint32_t> order;
+		order.reserve(m_nodes.size());
+		m_scratch.assign(1, 0);
+		while(!m_scratch.empty()) {
+			uint32_t node = m_scratch.back();
+			m_scratch.pop_back();
+			order.push_back(node);
+			for(uint32_t child = m_nodes[node].firstChild; child != NoNode; child = m_nodes[child].nextSibling) {
+				if(m_nodes[child].keyCount > MaxCompletions)
+					m_scratch.push_back(child);     // small subtrees have no lists below
+			}
+		}
+		for(size_t i = order.size(); i-- > 0; ) {
+			if(m_nodes[order[i]].keyCount > MaxCompletions) {
+				m_nodes[order[i]].list = AllocateList();
+				FillList(order[i]);
+			}
+		}
+		// grown a key at a time: up to half of each is spare
+		std::vector<Node>(m_nodes).swap(m_nodes);
+		std::vector<Entry>(m_entries).swap(m_entries);
+		std::string(m_labels).swap(m_labels);
+		m_builtNodes = m_nodes.size();
+		m_builtLabels = m_labels.size();
+		m_stats.rebuilds++;
+		m_bStale = false;
+	}
+
+	Node MakeNode(uint32_t labelStart, uint32_t labelLength, uint32_t parent) const
+	{
+		uint8_t first = labelLength > 0 ? (uint8_t)m_labels[labelStart] : 0;
+		Node node = { labelStart, (uint16_t)labelLength, first, 0, parent, NoNode, NoNode, NoNode, 0, NoNode };
+		return node;
+	}
+
+	// the node at or just below the end of key, NoNode if no key starts so
+	uint32_t FindPrefix(const std::string& key) const
+	{
+		uint32_t node = 0;
+		size_t pos = 0;
+		while(pos < key.size()) {
+			uint32_t child = FindChild(node, (uint8_t)key[pos]);
+			if(child == NoNode)
+				return NoNode;
+			const Node& next = m_nodes[child];
+			size_t length = key.size() - pos < next.labelLength ? key.size() - pos : next.labelLength;
+			if(memcmp(&m_labels[next.labelStart], key.data() + pos, length) != 0)
+				return NoNode;
+			node = child;
+			pos += length;
+		}
+		return node;
+	}
+
+	uint32_t FindChild(uint32_t node, uint8_t first) const
+	{
+		uint32_t child = m_nodes[node].firstChild;
+		while(child != NoNode && m_nodes[child].first < first)
+			child = m_nodes[child].nextSibling;
+		return child != NoNode && m_nodes[child].first == first ? child : NoNode;
+	}
+
+	// puts child, or the node in its place, among the children of node
+	uint32_t* FindChildLink(uint32_t node, uint8_t first)
+	{
+		uint32_t* pLink = &m_nodes[node].firstChild;
+		while(*pLink != NoNode && m_nodes[*pLink].first < first)
+			pLink = &m_nodes[*pLink].nextSibling;
+		return pLink;
+	}
+
+	// The keys of a row: its address, its name, the rest of its name from
+	// each later word. The build adds one kind for all rows at a time, which
+	// keeps the part of the trie it walks in the cache.
+	void AddKeys(uint32_t row, int kinds = KeyAll)
+	{
+		std::string& key = m_key;
+		if(kinds & KeyEmail) {
+			key.clear();
+			const std::wstring& email = m_store.GetField(row, FieldEmail);
+			m_collator.AppendPrimaryKey(email.data(), email.size(), key);
+			if(!key.empty())
+				AddKey(row, key.data(), key.size());
+		}
+		if((kinds & (KeyName | KeyWords)) == 0)
+			return;
+		key.clear();
+		const std::wstring& name = m_store.GetField(row, FieldName);
+		m_collator.AppendPrimaryKey(name.data(), name.size(), key);
+		if(!key.empty() && (kinds & KeyName))
+			AddKey(row, key.data(), key.size());
+		for(size_t i = 0; i < key.size() && (kinds & KeyWords); i++) {
+			if((uint8_t)key[i] == CCollator::WeightOther)
+				i += CCollator::OtherBytes;     // a code unit follows, not weights
+			else if((uint8_t)key[i] == CCollator::WeightSeparator && i + 1 < key.size())
+				AddKey(row, key.data() + i + 1, key.size() - i - 1);
+		}
+	}
+
+	void AddKey(uint32_t row, const char* pKey, size_t cch)
+	{
+		if(cch > MaxKeyBytes)
+			cch = MaxKeyBytes;
+		uint32_t node = 0;
+		size_t pos = 0;
+		while(pos < cch) {
+			uint32_t child = FindChild(node, (uint8_t)pKey[pos]);
+			if(child == NoNode) {
+				child = (uint32_t)m_nodes.size();
+				m_labels.append(pKey + pos, cch - pos);
+				m_nodes.push_back(MakeNode((uint32_t)(m_labels.size() - (cch - pos)), (uint32_t)(cch - pos), node));
+				uint32_t* pLink = FindChildLink(node, (uint8_t)pKey[pos]);
+				m_nodes[child].nextSibling = *pLink;
+				*pLink = child;
+				node = child;
+				break;
+			}
+			uint32_t length = 1;
+			uint32_t labelLength = m_nodes[child].labelLength;
+			const char* pLabel = &m_labels[m_nodes[child].labelStart];
+			while(length < labelLength && pos + length < cch && pLabel[length] == pKey[pos + length])
+				length++;
+			if(length < labelLength)
+				child = SplitNode(child, length);
+			node = child;
+			pos += length;
+		}
+
+		uint32_t entry = m_freeEntry;
+		if(entry != NoNode)
+			m_freeEntry = m_entries[entry].nextInNode;
+		else {
+			entry = (uint32_t)m_entries.size();
+			m_entries.push_back(Entry());
+		}
+		Entry& added = m_entries[entry];
+		added.row = row;
+		added.node = node;
+		added.previousInNode = NoNode;
+		added.nextInNode = m_nodes[node].firstEntry;
+		added.nextOfRow = m_rowEntries[row];
+		if(added.nextInNode != NoNode)
+			m_entries[added.nextInNode].previousInNode = entry;
+		m_nodes[node].firstEntry = entry;
+		m_rowEntries[row] = entry;
+
+		for(uint32_t up = node; up != NoNode; up = m_nodes[up].parent) {
+			Node& path = m_nodes[up];
+			path.keyCount++;
+			if(m_bBuilding || path.keyCount <= MaxCompletions)
+				continue;
+			if(path.list == NoNode) {
+				path.list = AllocateList();
+				FillList(up);
+			}
+			else {
+				Raise(path.list, row);
+			}
+		}
+	}
+
+	// Puts a node above child with the first length bytes of its label;
+	// returns it.
+	uint32_t SplitNode(uint32_t child, uint32_t length)
+	{
+		uint32_t parent = m_nodes[child].parent;
+		uint32_t middle = (uint32_t)m_nodes.size();
+		m_nodes.push_back(MakeNode(m_nodes[child].labelStart, length, parent));
+		*FindChildLink(parent, m_nodes[middle].first) = middle;     // where child was
+		Node& split = m_nodes[middle];
+		Node& lower = m_nodes[child];
+		split.firstChild = child;
+		split.nextSibling = lower.nextSibling;
+		split.keyCount = lower.keyCount;
+		if(lower.list != NoNode) {
+			split.list = AllocateList();
+			std::copy(m_lists.begin() + lower.list, m_lists.begin() + lower.list + ListSize, m_lists.begin() + split.list);
+		}
+		lower.labelStart += length;
+		lower.labelLength = (uint16_t)(lower.labelLength - length);
+		lower.first = (uint8_t)m_labels[lower.labelStart];
+		lower.parent = middle;
+		lower.nextSibling = NoNode;
+		return middle;
+	}
+
+	void RemoveKeys(uint32_t row)
+	{
+		while(m_rowEntries[row] != NoNode) {
+			uint32_t entry = m_rowEntries[row];
+			uint32_t node = m_entries[entry].node;
+			m_rowEntries[row] = m_entries[entry].nextOfRow;
+
+			const Entry& removed = m_entries[entry];
+			if(removed.previousInNode != NoNode)
+				m_entries[removed.previousInNode].nextInNode = removed.nextInNode;
+			else
+				m_nodes[node].firstEntry = removed.nextInNode;
+			if(removed.nextInNode != NoNode)
+				m_entries[removed.nextInNode].previousInNode = removed.previousInNode;
+			m_entries[entry].nextInNode = m_freeEntry;
+			m_freeEntry = entry;
+
+			for(uint32_t up = node; up != NoNode; up = m_nodes[up].parent) {
+				Node& path = m_nodes[up];
+				path.keyCount--;
+				if(path.list == NoNode)
+					continue;
+				if(path.keyCount <= MaxCompletions) {
+					FreeList(path.list);
+					path.list = NoNode;
+				}
+				else if(FindInList(path.list, row) != NoNode) {
+					FillList(up);   // the row may still be below through another key
+				}
+			}
+		}
+	}
+
+	void SetScoreLocked(uint32_t row, float score)
+	{
+		bool bRaised = score >= m_scores[row];
+		m_scores[row] = score;
+		for(uint32_t entry = m_rowEntries[row]; entry != NoNode; entry = m_entries[entry].nextOfRow) {
+			for(uint32_t up = m_entries[entry].node; up != NoNode; up = m_nodes[up].parent) {
+				uint32_t list = m_nodes[up].list;
+				if(list == NoNode)
+					continue;
+				if(bRaised)
+					Raise(list, row);
+				else if(FindInList(list, row) != NoNode)
+					FillList(up);
+			}
+		}
+	}
+
+	uint32_t FindInList(uint32_t list, uint32_t row) const
+	{
+		for(uint32_t i = 1; i <= m_lists[list]; i++) {
+			if(m_lists[list + i] == row)
+				return i;
+		}
+		return NoNode;
+	}
+
+	// The row is in the subtree of the list and scores no lower than it
+	// did: moves it up, or in when it now beats the last one.
+	void Raise(uint32_t list, uint32_t row)
+	{
+		uint32_t* pList = &m_lists[list];
+		uint32_t i = FindInList(list, row);
+		if(i == NoNode) {
+			if(pList[0] < MaxCompletions)
+				i = ++pList[0];
+			else if(IsBetter(row, pList[MaxCompletions]))
+				i = MaxCompletions;
+			else
+				return;
+			pList[i] = row;
+		}
+		for(; i > 1 && IsBetter(pList[i], pList[i - 1]); i--)
+			std::swap(pList[i], pList[i - 1]);
+	}
+
+	// Makes the list of a node from its keys and the lists or keys of its
+	// children.
+	void FillList(uint32_t node)
+	{
+		if(!m_bBuilding)
+			m_stats.recomputes++;
+		std::vector<uint32_t>& rows = m_scratch;
+		rows.clear();
+		for(uint32_t entry = m_nodes[node].firstEntry; entry != NoNode; entry = m_entries[entry].nextInNode)
+			rows.push_back(m_entries[entry].row);
+		for(uint32_t child = m_nodes[node].firstChild; child != NoNode; child = m_nodes[child].nextSibling) {
+			uint32_t list = m_nodes[child].list;
+			if(list != NoNode)
+				rows.insert(rows.end(), m_lists.begin() + list + 1, m_lists.begin() + list + 1 + m_lists[list]);
+			else
+				AppendKeys(child, rows);
+		}
+		SelectBest(rows);
+		uint32_t* pList = &m_lists[m_nodes[node].list];
+		pList[0] = (uint32_t)rows.size();
+		std::copy(rows.begin(), rows.end(), pList + 1);
+	}
+
+	// the best distinct rows of a small subtree, in order
+	void GatherBest(uint32_t node, std::vector<uint32_t>& rows)
+	{
+		AppendKeys(node, rows);
+		SelectBest(rows);
+	}
+
+	// the rows of every key in a subtree without a list
+	void AppendKeys(uint32_t node, std::vector<uint32_t>& rows) const
+	{
+		uint32_t up = m_nodes[node].parent;
+		uint32_t current = node;
+		while(current != up) {
+			for(uint32_t entry = m_nodes[current].firstEntry; entry != NoNode; entry = m_entries[entry].nextInNode)
+				rows.push_back(m_entries[entry].row);
+			// depth first: down, else along, else up until there is a next one
+			if(m_nodes[current].firstChild != NoNode) {
+				current = m_nodes[current].firstChild;
+				continue;
+			}
+			while(current != node && m_nodes[current].nextSibling == NoNode)
+				current = m_nodes[current].parent;
+			current = current == node ? up : m_nodes[current].nextSibling;
+		}
+	}
+
+	// Keeps the best MaxCompletions distinct rows, best first; one pass,
+	// as a subtree may end thousands of keys ("Ivanov").
+	void SelectBest(std::vector<uint32_t>& rows) const
+	{
+		uint32_t best[MaxCompletions];
+		size_t count = 0;
+		for(size_t i = 0; i < rows.size(); i++) {
+			uint32_t row = rows[i];
+			if(count == MaxCompletions && !IsBetter(row, best[count - 1]))
+				continue;
+			if(std::find(best, best + count, row) != best + count)
+				continue;
+			size_t at = count < MaxCompletions ? count++ : count - 1;
+			for(; at > 0 && IsBetter(row, best[at - 1]); at--)
+				best[at] = best[at - 1];
+			best[at] = row;
+		}
+		rows.assign(best, best + count);
+	}
+
+	uint32_t AllocateList()
+	{
+		uint32_t list = m_freeList;
+		if(list != NoNode)
+			m_freeList = m_lists[list + 1];
+		else {
+			list = (uint32_t)m_lists.size();
+			m_lists.resize(m_lists.size() + ListSize);
+		}
+		m_lists[list] = 0;
+		return list;
+	}
+
+	void FreeList(uint32_t list)
+	{
+		m_lists[list + 1] = m_freeList;
+		m_freeList = list;
+	}
+
+	CAutoCompleteTrie(const CAutoCompleteTrie&);
+	CAutoCompleteTrie& operator=(const CAutoCompleteTrie&);
+};
+
+}; // namespace Synrc
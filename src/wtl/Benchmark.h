@@ -0,0 +1,259 @@
+// Benchmark.h
+//
+//  Benchmark runner for the native engine. A case is a function doing one
+//  batch of work per call; it reports how many items the batch handled and
+//  any counters of its own (key bytes per contact, hit ratio, ...). The
+//  runner warms each case up, repeats it and prints one JSON object per
+//  case and line, so runs can be collected and compared by scripts.
+
+#pragma once
+
+#include <algorithm>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CBenchmarkContext - what a case reports back for one call
+// CBenchmarkRunner - registered cases, repetitions and JSON output
+
+namespace Synrc
+{
+
+struct BenchmarkCounter
+{
+	std::string name;
+	double value;
+};
+
+class CBenchmarkContext
+{
+public:
+	explicit CBenchmarkContext(uint32_t scalePercent) :
+		m_scalePercent(scalePercent), m_items(1), m_elapsedNs(0), m_startNs(0), m_bRunning(false)
+	{
+	}
+
+	// Problem size for a case that defaults to count items at 100%.
+	size_t Scale(size_t count) const
+	{
+		size_t scaled = (size_t)((uint64_t)count * m_scalePercent / 100);
+		return scaled > 0 ? scaled : 1;
+	}
+
+	void SetItems(uint64_t items)
+	{
+		m_items = items > 0 ? items : 1;
+	}
+
+	uint64_t GetItems() const
+	{
+		return m_items;
+	}
+
+	// last value wins, counters are reported from the final repetition
+	void SetCounter(const char* pName, double value)
+	{
+		for(size_t i = 0; i < m_counters.size(); i++) {
+			if(m_counters[i].name == pName) {
+				m_counters[i].value = value;
+				return;
+			}
+		}
+		BenchmarkCounter counter;
+		counter.name = pName;
+		counter.value = value;
+		m_counters.push_back(counter);
+	}
+
+	const std::vector<BenchmarkCounter>& GetCounters() const
+	{
+		return m_counters;
+	}
+
+	// setup inside a case that should not be timed
+	void PauseTiming()
+	{
+		if(m_bRunning) {
+			m_elapsedNs += GetTimeNs() - m_startNs;
+			m_bRunning = false;
+		}
+	}
+
+	void ResumeTiming()
+	{
+		if(!m_bRunning) {
+			m_startNs = GetTimeNs();
+			m_bRunning = true;
+		}
+	}
+
+	// runner only
+	uint64_t Restart()
+	{
+		PauseTiming();
+		uint64_t elapsed = m_elapsedNs;
+		m_elapsedNs = 0;
+		return elapsed;
+	}
+
+private:
+	uint32_t m_scalePercent;
+	uint64_t m_items;
+	uint64_t m_elapsedNs;
+	uint64_t m_startNs;
+	bool m_bRunning;
+	std::vector<BenchmarkCounter> m_counters;
+};
+
+typedef void (*BenchmarkProc)(CBenchmarkContext& context);
+
+struct BenchmarkResult
+{
+	std::string name;
+	uint32_t repetitions;
+	uint64_t items;             // per call
+	double minNs;               // per call
+	double medianNs;
+	double meanNs;
+	double maxNs;
+	double stddevNs;
+	std::vector<double> samplesNs;
+	std::vector<BenchmarkCounter> counters;
+
+	double GetNsPerItem() const
+	{
+		return medianNs / (double)items;
+	}
+};
+
+class CBenchmarkRunner
+{
+public:
+	CBenchmarkRunner() : m_scalePercent(100)
+	{
+	}
+
+	void Add(const char* pName, BenchmarkProc pfnProc, uint32_t repetitions = 5)
+	{
+		Case entry;
+		entry.name = pName;
+		entry.pfnProc = pfnProc;
+		entry.repetitions = repetitions > 0 ? repetitions : 1;
+		m_cases.push_back(entry);
+	}
+
+	// 100 runs every case at its default size, smaller values for quick runs
+	void SetScale(uint32_t percent)
+	{
+		m_scalePercent = percent > 0 ? percent : 1;
+	}
+
+	size_t GetCaseCount() const
+	{
+		return m_cases.size();
+	}
+
+	// Runs the cases whose name starts with filter (all for an empty one).
+	size_t Run(const std::string& filter, std::vector<BenchmarkResult>& results)
+	{
+		size_t ran = 0;
+		for(size_t i = 0; i < m_cases.size(); i++) {
+			const Case& entry = m_cases[i];
+			if(entry.name.compare(0, filter.size(), filter) != 0)
+				continue;
+
+			CBenchmarkContext context(m_scalePercent);
+			BenchmarkResult result;
+			result.name = entry.name;
+			result.repetitions = entry.repetitions;
+
+			context.ResumeTiming();
+			entry.pfnProc(context);     // warm-up
+			context.Restart();
+			for(uint32_t r = 0; r < entry.repetitions; r++) {
+				context.ResumeTiming();
+				entry.pfnProc(context);
+				result.samplesNs.push_back((double)context.Restart());
+			}
+			result.items = context.GetItems();
+			result.counters = context.GetCounters();
+			Summarize(result);
+			results.push_back(result);
+			ran++;
+		}
+		return ran;
+	}
+
+	static void Summarize(BenchmarkResult& result)
+	{
+		std::vector<double> sorted(result.samplesNs);
+		std::sort(sorted.begin(), sorted.end());
+		size_t n = sorted.size();
+		double sum = 0;
+		for(size_t i = 0; i < n; i++)
+			sum += sorted[i];
+		result.minNs = sorted[0];
+		result.maxNs = sorted[n - 1];
+		result.medianNs = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+		result.meanNs = sum / n;
+		double squares = 0;
+		for(size_t i = 0; i < n; i++)
+			squares += (sorted[i] - result.meanNs) * (sorted[i] - result.meanNs);
+		result.stddevNs = n > 1 ? sqrt(squares / (n - 1)) : 0;
+	}
+
+	static void FormatJson(const BenchmarkResult& result, std::string& line)
+	{
+		line.clear();
+		Append(line, "{\"name\":\"%s\",\"repetitions\":%u,\"items\":%llu,\"min_ns\":%.0f,\"median_ns\":%.0f,"
+			"\"mean_ns\":%.0f,\"max_ns\":%.0f,\"stddev_ns\":%.0f,\"ns_per_item\":%.2f",
+			result.name.c_str(), result.repetitions, (unsigned long long)result.items, result.minNs, result.medianNs,
+			result.meanNs, result.maxNs, result.stddevNs, result.GetNsPerItem());
+		line += ",\"samples_ns\":[";
+		for(size_t i = 0; i < result.samplesNs.size(); i++)
+			Append(line, i ? ",%.0f" : "%.0f", result.samplesNs[i]);
+		line += "],\"counters\":{";
+		for(size_t i = 0; i < result.counters.size(); i++)
+			Append(line, "%s\"%s\":%.6g", i ? "," : "", result.counters[i].name.c_str(), result.counters[i].value);
+		line += "}}";
+	}
+
+	// printf-style append, for the JSON lines and the reports built on them
+	static void Append(std::string& text, const char* pFormat, ...)
+	{
+		char buffer[512];
+		va_list args;
+		va_start(args, pFormat);
+#ifdef _WIN32
+		int cch = _vsnprintf_s(buffer, sizeof(buffer), _TRUNCATE, pFormat, args);
+#else
+		int cch = vsnprintf(buffer, sizeof(buffer), pFormat, args);
+#endif
+		va_end(args);
+		if(cch < 0 || cch >= (int)sizeof(buffer))
+			cch = (int)strlen(buffer);
+		text.append(buffer, cch);
+	}
+
+private:
+	struct Case
+	{
+		std::string name;
+		BenchmarkProc pfnProc;
+		uint32_t repetitions;
+	};
+
+	std::vector<Case> m_cases;
+	uint32_t m_scalePercent;
+};
+
+}; // namespace Synrc
@@ -0,0 +1,249 @@
+// BenchmarkBaseline.h
+//
+//  Regression gate for the benchmark suite. A benchmark.jsonl of an earlier
+//  run is the baseline; each case of a new run is compared with it by time
+//  per item, so runs at other scales still compare. A case regressed when
+//  its median got slower by more than the threshold and a Mann-Whitney U
+//  test on the repetitions says the shift is not noise: with 5 repetitions
+//  on each side, at least 21 of the 25 pairs have to be slower.
+
+#pragma once
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "Benchmark.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CBenchmarkBaseline - results of an earlier run and the comparison with it
+
+namespace Synrc
+{
+
+enum BenchmarkVerdict
+{
+	VerdictNew,             // not in the baseline
+	VerdictUnchanged,
+	VerdictImproved,
+	VerdictRegressed
+};
+
+struct BenchmarkComparison
+{
+	std::string name;
+	BenchmarkVerdict verdict;
+	double baselineNsPerItem;
+	double nsPerItem;
+	double changePercent;   // of the median time per item
+	double pValue;          // one-sided, in the direction of the change
+
+	BenchmarkComparison() : verdict(VerdictNew), baselineNsPerItem(0), nsPerItem(0), changePercent(0), pValue(1)
+	{
+	}
+};
+
+class CBenchmarkBaseline
+{
+public:
+	enum { DefaultThresholdPercent = 10 };
+
+	// p below this makes a change beyond the threshold count
+	static double GetSignificance()
+	{
+		return 0.05;
+	}
+
+	// Lines of benchmark.jsonl; lines without a name or samples are
+	// skipped. False when no case could be read.
+	bool Load(const std::string& text)
+	{
+		m_results.clear();
+		size_t pos = 0;
+		while(pos < text.size()) {
+			size_t end = text.find('\n', pos);
+			if(end == std::string::npos)
+				end = text.size();
+			BenchmarkResult result;
+			if(ParseLine(text.substr(pos, end - pos), result))
+				m_results.push_back(result);
+			pos = end + 1;
+		}
+		return !m_results.empty();
+	}
+
+	bool LoadFile(const std::string& path)
+	{
+		CNativeFile file;
+		std::string text;
+		return file.Open(path, CNativeFile::OpenRead) && file.ReadAll(text) && Load(text);
+	}
+
+	size_t GetCount() const
+	{
+		return m_results.size();
+	}
+
+	const BenchmarkResult* Find(const std::string& name) const
+	{
+		for(size_t i = 0; i < m_results.size(); i++) {
+			if(m_results[i].name == name)
+				return &m_results[i];
+		}
+		return NULL;
+	}
+
+	// One comparison per result; returns how many regressed.
+	size_t Compare(const std::vector<BenchmarkResult>& results, double thresholdPercent,
+		std::vector<BenchmarkComparison>& comparisons) const
+	{
+		size_t regressed = 0;
+		comparisons.clear();
+		for(size_t i = 0; i < results.size(); i++) {
+			BenchmarkComparison comparison;
+			comparison.name = results[i].name;
+			comparison.nsPerItem = results[i].GetNsPerItem();
+			const BenchmarkResult* pBaseline = Find(results[i].name);
+			if(pBaseline != NULL)
+				Judge(*pBaseline, results[i], thresholdPercent, comparison);
+			if(comparison.verdict == VerdictRegressed)
+				regressed++;
+			comparisons.push_back(comparison);
+		}
+		return regressed;
+	}
+
+	// {"name":...,"verdict":...,"baseline_ns_per_item":...,"ns_per_item":...,
+	//  "change_pct":...,"p_value":...}
+	static void FormatJson(const BenchmarkComparison& comparison, std::string& line)
+	{
+		static const char* const s_verdicts[] = { "new", "unchanged", "improved", "regressed" };
+		line.clear();
+		CBenchmarkRunner::Append(line, "{\"name\":\"%s\",\"verdict\":\"%s\",\"baseline_ns_per_item\":%.2f,"
+			"\"ns_per_item\":%.2f,\"change_pct\":%.1f,\"p_value\":%.4f}", comparison.name.c_str(),
+			s_verdicts[comparison.verdict], comparison.baselineNsPerItem, comparison.nsPerItem,
+			comparison.changePercent, comparison.pValue);
+	}
+
+	// Probability of at least this many slower pairs by chance, for
+	// samples a (before) and b (after): the Mann-Whitney U statistic of b,
+	// ties counting half, under the normal approximation.
+	static double GetSlowerPValue(const std::vector<double>& a, const std::vector<double>& b)
+	{
+		if(a.empty() || b.empty())
+			return 1.0;
+		double u = 0;
+		for(size_t i = 0; i < a.size(); i++) {
+			for(size_t j = 0; j < b.size(); j++)
+				u += b[j] > a[i] ? 1.0 : b[j] == a[i] ? 0.5 : 0.0;
+		}
+		double n1 = (double)a.size();
+		double n2 = (double)b.size();
+		double mean = n1 * n2 / 2;
+		double sd = sqrt(n1 * n2 * (n1 + n2 + 1) / 12);
+		double z = (u - mean - 0.5) / sd;     // continuity correction
+		return GetNormalTail(z);
+	}
+
+	// P(Z > z) of the standard normal, to about 1e-7
+	static double GetNormalTail(double z)
+	{
+		if(z < 0)
+			return 1.0 - GetNormalTail(-z);
+		// Abramowitz and Stegun 7.1.26 on erfc(z / sqrt(2))
+		double x = z / sqrt(2.0);
+		double t = 1.0 / (1.0 + 0.3275911 * x);
+		double poly = t * (0.254829592 + t * (-0.284496736 + t * (1.421413741 + t * (-1.453152027 + t * 1.061405429))));
+		return 0.5 * poly * exp(-x * x);
+	}
+
+private:
+	std::vector<BenchmarkResult> m_results;
+
+	static void Judge(const BenchmarkResult& baseline, const BenchmarkResult& result, double thresholdPercent,
+		BenchmarkComparison& comparison)
+	{
+		std::vector<double> before;
+		std::vector<double> after;
+		PerItem(baseline, before);
+		PerItem(result, after);
+		comparison.baselineNsPerItem = baseline.GetNsPerItem();
+		comparison.changePercent = comparison.baselineNsPerItem > 0 ?
+			(comparison.nsPerItem / comparison.baselineNsPerItem - 1) * 100 : 0;
+		if(comparison.changePercent >= 0)
+			comparison.pValue = GetSlowerPValue(before, after);
+		else
+			comparison.pValue = GetSlowerPValue(after, before);
+		bool bSignificant = comparison.pValue < GetSignificance();
+		if(bSignificant && comparison.changePercent > thresholdPercent)
+			comparison.verdict = VerdictRegressed;
+		else if(bSignificant && comparison.changePercent < -thresholdPercent)
+			comparison.verdict = VerdictImproved;
+		else
+			comparison.verdict = VerdictUnchanged;
+	}
+
+	static void PerItem(const BenchmarkResult& result, std::vector<double>& samples)
+	{
+		samples.resize(result.samplesNs.size());
+		for(size_t i = 0; i < samples.size(); i++)
+			samples[i] = result.samplesNs[i] / (double)result.items;
+	}
+
+	// Reads back what CBenchmarkRunner::FormatJson() wrote; counters are
+	// not needed for the gate and skipped.
+	static bool ParseLine(const std::string& line, BenchmarkResult& result)
+	{
+		size_t pos = line.find("\"name\":\"");
+		if(pos == std::string::npos)
+			return false;
+		pos += 8;
+		size_t end = line.find('"', pos);
+		if(end == std::string::npos)
+			return false;
+		result.name = line.substr(pos, end - pos);
+
+		double items = 0;
+		if(!GetNumber(line, "\"items\":", items) || items < 1)
+			return false;
+		result.items = (uint64_t)items;
+
+		pos = line.find("\"samples_ns\":[");
+		if(pos == std::string::npos)
+			return false;
+		const char* p = line.c_str() + pos + 14;
+		result.samplesNs.clear();
+		while(*p != ']' && *p != 0) {
+			char* pEnd = NULL;
+			double value = strtod(p, &pEnd);
+			if(pEnd == p)
+				return false;
+			result.samplesNs.push_back(value);
+			p = *pEnd == ',' ? pEnd + 1 : pEnd;
+		}
+		if(result.samplesNs.empty())
+			return false;
+		result.repetitions = (uint32_t)result.samplesNs.size();
+		CBenchmarkRunner::Summarize(result);
+		return true;
+	}
+
+	static bool GetNumber(const std::string& line, const char* pKey, double& value)
+	{
+		size_t pos = line.find(pKey);
+		if(pos == std::string::npos)
+			return false;
+		const char* p = line.c_str() + pos + strlen(pKey);
+		char* pEnd = NULL;
+		value = strtod(p, &pEnd);
+		return pEnd != p;
+	}
+};
+
+}; // namespace Synrc
@@ -0,0 +1,51 @@
+// BenchmarkMain.cpp : the benchmark suite without the UI, for Linux and macOS
+//
+//  Not part of Aero.vcxproj; the engine headers build on their own:
+//      g++ -std=c++11 -O2 -pthread -o aero-bench BenchmarkMain.cpp
+//  Arguments as for Aero.exe /benchmark:
+//      aero-bench [name prefix] [scale=percent] [baseline=file] [threshold=percent]
+//  The JSON lines go to stdout, as Aero.exe writes them to benchmark.jsonl.
+//  With a baseline the verdicts go to stderr and the exit code is 1 when a
+//  case regressed, 2 when the baseline cannot be read, so a saved run
+//  makes a local check:
+//      aero-bench > baseline.jsonl
+//      ... change ...
+//      aero-bench baseline=baseline.jsonl threshold=5 > benchmark.jsonl
+
+#include <stdio.h>
+
+#include <string>
+
+#include "BenchmarkSuite.h"
+
+int main(int argc, char* argv[])
+{
+	std::string arguments;
+	for(int i = 1; i < argc; i++) {
+		if(i > 1)
+			arguments += ' ';
+		arguments += argv[i];
+	}
+
+	std::string output;
+	int nRet = 0;
+	if(Synrc::BenchmarkArguments(arguments).baseline.empty()) {
+		Synrc::RunBenchmarkSuite(arguments, output);
+	}
+	else {
+		std::string report;
+		int regressed = Synrc::RunBenchmarkGate(arguments, output, report);
+		fputs(report.c_str(), stderr);
+		if(regressed < 0) {
+			fputs("baseline cannot be read\n", stderr);
+			nRet = 2;
+		}
+		else if(regressed > 0) {
+			nRet = 1;
+		}
+	}
+	fputs(output.c_str(), stdout);
+
+	Synrc::CTaskPool::ShutdownDefault();
+	return nRet;
+}
@@ -0,0 +1,2084 @@
+// BenchmarkSuite.h
+//
+//  The native engine's benchmark cases and the synthetic address book they
+//  run on. Run from the command line with
+//      Aero.exe /benchmark [name prefix] [scale=percent]
+//  which writes benchmark.jsonl next to the executable's working directory.
+//  The data is generated from a fixed seed, so runs are comparable: mixed
+//  Latin and Cyrillic names, accents, emails, phones, companies and labels.
+//
+//  With "baseline=<earlier benchmark.jsonl>" the run is also compared with
+//  an earlier one (BenchmarkBaseline.h); "threshold=<percent>" sets how much
+//  slower a case may get, 10% by default.
+
+#pragma once
+
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "AutoComplete.h"
+#include "Benchmark.h"
+#include "BenchmarkBaseline.h"
+#include "Collation.h"
+#include "ContactDatabase.h"
+#include "ContactSearch.h"
+#include "ContactStore.h"
+#include "DateIndex.h"
+#include "EventTrace.h"
+#include "FindService.h"
+#include "FuzzySearch.h"
+#include "GroupModel.h"
+#include "Latency.h"
+#include "ListHostHarness.h"
+#include "ListTrace.h"
+#include "ListTraceReplay.h"
+#include "MatchHighlight.h"
+#include "PhoneticSearch.h"
+#include "ProgressiveResults.h"
+#include "SearchCache.h"
+#include "SearchQuery.h"
+#include "SearchRanking.h"
+#include "Selection.h"
+#include "SortEngine.h"
+#include "StringPool.h"
+#include "SyncMockServer.h"
+#include "SyncTransport.h"
+#include "TranslitSearch.h"
+#include "UsageTracker.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CSyntheticContacts - deterministic generated contacts
+// CBenchmarkData - data sets shared by the cases of one run
+
+namespace Synrc
+{
+
+class CSyntheticContacts
+{
+public:
+	explicit CSyntheticContacts(uint32_t seed = 0x5EED1234) : m_state(seed ? seed : 1)
+	{
+	}
+
+	uint32_t Next()
+	{
+		m_state ^= m_state << 13;
+		m_state ^= m_state >> 17;
+		m_state ^= m_state << 5;
+		return m_state;
+	}
+
+	uint32_t Next(uint32_t range)
+	{
+		return range > 0 ? Next() % range : 0;
+	}
+
+	// Two fifths of the names are Cyrillic, half of the family names are
+	// built from syllables so the set does not collapse into a few hundred.
+	void MakeName(std::wstring& given, std::wstring& family)
+	{
+		static const wchar_t* const s_cyrillicGiven[] =
+		{
+			L"\u0418\u0432\u0430\u043D", L"\u041C\u0430\u0440\u0438\u044F",
+			L"\u0410\u043B\u0435\u043A\u0441\u0435\u0439", L"\u041E\u043B\u044C\u0433\u0430",
+			L"\u0414\u043C\u0438\u0442\u0440\u0438\u0439", L"\u0415\u043B\u0435\u043D\u0430",
+			L"\u0421\u0435\u0440\u0433\u0435\u0439", L"\u041D\u0430\u0442\u0430\u043B\u044C\u044F",
+			L"\u0410\u043D\u0434\u0440\u0435\u0439", L"\u0422\u0430\u0442\u044C\u044F\u043D\u0430",
+			L"\u0410\u0440\u0442\u0451\u043C", L"\u042E\u043B\u0438\u044F", L"\u041E\u043B\u0435\u0433",
+			L"\u0406\u0440\u0438\u043D\u0430", L"\u0422\u0430\u0440\u0430\u0441",
+			L"\u0411\u043E\u0433\u0434\u0430\u043D", L"\u0404\u0432\u0433\u0435\u043D",
+			L"\u0421\u0432\u0435\u0442\u043B\u0430\u043D\u0430", L"\u041C\u0438\u0445\u0430\u0438\u043B",
+			L"\u0410\u043D\u043D\u0430"
+		};
+
+		static const wchar_t* const s_cyrillicFamily[] =
+		{
+			L"\u0418\u0432\u0430\u043D\u043E\u0432", L"\u0421\u043C\u0438\u0440\u043D\u043E\u0432",
+			L"\u041A\u0443\u0437\u043D\u0435\u0446\u043E\u0432", L"\u041F\u043E\u043F\u043E\u0432",
+			L"\u0421\u043E\u043A\u043E\u043B\u043E\u0432", L"\u041B\u0435\u0431\u0435\u0434\u0435\u0432",
+			L"\u041A\u043E\u0437\u043B\u043E\u0432", L"\u041D\u043E\u0432\u0438\u043A\u043E\u0432",
+			L"\u041C\u043E\u0440\u043E\u0437\u043E\u0432", L"\u041F\u0435\u0442\u0440\u043E\u0432",
+			L"\u0412\u043E\u043B\u043A\u043E\u0432", L"\u0421\u043E\u043B\u043E\u0432\u044C\u0451\u0432",
+			L"\u0412\u0430\u0441\u0438\u043B\u044C\u0435\u0432", L"\u0417\u0430\u0439\u0446\u0435\u0432",
+			L"\u041F\u0430\u0432\u043B\u043E\u0432", L"\u0428\u0435\u0432\u0447\u0435\u043D\u043A\u043E",
+			L"\u041A\u043E\u0432\u0430\u043B\u0435\u043D\u043A\u043E",
+			L"\u0411\u043E\u043D\u0434\u0430\u0440\u0435\u043D\u043A\u043E",
+			L"\u0422\u043A\u0430\u0447\u0435\u043D\u043A\u043E", L"\u041A\u0440\u0430\u0432\u0447\u0443\u043A"
+		};
+
+		static const wchar_t* const s_cyrillicSyllables[] =
+		{
+			L"\u043A\u043E", L"\u0432\u0430", L"\u043B\u0435", L"\u043D\u0438", L"\u0440\u0430", L"\u0434\u043E",
+			L"\u043C\u0438", L"\u0448\u0435", L"\u043F\u043E", L"\u0442\u0443", L"\u0441\u0435", L"\u0431\u043E",
+			L"\u0437\u0438", L"\u0445\u043E", L"\u0447\u0435", L"\u043B\u0443"
+		};
+
+		static const wchar_t* const s_cyrillicEndings[] =
+		{
+			L"\u043E\u0432", L"\u0438\u043D", L"\u0441\u043A\u0438\u0439", L"\u0435\u043D\u043A\u043E",
+			L"\u0443\u043A", L"\u0435\u0432"
+		};
+
+		static const wchar_t* const s_latinGiven[] =
+		{
+			L"James", L"Mary", L"John", L"Patricia", L"Robert", L"Jennifer", L"Michael", L"Linda", L"William",
+			L"Elizabeth", L"David", L"Barbara", L"Richard", L"Susan", L"Joseph", L"Jessica", L"Olaf", L"Zo\u00EB",
+			L"Ren\u00E9e", L"J\u00FCrgen", L"Fran\u00E7ois", L"Ana", L"Luc\u00EDa", L"Mateo", L"S\u00F8ren",
+			L"\u0141ukasz"
+		};
+
+		static const wchar_t* const s_latinFamily[] =
+		{
+			L"Smith", L"Johnson", L"Williams", L"Brown", L"Jones", L"Garcia", L"Miller", L"Davis", L"Rodriguez",
+			L"Martinez", L"Hernandez", L"Lopez", L"Wilson", L"Anderson", L"Taylor", L"Moore", L"Jackson", L"Martin",
+			L"M\u00FCller", L"Schmidt", L"Dvo\u0159\u00E1k", L"Nowak", L"Kowalski", L"O'Brien", L"van der Berg",
+			L"Lef\u00E8vre", L"Sokolov", L"\u00C5berg"
+		};
+
+		static const wchar_t* const s_latinSyllables[] =
+		{
+			L"ka", L"to", L"ri", L"mo", L"lan", L"ber", L"si", L"vo", L"del", L"ma", L"no", L"ste", L"gu", L"pe",
+			L"har", L"wi"
+		};
+
+		static const wchar_t* const s_latinEndings[] =
+		{
+			L"son", L"er", L"ini", L"ez", L"ley", L"mann"
+		};
+
+		if(Next(5) < 2) {
+			given = Pick(s_cyrillicGiven);
+			if(Next(2))
+				family = Pick(s_cyrillicFamily);
+			else
+				MakeFamily(s_cyrillicSyllables, s_cyrillicEndings, family);
+		}
+		else {
+			given = Pick(s_latinGiven);
+			if(Next(2))
+				family = Pick(s_latinFamily);
+			else
+				MakeFamily(s_latinSyllables, s_latinEndings, family);
+		}
+	}
+
+	void MakeRecord(uint32_t index, ContactRecord& record)
+	{
+		static const wchar_t* const s_domains[] =
+		{
+			L"example.com", L"mail.example.org", L"corp.example.net", L"yandex.example", L"uni.example.edu"
+		};
+
+		static const wchar_t* const s_companies[] =
+		{
+			L"Synrc Research", L"Contoso", L"Northwind Traders", L"Fabrikam",
+			L"\u0420\u043E\u0433\u0430 \u0438 \u041A\u043E\u043F\u044B\u0442\u0430", L"Litware", L"Adventure Works",
+			L"Tailspin Toys"
+		};
+
+		static const wchar_t* const s_cities[] =
+		{
+			L"Kyiv", L"\u041C\u043E\u0441\u043A\u0432\u0430", L"London", L"Berlin", L"M\u00FCnchen",
+			L"\u041B\u044C\u0432\u0456\u0432", L"New York", L"Z\u00FCrich"
+		};
+
+		static const wchar_t* const s_labels[] =
+		{
+			L"Family", L"Work", L"Friends", L"Work;VIP", L"Family;Friends"
+		};
+
+		wchar_t number[16];
+		FormatNumber(L"c", index, number);
+		record.id = number;
+		MakeName(record.fields[FieldGivenName], record.fields[FieldFamilyName]);
+		record.fields[FieldName] = record.fields[FieldGivenName] + L" " + record.fields[FieldFamilyName];
+		FormatNumber(L"user", index, number);
+		record.fields[FieldEmail] = std::wstring(number) + L"@" + Pick(s_domains);
+		FormatNumber(L"+7 9", 100000000 + Next(900000000), number);
+		record.fields[FieldPhone] = number;
+		record.fields[FieldCompany] = Next(3) ? Pick(s_companies) : L"";
+		record.fields[FieldCity] = Pick(s_cities);
+		record.fields[FieldLabel] = Next(4) ? L"" : Pick(s_labels);
+		MakeDates(index, record);
+	}
+
+	void Generate(size_t count, std::vector<ContactRecord>& records)
+	{
+		records.resize(count);
+		for(size_t i = 0; i < count; i++)
+			MakeRecord((uint32_t)i, records[i]);
+	}
+
+	void Fill(CContactStore& store, size_t count)
+	{
+		store.Reserve(store.GetRowCount() + count);
+		ContactRecord record;
+		for(size_t i = 0; i < count; i++) {
+			MakeRecord((uint32_t)(store.GetRowCount()), record);
+			store.Put(record);
+		}
+	}
+
+private:
+	uint32_t m_state;
+
+	template <size_t N>
+	const wchar_t* Pick(const wchar_t* const (&items)[N])
+	{
+		return items[Next((uint32_t)N)];
+	}
+
+	template <size_t S, size_t E>
+	void MakeFamily(const wchar_t* const (&syllables)[S], const wchar_t* const (&endings)[E], std::wstring& family)
+	{
+		family.clear();
+		uint32_t parts = 2 + Next(2);
+		for(uint32_t i = 0; i < parts; i++)
+			family += Pick(syllables);
+		family += Pick(endings);
+		wchar_t& first = family[0];
+		if((first >= L'a' && first <= L'z') || (first >= 0x0430 && first <= 0x044F))
+			first = (wchar_t)(first - 0x20);
+	}
+
+	// A third of the contacts have a birthday, some without the year, and a
+	// tenth an anniversary. Taken from the index, not Next(), so the other
+	// fields are what they were before there were dates.
+	static void MakeDates(uint32_t index, ContactRecord& record)
+	{
+		uint32_t hash = index * 2654435761u;
+		hash ^= hash >> 15;
+		record.fields[FieldBirthday].clear();
+		record.fields[FieldAnniversary].clear();
+		if(hash % 3 == 0)
+			FormatDate(hash % 10 == 0 ? 0 : 1940 + hash / 3 % 70, hash / 7 % 366, record.fields[FieldBirthday]);
+		if(hash / 11 % 10 == 0)
+			FormatDate(1970 + hash / 13 % 55, hash / 17 % 366, record.fields[FieldAnniversary]);
+	}
+
+	// "YYYY-MM-DD" of a day of a leap year, 0..365; "--MM-DD" for year 0
+	static void FormatDate(uint32_t year, uint32_t day, std::wstring& text)
+	{
+		static const uint8_t s_monthDays[12] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+		uint32_t month = 0;
+		for(; day >= s_monthDays[month]; month++)
+			day -= s_monthDays[month];
+		if(month == 1 && day == 28 && year % 4 != 0)
+			day = 27;
+		wchar_t out[12];
+		wchar_t* p = out;
+		if(year == 0) {
+			*p++ = L'-';
+			*p++ = L'-';
+		}
+		else {
+			FormatNumber(L"", year, p);
+			p += 4;
+			*p++ = L'-';
+		}
+		*p++ = (wchar_t)(L'0' + (month + 1) / 10);
+		*p++ = (wchar_t)(L'0' + (month + 1) % 10);
+		*p++ = L'-';
+		*p++ = (wchar_t)(L'0' + (day + 1) / 10);
+		*p++ = (wchar_t)(L'0' + (day + 1) % 10);
+		text.assign(out, p);
+	}
+
+	static void FormatNumber(const wchar_t* pPrefix, uint32_t value, wchar_t* pOut)
+	{
+		wchar_t digits[12];
+		int count = 0;
+		do {
+			digits[count++] = (wchar_t)(L'0' + value % 10);
+			value /= 10;
+		} while(value != 0);
+		while(*pPrefix)
+			*pOut++ = *pPrefix++;
+		while(count > 0)
+			*pOut++ = digits[--count];
+		*pOut = 0;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CBenchmarkData - data sets shared by the cases of one run
+
+class CBenchmarkData
+{
+public:
+	// store with count generated contacts, rebuilt only when count changes
+	static CContactStore& GetStore(size_t count)
+	{
+		static CContactStore s_store;
+		if(s_store.GetLiveCount() != count) {
+			s_store.Clear();
+			CSyntheticContacts().Fill(s_store, count);
+		}
+		return s_store;
+	}
+
+	static const CCollator& GetCollator()
+	{
+		static CCollator s_collator;
+		return s_collator;
+	}
+
+	// the models behind the list for the store of count contacts: grouped
+	// by family name, with pooled display strings; built once
+	static CGroupModel& GetListModels(size_t count, CDisplayStringPool*& pStrings)
+	{
+		CContactStore& store = GetStore(count);
+		static CGroupModel s_groups(store, FieldFamilyName);
+		static CDisplayStringPool s_strings(store);
+		pStrings = &s_strings;
+		return s_groups;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Cases
+
+inline void BenchCollationKeys(CBenchmarkContext& context, CollationStrength strength)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(100000));
+	CCollator collator(CollationRoot, strength);
+	const std::vector<std::wstring>& names = store.GetColumn(FieldName);
+	std::string key;
+	size_t bytes = 0;
+	context.ResumeTiming();
+
+	for(size_t i = 0; i < names.size(); i++) {
+		key.clear();
+		collator.AppendKey(names[i].data(), names[i].size(), key);
+		bytes += key.size();
+	}
+
+	context.PauseTiming();
+	context.SetItems(names.size());
+	context.SetCounter("key_bytes_per_contact", (double)bytes / names.size());
+	CSortKeyColumn column;
+	column.Build(names, collator, CTaskPool::GetDefault());
+	context.SetCounter("column_bytes_per_contact", (double)column.GetMemoryUsage() / names.size());
+}
+
+inline void BenchCollationKeysTertiary(CBenchmarkContext& context)
+{
+	BenchCollationKeys(context, CollationTertiary);
+}
+
+inline void BenchCollationKeysPrimary(CBenchmarkContext& context)
+{
+	BenchCollationKeys(context, CollationPrimary);
+}
+
+// parallel build of the key column, as done the first time a column is sorted
+inline void BenchCollationKeyColumn(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CSortKeyColumn column;
+	context.ResumeTiming();
+	column.Build(store.GetColumn(FieldName), CBenchmarkData::GetCollator(), CTaskPool::GetDefault());
+	context.SetItems(store.GetLiveCount());
+}
+
+inline void BenchSortByName(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CSortEngine engine(store);
+	engine.GetKeys(FieldName);
+	context.ResumeTiming();
+	engine.GetOrder(FieldName, false);
+	context.SetItems(store.GetLiveCount());
+}
+
+// Single edits of a sorted 1M name column, the order read after each as
+// the list would: every edit is patched, none sorts again.
+inline void BenchSortEdits(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CSortEngine engine(store);
+	engine.GetOrder(FieldName, false);
+	uint64_t sorts = engine.GetStats().sorts;
+	const int edits = 2000;
+	uint32_t rowCount = (uint32_t)store.GetRowCount();
+	CSyntheticContacts random(29);
+	CLatencyHistogram latency;
+	ContactRecord record;
+	std::wstring name;
+	int puts = 0;
+	context.ResumeTiming();
+	for(int i = 0; i < edits; i++) {
+		if(!store.GetRecord(random.Next(rowCount), record))
+			continue;
+		// renamed and back, leaving the store as it was
+		name = record.fields[FieldName];
+		for(int step = 0; step < 2; step++) {
+			record.fields[FieldName] = step == 0 ? L"Zz " + name : name;
+			uint64_t editNs = GetTimeNs();
+			store.Put(record);
+			engine.GetOrder(FieldName, false);
+			latency.Record(GetTimeNs() - editNs);
+			puts++;
+		}
+	}
+	context.PauseTiming();
+	context.SetItems(puts);
+
+	std::vector<uint64_t> counts;
+	LatencySnapshot snapshot;
+	latency.Snapshot(counts, snapshot, false);
+	context.SetCounter("edit_p50_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.5));
+	context.SetCounter("edit_p99_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.99));
+	context.SetCounter("edit_max_ns", (double)snapshot.maxNs);
+	context.SetCounter("sorts", (double)(engine.GetStats().sorts - sorts));
+}
+
+// group-by-initial over a cached order: one pass over first key bytes
+inline void BenchInitialGroups(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CSortEngine engine(store);
+	engine.GetOrder(FieldFamilyName, false);
+	std::vector<InitialGroup> groups;
+	context.ResumeTiming();
+	engine.GetInitialGroups(FieldFamilyName, false, groups);
+	context.SetItems(store.GetLiveCount());
+	context.SetCounter("groups", (double)groups.size());
+}
+
+// type-to-jump prefixes of one to four letters of random names
+inline void MakeFindPrefixes(const CContactStore& store, std::vector<std::wstring>& prefixes)
+{
+	CSyntheticContacts random(99);
+	for(int i = 0; i < 1000; i++) {
+		const std::wstring& name = store.GetField(random.Next((uint32_t)store.GetRowCount()), FieldName);
+		prefixes.push_back(name.substr(0, 1 + random.Next(4)));
+	}
+}
+
+// the prefixes against the sorted name column
+inline void BenchFindPrefix(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CSortEngine engine(store);
+	engine.GetOrder(FieldName, false);
+	CFindService find(engine);
+	std::vector<std::wstring> prefixes;
+	MakeFindPrefixes(store, prefixes);
+	uint32_t found = 0;
+	context.ResumeTiming();
+	for(int repeat = 0; repeat < 100; repeat++) {
+		for(size_t i = 0; i < prefixes.size(); i++) {
+			if(find.Find(prefixes[i].data(), prefixes[i].size(), 0) != CFindService::NoPosition)
+				found++;
+		}
+	}
+	context.SetItems(100 * prefixes.size());
+	context.SetCounter("found", found / 100.0);
+}
+
+// The prefixes as LVN_ODFINDITEM asks for them, from a random item of the
+// list grouped by family name: the items are not in name order, so each
+// lookup marks the matching rows and walks the items to the first one.
+inline void BenchFindItem(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CDisplayStringPool* pStrings = NULL;
+	CGroupModel& groups = CBenchmarkData::GetListModels(context.Scale(1000000), pStrings);
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CSortEngine engine(store);
+	engine.GetOrder(FieldName, false);
+	CFindService find(engine);
+	CListDataSource source;
+	source.SetGroupModel(&groups);
+	std::vector<std::wstring> prefixes;
+	MakeFindPrefixes(store, prefixes);
+	CSyntheticContacts random(7);
+	std::vector<uint32_t> starts;
+	for(size_t i = 0; i < prefixes.size(); i++)
+		starts.push_back(random.Next(groups.GetItemCount()));
+	CLatencyHistogram latency;
+	uint32_t found = 0;
+	context.ResumeTiming();
+	for(size_t i = 0; i < prefixes.size(); i++) {
+		uint64_t startNs = GetTimeNs();
+		uint32_t item = source.FindItem(find, prefixes[i].data(), prefixes[i].size(), starts[i],
+			CFindService::FindPartial | CFindService::FindWrap);
+		latency.Record(GetTimeNs() - startNs);
+		if(item != CListDataSource::NoItem)
+			found++;
+	}
+	context.PauseTiming();
+	std::vector<uint64_t> counts;
+	LatencySnapshot snapshot;
+	latency.Snapshot(counts, snapshot, false);
+	context.SetItems(prefixes.size());
+	context.SetCounter("found", found);
+	context.SetCounter("p99_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.99));
+	context.SetCounter("max_ns", (double)snapshot.maxNs);
+}
+
+// select all of the list grouped by family name, map the items to store
+// rows and bulk delete with a cached order attached
+inline void BenchSelectDelete(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CSortEngine engine(store);
+	engine.GetOrder(FieldName, false);
+	CGroupModel groups(store, FieldFamilyName);
+	CListDataSource source;
+	source.SetGroupModel(&groups);
+	uint32_t count = source.GetItemCount();
+	CSelectionSet selection;
+	std::vector<uint32_t> rows;
+	context.ResumeTiming();
+	selection.SelectAll(count);
+	source.GetSelectedRows(selection, rows);
+	store.RemoveRows(rows);
+	context.PauseTiming();
+	context.SetItems(count);
+	context.SetCounter("runs", (double)selection.GetRuns().size());
+	context.SetCounter("rows", (double)rows.size());
+	context.SetCounter("left", (double)engine.GetOrder(FieldName, false).size());
+}
+
+// wakes the benchmark thread the way the list view's posted message would
+class CBenchmarkResultsWaiter : public IProgressiveResultsObserver
+{
+public:
+	CBenchmarkResultsWaiter() : m_bAvailable(false)
+	{
+	}
+
+	virtual void OnResultsAvailable()
+	{
+		CAutoLock lock(m_cs);
+		m_bAvailable = true;
+		m_cv.Broadcast();
+	}
+
+	void Wait()
+	{
+		CAutoLock lock(m_cs);
+		while(!m_bAvailable)
+			m_cv.Wait(m_cs);
+		m_bAvailable = false;
+	}
+
+private:
+	CCritSec m_cs;
+	CCondVar m_cv;
+	bool m_bAvailable;
+};
+
+// time until the first page of a half-the-store match set is shown
+inline void BenchFirstResults(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CProgressiveResults results;
+	CBenchmarkResultsWaiter waiter;
+	results.SetObserver(&waiter);
+	context.ResumeTiming();
+	results.Start(new CContactScanCursor(store, FieldName, L"a", CBenchmarkData::GetCollator()));
+	while(results.GetVisibleCount() < CProgressiveResults::DefaultFirstPage && !results.IsComplete()) {
+		waiter.Wait();
+		results.Poll();
+	}
+	context.PauseTiming();
+	results.Cancel();
+	results.Poll();
+	context.SetCounter("visible", results.GetVisibleCount());
+	context.SetCounter("loaded_at_cancel", results.GetLoadedCount());
+}
+
+// "Firm <index>", without the CRT's wide printf
+inline void FirmName(uint32_t index, std::wstring& name)
+{
+	name = L"Firm ";
+	size_t start = name.size();
+	do {
+		name.insert(name.begin() + start, (wchar_t)(L'0' + index % 10));
+		index /= 10;
+	} while(index != 0);
+}
+
+// Grouping by company with 50k distinct values: the build, then edits moving
+// contacts between groups, collapse/expand and item -> group lookups with
+// header creation, as scrolling does. Edits and lookups are timed per op.
+inline void BenchGroups(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	const uint32_t groupCount = (uint32_t)context.Scale(50000);
+	static CContactStore s_store;
+	if(s_store.GetLiveCount() != groupCount * 10) {
+		s_store.Clear();
+		CSyntheticContacts random(7);
+		s_store.Reserve(groupCount * 10);
+		ContactRecord record;
+		for(uint32_t i = 0; i < groupCount * 10; i++) {
+			random.MakeRecord(i, record);
+			FirmName(random.Next(groupCount), record.fields[FieldCompany]);
+			s_store.Put(record);
+		}
+	}
+	uint64_t startNs = GetTimeNs();
+	context.ResumeTiming();
+	CGroupModel groups(s_store, FieldCompany);
+	context.PauseTiming();
+	context.SetCounter("build_ms", (double)(GetTimeNs() - startNs) / 1e6);
+	context.SetCounter("groups", groups.GetGroupCount());
+
+	const int ops = 20000;
+	CSyntheticContacts random(11);
+	ContactRecord record;
+	startNs = GetTimeNs();
+	for(int i = 0; i < ops; i++) {
+		s_store.GetRecord(random.Next((uint32_t)s_store.GetRowCount()), record);
+		FirmName(random.Next(groupCount), record.fields[FieldCompany]);
+		s_store.Put(record);
+	}
+	context.SetCounter("update_ns", (double)(GetTimeNs() - startNs) / ops);
+
+	startNs = GetTimeNs();
+	for(int i = 0; i < ops; i++) {
+		uint32_t position = random.Next(groups.GetGroupCount());
+		groups.SetCollapsed(position, !groups.IsCollapsed(position));
+	}
+	context.SetCounter("toggle_ns", (double)(GetTimeNs() - startNs) / ops);
+
+	startNs = GetTimeNs();
+	uint32_t headers = 0;
+	for(int i = 0; i < ops; i++) {
+		uint32_t position = groups.GetItemGroup(random.Next(groups.GetItemCount()));
+		if(groups.TakeMissingHeader(position))
+			headers++;
+		groups.GetHeaderIndex(position);
+	}
+	context.SetCounter("lookup_ns", (double)(GetTimeNs() - startNs) / ops);
+	context.SetCounter("headers", headers);
+	context.SetItems(s_store.GetLiveCount());
+}
+
+// Scroll frames of 40 rows asking for two columns, answered from the
+// display string pool; the build is reported apart.
+inline void BenchDisplayStrings(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	uint64_t startNs = GetTimeNs();
+	CDisplayStringPool pool(store);
+	context.SetCounter("build_ms", (double)(GetTimeNs() - startNs) / 1e6);
+	context.SetCounter("bytes_per_contact", (double)pool.GetMemoryUsage() / store.GetLiveCount());
+
+	const uint32_t frames = 20000;
+	const uint32_t rowsPerFrame = 40;
+	wchar_t text[260];
+	size_t chars = 0;
+	CSyntheticContacts random(5);
+	uint64_t allocations = pool.GetArena().GetAllocationCount();
+	context.ResumeTiming();
+	for(uint32_t frame = 0; frame < frames; frame++) {
+		uint32_t top = random.Next((uint32_t)store.GetRowCount() - rowsPerFrame);
+		for(uint32_t row = top; row < top + rowsPerFrame; row++) {
+			chars += pool.CopyText(row, DisplayLastFirst, text, sizeof(text) / sizeof(text[0]));
+			chars += pool.CopyText(row, DisplayCompany, text, sizeof(text) / sizeof(text[0]));
+		}
+	}
+	context.PauseTiming();
+	context.SetItems((uint64_t)frames * rowsPerFrame * 2);
+	context.SetCounter("allocations_per_frame", (double)(pool.GetArena().GetAllocationCount() - allocations) / frames);
+	context.SetCounter("chars_per_fetch", (double)chars / (frames * rowsPerFrame * 2));
+}
+
+// Fetches without the string pool: whole records of random rows copied
+// out of the store.
+inline void BenchStoreFetch(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CSyntheticContacts random(11);
+	std::vector<uint32_t> rows(100000);
+	for(size_t i = 0; i < rows.size(); i++)
+		rows[i] = random.Next((uint32_t)store.GetRowCount());
+	ContactRecord record;
+	size_t chars = 0;
+	context.ResumeTiming();
+	for(size_t i = 0; i < rows.size(); i++) {
+		if(store.GetRecord(rows[i], record))
+			chars += record.fields[FieldName].size();
+	}
+	context.PauseTiming();
+	context.SetItems(rows.size());
+	context.SetCounter("name_chars", (double)chars / rows.size());
+}
+
+// the database snapshot of the store, written out
+inline void BenchSnapshotSave(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	std::string data;
+	context.ResumeTiming();
+	store.Serialize(data);
+	context.PauseTiming();
+	context.SetItems(store.GetLiveCount());
+	context.SetCounter("bytes_per_contact", (double)data.size() / store.GetLiveCount());
+}
+
+// the snapshot read back into an empty store, as opening the database does
+inline void BenchSnapshotLoad(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	std::string data;
+	store.Serialize(data);
+	CContactStore loaded;
+	CByteReader reader(data);
+	context.ResumeTiming();
+	bool bOk = loaded.Deserialize(reader);
+	context.PauseTiming();
+	context.SetItems(store.GetLiveCount());
+	context.SetCounter("ok", bOk && loaded.GetLiveCount() == store.GetLiveCount() ? 1 : 0);
+}
+
+// removes what CContactDatabase keeps in dir, logs up to seq maxSeq
+inline void ClearDatabaseDirectory(const CContactDatabase& db, const std::string& dir, uint64_t maxSeq)
+{
+	CNativeFile::Delete(db.GetSnapshotPath());
+	CNativeFile::Delete(db.GetSnapshotPath() + ".tmp");
+	for(uint64_t seq = 1; seq <= maxSeq; seq++)
+		CNativeFile::Delete(db.GetLogPath(seq));
+	CNativeFile::DeleteDirectory(dir);
+}
+
+inline bool IsSameRecord(const CContactStore& store, const std::wstring& id, const ContactRecord& expected)
+{
+	ContactRecord record;
+	uint32_t row = store.FindRow(id);
+	if(row == CContactStore::NoRow || !store.GetRecord(row, record))
+		return false;
+	std::string a;
+	std::string b;
+	CContactStore::SerializeRecord(record, a);
+	CContactStore::SerializeRecord(expected, b);
+	return a == b;
+}
+
+// 10k puts into a fresh database in the working directory, timed until
+// every LSN is durable; syncs_per_put shows how well group commit shares
+// the flushes. Then, untimed: a torn frame appended to the log must be cut
+// off by the replay on reopen, and after CheckpointNow plus RemoveRows of
+// every third contact a reopen must recover exactly the survivors.
+inline void BenchDatabaseDurable(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	const std::string dir = "aero-bench.db";
+	const uint32_t count = (uint32_t)context.Scale(10000);
+	std::vector<ContactRecord> records;
+	CSyntheticContacts().Generate(count, records);
+	std::vector<uint64_t> lsns(count);
+	ContactDatabaseOptions options;
+	options.checkpointBytes = 0;
+
+	CContactDatabase db;
+	ClearDatabaseDirectory(db, dir, 4);
+	if(!db.Open(dir, options)) {
+		context.SetCounter("ok", 0);
+		return;
+	}
+	context.ResumeTiming();
+	for(uint32_t i = 0; i < count; i++)
+		lsns[i] = db.Put(records[i]);
+	uint32_t lost = 0;
+	for(uint32_t i = 0; i < count; i++) {
+		if(!db.WaitDurable(lsns[i]))
+			lost++;
+	}
+	context.PauseTiming();
+	WriteAheadLogStats stats = db.GetLogStats();
+	db.Close();
+
+	// torn tail: half a frame header after the last record
+	bool bTornOk = false;
+	int64_t cbLog = -1;
+	{
+		CNativeFile file;
+		if(file.Open(db.GetLogPath(1), CNativeFile::OpenAppend)) {
+			cbLog = file.GetSize();
+			const char torn[CWriteAheadLog::HeaderSize / 2] = { 0x10 };
+			file.Write(torn, sizeof(torn));
+		}
+	}
+	if(db.Open(dir, options)) {
+		CNativeFile file;
+		bTornOk = db.GetStore().GetLiveCount() == count && file.Open(db.GetLogPath(1), CNativeFile::OpenRead) &&
+			file.GetSize() == cbLog;
+	}
+
+	bool bReopenOk = false;
+	std::vector<uint32_t> rows;
+	for(uint32_t i = 0; i < count; i += 3)
+		rows.push_back(db.GetStore().FindRow(records[i].id));
+	if(db.CheckpointNow() && db.WaitDurable(db.RemoveRows(rows))) {
+		db.Close();
+		if(db.Open(dir, options)) {
+			const CContactStore& store = db.GetStore();
+			bReopenOk = store.GetLiveCount() == count - rows.size();
+			for(uint32_t i = 0; i < count && bReopenOk; i++) {
+				if(i % 3 == 0)
+					bReopenOk = store.FindRow(records[i].id) == CContactStore::NoRow;
+				else
+					bReopenOk = IsSameRecord(store, records[i].id, records[i]);
+			}
+		}
+	}
+	db.Close();
+	ClearDatabaseDirectory(db, dir, 4);
+
+	context.SetItems(count);
+	context.SetCounter("ok", lost == 0 ? 1 : 0);
+	context.SetCounter("syncs_per_put", (double)stats.syncs / count);
+	context.SetCounter("max_group", (double)stats.maxGroup);
+	context.SetCounter("torn_ok", bTornOk ? 1 : 0);
+	context.SetCounter("reopen_ok", bReopenOk ? 1 : 0);
+}
+
+// Contacts as sync frames of 500 puts each, the way a push after an import
+// sends them.
+inline void EncodeSyncFrames(const CContactStore& store, std::vector<std::string>& frames)
+{
+	const size_t batchChanges = 500;
+	std::vector<SyncChange> changes;
+	ContactRecord record;
+	frames.clear();
+	for(uint32_t row = 0; row <= store.GetRowCount(); row++) {
+		if(!changes.empty() && (changes.size() == batchChanges || row == store.GetRowCount())) {
+			frames.push_back(std::string());
+			CSyncWire::EncodeBatch(frames.size(), &changes[0], changes.size(), frames.back());
+			changes.clear();
+		}
+		if(!store.GetRecord(row, record))
+			continue;
+		changes.push_back(SyncChange());
+		SyncChange& change = changes.back();
+		for(size_t i = 0; i < record.id.size(); i++)
+			change.id += (char)record.id[i];
+		CContactStore::SerializeRecord(record, change.payload);
+	}
+}
+
+inline void BenchSyncEncode(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	std::vector<std::string> frames;
+	context.ResumeTiming();
+	EncodeSyncFrames(store, frames);
+	context.PauseTiming();
+	size_t bytes = 0;
+	for(size_t i = 0; i < frames.size(); i++)
+		bytes += frames[i].size();
+	context.SetItems(store.GetLiveCount());
+	context.SetCounter("bytes_per_contact", (double)bytes / store.GetLiveCount());
+}
+
+// the frames decoded and applied to an empty store, as a pull would
+inline void BenchSyncApply(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	std::vector<std::string> frames;
+	EncodeSyncFrames(store, frames);
+	CContactStore applied;
+	std::vector<SyncChange> changes;
+	std::string body;
+	ContactRecord record;
+	uint32_t errors = 0;
+	context.ResumeTiming();
+	for(size_t i = 0; i < frames.size(); i++) {
+		body.assign(frames[i], CSyncWire::HeaderSize, std::string::npos);
+		uint64_t batchId = 0;
+		if(!CSyncWire::DecodeBatch(body, batchId, &changes)) {
+			errors++;
+			continue;
+		}
+		for(size_t c = 0; c < changes.size(); c++) {
+			CByteReader reader(changes[c].payload);
+			if(CContactStore::DeserializeRecord(reader, record))
+				applied.Put(record);
+			else
+				errors++;
+		}
+	}
+	context.PauseTiming();
+	context.SetItems(store.GetLiveCount());
+	context.SetCounter("errors", errors + (applied.GetLiveCount() == store.GetLiveCount() ? 0 : 1));
+}
+
+inline void AppendDecimal(std::string& text, uint32_t value)
+{
+	char digits[10];
+	size_t count = 0;
+	do {
+		digits[count++] = (char)('0' + value % 10);
+		value /= 10;
+	} while(value != 0);
+	while(count > 0)
+		text += digits[--count];
+}
+
+// 20k puts and deletes rotating over 500 ids pushed through CSyncTransport
+// to a loopback CSyncMockServer, so each id is rewritten by many batches.
+// Afterwards the server must hold every id's last change: with lost or busy
+// batches the resends arrive after newer ones and must not win. With
+// faults the first batch always meets one, so at any scale the case fails
+// unless something was resent and a resend's older changes were skipped.
+inline void RunSyncTransport(CBenchmarkContext& context, uint32_t rttMs, uint32_t dropPercent, uint32_t busyPercent)
+{
+	context.PauseTiming();
+	const uint32_t idCount = 500;
+	uint32_t pushes = (uint32_t)context.Scale(20000);
+	if(pushes < idCount * 4)
+		pushes = idCount * 4;   // every id rewritten by a few batches
+	bool bFaults = dropPercent > 0 || busyPercent > 0;
+	SyncMockServerOptions serverOptions;
+	serverOptions.rttMs = rttMs;
+	serverOptions.dropRequestPercent = dropPercent;
+	serverOptions.dropAckPercent = dropPercent;
+	serverOptions.busyPercent = busyPercent;
+	serverOptions.faultFirstBatches = bFaults ? 1 : 0;
+	CSyncMockServer server;
+	if(!server.Start(serverOptions)) {
+		context.SetCounter("ok", 0);
+		return;
+	}
+	SyncTransportOptions options;
+	options.port = server.GetPort();
+	options.maxBatchChanges = 64;
+	options.ackTimeoutMs = rttMs * 3 + 50;
+	CSyncTransport transport;
+	transport.Start(options);
+
+	std::vector<std::string> expected(idCount);     // last payload per id, empty once deleted
+	SyncChange change;
+	context.ResumeTiming();
+	for(uint32_t i = 0; i < pushes; i++) {
+		change.op = i % 7 == 3 ? SyncOpDelete : SyncOpPut;
+		change.id = "c";
+		AppendDecimal(change.id, i % idCount);
+		change.payload.clear();
+		if(change.op == SyncOpPut) {
+			change.payload = "v";
+			AppendDecimal(change.payload, i);
+		}
+		expected[i % idCount] = change.payload;
+		if(!transport.Push(change))
+			break;
+	}
+	bool bOk = transport.Flush(60000) && !transport.IsFailed();
+	context.PauseTiming();
+	SyncTransportStats stats = transport.GetStats();
+	transport.Close();
+
+	uint32_t stale = 0;
+	size_t live = 0;
+	std::string id;
+	std::string payload;
+	for(uint32_t i = 0; i < idCount; i++) {
+		id = "c";
+		AppendDecimal(id, i);
+		bool bFound = server.GetContact(id, payload);
+		bool bLive = !expected[i].empty();
+		if(bLive)
+			live++;
+		if(bFound != bLive || (bFound && payload != expected[i]))
+			stale++;
+	}
+	if(server.GetContactCount() != live)
+		stale++;
+	SyncMockServerStats serverStats = server.GetStats();
+	server.Stop();
+
+	if(bFaults && (stats.retries == 0 || serverStats.staleChanges == 0))
+		bOk = false;
+	context.SetItems(pushes);
+	context.SetCounter("ok", bOk ? 1 : 0);
+	context.SetCounter("stale", stale);
+	context.SetCounter("skipped_changes", (double)serverStats.staleChanges);
+	context.SetCounter("retries", (double)stats.retries);
+	context.SetCounter("peak_in_flight", stats.peakInFlight);
+}
+
+inline void BenchSyncTransportRtt0(CBenchmarkContext& context)
+{
+	RunSyncTransport(context, 0, 0, 0);
+}
+
+inline void BenchSyncTransportRtt5(CBenchmarkContext& context)
+{
+	RunSyncTransport(context, 5, 0, 0);
+}
+
+inline void BenchSyncTransportRtt20(CBenchmarkContext& context)
+{
+	RunSyncTransport(context, 20, 0, 0);
+}
+
+// 10% of requests and 10% of acknowledgements lost
+inline void BenchSyncTransportDrops(CBenchmarkContext& context)
+{
+	RunSyncTransport(context, 5, 10, 0);
+}
+
+// 10% of batches answered busy
+inline void BenchSyncTransportBusy(CBenchmarkContext& context)
+{
+	RunSyncTransport(context, 5, 0, 10);
+}
+
+// cost of instrumenting a handler: a scope timing into a histogram, and
+// the recording alone
+inline void BenchLatencyRecord(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CLatencyRegistry registry;
+	CLatencyHistogram* pHistogram = registry.Get("bench.scope");
+	const int samples = 1000000;
+	context.ResumeTiming();
+	for(int i = 0; i < samples; i++)
+		CLatencyScope scope(pHistogram);
+	context.PauseTiming();
+	context.SetItems(samples);
+	uint64_t startNs = GetTimeNs();
+	for(int i = 0; i < samples; i++)
+		pHistogram->Record((uint64_t)(i & 0xFFFF) * 37);
+	context.SetCounter("record_ns", (double)(GetTimeNs() - startNs) / samples);
+	std::string output;
+	registry.Dump(output);
+	context.SetCounter("dump_bytes", (double)output.size());
+}
+
+// Cost of the timeline: a scope while tracing is off and on, how many
+// scopes a second stay within 1% of one core, and writing the JSON of a
+// full ring. Leaves tracing off.
+inline void BenchEventTrace(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CEventTracer& tracer = CEventTracer::GetDefault();
+	tracer.Stop();
+	const int samples = 1000000;
+	uint64_t startNs = GetTimeNs();
+	for(int i = 0; i < samples; i++)
+		CTraceScope scope("bench.scope", "bench");
+	context.SetCounter("disabled_scope_ns", (double)(GetTimeNs() - startNs) / samples);
+	tracer.Start();
+	startNs = GetTimeNs();
+	context.ResumeTiming();
+	for(int i = 0; i < samples; i++)
+		CTraceScope scope("bench.scope", "bench");
+	context.PauseTiming();
+	double scopeNs = (double)(GetTimeNs() - startNs) / samples;
+	tracer.Stop();
+	context.SetItems(samples);
+	context.SetCounter("enabled_scope_ns", scopeNs);
+	context.SetCounter("scopes_per_s_at_1pct", scopeNs > 0 ? 0.01 * 1e9 / scopeNs : 0.0);
+	std::string json;
+	startNs = GetTimeNs();
+	size_t events = tracer.Write(json);
+	context.SetCounter("write_ms", (double)(GetTimeNs() - startNs) / 1e6);
+	context.SetCounter("json_bytes_per_event", events > 0 ? (double)json.size() / events : 0.0);
+}
+
+// Family names with one typo each (a letter changed, dropped or swapped
+// with the next) searched in the fuzzy index over 1M contacts: query
+// latency, the build, and how often the misspelled contact was found.
+// Then the one-word ones of the first hundred through the search box's
+// pipeline: fallback_ok is 1 when every one the exact and other-script
+// searches missed came back with the typo matches, the misspelled
+// contact among them, and the sound-alike ones.
+inline void BenchFuzzySearch(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CFuzzyIndex index(store, FieldFamilyName, CBenchmarkData::GetCollator());
+	uint64_t startNs = GetTimeNs();
+	index.Rebuild();
+	context.SetCounter("build_ms", (double)(GetTimeNs() - startNs) / 1e6);
+
+	CSyntheticContacts random(41);
+	std::vector<std::wstring> queries;
+	std::vector<uint32_t> targets;
+	while(queries.size() < 1000) {
+		uint32_t row = random.Next((uint32_t)store.GetRowCount());
+		std::wstring name = store.GetField(row, FieldFamilyName);
+		if(name.size() < 6)
+			continue;
+		size_t at = 1 + random.Next((uint32_t)name.size() - 2);
+		switch(random.Next(3)) {
+		case 0:
+			name[at] = name[at] == L'o' ? L'a' : L'o';
+			break;
+		case 1:
+			name.erase(at, 1);
+			break;
+		default:
+			std::swap(name[at], name[at + 1]);
+			break;
+		}
+		queries.push_back(name);
+		targets.push_back(row);
+	}
+
+	CLatencyHistogram latency;
+	std::vector<uint32_t> rows;
+	uint32_t found = 0;
+	size_t matches = 0;
+	context.ResumeTiming();
+	for(size_t i = 0; i < queries.size(); i++) {
+		uint64_t queryNs = GetTimeNs();
+		index.Search(queries[i], rows, false);
+		latency.Record(GetTimeNs() - queryNs);
+		if(std::binary_search(rows.begin(), rows.end(), targets[i]))
+			found++;
+		matches += rows.size();
+	}
+	context.PauseTiming();
+	context.SetItems(queries.size());
+
+	std::vector<uint64_t> counts;
+	LatencySnapshot snapshot;
+	latency.Snapshot(counts, snapshot, false);
+	FuzzySearchStats stats = index.GetStats();
+	context.SetCounter("query_p50_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.5));
+	context.SetCounter("query_p99_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.99));
+	context.SetCounter("recall", (double)found / queries.size());
+	context.SetCounter("matches_per_query", (double)matches / queries.size());
+	context.SetCounter("nodes_per_query", (double)stats.nodesVisited / stats.searches);
+	context.SetCounter("tokens", (double)index.GetTokenCount());
+	context.SetCounter("index_mb", index.GetMemoryUsage() / 1048576.0);
+
+	CContactSearch search(store, CBenchmarkData::GetCollator());
+	uint32_t misses = 0;
+	uint32_t fallbackBad = 0;
+	std::vector<uint32_t> fuzzy;
+	for(size_t i = 0; i < queries.size() && i < 100; i++) {
+		if(queries[i].find(L' ') != std::wstring::npos)
+			continue;       // "van der Berg" may lose a letter of a two letter word
+		CScopedSearchCursor exact(search.GetIndexes(), store, queries[i]);
+		rows.clear();
+		while(exact.Fetch(rows))
+			;
+		search.GetTranslitIndex().Search(queries[i], rows);
+		if(!rows.empty())
+			continue;
+		misses++;
+		IResultCursor* pCursor = search.CreateCursor(queries[i]);
+		while(pCursor->Fetch(rows))
+			;
+		delete pCursor;
+		std::sort(rows.begin(), rows.end());
+		search.GetFuzzyIndex().Search(queries[i], fuzzy);
+		search.GetPhoneticIndex().Search(queries[i], fuzzy);
+		std::sort(fuzzy.begin(), fuzzy.end());
+		fuzzy.erase(std::unique(fuzzy.begin(), fuzzy.end()), fuzzy.end());
+		if(rows != fuzzy || !std::binary_search(rows.begin(), rows.end(), targets[i]))
+			fallbackBad++;
+	}
+	context.SetCounter("fallback_misses", misses);
+	context.SetCounter("fallback_ok", misses > 0 && fallbackBad == 0 ? 1 : 0);
+}
+
+// Scoped queries over 1M contacts through the per-field indexes: query
+// latency with the indexes built, the build, and the share of examined
+// rows each field's terms kept.
+inline void BenchScopedSearch(CBenchmarkContext& context)
+{
+	static const wchar_t* const s_queries[] =
+	{
+		L"name:ann company:contoso", L"email:yandex AND label:work", L"phone:9123 label:vip",
+		L"company:\"northwind traders\" ivan", L"user12", L"name:\u0438\u0432\u0430\u043D email:example.org",
+		L"label:family phone:55"
+	};
+	const int queryCount = sizeof(s_queries) / sizeof(s_queries[0]);
+
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CFieldIndexSet indexes(store, CBenchmarkData::GetCollator());
+	uint64_t startNs = GetTimeNs();
+	for(int scope = 0; scope < CSearchQuery::ScopeCount; scope++)
+		indexes.GetIndex(CSearchQuery::GetScopeField(scope)).Rebuild();
+	context.SetCounter("build_ms", (double)(GetTimeNs() - startNs) / 1e6);
+
+	CLatencyHistogram latency;
+	double examined[FieldCount + 1] = { 0 };
+	double matched[FieldCount + 1] = { 0 };
+	size_t found = 0;
+	const int repeats = 10;
+	std::vector<uint32_t> rows;
+	context.ResumeTiming();
+	for(int repeat = 0; repeat < repeats; repeat++) {
+		for(int q = 0; q < queryCount; q++) {
+			uint64_t queryNs = GetTimeNs();
+			CScopedSearchCursor cursor(indexes, store, s_queries[q]);
+			rows.clear();
+			while(cursor.Fetch(rows))
+				;
+			latency.Record(GetTimeNs() - queryNs);
+			found += rows.size();
+			const std::vector<SearchTermStats>& stats = cursor.GetStats();
+			for(size_t t = 0; t < stats.size(); t++) {
+				examined[stats[t].field] += stats[t].examined;
+				matched[stats[t].field] += stats[t].matched;
+			}
+		}
+	}
+	context.PauseTiming();
+	context.SetItems(repeats * queryCount);
+
+	std::vector<uint64_t> counts;
+	LatencySnapshot snapshot;
+	latency.Snapshot(counts, snapshot, false);
+	context.SetCounter("query_p50_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.5));
+	context.SetCounter("query_p99_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.99));
+	context.SetCounter("found_per_query", (double)found / (repeats * queryCount));
+	static const char* const s_selectivity[CSearchQuery::ScopeCount] =
+	{
+		"selectivity_name", "selectivity_email", "selectivity_phone", "selectivity_company", "selectivity_label"
+	};
+	for(int scope = 0; scope < CSearchQuery::ScopeCount; scope++) {
+		ContactField field = CSearchQuery::GetScopeField(scope);
+		context.SetCounter(s_selectivity[scope], examined[field] > 0 ? matched[field] / examined[field] : 0.0);
+	}
+	context.SetCounter("selectivity_any", examined[FieldCount] > 0 ? matched[FieldCount] / examined[FieldCount] : 0.0);
+	context.SetCounter("index_mb", indexes.GetMemoryUsage() / 1048576.0);
+}
+
+// Time from starting a ranked name search to its first 50 rows in the
+// list, and to the complete result set, over 1M contacts: prefixes of one
+// to four letters, whole names and a few misspelled ones. Rows come with
+// their highlight spans, as the list paints them; what those cost is
+// counted apart.
+inline void BenchRankedSearch(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CFieldIndex index(store, FieldName, CBenchmarkData::GetCollator());
+	CFuzzyIndex fuzzy(store, FieldName, CBenchmarkData::GetCollator());
+	index.Rebuild();
+	fuzzy.Rebuild();
+	std::vector<std::wstring> queries;
+	CSyntheticContacts random(43);
+	for(int i = 0; i < 200; i++) {
+		const std::wstring& name = store.GetField(random.Next((uint32_t)store.GetRowCount()), FieldName);
+		if(i % 4 == 3)
+			queries.push_back(name);
+		else
+			queries.push_back(name.substr(0, 1 + random.Next(4)));
+	}
+	queries.push_back(L"Sokhatski");
+	queries.push_back(L"Petrova Ana");
+
+	const uint32_t page = 50;
+	CLatencyHistogram firstPage;
+	CLatencyHistogram complete;
+	CProgressiveResults results;
+	CBenchmarkResultsWaiter waiter;
+	results.SetObserver(&waiter);
+	size_t matches = 0;
+	uint64_t spanNs = 0;
+	uint64_t completeNs = 0;
+	size_t spanBytes = 0;
+	context.ResumeTiming();
+	for(size_t i = 0; i < queries.size(); i++) {
+		uint64_t startNs = GetTimeNs();
+		results.Start(new CRankedSearchCursor(index, queries[i], page, &fuzzy), page,
+			new CMatchHighlighter(store, CBenchmarkData::GetCollator(), queries[i]));
+		while(results.GetVisibleCount() < page && !results.IsComplete()) {
+			waiter.Wait();
+			results.Poll();
+		}
+		firstPage.Record(GetTimeNs() - startNs);
+		while(!results.IsComplete()) {
+			waiter.Wait();
+			results.Poll();
+		}
+		complete.Record(GetTimeNs() - startNs);
+		completeNs += GetTimeNs() - startNs;
+		matches += results.GetLoadedCount();
+		spanNs += results.GetSpanNs();
+		spanBytes += results.GetSpanTable().GetMemoryUsage();
+	}
+	context.PauseTiming();
+	context.SetItems(queries.size());
+
+	std::vector<uint64_t> counts;
+	LatencySnapshot snapshot;
+	firstPage.Snapshot(counts, snapshot, false);
+	context.SetCounter("top50_p50_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.5));
+	context.SetCounter("top50_p99_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.99));
+	complete.Snapshot(counts, snapshot, false);
+	context.SetCounter("complete_p50_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.5));
+	context.SetCounter("complete_p99_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.99));
+	context.SetCounter("matches_per_query", (double)matches / queries.size());
+	context.SetCounter("span_ns_per_row", matches > 0 ? (double)spanNs / matches : 0.0);
+	context.SetCounter("span_share", completeNs > 0 ? (double)spanNs / completeNs : 0.0);
+	context.SetCounter("span_bytes_per_row", matches > 0 ? (double)spanBytes / matches : 0.0);
+}
+
+// Keystrokes of people filtering 1M contacts by name: each types the start
+// of a name letter by letter, backspaces twice and retypes, then goes back
+// to the last three filters. Latency per keystroke through the result
+// cache, the same keystrokes searching the index directly, and the hits.
+inline void BenchSearchCache(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CFieldIndex index(store, FieldName, CBenchmarkData::GetCollator());
+	index.Rebuild();
+	std::vector<std::wstring> keystrokes;
+	std::vector<std::wstring> filters;
+	CSyntheticContacts random(44);
+	while(filters.size() < 50) {
+		std::wstring name = store.GetField(random.Next((uint32_t)store.GetRowCount()), FieldName);
+		name = name.substr(0, name.find(L' '));
+		if(name.size() < 4)
+			continue;
+		for(size_t cch = 1; cch <= name.size(); cch++)
+			keystrokes.push_back(name.substr(0, cch));
+		keystrokes.push_back(name.substr(0, name.size() - 1));
+		keystrokes.push_back(name.substr(0, name.size() - 2));
+		keystrokes.push_back(name.substr(0, name.size() - 1));
+		keystrokes.push_back(name);
+		for(size_t i = filters.size() >= 3 ? filters.size() - 3 : 0; i < filters.size(); i++)
+			keystrokes.push_back(filters[i]);
+		filters.push_back(name);
+	}
+
+	CQueryResultCache cache(store);
+	CLatencyHistogram cached;
+	std::vector<uint32_t> rows;
+	std::string key;
+	context.ResumeTiming();
+	for(size_t i = 0; i < keystrokes.size(); i++) {
+		uint64_t startNs = GetTimeNs();
+		index.GetQueryKey(keystrokes[i], key);
+		cache.SearchIndex(index, key, rows);
+		cached.Record(GetTimeNs() - startNs);
+	}
+	context.PauseTiming();
+	context.SetItems(keystrokes.size());
+
+	CLatencyHistogram direct;
+	for(size_t i = 0; i < keystrokes.size(); i++) {
+		uint64_t startNs = GetTimeNs();
+		index.GetQueryKey(keystrokes[i], key);
+		rows.clear();
+		index.Search(key, rows);
+		direct.Record(GetTimeNs() - startNs);
+	}
+
+	std::vector<uint64_t> counts;
+	LatencySnapshot snapshot;
+	cached.Snapshot(counts, snapshot, false);
+	context.SetCounter("cached_p50_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.5));
+	context.SetCounter("cached_p99_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.99));
+	direct.Snapshot(counts, snapshot, false);
+	context.SetCounter("direct_p50_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.5));
+	context.SetCounter("direct_p99_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.99));
+	QueryCacheStats stats = cache.GetStats();
+	context.SetCounter("hit_rate", stats.lookups > 0 ? (double)stats.hits / stats.lookups : 0.0);
+	context.SetCounter("narrowed_rate", stats.lookups > 0 ? (double)stats.narrowed / stats.lookups : 0.0);
+	context.SetCounter("evictions", (double)stats.evictions);
+	context.SetCounter("cache_mb", stats.bytes / 1048576.0);
+}
+
+// Names typed in the other script over 1M contacts: Latin spellings of the
+// Cyrillic names of the synthetic set and Cyrillic spellings of Latin
+// ones, through the transliteration index. Query latency, how many rows
+// each finds in the other script, the build, the cost of an edit (the
+// same records put back, so the store stays as the other cases see it)
+// and the index size. pipeline_ok is 1 when the search box's pipeline
+// returned every row the index found, for every query.
+inline void BenchTranslitSearch(CBenchmarkContext& context)
+{
+	static const wchar_t* const s_queries[] =
+	{
+		L"Ivanov", L"Smirnov", L"Kuznetsov", L"Popov", L"Lebedev", L"Kozlov", L"Novikov", L"Morozov",
+		L"Petrov", L"Volkov", L"Solovyev", L"Vasilyev", L"Zaitsev", L"Pavlov", L"Shevchenko", L"Kovalenko",
+		L"Bondarenko", L"Tkachenko", L"Kravchuk", L"Maria", L"Alexey", L"Olga", L"Dmitry", L"Yelena",
+		L"Natalya", L"Tatiana", L"Artem", L"Yulia", L"Iryna", L"Taras", L"Bohdan", L"Yevhen", L"Svetlana",
+		L"Mikhail", L"Sergey Kozlov", L"Anna Shevch",
+		L"\u0421\u043E\u043A\u043E\u043B\u043E\u0432", L"\u041C\u0430\u0440\u0442\u0438\u043D",
+		L"\u041D\u043E\u0432\u0430\u043A", L"\u0410\u043D\u0430"
+	};
+	const int queryCount = sizeof(s_queries) / sizeof(s_queries[0]);
+
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CTranslitIndex index(store, FieldName);
+	uint64_t startNs = GetTimeNs();
+	index.Rebuild();
+	context.SetCounter("build_ms", (double)(GetTimeNs() - startNs) / 1e6);
+
+	CLatencyHistogram latency;
+	std::vector<uint32_t> rows;
+	size_t matches = 0;
+	size_t crossRows = 0;
+	uint32_t crossFound = 0;
+	context.ResumeTiming();
+	for(int round = 0; round < 5; round++) {
+		for(int q = 0; q < queryCount; q++) {
+			rows.clear();
+			uint64_t queryNs = GetTimeNs();
+			index.Search(s_queries[q], rows);
+			latency.Record(GetTimeNs() - queryNs);
+			if(round > 0)
+				continue;
+			matches += rows.size();
+			bool bCyrillicQuery = s_queries[q][0] >= 0x0400;
+			size_t cross = 0;
+			CAutoLock storeLock(store.GetLock());
+			for(size_t i = 0; i < rows.size(); i++) {
+				const std::wstring& name = store.GetField(rows[i], FieldName);
+				if(!name.empty() && (name[0] >= 0x0400 && name[0] < 0x0530) != bCyrillicQuery)
+					cross++;
+			}
+			crossRows += cross;
+			if(cross > 0)
+				crossFound++;
+		}
+	}
+	context.PauseTiming();
+	context.SetItems(queryCount * 5);
+
+	uint32_t pipelineBad = 0;
+	{
+		CContactSearch search(store, CBenchmarkData::GetCollator());
+		std::vector<uint32_t> found;
+		for(int q = 0; q < queryCount; q++) {
+			IResultCursor* pCursor = search.CreateCursor(s_queries[q]);
+			found.clear();
+			while(pCursor->Fetch(found))
+				;
+			delete pCursor;
+			std::sort(found.begin(), found.end());
+			rows.clear();
+			index.Search(s_queries[q], rows);
+			if(!std::includes(found.begin(), found.end(), rows.begin(), rows.end()))
+				pipelineBad++;
+		}
+	}
+	context.SetCounter("pipeline_ok", pipelineBad == 0 ? 1 : 0);
+
+	const int edits = 20000;
+	CSyntheticContacts random(47);
+	ContactRecord record;
+	startNs = GetTimeNs();
+	for(int i = 0; i < edits; i++) {
+		if(store.GetRecord(random.Next((uint32_t)store.GetRowCount()), record))
+			store.Put(record);
+	}
+	context.SetCounter("edit_ns", (double)(GetTimeNs() - startNs) / edits);
+
+	std::vector<uint64_t> counts;
+	LatencySnapshot snapshot;
+	latency.Snapshot(counts, snapshot, false);
+	TranslitSearchStats stats = index.GetStats();
+	context.SetCounter("query_p50_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.5));
+	context.SetCounter("query_p99_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.99));
+	context.SetCounter("matches_per_query", (double)matches / queryCount);
+	context.SetCounter("cross_script_rows_per_query", (double)crossRows / queryCount);
+	context.SetCounter("cross_script_found", (double)crossFound / queryCount);
+	context.SetCounter("merged_rows", (double)stats.merges);
+	context.SetCounter("index_mb", index.GetMemoryUsage() / 1048576.0);
+	context.SetCounter("index_bytes_per_row", (double)index.GetMemoryUsage() / store.GetRowCount());
+}
+
+// Misspelled and other-script names over 1M contacts through the phonetic
+// index: the batch encode of every name word (on one core), the whole
+// build, query latency and matches, the sound-alike groups a duplicate
+// pass finds, and the index size. pipeline_ok is 1 when, for every query
+// nothing matched exactly, the search box's pipeline returned the rows
+// the index found.
+inline void BenchPhoneticSearch(CBenchmarkContext& context)
+{
+	static const wchar_t* const s_queries[] =
+	{
+		L"Smirnoff", L"Kuznecov", L"Ivanoff", L"Popoff", L"Lebedeff", L"Morosov", L"Petroff", L"Volkoff",
+		L"Solovjev", L"Vasiliev", L"Zaytsev", L"Shevtchenko", L"Kovalenco", L"Tkachenco", L"Kravtchuk",
+		L"Mariya", L"Aleksey", L"Olha", L"Dimitri", L"Jelena", L"Natalia", L"Tatyana", L"Julia",
+		L"Irina", L"Bogdan", L"Sergei Kozloff", L"Katherine", L"Philip", L"Jurgen Muller",
+		L"\u0421\u043C\u0438\u0442", L"\u041C\u0430\u0440\u0442\u0438\u043D"
+	};
+	const int queryCount = sizeof(s_queries) / sizeof(s_queries[0]);
+
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CPhoneticIndex index(store, FieldName);
+	uint64_t startNs = GetTimeNs();
+	index.Rebuild();
+	context.SetCounter("build_ms", (double)(GetTimeNs() - startNs) / 1e6);
+	PhoneticIndexStats stats = index.GetStats();
+	context.SetCounter("encode_ms", (double)stats.encodeNs / 1e6);
+	context.SetCounter("encode_ns_per_word", stats.words > 0 ? (double)stats.encodeNs / stats.words : 0.0);
+
+	CLatencyHistogram latency;
+	std::vector<uint32_t> rows;
+	size_t matches = 0;
+	context.ResumeTiming();
+	for(int round = 0; round < 5; round++) {
+		for(int q = 0; q < queryCount; q++) {
+			rows.clear();
+			uint64_t queryNs = GetTimeNs();
+			index.Search(s_queries[q], rows);
+			latency.Record(GetTimeNs() - queryNs);
+			if(round == 0)
+				matches += rows.size();
+		}
+	}
+	context.PauseTiming();
+	context.SetItems(queryCount * 5);
+
+	std::vector<uint32_t> groupStarts;
+	startNs = GetTimeNs();
+	index.FindSoundAlikes(rows, groupStarts);
+	context.SetCounter("duplicates_ms", (double)(GetTimeNs() - startNs) / 1e6);
+	context.SetCounter("duplicate_groups", (double)(groupStarts.size() - 1));
+	context.SetCounter("duplicate_rows", (double)rows.size());
+
+	uint32_t fallbacks = 0;
+	uint32_t pipelineBad = 0;
+	{
+		CContactSearch search(store, CBenchmarkData::GetCollator());
+		std::vector<uint32_t> found;
+		for(int q = 0; q < queryCount; q++) {
+			CScopedSearchCursor exact(search.GetIndexes(), store, s_queries[q]);
+			found.clear();
+			while(exact.Fetch(found))
+				;
+			search.GetTranslitIndex().Search(s_queries[q], found);
+			if(!found.empty())
+				continue;
+			fallbacks++;
+			IResultCursor* pCursor = search.CreateCursor(s_queries[q]);
+			while(pCursor->Fetch(found))
+				;
+			delete pCursor;
+			std::sort(found.begin(), found.end());
+			rows.clear();
+			index.Search(s_queries[q], rows);
+			if(!std::includes(found.begin(), found.end(), rows.begin(), rows.end()))
+				pipelineBad++;
+		}
+	}
+	context.SetCounter("fallback_queries", fallbacks);
+	context.SetCounter("pipeline_ok", pipelineBad == 0 ? 1 : 0);
+
+	std::vector<uint64_t> counts;
+	LatencySnapshot snapshot;
+	latency.Snapshot(counts, snapshot, false);
+	context.SetCounter("query_p50_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.5));
+	context.SetCounter("query_p99_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.99));
+	context.SetCounter("matches_per_query", (double)matches / queryCount);
+	context.SetCounter("codes", (double)index.GetCodeCount());
+	context.SetCounter("index_mb", index.GetMemoryUsage() / 1048576.0);
+	context.SetCounter("index_bytes_per_row", (double)index.GetMemoryUsage() / store.GetRowCount());
+}
+
+// Address completion over 1M contacts: the trie build, a day of uses
+// skewed towards a few contacts, then ten completions for prefixes of one
+// to six characters of addresses and name words. The cost of a use and of
+// an edit (the same records put back, so the store stays as the other
+// cases see it) and the trie size.
+inline void BenchAutoComplete(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CAutoCompleteTrie trie(store, CBenchmarkData::GetCollator());
+	uint64_t startNs = GetTimeNs();
+	trie.Rebuild();
+	context.SetCounter("build_ms", (double)(GetTimeNs() - startNs) / 1e6);
+
+	const int uses = 200000;
+	uint32_t rowCount = (uint32_t)store.GetRowCount();
+	uint32_t time = CFrecency::GetNow() - 24 * 3600;
+	CSyntheticContacts random(48);
+	startNs = GetTimeNs();
+	for(int i = 0; i < uses; i++) {
+		// a third of the uses go to a thousandth of the contacts
+		uint32_t row = random.Next(3) == 0 ? random.Next(rowCount / 1000 + 1) * 997 % rowCount : random.Next(rowCount);
+		trie.RecordUse(row, time + (uint32_t)((uint64_t)i * 24 * 3600 / uses));
+	}
+	context.SetCounter("use_ns", (double)(GetTimeNs() - startNs) / uses);
+
+	const int prefixCount = 2000;
+	std::vector<std::wstring> prefixes;
+	{
+		CAutoLock storeLock(store.GetLock());
+		for(int i = 0; i < prefixCount; i++) {
+			uint32_t row = random.Next(rowCount);
+			const std::wstring& text = store.GetField(row, i % 2 == 0 ? FieldEmail : FieldName);
+			size_t start = i % 4 == 3 && text.find(L' ') != std::wstring::npos ? text.find(L' ') + 1 : 0;
+			prefixes.push_back(text.substr(start, 1 + i % 6));
+		}
+	}
+
+	CLatencyHistogram latency;
+	std::vector<uint32_t> rows;
+	size_t completions = 0;
+	context.ResumeTiming();
+	for(int round = 0; round < 5; round++) {
+		for(int i = 0; i < prefixCount; i++) {
+			uint64_t queryNs = GetTimeNs();
+			trie.Complete(prefixes[i], CAutoCompleteTrie::MaxCompletions, rows);
+			latency.Record(GetTimeNs() - queryNs);
+			completions += rows.size();
+		}
+	}
+	context.PauseTiming();
+	context.SetItems(prefixCount * 5);
+
+	const int edits = 20000;
+	ContactRecord record;
+	startNs = GetTimeNs();
+	for(int i = 0; i < edits; i++) {
+		if(store.GetRecord(random.Next(rowCount), record))
+			store.Put(record);
+	}
+	context.SetCounter("edit_ns", (double)(GetTimeNs() - startNs) / edits);
+
+	std::vector<uint64_t> counts;
+	LatencySnapshot snapshot;
+	latency.Snapshot(counts, snapshot, false);
+	context.SetCounter("complete_p50_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.5));
+	context.SetCounter("complete_p99_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.99));
+	context.SetCounter("completions_per_prefix", (double)completions / (prefixCount * 5));
+	context.SetCounter("nodes", (double)trie.GetNodeCount());
+	context.SetCounter("index_mb", trie.GetMemoryUsage() / 1048576.0);
+	context.SetCounter("index_bytes_per_row", (double)trie.GetMemoryUsage() / rowCount);
+}
+
+// The "Frequent" group over 1M contacts: a use with the pinned group kept
+// current as the list view does it, reading the most used, and saving and
+// loading the counts.
+inline void BenchFrequentContacts(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	CUsageTracker usage(store);
+	CGroupModel groups(store, FieldCompany);
+
+	const int uses = 500000;
+	uint32_t rowCount = (uint32_t)store.GetRowCount();
+	uint32_t time = CFrecency::GetNow() - 30 * 24 * 3600;
+	CSyntheticContacts random(49);
+	std::vector<uint32_t> picks(uses);
+	for(int i = 0; i < uses; i++) {
+		// a third of the uses go to a thousandth of the contacts
+		picks[i] = random.Next(3) == 0 ? random.Next(rowCount / 1000 + 1) * 997 % rowCount : random.Next(rowCount);
+	}
+
+	std::vector<uint32_t> rows;
+	uint32_t version = usage.GetTopVersion();
+	uint32_t pinnedUpdates = 0;
+	context.ResumeTiming();
+	for(int i = 0; i < uses; i++) {
+		usage.RecordUse(picks[i], time + (uint32_t)((uint64_t)i * 30 * 24 * 3600 / uses));
+		if(usage.GetTopVersion() != version) {
+			version = usage.GetTopVersion();
+			usage.GetTop(10, rows);
+			groups.SetPinnedRows(0, L"Frequent", rows);
+			pinnedUpdates++;
+		}
+	}
+	context.PauseTiming();
+	context.SetItems(uses);
+	context.SetCounter("pinned_updates_per_1k_uses", pinnedUpdates * 1000.0 / uses);
+
+	const int reads = 100000;
+	uint64_t startNs = GetTimeNs();
+	size_t listed = 0;
+	for(int i = 0; i < reads; i++) {
+		usage.GetTop(10, rows);
+		listed += rows.size();
+	}
+	context.SetCounter("top_ns", (double)(GetTimeNs() - startNs) / reads);
+	context.SetCounter("top_rows", (double)listed / reads);
+
+	std::string path = "aero-bench-usage.bin";
+	startNs = GetTimeNs();
+	bool bSaved = usage.Save(path);
+	context.SetCounter("save_ms", (double)(GetTimeNs() - startNs) / 1e6);
+	CUsageTracker loaded(store);
+	startNs = GetTimeNs();
+	bool bLoaded = bSaved && loaded.Load(path);
+	context.SetCounter("load_ms", (double)(GetTimeNs() - startNs) / 1e6);
+	context.SetCounter("load_ok", bLoaded ? 1 : 0);
+
+	// the loaded most used list against a full sort of the loaded counts
+	std::vector<std::pair<double, uint32_t> > ranked;
+	uint32_t latest = time + 30 * 24 * 3600;
+	for(uint32_t row = 0; row < rowCount; row++) {
+		double count = loaded.GetCount(row, latest);
+		if(count > 0)
+			ranked.push_back(std::make_pair(-count, row));
+	}
+	size_t keep = ranked.size() < (size_t)CUsageTracker::TopCapacity ? ranked.size() : (size_t)CUsageTracker::TopCapacity;
+	std::partial_sort(ranked.begin(), ranked.begin() + keep, ranked.end());
+	std::vector<uint32_t> loadedTop;
+	loaded.GetTop(CUsageTracker::TopCapacity, loadedTop);
+	usage.GetTop(CUsageTracker::TopCapacity, rows);
+	bool bTopOk = loadedTop.size() == keep && loadedTop == rows;
+	for(size_t i = 0; bTopOk && i < keep; i++)
+		bTopOk = loadedTop[i] == ranked[i].second;
+	context.SetCounter("load_top_ok", bTopOk ? 1 : 0);
+	CNativeFile::Delete(path);
+	context.SetCounter("tracker_bytes_per_row", (double)usage.GetMemoryUsage() / rowCount);
+}
+
+// Birthdays and anniversaries over 1M contacts: the next 30 days from dates
+// spread over the year, counting them, moving a date, and the pinned
+// "Upcoming" group following the edits.
+inline void BenchUpcomingDates(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CContactStore& store = CBenchmarkData::GetStore(context.Scale(1000000));
+	uint64_t startNs = GetTimeNs();
+	CDateIndex dates(store);
+	context.SetCounter("build_ms", (double)(GetTimeNs() - startNs) / 1e6);
+
+	const int queryCount = 2000;
+	std::vector<CalendarDate> froms;
+	CSyntheticContacts random(50);
+	for(int i = 0; i < queryCount; i++) {
+		uint16_t year = (uint16_t)(2023 + random.Next(4));
+		uint8_t month = (uint8_t)(1 + random.Next(12));
+		froms.push_back(CalendarDate(year, month, (uint8_t)(1 + random.Next(CDateIndex::GetMonthDays(month, year)))));
+	}
+
+	CLatencyHistogram latency;
+	std::vector<UpcomingEvent> events;
+	size_t found = 0;
+	context.ResumeTiming();
+	for(int i = 0; i < queryCount; i++) {
+		uint64_t queryNs = GetTimeNs();
+		dates.GetUpcoming(froms[i], 30, events);
+		latency.Record(GetTimeNs() - queryNs);
+		found += events.size();
+	}
+	context.PauseTiming();
+	context.SetItems(queryCount);
+
+	startNs = GetTimeNs();
+	for(int i = 0; i < queryCount; i++)
+		dates.GetUpcoming(froms[i], 30, events, DateKindCount, 50);
+	context.SetCounter("first50_ns", (double)(GetTimeNs() - startNs) / queryCount);
+
+	startNs = GetTimeNs();
+	size_t counted = 0;
+	for(int i = 0; i < queryCount; i++)
+		counted += dates.CountUpcoming(froms[i], 30);
+	context.SetCounter("count_ns", (double)(GetTimeNs() - startNs) / queryCount);
+
+	// each edit moves a birthday and puts it back, leaving the store as it was
+	const int edits = 20000;
+	uint32_t rowCount = (uint32_t)store.GetRowCount();
+	ContactRecord record;
+	std::wstring birthday;
+	int puts = 0;
+	startNs = GetTimeNs();
+	for(int i = 0; i < edits; i++) {
+		if(!store.GetRecord(random.Next(rowCount), record))
+			continue;
+		birthday = record.fields[FieldBirthday];
+		record.fields[FieldBirthday] = i % 2 == 0 ? L"1990-12-30" : L"--01-02";
+		store.Put(record);
+		record.fields[FieldBirthday] = birthday;
+		store.Put(record);
+		puts += 2;
+	}
+	context.SetCounter("edit_ns", puts > 0 ? (double)(GetTimeNs() - startNs) / puts : 0.0);
+
+	CGroupModel groups(store, FieldCompany);
+	CUpcomingGroup upcoming(dates, groups, 0);
+	const int updates = 1000;
+	startNs = GetTimeNs();
+	for(int i = 0; i < updates; i++)
+		upcoming.Update(froms[i]);
+	context.SetCounter("group_update_us", (double)(GetTimeNs() - startNs) / 1e3 / updates);
+	context.SetCounter("group_rows", groups.GetGroupCount() > 0 && groups.IsPinned(0) ? groups.GetGroupSize(0) : 0);
+
+	std::vector<uint64_t> counts;
+	LatencySnapshot snapshot;
+	latency.Snapshot(counts, snapshot, false);
+	context.SetCounter("query_p50_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.5));
+	context.SetCounter("query_p99_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.99));
+	context.SetCounter("events_per_query", (double)found / queryCount);
+	context.SetCounter("count_matches", counted == found ? 1 : 0);
+	context.SetCounter("index_bytes_per_row", (double)dates.GetMemoryUsage() / rowCount);
+}
+
+// Frames of the headless list host over 1M contacts grouped by family
+// name: frame latency, pool allocations and how often the header of a row
+// existed already. Every case starts with a fresh list, no headers made.
+enum ListHostScenario
+{
+	ListHostScroll,
+	ListHostJump,
+	ListHostResize
+};
+
+inline void BenchListHost(CBenchmarkContext& context, ListHostScenario scenario)
+{
+	context.PauseTiming();
+	CDisplayStringPool* pStrings = NULL;
+	CGroupModel& groups = CBenchmarkData::GetListModels(context.Scale(1000000), pStrings);
+	CHeadlessListHost host(groups, *pStrings, DisplayLastFirst);
+	const uint32_t frames = 5000;
+	uint64_t allocations = pStrings->GetArena().GetAllocationCount();
+	context.ResumeTiming();
+	switch(scenario) {
+	case ListHostScroll:
+		host.Scroll(frames, 3);
+		break;
+	case ListHostJump:
+		host.Jump(frames);
+		break;
+	case ListHostResize:
+		host.Resize(frames);
+		break;
+	}
+	context.PauseTiming();
+	context.SetItems(frames);
+
+	std::vector<uint64_t> counts;
+	LatencySnapshot snapshot;
+	host.GetFrames().Snapshot(counts, snapshot, true);
+	const ListDataStats& stats = host.GetSource().GetStats();
+	context.SetCounter("frame_p50_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.5));
+	context.SetCounter("frame_p99_ns", (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, 0.99));
+	context.SetCounter("frame_max_ns", (double)snapshot.maxNs);
+	context.SetCounter("allocations_per_frame", (double)(pStrings->GetArena().GetAllocationCount() - allocations) / frames);
+	context.SetCounter("header_hit_ratio", stats.groupLookups ? (double)stats.groupHeaderHits / stats.groupLookups : 0.0);
+	context.SetCounter("text_hit_ratio", stats.textFetches ? (double)stats.textHits / stats.textFetches : 0.0);
+	context.SetCounter("headers", (double)host.GetHeaderCount());
+	context.SetCounter("errors", host.GetErrors());
+}
+
+inline void BenchListHostScroll(CBenchmarkContext& context)
+{
+	BenchListHost(context, ListHostScroll);
+}
+
+inline void BenchListHostJump(CBenchmarkContext& context)
+{
+	BenchListHost(context, ListHostJump);
+}
+
+inline void BenchListHostResize(CBenchmarkContext& context)
+{
+	BenchListHost(context, ListHostResize);
+}
+
+// Records the list host scrolling, jumping and resizing plus a few search
+// edits, then replays the trace at full speed into a fresh list.
+inline void BenchTraceReplay(CBenchmarkContext& context)
+{
+	context.PauseTiming();
+	CDisplayStringPool* pStrings = NULL;
+	CGroupModel& groups = CBenchmarkData::GetListModels(context.Scale(1000000), pStrings);
+	CListTraceRecorder trace;
+	{
+		CHeadlessListHost host(groups, *pStrings, DisplayLastFirst);
+		host.GetSource().SetTraceRecorder(&trace);
+		host.Scroll(1000, 3);
+		host.Jump(1000);
+		host.Resize(1000);
+		trace.SearchEdit(L"an");
+		trace.SearchEdit(L"ann");
+	}
+	CHeadlessListHost host(groups, *pStrings, DisplayLastFirst);
+	CListTraceReplayer replayer(host.GetSource());
+	replayer.SetSearch(&CBenchmarkData::GetStore(context.Scale(1000000)), FieldName, &CBenchmarkData::GetCollator());
+	context.ResumeTiming();
+	bool bOk = replayer.Replay(trace.GetData(), false);
+	context.PauseTiming();
+	context.SetItems(replayer.GetEventCount());
+	context.SetCounter("ok", bOk ? 1 : 0);
+	context.SetCounter("trace_bytes_per_event", (double)trace.GetData().size() / trace.GetEventCount());
+
+	static const char* const s_counters[TraceEventEnd - 1] =
+	{
+		"cachehint_p99_ns", "itemgroup_p99_ns", "itemingroup_p99_ns", "dispinfo_p99_ns", "finditem_p99_ns",
+		"searchedit_p50_ns"
+	};
+	std::vector<uint64_t> counts;
+	LatencySnapshot snapshot;
+	for(int kind = TraceCacheHint; kind < TraceEventEnd; kind++) {
+		replayer.GetLatency((ListTraceEvent)kind).Snapshot(counts, snapshot, false);
+		if(snapshot.count == 0)
+			continue;
+		double q = kind == TraceSearchEdit ? 0.5 : 0.99;
+		context.SetCounter(s_counters[kind - 1], (double)CLatencyHistogram::GetQuantile(counts, snapshot.count, q));
+	}
+}
+
+// "/replay <trace file> [realtime]": replays a recorded trace against the
+// benchmark address book, grouped by family name; latency lines to output
+inline bool RunTraceReplay(const std::string& arguments, std::string& output)
+{
+	std::string path = arguments;
+	bool bRealTime = false;
+	size_t space = path.find(' ');
+	if(space != std::string::npos) {
+		bRealTime = path.compare(space + 1, std::string::npos, "realtime") == 0;
+		path.erase(space);
+	}
+	CDisplayStringPool* pStrings = NULL;
+	CGroupModel& groups = CBenchmarkData::GetListModels(1000000, pStrings);
+	CContactStore& store = CBenchmarkData::GetStore(1000000);
+	CHeadlessListHost host(groups, *pStrings, DisplayLastFirst);
+	CSortEngine engine(store);
+	CFindService find(engine);
+	CListTraceReplayer replayer(host.GetSource());
+	replayer.SetFindService(&find);
+	replayer.SetSearch(&store, FieldName, &CBenchmarkData::GetCollator());
+	bool bOk = replayer.ReplayFile(path, bRealTime);
+	replayer.Dump(output);
+	return bOk;
+}
+
+inline void RegisterBenchmarks(CBenchmarkRunner& runner)
+{
+	runner.Add("collation.keys.tertiary", BenchCollationKeysTertiary);
+	runner.Add("collation.keys.primary", BenchCollationKeysPrimary);
+	runner.Add("collation.column.1m", BenchCollationKeyColumn, 3);
+	runner.Add("sort.name.1m", BenchSortByName, 3);
+	runner.Add("sort.edit.1m", BenchSortEdits);
+	runner.Add("sort.initials.1m", BenchInitialGroups, 3);
+	runner.Add("find.prefix.1m", BenchFindPrefix, 3);
+	runner.Add("find.item.1m", BenchFindItem, 3);
+	runner.Add("selection.delete.1m", BenchSelectDelete, 3);
+	runner.Add("results.first.1m", BenchFirstResults);
+	runner.Add("groups.50k", BenchGroups);
+	runner.Add("strings.fetch.1m", BenchDisplayStrings);
+	runner.Add("store.fetch.1m", BenchStoreFetch);
+	runner.Add("snapshot.save.1m", BenchSnapshotSave, 3);
+	runner.Add("snapshot.load.1m", BenchSnapshotLoad, 3);
+	runner.Add("db.durable.10k", BenchDatabaseDurable, 3);
+	runner.Add("sync.encode.1m", BenchSyncEncode, 3);
+	runner.Add("sync.apply.1m", BenchSyncApply, 3);
+	runner.Add("sync.transport.rtt0", BenchSyncTransportRtt0, 3);
+	runner.Add("sync.transport.rtt5", BenchSyncTransportRtt5, 3);
+	runner.Add("sync.transport.rtt20", BenchSyncTransportRtt20, 3);
+	runner.Add("sync.transport.rtt5.drop", BenchSyncTransportDrops, 3);
+	runner.Add("sync.transport.rtt5.busy", BenchSyncTransportBusy, 3);
+	runner.Add("latency.record", BenchLatencyRecord);
+	runner.Add("trace.scope", BenchEventTrace);
+	runner.Add("listhost.scroll.1m", BenchListHostScroll);
+	runner.Add("listhost.jump.1m", BenchListHostJump);
+	runner.Add("listhost.resize.1m", BenchListHostResize);
+	runner.Add("trace.replay.1m", BenchTraceReplay);
+	runner.Add("fuzzy.search.1m", BenchFuzzySearch);
+	runner.Add("search.scoped.1m", BenchScopedSearch);
+	runner.Add("search.ranked.1m", BenchRankedSearch);
+	runner.Add("search.cache.1m", BenchSearchCache);
+	runner.Add("search.translit.1m", BenchTranslitSearch);
+	runner.Add("search.phonetic.1m", BenchPhoneticSearch);
+	runner.Add("search.complete.1m", BenchAutoComplete);
+	runner.Add("groups.frequent.1m", BenchFrequentContacts);
+	runner.Add("groups.upcoming.1m", BenchUpcomingDates);
+}
+
+// "[name prefix] [scale=percent] [baseline=file] [threshold=percent]"
+struct BenchmarkArguments
+{
+	std::string filter;
+	uint32_t scale;
+	std::string baseline;
+	double thresholdPercent;
+
+	explicit BenchmarkArguments(const std::string& arguments) :
+		scale(100), thresholdPercent(CBenchmarkBaseline::DefaultThresholdPercent)
+	{
+		size_t pos = 0;
+		while(pos < arguments.size()) {
+			size_t end = arguments.find(' ', pos);
+			if(end == std::string::npos)
+				end = arguments.size();
+			std::string word = arguments.substr(pos, end - pos);
+			if(word.compare(0, 6, "scale=") == 0)
+				scale = (uint32_t)atoi(word.c_str() + 6);
+			else if(word.compare(0, 9, "baseline=") == 0)
+				baseline = word.substr(9);
+			else if(word.compare(0, 10, "threshold=") == 0)
+				thresholdPercent = atof(word.c_str() + 10);
+			else if(!word.empty())
+				filter = word;
+			pos = end + 1;
+		}
+	}
+};
+
+// One JSON line per case into output; results are also appended to
+// pResults when given.
+inline size_t RunBenchmarkSuite(const std::string& arguments, std::string& output,
+	std::vector<BenchmarkResult>* pResults = NULL)
+{
+	BenchmarkArguments options(arguments);
+	CBenchmarkRunner runner;
+	runner.SetScale(options.scale);
+	RegisterBenchmarks(runner);
+	std::vector<BenchmarkResult> results;
+	runner.Run(options.filter, results);
+
+	std::string line;
+	for(size_t i = 0; i < results.size(); i++) {
+		CBenchmarkRunner::FormatJson(results[i], line);
+		output += line;
+		output += '\n';
+	}
+	if(pResults != NULL)
+		pResults->insert(pResults->end(), results.begin(), results.end());
+	return results.size();
+}
+
+// The suite as a regression gate: runs it as RunBenchmarkSuite() does and
+// compares the results with the "baseline=" file, one verdict line per
+// case into report. Returns the regressed cases, -1 without a readable
+// baseline.
+inline int RunBenchmarkGate(const std::string& arguments, std::string& output, std::string& report)
+{
+	BenchmarkArguments options(arguments);
+	CBenchmarkBaseline baseline;
+	if(options.baseline.empty() || !baseline.LoadFile(options.baseline))
+		return -1;
+	std::vector<BenchmarkResult> results;
+	RunBenchmarkSuite(arguments, output, &results);
+
+	std::vector<BenchmarkComparison> comparisons;
+	size_t regressed = baseline.Compare(results, options.thresholdPercent, comparisons);
+	std::string line;
+	for(size_t i = 0; i < comparisons.size(); i++) {
+		CBenchmarkBaseline::FormatJson(comparisons[i], line);
+		report += line;
+		report += '\n';
+	}
+	return (int)regressed;
+}
+
+}; // namespace Synrc
@@ -0,0 +1,264 @@
+// BinaryStream.h
+//
+//  Little-endian encoding helpers for everything the native engine writes
+//  to disk: the write-ahead log, contact snapshots and traces. Strings are
+//  always stored as UTF-16LE with a length prefix, whatever the size of
+//  wchar_t on the platform that wrote them.
+
+#pragma once
+
+#include <string.h>
+#include <string>
+
+#include "Platform.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CByteWriter - appends encoded values to a std::string buffer
+// CByteReader - decodes values from a memory range, remembering any overrun
+
+namespace Synrc
+{
+
+// CRC-32 (IEEE 802.3), chainable: Crc32(b, nb, Crc32(a, na)) == Crc32(a + b)
+inline uint32_t Crc32(const void* pData, size_t cb, uint32_t crc = 0)
+{
+	static uint32_t s_table[256];
+	static volatile int32_t s_ready = 0;
+	if(!AtomicLoad(&s_ready)) {
+		for(uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for(int k = 0; k < 8; k++)
+				c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			s_table[i] = c;
+		}
+		AtomicStore(&s_ready, 1);
+	}
+	const unsigned char* p = static_cast<const unsigned char*>(pData);
+	crc = ~crc;
+	for(size_t i = 0; i < cb; i++)
+		crc = s_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+class CByteWriter
+{
+public:
+	explicit CByteWriter(std::string& buffer) : m_buffer(buffer)
+	{
+	}
+
+	void PutU8(uint8_t v)
+	{
+		m_buffer.push_back((char)v);
+	}
+
+	void PutU16(uint16_t v)
+	{
+		char b[2] = { (char)v, (char)(v >> 8) };
+		m_buffer.append(b, 2);
+	}
+
+	void PutU32(uint32_t v)
+	{
+		char b[4] = { (char)v, (char)(v >> 8), (char)(v >> 16), (char)(v >> 24) };
+		m_buffer.append(b, 4);
+	}
+
+	void PutU64(uint64_t v)
+	{
+		PutU32((uint32_t)v);
+		PutU32((uint32_t)(v >> 32));
+	}
+
+	// LEB128, 1 byte for values below 128
+	void PutVarU64(uint64_t v)
+	{
+		while(v >= 0x80) {
+			m_buffer.push_back((char)(v | 0x80));
+			v >>= 7;
+		}
+		m_buffer.push_back((char)v);
+	}
+
+	void PutBytes(const void* p, size_t cb)
+	{
+		m_buffer.append(static_cast<const char*>(p), cb);
+	}
+
+	// varint length in UTF-16 units, then UTF-16LE code units
+	void PutWString(const std::wstring& s)
+	{
+		PutWString(s.data(), s.size());
+	}
+
+	void PutWString(const wchar_t* p, size_t cch)
+	{
+#ifdef _WIN32
+		PutVarU64(cch);
+		for(size_t i = 0; i < cch; i++)
+			PutU16((uint16_t)p[i]);
+#else
+		size_t units = 0;
+		for(size_t i = 0; i < cch; i++)
+			units += (uint32_t)p[i] > 0xFFFF ? 2 : 1;
+		PutVarU64(units);
+		for(size_t i = 0; i < cch; i++) {
+			uint32_t c = (uint32_t)p[i];
+			if(c > 0xFFFF) {
+				c -= 0x10000;
+				PutU16((uint16_t)(0xD800 + (c >> 10)));
+				PutU16((uint16_t)(0xDC00 + (c & 0x3FF)));
+			}
+			else
+				PutU16((uint16_t)c);
+		}
+#endif
+	}
+
+	size_t GetSize() const
+	{
+		return m_buffer.size();
+	}
+
+private:
+	std::string& m_buffer;
+
+	CByteWriter& operator=(const CByteWriter&);
+};
+
+class CByteReader
+{
+public:
+	CByteReader(const void* p, size_t cb) :
+		m_p(static_cast<const unsigned char*>(p)), m_pEnd(static_cast<const unsigned char*>(p) + cb), m_bOk(true)
+	{
+	}
+
+	explicit CByteReader(const std::string& s) :
+		m_p(reinterpret_cast<const unsigned char*>(s.data())), m_pEnd(reinterpret_cast<const unsigned char*>(s.data()) + s.size()), m_bOk(true)
+	{
+	}
+
+	// false once any read ran past the end; the values read after that are zero
+	bool IsOk() const
+	{
+		return m_bOk;
+	}
+
+	size_t GetRemaining() const
+	{
+		return m_pEnd - m_p;
+	}
+
+	const unsigned char* GetPosition() const
+	{
+		return m_p;
+	}
+
+	uint8_t GetU8()
+	{
+		if(!Need(1))
+			return 0;
+		return *m_p++;
+	}
+
+	uint16_t GetU16()
+	{
+		if(!Need(2))
+			return 0;
+		uint16_t v = (uint16_t)(m_p[0] | (m_p[1] << 8));
+		m_p += 2;
+		return v;
+	}
+
+	uint32_t GetU32()
+	{
+		if(!Need(4))
+			return 0;
+		uint32_t v = m_p[0] | (m_p[1] << 8) | (m_p[2] << 16) | ((uint32_t)m_p[3] << 24);
+		m_p += 4;
+		return v;
+	}
+
+	uint64_t GetU64()
+	{
+		uint64_t lo = GetU32();
+		return lo | ((uint64_t)GetU32() << 32);
+	}
+
+	uint64_t GetVarU64()
+	{
+		uint64_t v = 0;
+		for(int shift = 0; shift < 64; shift += 7) {
+			if(!Need(1))
+				return 0;
+			unsigned char b = *m_p++;
+			v |= (uint64_t)(b & 0x7F) << shift;
+			if((b & 0x80) == 0)
+				return v;
+		}
+		m_bOk = false;
+		return 0;
+	}
+
+	bool GetBytes(void* p, size_t cb)
+	{
+		if(!Need(cb))
+			return false;
+		memcpy(p, m_p, cb);
+		m_p += cb;
+		return true;
+	}
+
+	bool Skip(size_t cb)
+	{
+		if(!Need(cb))
+			return false;
+		m_p += cb;
+		return true;
+	}
+
+	bool GetWString(std::wstring& s)
+	{
+		uint64_t units = GetVarU64();
+		if(!m_bOk || !Need(units * 2))
+			return false;
+		s.clear();
+		s.reserve((size_t)units);
+		for(uint64_t i = 0; i < units; i++) {
+			uint32_t c = m_p[0] | (m_p[1] << 8);
+			m_p += 2;
+#ifndef _WIN32
+			if(c >= 0xD800 && c < 0xDC00 && i + 1 < units) {
+				uint32_t low = m_p[0] | (m_p[1] << 8);
+				if(low >= 0xDC00 && low < 0xE000) {
+					m_p += 2;
+					i++;
+					c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+				}
+			}
+#endif
+			s.push_back((wchar_t)c);
+		}
+		return true;
+	}
+
+private:
+	const unsigned char* m_p;
+	const unsigned char* m_pEnd;
+	bool m_bOk;
+
+	bool Need(uint64_t cb)
+	{
+		if(!m_bOk || (uint64_t)(m_pEnd - m_p) < cb) {
+			m_bOk = false;
+			return false;
+		}
+		return true;
+	}
+};
+
+}; // namespace Synrc
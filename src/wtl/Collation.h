@@ -0,0 +1,459 @@
+// Collation.h
+//
+//  Binary collation keys for names. A key orders by memcmp the way a person
+//  expects an address book to be ordered: case and diacritics only break
+//  ties, Latin and Cyrillic names each follow their alphabet, and the
+//  locale decides which script comes first and how a few letters sort.
+//
+//  Key layout:
+//      primary weights, one byte per letter (two for expansions such as
+//      "ss" for sharp s), never 0x00
+//      [0x00, one case/accent byte per letter]   tertiary strength only,
+//      trailing plain lowercase bytes trimmed
+//  A primary-strength key of a prefix is a byte prefix of the primary part
+//  of every key that starts with it, which makes type-ahead a binary search.
+//  Characters outside the tables sort after all letters by code unit.
+
+#pragma once
+
+#include <string.h>
+#include <string>
+
+#include "Platform.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// ISortKeyBuilder - turns display text into a key ordered by memcmp
+// COrdinalKeyBuilder - UTF-16 code unit order, what wcscmp gives on Windows
+// CCollator - locale-tailored collation keys and initials
+
+namespace Synrc
+{
+
+class ISortKeyBuilder
+{
+public:
+	virtual ~ISortKeyBuilder()
+	{
+	}
+
+	// Appends the key of the text to key. Called from several threads at once.
+	virtual void AppendKey(const wchar_t* pText, size_t cch, std::string& key) const = 0;
+};
+
+class COrdinalKeyBuilder : public ISortKeyBuilder
+{
+public:
+	virtual void AppendKey(const wchar_t* pText, size_t cch, std::string& key) const
+	{
+		for(size_t i = 0; i < cch; i++) {
+			uint32_t c = (uint32_t)pText[i];
+			if(c > 0xFFFF) {
+				c -= 0x10000;
+				PutUnit(0xD800 + (c >> 10), key);
+				c = 0xDC00 + (c & 0x3FF);
+			}
+			PutUnit(c, key);
+		}
+	}
+
+private:
+	static void PutUnit(uint32_t unit, std::string& key)
+	{
+		key.push_back((char)(unit >> 8));
+		key.push_back((char)unit);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CCollator - locale-tailored collation keys and initials
+
+enum CollationLocale
+{
+	CollationRoot = 0,      // Latin before Cyrillic, diacritics ignored
+	CollationRussian,       // Cyrillic first, ukrainian letters fold into russian ones
+	CollationUkrainian,     // Cyrillic first, ghe with upturn, ye, i and yi are letters
+	CollationGerman,        // phonebook order: umlauts expand to ae, oe, ue
+	CollationSwedish,       // a-ring, a-umlaut, o-umlaut are letters after z
+	CollationLocaleCount
+};
+
+enum CollationStrength
+{
+	CollationPrimary = 0,   // letters only: "Eve" == "eve" == "Eve"
+	CollationTertiary       // then accents, then case
+};
+
+class CCollator : public ISortKeyBuilder
+{
+public:
+	enum
+	{
+		WeightSeparator = 0x01, // runs of blanks, hyphens and similar between words
+		WeightDigit = 0x02,     // 0x02..0x0B
+		WeightLetter = 0x10,    // first letter of the first script
+		WeightOther = 0xF0,     // followed by OtherBytes of the code unit
+		OtherBytes = 3,         // base 255 digits, most significant first, each plus one
+		TableSize = 0x0500
+	};
+
+	explicit CCollator(CollationLocale locale = CollationRoot, CollationStrength strength = CollationTertiary) :
+		m_locale(locale), m_strength(strength)
+	{
+		BuildTables();
+	}
+
+	CollationLocale GetLocale() const
+	{
+		return m_locale;
+	}
+
+	CollationStrength GetStrength() const
+	{
+		return m_strength;
+	}
+
+	virtual void AppendKey(const wchar_t* pText, size_t cch, std::string& key) const
+	{
+		Append(pText, cch, key, m_strength);
+	}
+
+	// key without the tertiary part, for prefix searches and grouping
+	void AppendPrimaryKey(const wchar_t* pText, size_t cch, std::string& key) const
+	{
+		Append(pText, cch, key, CollationPrimary);
+	}
+
+	std::string GetKey(const std::wstring& text) const
+	{
+		std::string key;
+		AppendKey(text.data(), text.size(), key);
+		return key;
+	}
+
+	// -1, 0, 1 like wcscmp, through the keys
+	int Compare(const std::wstring& a, const std::wstring& b) const
+	{
+		std::string keyA = GetKey(a), keyB = GetKey(b);
+		int result = memcmp(keyA.data(), keyB.data(), keyA.size() < keyB.size() ? keyA.size() : keyB.size());
+		if(result != 0)
+			return result < 0 ? -1 : 1;
+		return keyA.size() < keyB.size() ? -1 : keyA.size() > keyB.size() ? 1 : 0;
+	}
+
+	// First primary weight of the text, 0 for text without letters or digits.
+	// Groups by initial are ordered by this value.
+	uint32_t GetInitialWeight(const wchar_t* pText, size_t cch) const
+	{
+		for(size_t i = 0; i < cch; i++) {
+			uint32_t c = (uint32_t)pText[i];
+			if(c >= TableSize || IsUnmapped(m_table[c]))
+				return WeightOther;
+			if(m_table[c].primary[0] != 0)
+				return m_table[c].primary[0];
+		}
+		return 0;
+	}
+
+	// Upper case letter a group by initial is labelled with: the base letter
+	// for accented ones, '#' for digits, 0 when there is none.
+	wchar_t GetInitial(const wchar_t* pText, size_t cch) const
+	{
+		for(size_t i = 0; i < cch; i++) {
+			uint32_t c = (uint32_t)pText[i];
+			if(c >= TableSize || IsUnmapped(m_table[c]))
+				return pText[i];
+			if(m_table[c].primary[0] != 0)
+				return m_initials[m_table[c].primary[0]];
+		}
+		return 0;
+	}
+
+	wchar_t GetInitialForWeight(uint32_t weight) const
+	{
+		return weight < 256 ? m_initials[weight] : 0;
+	}
+
+private:
+	enum
+	{
+		FlagUpper = 0x01,
+		FlagAccent = 0x02,
+		FlagIgnorable = 0x04,   // combining marks and punctuation inside words
+		FlagSeparator = 0x08,
+		MaxTertiary = 128       // letters past this only differ at primary strength
+	};
+
+	struct Entry
+	{
+		uint8_t primary[2];     // 0 = unused slot
+		uint8_t flags;
+	};
+
+	CollationLocale m_locale;
+	CollationStrength m_strength;
+	Entry m_table[TableSize];
+	wchar_t m_initials[256];
+
+	static bool IsUnmapped(const Entry& entry)
+	{
+		return entry.primary[0] == 0 && (entry.flags & (FlagIgnorable | FlagSeparator)) == 0;
+	}
+
+	void Append(const wchar_t* pText, size_t cch, std::string& key, CollationStrength strength) const
+	{
+		size_t start = key.size();
+		uint8_t levels[MaxTertiary];
+		size_t letters = 0;
+		bool bSeparator = false;
+
+		for(size_t i = 0; i < cch; i++) {
+			uint32_t c = (uint32_t)pText[i];
+			const Entry* pEntry = c < TableSize ? &m_table[c] : NULL;
+			if(pEntry && (pEntry->flags & FlagIgnorable)) {
+				// a combining accent belongs to the letter before it
+				if(c >= 0x0300 && c < 0x0370 && letters > 0 && letters <= MaxTertiary)
+					levels[letters - 1] |= FlagAccent;
+				continue;
+			}
+			if(pEntry && (pEntry->flags & FlagSeparator)) {
+				bSeparator = key.size() > start;
+				continue;
+			}
+			if(bSeparator) {
+				key.push_back((char)WeightSeparator);
+				bSeparator = false;
+			}
+
+			uint8_t flags = 0;
+			if(pEntry && pEntry->primary[0]) {
+				key.push_back((char)pEntry->primary[0]);
+				if(pEntry->primary[1])
+					key.push_back((char)pEntry->primary[1]);
+				flags = pEntry->flags;
+			}
+			else {
+				// in code unit order and never 0x00, which ends the primary part
+				key.push_back((char)WeightOther);
+				key.push_back((char)(c / (255 * 255) + 1));
+				key.push_back((char)(c / 255 % 255 + 1));
+				key.push_back((char)(c % 255 + 1));
+			}
+			if(letters < MaxTertiary)
+				levels[letters] = (uint8_t)(flags & (FlagUpper | FlagAccent));
+			letters++;
+		}
+
+		if(strength != CollationTertiary)
+			return;
+		size_t used = letters < MaxTertiary ? letters : (size_t)MaxTertiary;
+		while(used > 0 && levels[used - 1] == 0)
+			used--;
+		if(used > 0) {
+			key.push_back('\0');
+			for(size_t i = 0; i < used; i++)
+				key.push_back((char)(levels[i] + 1));
+		}
+	}
+
+	void Set(uint32_t c, uint8_t primary, uint8_t flags, uint8_t second = 0)
+	{
+		m_table[c].primary[0] = primary;
+		m_table[c].primary[1] = second;
+		m_table[c].flags = flags;
+	}
+
+	// Latin letters from the base letter table, upper case flagged
+	void SetLatin(uint32_t c, char base, uint8_t flags, const uint8_t* pLatin)
+	{
+		if(base >= 'A' && base <= 'Z') {
+			flags |= FlagUpper;
+			base = (char)(base - 'A' + 'a');
+		}
+		if(base >= 'a' && base <= 'z')
+			Set(c, pLatin[base - 'a'], flags);
+	}
+
+	void SetExpansion(uint32_t c, const char* pPair, uint8_t flags, const uint8_t* pLatin)
+	{
+		Set(c, pLatin[pPair[0] - 'a'], flags, pLatin[pPair[1] - 'a']);
+	}
+
+	void BuildTables()
+	{
+		memset(m_table, 0, sizeof(m_table));
+		memset(m_initials, 0, sizeof(m_initials));
+
+		// unified cyrillic alphabet: russian order with the ukrainian,
+		// belarusian and south slavic letters next to their neighbours
+		static const uint16_t s_cyrillic[] =
+		{
+			0x0430, 0x0431, 0x0432, 0x0433, 0x0491, 0x0434, 0x0452, 0x0453, 0x0435, 0x0454,
+			0x0436, 0x0437, 0x0455, 0x0438, 0x0456, 0x0457, 0x0439, 0x0458, 0x043A, 0x045C,
+			0x043B, 0x0459, 0x043C, 0x043D, 0x045A, 0x043E, 0x043F, 0x0440, 0x0441, 0x0442,
+			0x045B, 0x0443, 0x045E, 0x0444, 0x0445, 0x0446, 0x0447, 0x045F, 0x0448, 0x0449,
+			0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F
+		};
+		const size_t cyrillicCount = sizeof(s_cyrillic) / sizeof(s_cyrillic[0]);
+		const size_t latinCount = m_locale == CollationSwedish ? 29 : 26;
+
+		uint8_t latinBase = WeightLetter;
+		uint8_t cyrillicBase = (uint8_t)(WeightLetter + latinCount);
+		if(m_locale == CollationRussian || m_locale == CollationUkrainian) {
+			cyrillicBase = WeightLetter;
+			latinBase = (uint8_t)(WeightLetter + cyrillicCount);
+		}
+		uint8_t greekBase = (uint8_t)(WeightLetter + latinCount + cyrillicCount);
+
+		uint8_t latin[26];
+		for(int i = 0; i < 26; i++) {
+			latin[i] = (uint8_t)(latinBase + i);
+			m_initials[latin[i]] = (wchar_t)('A' + i);
+		}
+
+		// separators and ignorables in the ASCII and Latin-1 range
+		for(uint32_t c = 0; c < 0x00C0; c++)
+			Set(c, 0, FlagIgnorable);
+		static const char s_separators[] = " \t\r\n-_/\\,;.:&+|";
+		for(const char* p = s_separators; *p; p++)
+			Set((unsigned char)*p, 0, FlagSeparator);
+		Set(0x00A0, 0, FlagSeparator);
+		Set(0x02BC, 0, FlagIgnorable);         // modifier apostrophe, as in ukrainian names
+		for(uint32_t d = 0; d < 10; d++) {
+			Set('0' + d, (uint8_t)(WeightDigit + d), 0);
+			m_initials[WeightDigit + d] = L'#';
+		}
+		for(uint32_t c = 'a'; c <= 'z'; c++) {
+			SetLatin(c, (char)c, 0, latin);
+			SetLatin(c - 'a' + 'A', (char)(c - 'a' + 'A'), 0, latin);
+		}
+
+		// Latin-1 letters, U+00C0..U+00FF, '*' expands, '?' is not a letter
+		static const char s_latin1[] = "AAAAAA*CEEEEIIIIDNOOOOO?OUUUUY**aaaaaa*ceeeeiiiidnooooo?ouuuuy*y";
+		for(uint32_t i = 0; i < 64; i++) {
+			uint32_t c = 0x00C0 + i;
+			char base = s_latin1[i];
+			if(base == '?')
+				Set(c, 0, FlagIgnorable);
+			else if(base != '*')
+				SetLatin(c, base, FlagAccent, latin);
+		}
+		SetExpansion(0x00C6, "ae", FlagUpper | FlagAccent, latin);
+		SetExpansion(0x00E6, "ae", FlagAccent, latin);
+		SetExpansion(0x00DE, "th", FlagUpper | FlagAccent, latin);
+		SetExpansion(0x00FE, "th", FlagAccent, latin);
+		SetExpansion(0x00DF, "ss", FlagAccent, latin);
+
+		// Latin Extended-A, U+0100..U+017F
+		static const char s_latinA[] =
+			"AaAaAaCcCcCcCcDdDdEeEeEeEeEeGgGgGgGgHhHhIiIiIiIi"
+			"Ii**JjKkkLlLlLlLlLlNnNnNnnNnOoOoOo**RrRrRrSsSsSs"
+			"SsTtTtTtUuUuUuUuUuUuWwYyYZzZzZzs";
+		for(uint32_t i = 0; i < 128; i++) {
+			char base = s_latinA[i];
+			if(base != '*')
+				SetLatin(0x0100 + i, base, FlagAccent, latin);
+		}
+		SetExpansion(0x0132, "ij", FlagUpper | FlagAccent, latin);
+		SetExpansion(0x0133, "ij", FlagAccent, latin);
+		SetExpansion(0x0152, "oe", FlagUpper | FlagAccent, latin);
+		SetExpansion(0x0153, "oe", FlagAccent, latin);
+
+		// combining diacritical marks
+		for(uint32_t c = 0x0300; c < 0x0370; c++)
+			Set(c, 0, FlagIgnorable);
+
+		// Greek, final sigma as sigma, tonos and dialytika as accents
+		uint8_t greek[25];
+		uint8_t nextGreek = greekBase;
+		for(uint32_t i = 0; i < 25; i++)
+			greek[i] = 0x03B1 + i == 0x03C2 ? 0 : nextGreek++;
+		greek[0x03C2 - 0x03B1] = greek[0x03C3 - 0x03B1];
+		for(uint32_t i = 0; i < 25; i++) {
+			Set(0x03B1 + i, greek[i], 0);
+			if(0x0391 + i != 0x03A2)
+				Set(0x0391 + i, greek[i], FlagUpper);
+			if(0x03B1 + i != 0x03C2)
+				m_initials[greek[i]] = (wchar_t)(0x0391 + i);
+		}
+		static const uint16_t s_greekAccented[][2] =
+		{
+			{ 0x0386, 0x03B1 }, { 0x0388, 0x03B5 }, { 0x0389, 0x03B7 }, { 0x038A, 0x03B9 },
+			{ 0x038C, 0x03BF }, { 0x038E, 0x03C5 }, { 0x038F, 0x03C9 }, { 0x03AA, 0x03B9 },
+			{ 0x03AB, 0x03C5 }, { 0x03AC, 0x03B1 }, { 0x03AD, 0x03B5 }, { 0x03AE, 0x03B7 },
+			{ 0x03AF, 0x03B9 }, { 0x03CA, 0x03B9 }, { 0x03CB, 0x03C5 }, { 0x03CC, 0x03BF },
+			{ 0x03CD, 0x03C5 }, { 0x03CE, 0x03C9 }, { 0x0390, 0x03B9 }, { 0x03B0, 0x03C5 }
+		};
+		for(size_t i = 0; i < sizeof(s_greekAccented) / sizeof(s_greekAccented[0]); i++) {
+			uint32_t c = s_greekAccented[i][0];
+			bool bUpper = c < 0x03AC && c != 0x0390;
+			Set(c, greek[s_greekAccented[i][1] - 0x03B1], (uint8_t)(FlagAccent | (bUpper ? FlagUpper : 0)));
+		}
+
+		// Cyrillic: the lower case letters of the alphabet, then their capitals
+		for(size_t i = 0; i < cyrillicCount; i++) {
+			uint32_t lower = s_cyrillic[i];
+			uint32_t upper = lower >= 0x0450 && lower < 0x0460 ? lower - 0x50 : lower == 0x0491 ? 0x0490 : lower - 0x20;
+			uint8_t weight = (uint8_t)(cyrillicBase + i);
+			Set(lower, weight, 0);
+			Set(upper, weight, FlagUpper);
+			m_initials[weight] = (wchar_t)upper;
+		}
+		// io and the grave variants sort as plain letters with an accent
+		Set(0x0451, m_table[0x0435].primary[0], FlagAccent);
+		Set(0x0401, m_table[0x0435].primary[0], FlagAccent | FlagUpper);
+		Set(0x0450, m_table[0x0435].primary[0], FlagAccent);
+		Set(0x0400, m_table[0x0435].primary[0], FlagAccent | FlagUpper);
+		Set(0x045D, m_table[0x0438].primary[0], FlagAccent);
+		Set(0x040D, m_table[0x0438].primary[0], FlagAccent | FlagUpper);
+		if(m_locale == CollationRussian) {
+			// russian has no ghe with upturn, ye, i or yi: they fold into the
+			// russian letters they are typed as
+			static const uint16_t s_folds[][3] =
+			{
+				{ 0x0491, 0x0490, 0x0433 }, { 0x0454, 0x0404, 0x0435 },
+				{ 0x0456, 0x0406, 0x0438 }, { 0x0457, 0x0407, 0x0438 }
+			};
+			for(int i = 0; i < 4; i++) {
+				uint8_t weight = m_table[s_folds[i][2]].primary[0];
+				Set(s_folds[i][0], weight, FlagAccent);
+				Set(s_folds[i][1], weight, FlagAccent | FlagUpper);
+			}
+		}
+
+		if(m_locale == CollationGerman) {
+			SetExpansion(0x00C4, "ae", FlagUpper | FlagAccent, latin);
+			SetExpansion(0x00E4, "ae", FlagAccent, latin);
+			SetExpansion(0x00D6, "oe", FlagUpper | FlagAccent, latin);
+			SetExpansion(0x00F6, "oe", FlagAccent, latin);
+			SetExpansion(0x00DC, "ue", FlagUpper | FlagAccent, latin);
+			SetExpansion(0x00FC, "ue", FlagAccent, latin);
+		}
+		else if(m_locale == CollationSwedish) {
+			// a-ring, a-umlaut (ae), o-umlaut (o-slash) follow z; u-umlaut is y
+			static const uint16_t s_swedish[][2] =
+			{
+				{ 0x00E5, 0x00C5 }, { 0x00E4, 0x00C4 }, { 0x00F6, 0x00D6 }
+			};
+			for(int i = 0; i < 3; i++) {
+				uint8_t weight = (uint8_t)(latinBase + 26 + i);
+				Set(s_swedish[i][0], weight, 0);
+				Set(s_swedish[i][1], weight, FlagUpper);
+				m_initials[weight] = (wchar_t)s_swedish[i][1];
+			}
+			Set(0x00E6, m_table[0x00E4].primary[0], FlagAccent);
+			Set(0x00C6, m_table[0x00E4].primary[0], FlagAccent | FlagUpper);
+			Set(0x00F8, m_table[0x00F6].primary[0], FlagAccent);
+			Set(0x00D8, m_table[0x00F6].primary[0], FlagAccent | FlagUpper);
+			Set(0x00FC, latin['y' - 'a'], FlagAccent);
+			Set(0x00DC, latin['y' - 'a'], FlagAccent | FlagUpper);
+		}
+	}
+
+	CCollator(const CCollator&);
+	CCollator& operator=(const CCollator&);
+};
+
+}; // namespace Synrc
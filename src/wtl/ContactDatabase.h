@@ -0,0 +1,366 @@
+// ContactDatabase.h
+//
+//  Durable home of the contact store. Edits are applied to the in-memory
+//  store right away and appended to a write-ahead log; an edit is saved
+//  once WaitDurable() returns for its LSN, and many edits share one fsync.
+//  A background checkpoint rotates the log, writes the whole store into a
+//  snapshot and deletes the logs the snapshot covers.
+//
+//  Layout of the database directory:
+//      contacts.snapshot   magic, version, last LSN, first log, contacts, crc
+//      contacts.wal.<n>    logs still to replay on top of the snapshot
+//
+//  Log records hold whole contacts, so replaying one that the snapshot
+//  already contains is harmless; recovery is snapshot + every log from the
+//  one the snapshot names.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "BinaryStream.h"
+#include "ContactStore.h"
+#include "EventTrace.h"
+#include "TaskPool.h"
+#include "WriteAheadLog.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CContactDatabase - contact store persisted as snapshot + write-ahead log
+
+namespace Synrc
+{
+
+struct ContactDatabaseOptions
+{
+	uint64_t checkpointBytes;       // log volume that triggers a background checkpoint, 0 = manual only
+
+	ContactDatabaseOptions() : checkpointBytes(32 * 1024 * 1024)
+	{
+	}
+};
+
+class CContactDatabase
+{
+public:
+	enum
+	{
+		RecordPut = 1,
+		RecordRemove = 2,
+		RecordRemoveMany = 3
+	};
+
+	enum
+	{
+		SnapshotMagic = 0x53435953,     // "SYCS"
+		SnapshotVersion = 2             // 1: no FieldBirthday, FieldAnniversary
+	};
+
+	CContactDatabase() :
+		m_checkpoints(CTaskPool::GetDefault()), m_lastSnapshotLsn(0), m_walSeq(0), m_walBytes(0),
+		m_bOpen(false), m_bCheckpointing(0), m_bCheckpointFailed(0)
+	{
+	}
+
+	~CContactDatabase()
+	{
+		Close();
+	}
+
+	// Loads the snapshot, replays the logs after it and opens the newest
+	// log for appending. The store observers see the recovered contacts.
+	bool Open(const std::string& dir, const ContactDatabaseOptions& options = ContactDatabaseOptions())
+	{
+		CTraceScope trace("db.open", "load");
+		if(m_bOpen || !CNativeFile::MakeDirectory(dir))
+			return false;
+		m_dir = dir;
+		m_options = options;
+		m_store.Clear();
+
+		uint64_t lastLsn = 0;
+		m_walSeq = 1;
+		if(CNativeFile::Exists(GetSnapshotPath()) && !LoadSnapshot(lastLsn, m_walSeq))
+			return false;
+		m_lastSnapshotLsn = (int64_t)lastLsn;
+
+		// a crash between snapshot and cleanup leaves covered logs behind
+		for(uint64_t seq = m_walSeq; seq-- > 1 && CNativeFile::Exists(GetLogPath(seq)); )
+			CNativeFile::Delete(GetLogPath(seq));
+
+		uint64_t seq = m_walSeq;
+		ReplayHandler handler(m_store);
+		for(; CNativeFile::Exists(GetLogPath(seq)); seq++) {
+			CTraceScope replay("db.replay", "load");
+			uint64_t logLsn = 0;
+			if(!CWriteAheadLog::Replay(GetLogPath(seq), (uint64_t)m_lastSnapshotLsn, handler, &logLsn))
+				return false;
+			if(logLsn > lastLsn)
+				lastLsn = logLsn;
+		}
+		if(seq > m_walSeq)
+			m_walSeq = seq - 1;
+		m_walBytes = 0;
+
+		if(!m_wal.Open(GetLogPath(m_walSeq), lastLsn))
+			return false;
+		m_bOpen = true;
+		return true;
+	}
+
+	// waits for a running checkpoint and makes every edit durable
+	void Close()
+	{
+		if(!m_bOpen)
+			return;
+		m_checkpoints.Wait();
+		m_wal.Close();
+		m_bOpen = false;
+	}
+
+	CContactStore& GetStore()
+	{
+		return m_store;
+	}
+
+	// Applies the edit and logs it; returns the LSN to wait on, 0 on failure.
+	uint64_t Put(const ContactRecord& record)
+	{
+		m_store.Put(record);
+		m_record.clear();
+		CContactStore::SerializeRecord(record, m_record);
+		return Log(RecordPut, m_record);
+	}
+
+	uint64_t Remove(const std::wstring& id)
+	{
+		if(!m_store.Remove(id))
+			return 0;
+		m_record.clear();
+		CByteWriter(m_record).PutWString(id);
+		return Log(RecordRemove, m_record);
+	}
+
+	// bulk delete of store rows, logged as one record of ids
+	uint64_t RemoveRows(const std::vector<uint32_t>& rows)
+	{
+		uint32_t count = 0;
+		for(size_t i = 0; i < rows.size(); i++) {
+			if(m_store.IsLive(rows[i]))
+				count++;
+		}
+		if(count == 0)
+			return 0;
+		m_record.clear();
+		CByteWriter writer(m_record);
+		writer.PutU32(count);
+		for(size_t i = 0; i < rows.size(); i++) {
+			if(m_store.IsLive(rows[i]))
+				writer.PutWString(m_store.GetId(rows[i]));
+		}
+		m_store.RemoveRows(rows);
+		return Log(RecordRemoveMany, m_record);
+	}
+
+	bool WaitDurable(uint64_t lsn, uint32_t timeoutMs = CCondVar::INFINITE_WAIT)
+	{
+		return lsn != 0 && m_wal.WaitDurable(lsn, timeoutMs);
+	}
+
+	bool Flush(uint32_t timeoutMs = CCondVar::INFINITE_WAIT)
+	{
+		return m_wal.Flush(timeoutMs);
+	}
+
+	// Starts a checkpoint on the task pool unless one is already running.
+	void Checkpoint()
+	{
+		if(!m_bOpen || AtomicLoad(&m_bCheckpointing))
+			return;
+		AtomicStore(&m_bCheckpointing, 1);
+		m_walBytes = 0;
+		m_checkpoints.Run(CheckpointProc, this, PrioritySync);
+	}
+
+	// synchronous variant, for shutdown and tests
+	bool CheckpointNow()
+	{
+		m_checkpoints.Wait();
+		AtomicStore(&m_bCheckpointing, 1);
+		m_walBytes = 0;
+		return RunCheckpoint();
+	}
+
+	void WaitCheckpoint()
+	{
+		m_checkpoints.Wait();
+	}
+
+	uint64_t GetLastSnapshotLsn()
+	{
+		return (uint64_t)AtomicLoad64(&m_lastSnapshotLsn);
+	}
+
+	bool IsCheckpointFailed()
+	{
+		return AtomicLoad(&m_bCheckpointFailed) != 0;
+	}
+
+	WriteAheadLogStats GetLogStats()
+	{
+		return m_wal.GetStats();
+	}
+
+	std::string GetSnapshotPath() const
+	{
+		return CNativeFile::JoinPath(m_dir, "contacts.snapshot");
+	}
+
+	std::string GetLogPath(uint64_t seq) const
+	{
+		char digits[24];
+		char* p = digits + sizeof(digits);
+		*--p = '\0';
+		do {
+			*--p = (char)('0' + seq % 10);
+			seq /= 10;
+		} while(seq != 0);
+		return CNativeFile::JoinPath(m_dir, std::string("contacts.wal.") + p);
+	}
+
+private:
+	struct ReplayHandler
+	{
+		CContactStore& store;
+		ContactRecord record;
+		std::wstring id;
+		std::vector<uint32_t> rows;
+
+		explicit ReplayHandler(CContactStore& s) : store(s)
+		{
+		}
+
+		void operator()(uint64_t /*lsn*/, uint8_t type, const char* pPayload, size_t cb)
+		{
+			CByteReader reader(pPayload, cb);
+			if(type == RecordPut) {
+				if(CContactStore::DeserializeRecord(reader, record))
+					store.Put(record);
+			}
+			else if(type == RecordRemove) {
+				if(reader.GetWString(id))
+					store.Remove(id);
+			}
+			else if(type == RecordRemoveMany) {
+				rows.clear();
+				for(uint32_t count = reader.GetU32(); count > 0 && reader.GetWString(id); count--)
+					rows.push_back(store.FindRow(id));
+				store.RemoveRows(rows);
+			}
+		}
+
+	private:
+		ReplayHandler& operator=(const ReplayHandler&);
+	};
+
+	CContactStore m_store;
+	CWriteAheadLog m_wal;
+	CTaskGroup m_checkpoints;
+	ContactDatabaseOptions m_options;
+	std::string m_dir;
+	std::string m_record;
+	volatile int64_t m_lastSnapshotLsn;
+	uint64_t m_walSeq;                  // log currently appended to, checkpoint thread only once open
+	uint64_t m_walBytes;                // logged since the last checkpoint started, owner thread only
+	bool m_bOpen;
+	volatile int32_t m_bCheckpointing;
+	volatile int32_t m_bCheckpointFailed;
+
+	uint64_t Log(uint8_t type, const std::string& payload)
+	{
+		uint64_t lsn = m_wal.Append(type, payload);
+		m_walBytes += payload.size() + CWriteAheadLog::HeaderSize;
+		if(m_options.checkpointBytes != 0 && m_walBytes >= m_options.checkpointBytes)
+			Checkpoint();
+		return lsn;
+	}
+
+	bool LoadSnapshot(uint64_t& lastLsn, uint64_t& walSeq)
+	{
+		CTraceScope trace("db.snapshot", "load");
+		CNativeFile file;
+		std::string data;
+		if(!file.Open(GetSnapshotPath(), CNativeFile::OpenRead) || !file.ReadAll(data) || data.size() < 4)
+			return false;
+		CByteReader tail(data.data() + data.size() - 4, 4);
+		if(Crc32(data.data(), data.size() - 4) != tail.GetU32())
+			return false;
+
+		CByteReader reader(data.data(), data.size() - 4);
+		if(reader.GetU32() != SnapshotMagic)
+			return false;
+		uint32_t version = reader.GetU32();
+		if(version != SnapshotVersion && version != 1)
+			return false;
+		lastLsn = reader.GetU64();
+		walSeq = reader.GetU64();
+		CTraceScope parse("db.parse", "load");
+		return m_store.Deserialize(reader, version == 1 ? (int)FieldBirthday : (int)FieldCount);
+	}
+
+	// Everything up to the rotation LSN is already applied to the store, so
+	// the snapshot taken afterwards covers it; later edits may be in there
+	// too and are simply replayed again.
+	bool RunCheckpoint()
+	{
+		CTraceScope trace("db.checkpoint", "save");
+		uint64_t nextSeq = m_walSeq + 1;
+		uint64_t lsn = m_wal.Rotate(GetLogPath(nextSeq));
+		bool bOk = lsn != 0;
+		if(bOk) {
+			uint64_t oldSeq = m_walSeq;
+			m_walSeq = nextSeq;
+
+			std::string data;
+			CByteWriter writer(data);
+			writer.PutU32(SnapshotMagic);
+			writer.PutU32(SnapshotVersion);
+			writer.PutU64(lsn);
+			writer.PutU64(nextSeq);
+			{
+				CTraceScope serialize("db.serialize", "save");
+				CAutoLock lock(m_store.GetLock());
+				m_store.Serialize(data);
+			}
+			writer.PutU32(Crc32(data.data(), data.size()));
+
+			std::string tmpPath = GetSnapshotPath() + ".tmp";
+			CNativeFile file;
+			bOk = file.Open(tmpPath, CNativeFile::OpenCreate) && file.Write(data.data(), data.size()) && file.Sync();
+			file.Close();
+			bOk = bOk && CNativeFile::Replace(tmpPath, GetSnapshotPath());
+			if(bOk) {
+				AtomicStore64(&m_lastSnapshotLsn, (int64_t)lsn);
+				for(uint64_t seq = oldSeq; seq >= 1 && CNativeFile::Exists(GetLogPath(seq)); seq--)
+					CNativeFile::Delete(GetLogPath(seq));
+			}
+		}
+		AtomicStore(&m_bCheckpointFailed, bOk ? 0 : 1);
+		AtomicStore(&m_bCheckpointing, 0);
+		return bOk;
+	}
+
+	static void CheckpointProc(void* p)
+	{
+		static_cast<CContactDatabase*>(p)->RunCheckpoint();
+	}
+
+	CContactDatabase(const CContactDatabase&);
+	CContactDatabase& operator=(const CContactDatabase&);
+};
+
+}; // namespace Synrc
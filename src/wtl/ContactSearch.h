@@ -0,0 +1,174 @@
+// ContactSearch.h
+//
+//  What the search box runs: its text as one result cursor over the search
+//  indexes, which live here so the frame and the benchmarks build the same
+//  pipeline. A query of one term on the name or on any field - what people
+//  type - matches names by relevance (SearchRanking.h): whole name, then its
+//  start, a word start, inside a word, and the more used contact first
+//  within each; an any-field term then adds the other fields' matches in
+//  store order, and then names written in the other script
+//  (TranslitSearch.h), so "Sokhatsky" finds the Cyrillic spelling too.
+//  Other queries run the scoped search of SearchQuery.h.
+//
+//  When the one-term query finds nothing at all, the names are searched
+//  again allowing a few typos (FuzzySearch.h), so "Sokhatski" still finds
+//  "Sokhatsky", and for names that sound the same (PhoneticSearch.h), so
+//  "Smirnoff" finds "Smirnov"; a query that found something never pays
+//  for either. The phonetic index also serves the duplicate finder.
+//
+//  Threading: cursors run on the pool; every index has its own lock.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "Collation.h"
+#include "ContactStore.h"
+#include "FuzzySearch.h"
+#include "PhoneticSearch.h"
+#include "ProgressiveResults.h"
+#include "SearchCache.h"
+#include "SearchQuery.h"
+#include "SearchRanking.h"
+#include "TranslitSearch.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CMergedCursor - rows of several cursors in turn, each row once
+// CContactSearch - the search indexes and the cursor a query runs as
+
+namespace Synrc
+{
+
+class CMergedCursor : public IResultCursor
+{
+public:
+	CMergedCursor() : m_next(0)
+	{
+	}
+
+	virtual ~CMergedCursor()
+	{
+		for(size_t i = 0; i < m_cursors.size(); i++)
+			delete m_cursors[i];
+	}
+
+	// takes the cursor; its rows follow those of the ones added before
+	void Add(IResultCursor* pCursor)
+	{
+		m_cursors.push_back(pCursor);
+	}
+
+	// a batch of the current cursor, less the rows already returned
+	virtual bool Fetch(std::vector<uint32_t>& rows)
+	{
+		if(m_next == m_cursors.size())
+			return false;
+		m_batch.clear();
+		if(!m_cursors[m_next]->Fetch(m_batch))
+			m_next++;
+		for(size_t i = 0; i < m_batch.size(); i++) {
+			uint32_t row = m_batch[i];
+			if(row >= m_seen.size())
+				m_seen.resize(row + 1, false);
+			if(!m_seen[row]) {
+				m_seen[row] = true;
+				rows.push_back(row);
+			}
+		}
+		return m_next < m_cursors.size();
+	}
+
+private:
+	std::vector<IResultCursor*> m_cursors;
+	size_t m_next;
+	std::vector<uint32_t> m_batch;
+	std::vector<bool> m_seen;       // by row
+
+	CMergedCursor(const CMergedCursor&);
+	CMergedCursor& operator=(const CMergedCursor&);
+};
+
+class CContactSearch
+{
+public:
+	// pUsage ranks the more used of equal matches first, NULL for none
+	CContactSearch(CContactStore& store, const CCollator& collator, const IUsageCounts* pUsage = NULL) :
+		m_store(store), m_pUsage(pUsage), m_indexes(store, collator), m_cache(store), m_fuzzy(store, FieldName, collator),
+		m_translit(store, FieldName), m_phonetic(store, FieldName)
+	{
+	}
+
+	// The rows of text, the best pageSize of them first; NULL when it has
+	// no terms. The caller owns the cursor.
+	IResultCursor* CreateCursor(const std::wstring& text, uint32_t pageSize = CProgressiveResults::DefaultFirstPage)
+	{
+		std::vector<SearchTerm> terms;
+		CSearchQuery::Parse(text, terms);
+		if(terms.empty())
+			return NULL;
+		if(terms.size() > 1 || (terms[0].field != FieldCount && terms[0].field != FieldName))
+			return new CScopedSearchCursor(m_indexes, m_store, text, &m_cache);
+
+		const std::wstring& words = terms[0].text;
+		CMergedCursor* pExact = new CMergedCursor;
+		pExact->Add(new CRankedSearchCursor(m_indexes.GetIndex(FieldName), words, pageSize, NULL, m_pUsage, &m_cache));
+		if(terms[0].field == FieldCount)
+			pExact->Add(new CScopedSearchCursor(m_indexes, m_store, text, &m_cache));
+		pExact->Add(new CTranslitCursor(m_translit, words));
+		CMergedCursor* pFallback = new CMergedCursor;
+		pFallback->Add(new CFuzzyCursor(m_fuzzy, words));
+		pFallback->Add(new CPhoneticCursor(m_phonetic, words));
+		return new CFallbackCursor(pExact, pFallback);
+	}
+
+	CFieldIndexSet& GetIndexes()
+	{
+		return m_indexes;
+	}
+
+	CQueryResultCache& GetCache()
+	{
+		return m_cache;
+	}
+
+	CFuzzyIndex& GetFuzzyIndex()
+	{
+		return m_fuzzy;
+	}
+
+	CTranslitIndex& GetTranslitIndex()
+	{
+		return m_translit;
+	}
+
+	// names by sound; FindSoundAlikes() lists likely duplicates
+	CPhoneticIndex& GetPhoneticIndex()
+	{
+		return m_phonetic;
+	}
+
+	size_t GetMemoryUsage()
+	{
+		return m_indexes.GetMemoryUsage() + m_fuzzy.GetMemoryUsage() + m_translit.GetMemoryUsage() +
+			m_phonetic.GetMemoryUsage();
+	}
+
+private:
+	CContactStore& m_store;
+	const IUsageCounts* m_pUsage;
+	CFieldIndexSet m_indexes;
+	CQueryResultCache m_cache;
+	CFuzzyIndex m_fuzzy;
+	CTranslitIndex m_translit;
+	CPhoneticIndex m_phonetic;
+
+	CContactSearch(const CContactSearch&);
+	CContactSearch& operator=(const CContactSearch&);
+};
+
+}; // namespace Synrc
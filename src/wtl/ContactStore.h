@@ -0,0 +1,347 @@
+// ContactStore.h
+//
+//  In-memory, column oriented contact store behind the owner-data list.
+//  Every contact lives in a dense row; a row index never changes while the
+//  contact exists, removed rows stay behind as tombstones until Clear(). Each
+//  field is its own column so sort, search and group code only touch the
+//  data they need.
+//
+//  Threading: the owning (UI) thread mutates and reads without locking.
+//  Mutations take GetLock(), so other threads read consistently under it.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "Platform.h"
+#include "BinaryStream.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// ContactRecord - one contact as a flat set of fields
+// IContactStoreObserver - notified after each row change
+// CContactStore - dense rows, one column per field
+
+namespace Synrc
+{
+
+enum ContactField
+{
+	FieldName = 0,          // display name, "First Last"
+	FieldGivenName,
+	FieldFamilyName,
+	FieldEmail,
+	FieldPhone,
+	FieldCompany,
+	FieldCity,
+	FieldLabel,             // categories, ';' separated
+	FieldBirthday,          // "YYYY-MM-DD", or "--MM-DD" without the year
+	FieldAnniversary,       // same as FieldBirthday
+	FieldCount
+};
+
+enum ContactChange
+{
+	ContactAdded,
+	ContactUpdated,
+	ContactRemoved,
+	ContactsRemoved,        // several rows went at once, row is NoRow; IsLive() tells which
+	ContactsCleared         // every row is gone, row is NoRow
+};
+
+struct ContactRecord
+{
+	std::wstring id;
+	std::wstring fields[FieldCount];
+};
+
+class IContactStoreObserver
+{
+public:
+	virtual ~IContactStoreObserver()
+	{
+	}
+
+	virtual void OnContactChanged(uint32_t row, ContactChange change) = 0;
+};
+
+class CContactStore
+{
+public:
+	enum { NoRow = 0xFFFFFFFF };
+
+	CContactStore() : m_liveCount(0), m_epoch(0)
+	{
+	}
+
+	size_t GetRowCount() const
+	{
+		return m_ids.size();
+	}
+
+	size_t GetLiveCount() const
+	{
+		return m_liveCount;
+	}
+
+	bool IsLive(uint32_t row) const
+	{
+		return row < m_live.size() && m_live[row] != 0;
+	}
+
+	const std::wstring& GetId(uint32_t row) const
+	{
+		return m_ids[row];
+	}
+
+	const std::wstring& GetField(uint32_t row, ContactField field) const
+	{
+		return m_columns[field][row];
+	}
+
+	const std::vector<std::wstring>& GetColumn(ContactField field) const
+	{
+		return m_columns[field];
+	}
+
+	uint32_t FindRow(const std::wstring& id) const
+	{
+		IdMap::const_iterator it = m_rowById.find(id);
+		return it == m_rowById.end() ? (uint32_t)NoRow : it->second;
+	}
+
+	bool GetRecord(uint32_t row, ContactRecord& record) const
+	{
+		if(!IsLive(row))
+			return false;
+		record.id = m_ids[row];
+		for(int f = 0; f < FieldCount; f++)
+			record.fields[f] = m_columns[f][row];
+		return true;
+	}
+
+	// Bumped by every mutation. Caches tag their entries with it.
+	uint64_t GetEpoch() const
+	{
+		return m_epoch;
+	}
+
+	// inserts or replaces the contact with record.id, returns its row
+	uint32_t Put(const ContactRecord& record)
+	{
+		uint32_t row;
+		ContactChange change;
+		{
+			CAutoLock lock(m_cs);
+			row = FindRow(record.id);
+			if(row == NoRow) {
+				row = (uint32_t)m_ids.size();
+				m_ids.push_back(record.id);
+				m_live.push_back(1);
+				for(int f = 0; f < FieldCount; f++)
+					m_columns[f].push_back(record.fields[f]);
+				m_rowById[record.id] = row;
+				m_liveCount++;
+				change = ContactAdded;
+			}
+			else {
+				for(int f = 0; f < FieldCount; f++)
+					m_columns[f][row] = record.fields[f];
+				change = ContactUpdated;
+			}
+			m_epoch++;
+		}
+		Notify(row, change);
+		return row;
+	}
+
+	bool Remove(const std::wstring& id)
+	{
+		uint32_t row = FindRow(id);
+		if(row == NoRow)
+			return false;
+		RemoveRow(row);
+		return true;
+	}
+
+	// observers are notified while the row data is still readable
+	void RemoveRow(uint32_t row)
+	{
+		if(!IsLive(row))
+			return;
+		Notify(row, ContactRemoved);
+		CAutoLock lock(m_cs);
+		m_rowById.erase(m_ids[row]);
+		m_live[row] = 0;
+		m_liveCount--;
+		m_epoch++;
+	}
+
+	// Bulk delete: one notification after all rows are tombstoned instead
+	// of one per row. Rows already removed are skipped; returns the count.
+	// Erasing most of the id map key by key is far slower than rebuilding
+	// it from the survivors, so large deletes do that.
+	size_t RemoveRows(const std::vector<uint32_t>& rows)
+	{
+		size_t removed = 0;
+		IdMap survivors;
+		{
+			CAutoLock lock(m_cs);
+			bool bRebuild = rows.size() >= m_liveCount / 4;
+			for(size_t i = 0; i < rows.size(); i++) {
+				uint32_t row = rows[i];
+				if(!IsLive(row))
+					continue;
+				if(!bRebuild)
+					m_rowById.erase(m_ids[row]);
+				m_live[row] = 0;
+				removed++;
+			}
+			m_liveCount -= removed;
+			if(bRebuild) {
+				survivors.reserve(m_liveCount);
+				for(size_t row = 0; row < m_ids.size() && survivors.size() < m_liveCount; row++) {
+					if(m_live[row])
+						survivors[m_ids[row]] = (uint32_t)row;
+				}
+				m_rowById.swap(survivors);     // the old map is freed outside the lock
+			}
+			m_epoch++;
+		}
+		if(removed > 0)
+			Notify((uint32_t)NoRow, ContactsRemoved);
+		return removed;
+	}
+
+	void Clear()
+	{
+		{
+			CAutoLock lock(m_cs);
+			m_ids.clear();
+			m_live.clear();
+			for(int f = 0; f < FieldCount; f++)
+				m_columns[f].clear();
+			m_rowById.clear();
+			m_liveCount = 0;
+			m_epoch++;
+		}
+		Notify((uint32_t)NoRow, ContactsCleared);
+	}
+
+	void Reserve(size_t rows)
+	{
+		CAutoLock lock(m_cs);
+		m_ids.reserve(rows);
+		m_live.reserve(rows);
+		for(int f = 0; f < FieldCount; f++)
+			m_columns[f].reserve(rows);
+		m_rowById.reserve(rows);
+	}
+
+	CCritSec& GetLock()
+	{
+		return m_cs;
+	}
+
+	void AddObserver(IContactStoreObserver* pObserver)
+	{
+		m_observers.push_back(pObserver);
+	}
+
+	void RemoveObserver(IContactStoreObserver* pObserver)
+	{
+		for(size_t i = 0; i < m_observers.size(); i++) {
+			if(m_observers[i] == pObserver) {
+				m_observers.erase(m_observers.begin() + i);
+				return;
+			}
+		}
+	}
+
+	// Serialization of the live rows; callers off the owning thread hold GetLock().
+	void Serialize(std::string& data) const
+	{
+		CByteWriter writer(data);
+		writer.PutU32((uint32_t)m_liveCount);
+		for(size_t row = 0; row < m_ids.size(); row++) {
+			if(!m_live[row])
+				continue;
+			writer.PutWString(m_ids[row]);
+			for(int f = 0; f < FieldCount; f++)
+				writer.PutWString(m_columns[f][row]);
+		}
+	}
+
+	// Replaces the contents; observers see one ContactAdded per row. Data
+	// written before a field existed holds the first fieldCount fields.
+	bool Deserialize(CByteReader& reader, int fieldCount = FieldCount)
+	{
+		Clear();
+		uint32_t count = reader.GetU32();
+		if(!reader.IsOk())
+			return false;
+		Reserve(count);
+		ContactRecord record;
+		for(uint32_t i = 0; i < count; i++) {
+			reader.GetWString(record.id);
+			for(int f = 0; f < FieldCount; f++) {
+				if(f < fieldCount)
+					reader.GetWString(record.fields[f]);
+				else
+					record.fields[f].clear();
+			}
+			if(!reader.IsOk())
+				return false;
+			Put(record);
+		}
+		return true;
+	}
+
+	static void SerializeRecord(const ContactRecord& record, std::string& data)
+	{
+		CByteWriter writer(data);
+		writer.PutWString(record.id);
+		for(int f = 0; f < FieldCount; f++)
+			writer.PutWString(record.fields[f]);
+	}
+
+	// A record that ends before the dates was written without them.
+	static bool DeserializeRecord(CByteReader& reader, ContactRecord& record)
+	{
+		reader.GetWString(record.id);
+		for(int f = 0; f < FieldCount; f++) {
+			if(f >= FieldBirthday && reader.GetRemaining() == 0)
+				record.fields[f].clear();
+			else
+				reader.GetWString(record.fields[f]);
+		}
+		return reader.IsOk();
+	}
+
+private:
+	typedef std::unordered_map<std::wstring, uint32_t> IdMap;
+
+	CCritSec m_cs;
+	std::vector<std::wstring> m_ids;
+	std::vector<uint8_t> m_live;
+	std::vector<std::wstring> m_columns[FieldCount];
+	IdMap m_rowById;
+	size_t m_liveCount;
+	uint64_t m_epoch;
+	std::vector<IContactStoreObserver*> m_observers;
+
+	void Notify(uint32_t row, ContactChange change)
+	{
+		for(size_t i = 0; i < m_observers.size(); i++)
+			m_observers[i]->OnContactChanged(row, change);
+	}
+
+	CContactStore(const CContactStore&);
+	CContactStore& operator=(const CContactStore&);
+};
+
+}; // namespace Synrc
@@ -0,0 +1,587 @@
+// DateIndex.h
+//
+//  Birthdays and anniversaries by day of the year, to answer "in the next
+//  30 days" without a scan. Each of the 366 days of a leap year keeps its
+//  contacts in row order; a query walks the days from the given date on,
+//  across the end of the year, so it costs the days asked for and the
+//  events found, whatever the size of the address book. An edit moves a
+//  row from one day to another.
+//
+//  Dates are read from FieldBirthday and FieldAnniversary as vCard BDAY and
+//  the Date values of contact.xsd write them: "1985-04-12", "19850412", or
+//  "--04-12" and "--0412" without the year; a time after the date is
+//  ignored. A date of 29 February falls on the 28th in other years.
+//
+//  CUpcomingGroup keeps a pinned group of a CGroupModel (see GroupModel.h)
+//  at the contacts with an event in the next days, for the list view.
+//
+//  Threading: one lock; the store's is taken inside it.
+
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "ContactStore.h"
+#include "EventTrace.h"
+#include "GroupModel.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CDateIndex - contacts by the day of the year of their dates
+// CUpcomingGroup - a pinned group of the contacts with an event soon
+
+namespace Synrc
+{
+
+enum DateKind
+{
+	DateBirthday = 0,
+	DateAnniversary,
+	DateKindCount
+};
+
+struct CalendarDate
+{
+	uint16_t year;          // 0 when not known
+	uint8_t month;          // 1..12
+	uint8_t day;            // 1..31
+
+	CalendarDate() : year(0), month(0), day(0)
+	{
+	}
+
+	CalendarDate(uint16_t y, uint8_t m, uint8_t d) : year(y), month(m), day(d)
+	{
+	}
+
+	bool operator==(const CalendarDate& other) const
+	{
+		return year == other.year && month == other.month && day == other.day;
+	}
+
+	bool operator!=(const CalendarDate& other) const
+	{
+		return !(*this == other);
+	}
+};
+
+struct UpcomingEvent
+{
+	uint32_t row;
+	uint16_t daysAway;      // 0 for the date queried from
+	uint16_t years;         // which birthday or anniversary, 0 without the year
+	DateKind kind;
+};
+
+struct DateIndexStats
+{
+	uint64_t queries;
+	uint64_t updates;       // edits that moved or dropped a date
+	uint64_t rebuilds;
+
+	DateIndexStats() : queries(0), updates(0), rebuilds(0)
+	{
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CDateIndex - contacts by the day of the year of their dates
+
+class CDateIndex : public IContactStoreObserver
+{
+public:
+	enum
+	{
+		DaysInLeapYear = 366,
+		LeapDay = 59,           // 29 February, as a day of a leap year
+		NoDay = 0xFFFF,
+		NoLimit = 0xFFFFFFFF
+	};
+
+	explicit CDateIndex(CContactStore& store) : m_store(store), m_version(0)
+	{
+		m_store.AddObserver(this);
+		Rebuild();
+	}
+
+	~CDateIndex()
+	{
+		m_store.RemoveObserver(this);
+	}
+
+	static ContactField GetDateField(DateKind kind)
+	{
+		return kind == DateBirthday ? FieldBirthday : FieldAnniversary;
+	}
+
+	static bool IsLeapYear(uint32_t year)
+	{
+		return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+	}
+
+	// days of the month in year; of a leap year when the year is not known
+	static uint32_t GetMonthDays(uint32_t month, uint32_t year)
+	{
+		static const uint8_t s_days[12] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+		if(month == 2 && year != 0 && !IsLeapYear(year))
+			return 28;
+		return s_days[month - 1];
+	}
+
+	// 0..365, counted as in a leap year
+	static uint32_t GetDayOfYear(uint32_t month, uint32_t day)
+	{
+		static const uint16_t s_firstDays[12] = { 0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335 };
+		return s_firstDays[month - 1] + day - 1;
+	}
+
+	static CalendarDate GetToday()
+	{
+#ifdef _WIN32
+		SYSTEMTIME now;
+		GetLocalTime(&now);
+		return CalendarDate(now.wYear, (uint8_t)now.wMonth, (uint8_t)now.wDay);
+#else
+		time_t now = time(NULL);
+		struct tm local;
+		localtime_r(&now, &local);
+		return CalendarDate((uint16_t)(local.tm_year + 1900), (uint8_t)(local.tm_mon + 1), (uint8_t)local.tm_mday);
+#endif
+	}
+
+	// The date at the start of text, in one of the forms above; false when
+	// there is none or it does not exist.
+	static bool ParseDate(const std::wstring& text, CalendarDate& date)
+	{
+		const wchar_t* p = text.c_str();
+		const wchar_t* pEnd = p + text.size();
+		while(p < pEnd && *p == L' ')
+			p++;
+		uint32_t year = 0;
+		uint32_t month;
+		uint32_t day;
+		if(pEnd - p >= 2 && p[0] == L'-' && p[1] == L'-')
+			p += 2;
+		else if(!GetDigits(p, pEnd, 4, year) || year == 0)
+			return false;
+		else if(p < pEnd && *p == L'-')
+			p++;
+		if(!GetDigits(p, pEnd, 2, month))
+			return false;
+		if(p < pEnd && *p == L'-')
+			p++;
+		if(!GetDigits(p, pEnd, 2, day) || (p < pEnd && *p >= L'0' && *p <= L'9'))
+			return false;
+		if(month < 1 || month > 12 || day < 1 || day > GetMonthDays(month, year))
+			return false;
+		date = CalendarDate((uint16_t)year, (uint8_t)month, (uint8_t)day);
+		return true;
+	}
+
+	// Full build from the store; edits after that are patched in.
+	void Rebuild()
+	{
+		CTraceScope trace("index.dates", "index");
+		CAutoLock lock(m_cs);
+		CAutoLock storeLock(m_store.GetLock());
+		uint32_t rowCount = (uint32_t)m_store.GetRowCount();
+		for(int kind = 0; kind < DateKindCount; kind++) {
+			m_rowDays[kind].assign(rowCount, (uint16_t)NoDay);
+			m_rowYears[kind].assign(rowCount, 0);
+			for(uint32_t day = 0; day < DaysInLeapYear; day++)
+				m_days[kind][day].clear();
+		}
+		CalendarDate date;
+		for(uint32_t row = 0; row < rowCount; row++) {
+			if(!m_store.IsLive(row))
+				continue;
+			for(int kind = 0; kind < DateKindCount; kind++) {
+				if(!ParseDate(m_store.GetField(row, GetDateField((DateKind)kind)), date))
+					continue;
+				uint32_t day = GetDayOfYear(date.month, date.day);
+				m_rowDays[kind][row] = (uint16_t)day;
+				m_rowYears[kind][row] = date.year;
+				m_days[kind][day].push_back(row);
+			}
+		}
+		m_version++;
+		m_stats.rebuilds++;
+	}
+
+	// The date of the row, false when it has none.
+	bool GetDate(uint32_t row, DateKind kind, CalendarDate& date)
+	{
+		CAutoLock lock(m_cs);
+		if(row >= m_rowDays[kind].size() || m_rowDays[kind][row] == NoDay)
+			return false;
+		uint32_t day = m_rowDays[kind][row];
+		uint32_t month = 1;
+		for(; day >= GetMonthDays(month, 0); month++)
+			day -= GetMonthDays(month, 0);
+		date = CalendarDate(m_rowYears[kind][row], (uint8_t)month, (uint8_t)(day + 1));
+		return true;
+	}
+
+	// Events from the date from on, for days days - a year at most - by days
+	// away, birthdays first, then by row; DateKindCount for both kinds.
+	// Stopping at maxCount keeps the cost that of the events kept.
+	void GetUpcoming(const CalendarDate& from, uint32_t days, std::vector<UpcomingEvent>& events,
+		DateKind kind = DateKindCount, uint32_t maxCount = NoLimit)
+	{
+		CAutoLock lock(m_cs);
+		m_stats.queries++;
+		events.clear();
+		GetVisits(from, days);
+		for(size_t i = 0; i < m_visits.size(); i++) {
+			const DayVisit& visit = m_visits[i];
+			for(int k = 0; k < DateKindCount; k++) {
+				if(kind != DateKindCount && kind != k)
+					continue;
+				const std::vector<uint32_t>& rows = m_days[k][visit.day];
+				for(size_t r = 0; r < rows.size(); r++) {
+					if(events.size() >= maxCount)
+						return;
+					uint16_t year = m_rowYears[k][rows[r]];
+					UpcomingEvent event;
+					event.row = rows[r];
+					event.daysAway = visit.daysAway;
+					event.years = year != 0 && year < visit.year ? (uint16_t)(visit.year - year) : 0;
+					event.kind = (DateKind)k;
+					events.push_back(event);
+				}
+			}
+		}
+	}
+
+	// how many GetUpcoming() would return, in O(days)
+	size_t CountUpcoming(const CalendarDate& from, uint32_t days, DateKind kind = DateKindCount)
+	{
+		CAutoLock lock(m_cs);
+		m_stats.queries++;
+		GetVisits(from, days);
+		size_t count = 0;
+		for(size_t i = 0; i < m_visits.size(); i++) {
+			for(int k = 0; k < DateKindCount; k++) {
+				if(kind == DateKindCount || kind == k)
+					count += m_days[k][m_visits[i].day].size();
+			}
+		}
+		return count;
+	}
+
+	// The rows of GetUpcoming(), each once, at its first event; maxCount
+	// counts contacts, not events.
+	void GetUpcomingRows(const CalendarDate& from, uint32_t days, std::vector<uint32_t>& rows,
+		DateKind kind = DateKindCount, uint32_t maxCount = NoLimit)
+	{
+		CAutoLock lock(m_cs);
+		m_stats.queries++;
+		rows.clear();
+		GetVisits(from, days);
+		// a contact with both dates in the range is listed at the first: the
+		// walk step of each day tells which one that is
+		uint16_t visitOf[DaysInLeapYear];
+		for(uint32_t day = 0; day < DaysInLeapYear; day++)
+			visitOf[day] = (uint16_t)NoDay;
+		for(size_t i = 0; i < m_visits.size(); i++)
+			visitOf[m_visits[i].day] = (uint16_t)i;
+		for(size_t i = 0; i < m_visits.size(); i++) {
+			for(int k = 0; k < DateKindCount; k++) {
+				if(kind != DateKindCount && kind != k)
+					continue;
+				const std::vector<uint32_t>& dayRows = m_days[k][m_visits[i].day];
+				for(size_t r = 0; r < dayRows.size(); r++) {
+					if(rows.size() >= maxCount)
+						return;
+					uint32_t row = dayRows[r];
+					if(kind == DateKindCount && IsListedBefore(row, k, i, visitOf))
+						continue;
+					rows.push_back(row);
+				}
+			}
+		}
+	}
+
+	// changes whenever a date is added, moved or dropped
+	uint32_t GetVersion()
+	{
+		CAutoLock lock(m_cs);
+		return m_version;
+	}
+
+	size_t GetMemoryUsage()
+	{
+		CAutoLock lock(m_cs);
+		size_t total = 0;
+		for(int kind = 0; kind < DateKindCount; kind++) {
+			total += (m_rowDays[kind].capacity() + m_rowYears[kind].capacity()) * sizeof(uint16_t);
+			for(uint32_t day = 0; day < DaysInLeapYear; day++)
+				total += sizeof(std::vector<uint32_t>) + m_days[kind][day].capacity() * sizeof(uint32_t);
+		}
+		return total;
+	}
+
+	DateIndexStats GetStats()
+	{
+		CAutoLock lock(m_cs);
+		return m_stats;
+	}
+
+	// implementation of IContactStoreObserver
+	virtual void OnContactChanged(uint32_t row, ContactChange change)
+	{
+		CAutoLock lock(m_cs);
+		switch(change) {
+		case ContactAdded:
+		case ContactUpdated:
+			{
+				CAutoLock storeLock(m_store.GetLock());
+				for(int kind = 0; kind < DateKindCount; kind++) {
+					CalendarDate date;
+					if(ParseDate(m_store.GetField(row, GetDateField((DateKind)kind)), date))
+						SetDate(row, (DateKind)kind, GetDayOfYear(date.month, date.day), date.year);
+					else
+						SetDate(row, (DateKind)kind, NoDay, 0);
+				}
+			}
+			break;
+		case ContactRemoved:
+			for(int kind = 0; kind < DateKindCount; kind++)
+				SetDate(row, (DateKind)kind, NoDay, 0);
+			break;
+		case ContactsRemoved:
+			{
+				CAutoLock storeLock(m_store.GetLock());
+				for(int kind = 0; kind < DateKindCount; kind++) {
+					for(uint32_t day = 0; day < DaysInLeapYear; day++) {
+						std::vector<uint32_t>& rows = m_days[kind][day];
+						rows.erase(std::remove_if(rows.begin(), rows.end(), RowDead(m_store, m_rowDays[kind])), rows.end());
+					}
+				}
+				m_version++;
+			}
+			break;
+		case ContactsCleared:
+			for(int kind = 0; kind < DateKindCount; kind++) {
+				m_rowDays[kind].clear();
+				m_rowYears[kind].clear();
+				for(uint32_t day = 0; day < DaysInLeapYear; day++)
+					m_days[kind][day].clear();
+			}
+			m_version++;
+			break;
+		}
+	}
+	// implementation of IContactStoreObserver
+
+private:
+	// a day of the year met walking from a date, and where
+	struct DayVisit
+	{
+		uint16_t day;
+		uint16_t daysAway;
+		uint16_t year;
+	};
+
+	struct RowDead
+	{
+		const CContactStore& store;
+		std::vector<uint16_t>& rowDays;
+
+		RowDead(const CContactStore& s, std::vector<uint16_t>& r) : store(s), rowDays(r)
+		{
+		}
+
+		bool operator()(uint32_t row) const
+		{
+			if(store.IsLive(row))
+				return false;
+			rowDays[row] = (uint16_t)NoDay;
+			return true;
+		}
+
+	private:
+		RowDead& operator=(const RowDead&);
+	};
+
+	CContactStore& m_store;
+	CCritSec m_cs;
+	std::vector<uint16_t> m_rowDays[DateKindCount];     // day of the year per row, NoDay without a date
+	std::vector<uint16_t> m_rowYears[DateKindCount];    // 0 without the year
+	std::vector<uint32_t> m_days[DateKindCount][DaysInLeapYear];   // rows, ascending
+	uint32_t m_version;
+	DateIndexStats m_stats;
+	std::vector<DayVisit> m_visits;
+
+	static bool GetDigits(const wchar_t*& p, const wchar_t* pEnd, int count, uint32_t& value)
+	{
+		value = 0;
+		for(int i = 0; i < count; i++, p++) {
+			if(p >= pEnd || *p < L'0' || *p > L'9')
+				return false;
+			value = value * 10 + (*p - L'0');
+		}
+		return true;
+	}
+
+	// whether the walk met the row's other date before its date of kind at
+	// step visit
+	bool IsListedBefore(uint32_t row, int kind, size_t visit, const uint16_t* pVisitOf) const
+	{
+		for(int other = 0; other < DateKindCount; other++) {
+			if(other == kind || row >= m_rowDays[other].size() || m_rowDays[other][row] == NoDay)
+				continue;
+			uint32_t at = pVisitOf[m_rowDays[other][row]];
+			if(at != NoDay && (at < visit || (at == visit && other < kind)))
+				return true;
+		}
+		return false;
+	}
+
+	// Moves the row to day, or out with NoDay.
+	void SetDate(uint32_t row, DateKind kind, uint32_t day, uint16_t year)
+	{
+		if(row >= m_rowDays[kind].size()) {
+			if(day == NoDay)
+				return;
+			m_rowDays[kind].resize(row + 1, (uint16_t)NoDay);
+			m_rowYears[kind].resize(row + 1, 0);
+		}
+		uint32_t oldDay = m_rowDays[kind][row];
+		if(oldDay == day && m_rowYears[kind][row] == year)
+			return;
+		if(oldDay != day) {
+			if(oldDay != NoDay) {
+				std::vector<uint32_t>& rows = m_days[kind][oldDay];
+				std::vector<uint32_t>::iterator it = std::lower_bound(rows.begin(), rows.end(), row);
+				if(it != rows.end() && *it == row)
+					rows.erase(it);
+			}
+			if(day != NoDay) {
+				std::vector<uint32_t>& rows = m_days[kind][day];
+				if(rows.empty() || rows.back() < row)
+					rows.push_back(row);
+				else
+					rows.insert(std::lower_bound(rows.begin(), rows.end(), row), row);
+			}
+		}
+		m_rowDays[kind][row] = (uint16_t)day;
+		m_rowYears[kind][row] = year;
+		m_version++;
+		m_stats.updates++;
+	}
+
+	// The days from the date on, each day of the year once; 29 February
+	// comes with the 28th in other years.
+	void GetVisits(const CalendarDate& from, uint32_t days)
+	{
+		m_visits.clear();
+		if(from.month < 1 || from.month > 12 || from.day < 1 || from.day > GetMonthDays(from.month, from.year))
+			return;
+		bool bSeen[DaysInLeapYear] = { false };
+		uint32_t year = from.year;
+		uint32_t month = from.month;
+		uint32_t day = from.day;
+		if(days > DaysInLeapYear)
+			days = DaysInLeapYear;
+		for(uint32_t away = 0; away < days; away++) {
+			AddVisit(GetDayOfYear(month, day), away, year, bSeen);
+			if(month == 2 && day == 28 && !IsLeapYear(year))
+				AddVisit(LeapDay, away, year, bSeen);
+			if(++day > GetMonthDays(month, year)) {
+				day = 1;
+				if(++month > 12) {
+					month = 1;
+					year++;
+				}
+			}
+		}
+	}
+
+	void AddVisit(uint32_t day, uint32_t away, uint32_t year, bool* pSeen)
+	{
+		if(pSeen[day])
+			return;
+		pSeen[day] = true;
+		DayVisit visit = { (uint16_t)day, (uint16_t)away, (uint16_t)year };
+		m_visits.push_back(visit);
+	}
+
+	CDateIndex(const CDateIndex&);
+	CDateIndex& operator=(const CDateIndex&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CUpcomingGroup - a pinned group of the contacts with an event soon
+
+class CUpcomingGroup
+{
+public:
+	enum
+	{
+		DefaultDays = 30,
+		DefaultMaxRows = 100    // the nearest ones, in a big address book
+	};
+
+	// groups and dates must be over the same store and outlive this
+	CUpcomingGroup(CDateIndex& dates, CGroupModel& groups, uint32_t slot, uint32_t days = DefaultDays,
+		uint32_t maxRows = DefaultMaxRows, const std::wstring& label = L"Upcoming") :
+		m_dates(dates), m_groups(groups), m_slot(slot), m_days(days), m_maxRows(maxRows), m_label(label),
+		m_version(0), m_bShown(false)
+	{
+	}
+
+	// Sets the group for today when a date or the day changed since the
+	// last call; true when it did.
+	bool Update(const CalendarDate& today = CDateIndex::GetToday())
+	{
+		uint32_t version = m_dates.GetVersion();
+		if(m_bShown && version == m_version && today == m_today)
+			return false;
+		m_version = version;
+		m_today = today;
+		m_bShown = true;
+		m_dates.GetUpcomingRows(today, m_days, m_rows, DateKindCount, m_maxRows);
+		m_groups.SetPinnedRows(m_slot, m_label, m_rows);
+		return true;
+	}
+
+	// takes the group out of the list until the next Update()
+	void Hide()
+	{
+		m_bShown = false;
+		m_groups.SetPinnedRows(m_slot, m_label, std::vector<uint32_t>());
+	}
+
+	uint32_t GetSlot() const
+	{
+		return m_slot;
+	}
+
+	CGroupModel& GetGroupModel() const
+	{
+		return m_groups;
+	}
+
+private:
+	CDateIndex& m_dates;
+	CGroupModel& m_groups;
+	uint32_t m_slot;
+	uint32_t m_days;
+	uint32_t m_maxRows;
+	std::wstring m_label;
+	uint32_t m_version;
+	CalendarDate m_today;
+	bool m_bShown;
+	std::vector<uint32_t> m_rows;
+
+	CUpcomingGroup(const CUpcomingGroup&);
+	CUpcomingGroup& operator=(const CUpcomingGroup&);
+};
+
+}; // namespace Synrc
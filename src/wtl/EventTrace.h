@@ -0,0 +1,278 @@
+// EventTrace.h
+//
+//  Timeline of what the threads were doing, for startup and sync: window
+//  creation, database load and parse, index builds, the first paint, sync
+//  batches and checkpoints. Scopes record complete events into a ring per
+//  thread; the tracer collects the rings into Chrome trace JSON for
+//  chrome://tracing or Perfetto.
+//
+//  Off by default. A disabled scope is one load of a flag; an enabled one
+//  two clock reads and a store into the thread's ring, under a lock that
+//  only writing the JSON contends for. Scopes are meant for
+//  stages of a millisecond or more, not for per-item work.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "Benchmark.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CTraceBuffer - ring of one thread's events
+// CEventTracer - enables tracing, owns the rings, writes Chrome JSON
+// CTraceScope - records a block as a complete event
+
+namespace Synrc
+{
+
+struct TraceEvent
+{
+	const char* pName;          // literals only, kept by pointer
+	const char* pCategory;
+	uint64_t startNs;
+	uint64_t durationNs;
+	char phase;                 // 'X' complete, 'i' instant
+};
+
+class CTraceBuffer
+{
+public:
+	enum { Capacity = 4096 };   // older events are overwritten
+
+	explicit CTraceBuffer(int32_t threadId) : m_threadId(threadId), m_pThreadName(NULL), m_written(0)
+	{
+	}
+
+	// owning thread only
+	void Add(const char* pName, const char* pCategory, uint64_t startNs, uint64_t durationNs, char phase)
+	{
+		CAutoLock lock(m_cs);
+		TraceEvent& event = m_events[m_written % Capacity];
+		event.pName = pName;
+		event.pCategory = pCategory;
+		event.startNs = startNs;
+		event.durationNs = durationNs;
+		event.phase = phase;
+		m_written++;
+	}
+
+	// appends the events kept, oldest first, from any thread
+	void Collect(std::vector<TraceEvent>& events)
+	{
+		CAutoLock lock(m_cs);
+		uint64_t begin = m_written > Capacity ? m_written - Capacity : 0;
+		for(uint64_t i = begin; i < m_written; i++)
+			events.push_back(m_events[i % Capacity]);
+	}
+
+	int32_t GetThreadId() const
+	{
+		return m_threadId;
+	}
+
+	const char* GetThreadName()
+	{
+		CAutoLock lock(m_cs);
+		return m_pThreadName;
+	}
+
+	void SetThreadName(const char* pName)
+	{
+		CAutoLock lock(m_cs);
+		m_pThreadName = pName;
+	}
+
+private:
+	CCritSec m_cs;
+	int32_t m_threadId;
+	const char* m_pThreadName;
+	uint64_t m_written;
+	TraceEvent m_events[Capacity];
+
+	CTraceBuffer(const CTraceBuffer&);
+	CTraceBuffer& operator=(const CTraceBuffer&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CEventTracer - enables tracing, owns the rings, writes Chrome JSON
+
+class CEventTracer
+{
+public:
+	CEventTracer() : m_nextThreadId(0), m_startNs(0)
+	{
+	}
+
+	~CEventTracer()
+	{
+		for(size_t i = 0; i < m_buffers.size(); i++)
+			delete m_buffers[i];
+	}
+
+	static CEventTracer& GetDefault()
+	{
+		static CEventTracer s_tracer;
+		return s_tracer;
+	}
+
+	static bool IsEnabled()
+	{
+		return AtomicLoad(&EnabledFlag()) != 0;
+	}
+
+	// A new session: events recorded before are no longer written.
+	void Start()
+	{
+		AtomicStore64(&m_startNs, (int64_t)GetTimeNs());
+		AtomicStore(&EnabledFlag(), 1);
+	}
+
+	void Stop()
+	{
+		AtomicStore(&EnabledFlag(), 0);
+	}
+
+	// Records on the calling thread; events of disabled tracing are kept
+	// too, so a scope that began while enabled is always complete.
+	void Add(const char* pName, const char* pCategory, uint64_t startNs, uint64_t durationNs, char phase = 'X')
+	{
+		GetThreadBuffer().Add(pName, pCategory, startNs, durationNs, phase);
+	}
+
+	// Names the calling thread in the timeline; pName must be a literal.
+	// Costs nothing until the thread records its first event.
+	void SetThreadName(const char* pName)
+	{
+		ThreadNameSlot() = pName;
+		if(ThreadBufferSlot() != NULL)
+			ThreadBufferSlot()->SetThreadName(pName);
+	}
+
+	// The session so far as a Chrome trace: complete ("X") and instant
+	// ("i") events in microseconds since Start(), threads named by "M"
+	// metadata events. Returns the events written.
+	size_t Write(std::string& json)
+	{
+		uint64_t startNs = (uint64_t)AtomicLoad64(&m_startNs);
+		json += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		size_t count = 0;
+		CAutoLock lock(m_cs);
+		for(size_t b = 0; b < m_buffers.size(); b++) {
+			CTraceBuffer& buffer = *m_buffers[b];
+			if(buffer.GetThreadName() != NULL) {
+				CBenchmarkRunner::Append(json, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+					"\"args\":{\"name\":\"%s\"}}", count > 0 ? "," : "", buffer.GetThreadId(), buffer.GetThreadName());
+				count++;
+			}
+			m_events.clear();
+			buffer.Collect(m_events);
+			for(size_t i = 0; i < m_events.size(); i++) {
+				const TraceEvent& event = m_events[i];
+				if(event.startNs < startNs)
+					continue;
+				CBenchmarkRunner::Append(json, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f",
+					count > 0 ? "," : "", event.pName, event.pCategory, event.phase, (event.startNs - startNs) / 1000.0);
+				if(event.phase == 'i')
+					CBenchmarkRunner::Append(json, ",\"s\":\"p\"");
+				else
+					CBenchmarkRunner::Append(json, ",\"dur\":%.3f", event.durationNs / 1000.0);
+				CBenchmarkRunner::Append(json, ",\"pid\":1,\"tid\":%d}", buffer.GetThreadId());
+				count++;
+			}
+		}
+		json += "\n]}\n";
+		return count;
+	}
+
+	bool Save(const std::string& path)
+	{
+		std::string json;
+		Write(json);
+		CNativeFile file;
+		return file.Open(path, CNativeFile::OpenCreate) && file.Write(json.data(), json.size());
+	}
+
+private:
+	CCritSec m_cs;
+	std::vector<CTraceBuffer*> m_buffers;
+	std::vector<TraceEvent> m_events;   // Write() scratch
+	volatile int32_t m_nextThreadId;
+	volatile int64_t m_startNs;
+
+	static volatile int32_t& EnabledFlag()
+	{
+		static volatile int32_t s_bEnabled = 0;
+		return s_bEnabled;
+	}
+
+	static CTraceBuffer*& ThreadBufferSlot()
+	{
+		static SYNRC_THREAD_LOCAL CTraceBuffer* s_pBuffer = NULL;
+		return s_pBuffer;
+	}
+
+	static const char*& ThreadNameSlot()
+	{
+		static SYNRC_THREAD_LOCAL const char* s_pName = NULL;
+		return s_pName;
+	}
+
+	// the calling thread's ring, made on its first event and kept for the
+	// tracer's life, so the timeline still has threads that ended
+	CTraceBuffer& GetThreadBuffer()
+	{
+		CTraceBuffer*& pBuffer = ThreadBufferSlot();
+		if(pBuffer == NULL) {
+			pBuffer = new CTraceBuffer(AtomicIncrement(&m_nextThreadId));
+			pBuffer->SetThreadName(ThreadNameSlot());
+			CAutoLock lock(m_cs);
+			m_buffers.push_back(pBuffer);
+		}
+		return *pBuffer;
+	}
+
+	CEventTracer(const CEventTracer&);
+	CEventTracer& operator=(const CEventTracer&);
+};
+
+// a point in time, such as the first paint
+inline void TraceInstant(const char* pName, const char* pCategory)
+{
+	if(CEventTracer::IsEnabled())
+		CEventTracer::GetDefault().Add(pName, pCategory, GetTimeNs(), 0, 'i');
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CTraceScope - records a block as a complete event
+
+class CTraceScope
+{
+public:
+	// pName and pCategory must be literals; nothing happens while disabled
+	CTraceScope(const char* pName, const char* pCategory) :
+		m_pName(CEventTracer::IsEnabled() ? pName : NULL), m_pCategory(pCategory),
+		m_startNs(m_pName != NULL ? GetTimeNs() : 0)
+	{
+	}
+
+	~CTraceScope()
+	{
+		if(m_pName != NULL)
+			CEventTracer::GetDefault().Add(m_pName, m_pCategory, m_startNs, GetTimeNs() - m_startNs);
+	}
+
+private:
+	const char* m_pName;
+	const char* m_pCategory;
+	uint64_t m_startNs;
+
+	CTraceScope(const CTraceScope&);
+	CTraceScope& operator=(const CTraceScope&);
+};
+
+}; // namespace Synrc
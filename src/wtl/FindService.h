@@ -0,0 +1,181 @@
+// FindService.h
+//
+//  Type-to-jump for the owner-data list view. The control turns typed
+//  characters into LVN_ODFINDITEM requests (LVFI_PARTIAL | LVFI_WRAP with the
+//  incremental search string); answering them by walking the items is linear
+//  in the list size. Here the typed text becomes a primary collation key, and
+//  since the sorted order is sorted by the same keys, the matching rows form
+//  one run that two binary searches find: O(log n) memcmps per keystroke.
+
+#pragma once
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "Collation.h"
+#include "SortEngine.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CFindService - prefix and exact lookups in the displayed sort order
+
+namespace Synrc
+{
+
+class CFindService
+{
+public:
+	enum
+	{
+		FindPartial = 0x01,     // prefix match, as LVFI_PARTIAL
+		FindWrap = 0x02         // continue from the top of the range, as LVFI_WRAP
+	};
+
+	enum { NoPosition = 0xFFFFFFFF };
+
+	// pCollator must be the key builder of the searched fields, NULL for the
+	// engine's root collation
+	explicit CFindService(CSortEngine& engine, const CCollator* pCollator = NULL) :
+		m_engine(engine), m_collator(pCollator ? *pCollator : engine.GetCollator()),
+		m_field(FieldName), m_bDescending(false), m_first(0), m_count(NoPosition)
+	{
+	}
+
+	// the column and direction the view is sorted by
+	void SetOrder(ContactField field, bool bDescending)
+	{
+		m_field = field;
+		m_bDescending = bDescending;
+	}
+
+	// Limits lookups to positions [first, first + count) of the order, e.g.
+	// the group the caret is in; positions stay relative to the whole order.
+	void SetRange(uint32_t first, uint32_t count)
+	{
+		m_first = first;
+		m_count = count;
+	}
+
+	void ClearRange()
+	{
+		m_first = 0;
+		m_count = NoPosition;
+	}
+
+	// Position of the first match at or after start, NoPosition if none.
+	uint32_t Find(const wchar_t* pText, size_t cch, uint32_t start, uint32_t flags = FindPartial | FindWrap)
+	{
+		uint32_t first = 0;
+		uint32_t count = 0;
+		if(!FindRun(pText, cch, (flags & FindPartial) != 0, first, count))
+			return NoPosition;
+		if(start < first)
+			return first;
+		if(start < first + count)
+			return start;
+		return (flags & FindWrap) ? first : NoPosition;
+	}
+
+	// Every position of the range whose text matches, as one run.
+	bool FindRun(const wchar_t* pText, size_t cch, bool bPartial, uint32_t& first, uint32_t& count)
+	{
+		const std::vector<uint32_t>& rows = m_engine.GetOrder(m_field, m_bDescending);
+		const CSortKeyColumn& keys = m_engine.GetKeys(m_field);
+		uint32_t lo = m_first < rows.size() ? m_first : (uint32_t)rows.size();
+		uint32_t hi = m_count < rows.size() - lo ? lo + m_count : (uint32_t)rows.size();
+
+		m_query.clear();
+		m_collator.AppendPrimaryKey(pText, cch, m_query);
+		MatchLess less(keys, m_query, bPartial, m_bDescending);
+		first = LowerBound(rows, lo, hi, less, false);
+		uint32_t last = LowerBound(rows, first, hi, less, true);
+		count = last - first;
+		return count > 0;
+	}
+
+	// The rows of the run FindRun() finds, for a list that does not show
+	// them in the sort order.
+	bool FindRunRows(const wchar_t* pText, size_t cch, bool bPartial, std::vector<uint32_t>& rows)
+	{
+		uint32_t first = 0;
+		uint32_t count = 0;
+		rows.clear();
+		if(!FindRun(pText, cch, bPartial, first, count))
+			return false;
+		const std::vector<uint32_t>& order = m_engine.GetOrder(m_field, m_bDescending);
+		rows.assign(order.begin() + first, order.begin() + first + count);
+		return true;
+	}
+
+private:
+	// Orders a key against the query: 0 for a match, otherwise the side of
+	// the run it is on. Keys compare by their first query-length bytes; an
+	// exact match also needs the primary part to end there, and the 0 byte
+	// before the tertiary part sorts below any weight.
+	struct MatchLess
+	{
+		const CSortKeyColumn& keys;
+		const std::string& query;
+		bool bPartial;
+		bool bDescending;
+
+		MatchLess(const CSortKeyColumn& k, const std::string& q, bool bP, bool bDesc) :
+			keys(k), query(q), bPartial(bP), bDescending(bDesc)
+		{
+		}
+
+		int Compare(uint32_t row) const
+		{
+			uint32_t cb = 0;
+			const unsigned char* pKey = keys.GetKey(row, cb);
+			uint32_t cbQuery = (uint32_t)query.size();
+			int result = memcmp(pKey, query.data(), cb < cbQuery ? cb : cbQuery);
+			if(result != 0)
+				result = result < 0 ? -1 : 1;
+			else if(cb < cbQuery)
+				result = -1;
+			else if(!bPartial && cb > cbQuery && pKey[cbQuery] != 0)
+				result = 1;
+			return bDescending ? -result : result;
+		}
+
+		// before the run, or (bEnd) before or inside it
+		bool IsBefore(uint32_t row, bool bEnd) const
+		{
+			int result = Compare(row);
+			return bEnd ? result <= 0 : result < 0;
+		}
+
+	private:
+		MatchLess& operator=(const MatchLess&);
+	};
+
+	CSortEngine& m_engine;
+	const CCollator& m_collator;
+	ContactField m_field;
+	bool m_bDescending;
+	uint32_t m_first;
+	uint32_t m_count;
+	std::string m_query;
+
+	static uint32_t LowerBound(const std::vector<uint32_t>& rows, uint32_t lo, uint32_t hi, const MatchLess& less, bool bEnd)
+	{
+		while(lo < hi) {
+			uint32_t mid = lo + (hi - lo) / 2;
+			if(less.IsBefore(rows[mid], bEnd))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+
+	CFindService(const CFindService&);
+	CFindService& operator=(const CFindService&);
+};
+
+}; // namespace Synrc
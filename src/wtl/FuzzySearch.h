@@ -0,0 +1,574 @@
+// FuzzySearch.h
+//
+//  Typo tolerant search: "Sokhatski" finds "Sokhatsky". The words of a
+//  field are indexed by their primary collation keys (so case and accents
+//  never count as typos) in a trie, each distinct word with the rows that
+//  contain it. A query word walks the trie with a Levenshtein automaton:
+//  its state is the edit distance row of the query against the path so
+//  far, one row per trie level, and a subtree is skipped as soon as every
+//  entry of the row is over the bound. Swapping two adjacent letters is one
+//  edit. Only the few thousand nodes near the query are visited, so a
+//  search over a million contacts takes milliseconds.
+//
+//  Edits after the build are not patched into the trie: their rows are
+//  checked one by one until there are enough of them to rebuild.
+//
+//  Threading: the index has its own lock. Store notifications on the
+//  owning thread take it briefly; searches on pool threads take it and
+//  then the store's lock, never the other way round.
+
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Platform.h"
+#include "Collation.h"
+#include "ContactStore.h"
+#include "EventTrace.h"
+#include "ProgressiveResults.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CFuzzyIndex - trie of a field's words, searched within an edit bound
+// CFuzzyCursor - the rows of a fuzzy search as a result cursor
+// CFallbackCursor - exact matches, fuzzy ones when there are none
+
+namespace Synrc
+{
+
+struct FuzzySearchStats
+{
+	uint64_t searches;
+	uint64_t nodesVisited;
+	uint64_t tokensMatched;
+	uint64_t rebuilds;
+
+	FuzzySearchStats() : searches(0), nodesVisited(0), tokensMatched(0), rebuilds(0)
+	{
+	}
+};
+
+class CFuzzyIndex : public IContactStoreObserver
+{
+public:
+	enum
+	{
+		MaxTokenBytes = 48,     // longer words are indexed by their start
+		MaxEdits = 2,
+		RebuildRows = 4096      // edited rows checked one by one before a rebuild
+	};
+
+	CFuzzyIndex(CContactStore& store, ContactField field, const CCollator& collator) :
+		m_store(store), m_field(field), m_collator(collator), m_bStale(true)
+	{
+		m_store.AddObserver(this);
+	}
+
+	~CFuzzyIndex()
+	{
+		m_store.RemoveObserver(this);
+	}
+
+	// Edits allowed for a word of this many letters: none up to two, one
+	// up to five, then two.
+	static uint32_t GetDefaultMaxEdits(size_t letters)
+	{
+		return letters <= 2 ? 0 : letters <= 5 ? 1 : 2;
+	}
+
+	// Builds now instead of on the next search.
+	void Rebuild()
+	{
+		CAutoLock lock(m_cs);
+		CAutoLock storeLock(m_store.GetLock());
+		Build();
+	}
+
+	// Ascending rows whose field has, for every word of text, a word within
+	// GetDefaultMaxEdits() of it; with bPrefixLast the last word only has
+	// to be close to the start of one, as while typing.
+	void Search(const std::wstring& text, std::vector<uint32_t>& rows, bool bPrefixLast = true)
+	{
+		rows.clear();
+		std::string key;
+		m_collator.AppendPrimaryKey(text.data(), text.size(), key);
+		std::vector<std::string> words;
+		SplitWords(key, words);
+		if(words.empty())
+			return;
+
+		CAutoLock lock(m_cs);
+		CAutoLock storeLock(m_store.GetLock());
+		if(m_bStale)
+			Build();
+		m_stats.searches++;
+
+		std::vector<uint32_t> matches;
+		for(size_t w = 0; w < words.size(); w++) {
+			bool bPrefix = bPrefixLast && w + 1 == words.size();
+			MatchWord(words[w], GetDefaultMaxEdits(words[w].size()), bPrefix, matches);
+			if(w == 0) {
+				rows.swap(matches);
+			}
+			else {
+				std::vector<uint32_t>::iterator end = std::set_intersection(rows.begin(), rows.end(),
+					matches.begin(), matches.end(), rows.begin());
+				rows.erase(end, rows.end());
+			}
+			if(rows.empty())
+				break;
+		}
+		// stale postings of removed and edited rows go; edited ones are checked as they are now
+		size_t kept = 0;
+		for(size_t i = 0; i < rows.size(); i++) {
+			if(m_store.IsLive(rows[i]) && !std::binary_search(m_dirty.begin(), m_dirty.end(), rows[i]))
+				rows[kept++] = rows[i];
+		}
+		rows.resize(kept);
+		size_t clean = rows.size();
+		for(size_t i = 0; i < m_dirty.size(); i++) {
+			if(m_store.IsLive(m_dirty[i]) && MatchRow(m_dirty[i], words, bPrefixLast))
+				rows.push_back(m_dirty[i]);
+		}
+		std::inplace_merge(rows.begin(), rows.begin() + clean, rows.end());
+	}
+
+	// Edit distance of word to token (or to its closest start with
+	// bPrefix), both primary keys; bound + 1 once it is over bound.
+	static uint32_t GetDistance(const std::string& word, const std::string& token, uint32_t bound, bool bPrefix)
+	{
+		size_t m = word.size() < MaxTokenBytes ? word.size() : (size_t)MaxTokenBytes;
+		size_t n = token.size() < MaxTokenBytes ? token.size() : (size_t)MaxTokenBytes;
+		uint8_t rows[3][MaxTokenBytes + 1];
+		for(size_t j = 0; j <= m; j++)
+			rows[0][j] = (uint8_t)j;
+		uint32_t best = bPrefix ? rows[0][m] : bound + 1;
+		for(size_t i = 1; i <= n; i++) {
+			uint8_t* pRow = rows[i % 3];
+			const uint8_t* pUp = rows[(i - 1) % 3];
+			const uint8_t* pUpUp = rows[(i + 1) % 3];
+			if(!NextRow(word.data(), m, (uint8_t)token[i - 1], i >= 2 ? (uint8_t)token[i - 2] : 0,
+				pUp, i >= 2 ? pUpUp : NULL, pRow, (uint8_t)i, bound))
+				break;
+			if(bPrefix && pRow[m] < best)
+				best = pRow[m];
+			if(i == n && !bPrefix)
+				best = pRow[m];
+		}
+		if(n == 0 && !bPrefix)
+			best = (uint32_t)m;
+		return best <= bound ? best : bound + 1;
+	}
+
+	size_t GetTokenCount() const
+	{
+		return m_tokenStarts.empty() ? 0 : m_tokenStarts.size() - 1;
+	}
+
+	size_t GetNodeCount() const
+	{
+		return m_nodes.size();
+	}
+
+	size_t GetMemoryUsage() const
+	{
+		return m_nodes.capacity() * sizeof(Node) + m_postings.capacity() * sizeof(uint32_t) +
+			m_tokenStarts.capacity() * sizeof(uint32_t) + m_dirty.capacity() * sizeof(uint32_t);
+	}
+
+	FuzzySearchStats GetStats()
+	{
+		CAutoLock lock(m_cs);
+		return m_stats;
+	}
+
+	// implementation of IContactStoreObserver
+	virtual void OnContactChanged(uint32_t row, ContactChange change)
+	{
+		CAutoLock lock(m_cs);
+		if(m_bStale)
+			return;
+		switch(change) {
+		case ContactAdded:
+		case ContactUpdated:
+			if(m_dirty.size() >= RebuildRows) {
+				m_bStale = true;
+				break;
+			}
+			m_dirty.insert(std::lower_bound(m_dirty.begin(), m_dirty.end(), row), row);
+			if(m_dirty.size() > 1 && std::adjacent_find(m_dirty.begin(), m_dirty.end()) != m_dirty.end())
+				m_dirty.erase(std::unique(m_dirty.begin(), m_dirty.end()), m_dirty.end());
+			break;
+		case ContactRemoved:
+		case ContactsRemoved:
+			break;              // postings of dead rows are skipped
+		case ContactsCleared:
+			m_bStale = true;
+			break;
+		}
+	}
+	// implementation of IContactStoreObserver
+
+private:
+	enum { NoToken = 0xFFFFFFFF };
+
+	// Children of a node are consecutive and sorted by byte. Trie order is
+	// token order, so a node's words are the token range [first, end).
+	struct Node
+	{
+		uint32_t firstChild;
+		uint32_t tokenFirst;
+		uint32_t tokenEnd;
+		uint16_t childCount;
+		uint8_t label;
+		uint8_t bTerminal;      // the word of tokenFirst ends here
+	};
+
+	CContactStore& m_store;
+	ContactField m_field;
+	const CCollator& m_collator;
+	CCritSec m_cs;
+	bool m_bStale;
+	std::vector<Node> m_nodes;              // [0] is the root
+	std::vector<uint32_t> m_tokenStarts;    // per token: its first posting
+	std::vector<uint32_t> m_postings;       // rows per token, ascending
+	std::vector<uint32_t> m_dirty;          // rows edited since the build, ascending
+	FuzzySearchStats m_stats;
+
+	// search scratch, under m_cs
+	std::string m_word;
+	size_t m_bound;
+	bool m_bPrefix;
+	uint8_t m_rows[MaxTokenBytes + 2][MaxTokenBytes + 1];
+	uint8_t m_path[MaxTokenBytes + 1];
+	std::vector<uint32_t> m_tokens;
+
+	// words of a primary key: runs between separator weights; the bytes
+	// of a character outside the tables stay together
+	static void SplitWords(const std::string& key, std::vector<std::string>& words)
+	{
+		words.clear();
+		size_t start = 0;
+		for(size_t i = 0; i <= key.size(); i++) {
+			if(i < key.size() && (uint8_t)key[i] == CCollator::WeightOther) {
+				i += CCollator::OtherBytes;
+				continue;
+			}
+			if(i == key.size() || (uint8_t)key[i] == CCollator::WeightSeparator) {
+				if(i > start)
+					words.push_back(key.substr(start, std::min(i - start, (size_t)MaxTokenBytes)));
+				start = i + 1;
+			}
+		}
+	}
+
+	void Build()
+	{
+		CTraceScope trace("index.fuzzy", "index");
+		typedef std::unordered_map<std::string, uint32_t> TokenMap;
+		TokenMap ids;
+		std::vector<std::pair<uint32_t, uint32_t> > pairs;     // token id, row
+		std::vector<std::string> words;
+		std::string key;
+		for(uint32_t row = 0; row < m_store.GetRowCount(); row++) {
+			if(!m_store.IsLive(row))
+				continue;
+			const std::wstring& text = m_store.GetField(row, m_field);
+			key.clear();
+			m_collator.AppendPrimaryKey(text.data(), text.size(), key);
+			SplitWords(key, words);
+			for(size_t w = 0; w < words.size(); w++) {
+				std::pair<TokenMap::iterator, bool> inserted = ids.insert(TokenMap::value_type(words[w], (uint32_t)ids.size()));
+				pairs.push_back(std::make_pair(inserted.first->second, row));
+			}
+		}
+
+		// token ids in byte order, the trie's order
+		std::vector<const std::string*> tokens(ids.size());
+		for(TokenMap::const_iterator it = ids.begin(); it != ids.end(); ++it)
+			tokens[it->second] = &it->first;
+		std::vector<uint32_t> order(tokens.size());
+		for(uint32_t i = 0; i < order.size(); i++)
+			order[i] = i;
+		std::sort(order.begin(), order.end(), CompareTokens(tokens));
+		std::vector<uint32_t> rank(order.size());
+		for(uint32_t i = 0; i < order.size(); i++)
+			rank[order[i]] = i;
+
+		// postings by counting sort; rows arrive ascending
+		m_tokenStarts.assign(order.size() + 1, 0);
+		for(size_t i = 0; i < pairs.size(); i++)
+			m_tokenStarts[rank[pairs[i].first] + 1]++;
+		for(size_t t = 0; t < order.size(); t++)
+			m_tokenStarts[t + 1] += m_tokenStarts[t];
+		std::vector<uint32_t> fill(m_tokenStarts.begin(), m_tokenStarts.end() - 1);
+		m_postings.resize(pairs.size());
+		for(size_t i = 0; i < pairs.size(); i++) {
+			uint32_t t = rank[pairs[i].first];
+			if(fill[t] > m_tokenStarts[t] && m_postings[fill[t] - 1] == pairs[i].second)
+				continue;       // the word twice in one field
+			m_postings[fill[t]++] = pairs[i].second;
+		}
+		// close the gaps the duplicates left
+		size_t out = 0;
+		for(size_t t = 0; t < order.size(); t++) {
+			uint32_t start = m_tokenStarts[t];
+			m_tokenStarts[t] = (uint32_t)out;
+			for(uint32_t p = start; p < fill[t]; p++)
+				m_postings[out++] = m_postings[p];
+		}
+		m_tokenStarts[order.size()] = (uint32_t)out;
+		m_postings.resize(out);
+
+		std::vector<const std::string*> sorted(order.size());
+		for(size_t i = 0; i < order.size(); i++)
+			sorted[i] = tokens[order[i]];
+		m_nodes.clear();
+		Node root = { 0, 0, (uint32_t)sorted.size(), 0, 0, 0 };
+		m_nodes.push_back(root);
+		BuildNode(0, sorted, 0);
+
+		m_dirty.clear();
+		m_bStale = false;
+		m_stats.rebuilds++;
+	}
+
+	struct CompareTokens
+	{
+		const std::vector<const std::string*>& tokens;
+
+		explicit CompareTokens(const std::vector<const std::string*>& tokens_) : tokens(tokens_)
+		{
+		}
+
+		bool operator()(uint32_t a, uint32_t b) const
+		{
+			return *tokens[a] < *tokens[b];
+		}
+	};
+
+	// children of the node covering sorted tokens [tokenFirst, tokenEnd)
+	// whose first depth bytes are the path to it
+	void BuildNode(uint32_t index, const std::vector<const std::string*>& sorted, size_t depth)
+	{
+		uint32_t first = m_nodes[index].tokenFirst;
+		uint32_t end = m_nodes[index].tokenEnd;
+		if(first < end && sorted[first]->size() == depth) {
+			m_nodes[index].bTerminal = 1;
+			first++;
+		}
+		uint32_t firstChild = (uint32_t)m_nodes.size();
+		uint16_t children = 0;
+		for(uint32_t t = first; t < end; ) {
+			uint8_t label = (uint8_t)(*sorted[t])[depth];
+			uint32_t next = t + 1;
+			while(next < end && (uint8_t)(*sorted[next])[depth] == label)
+				next++;
+			Node child = { 0, t, next, 0, label, 0 };
+			m_nodes.push_back(child);
+			children++;
+			t = next;
+		}
+		m_nodes[index].firstChild = firstChild;
+		m_nodes[index].childCount = children;
+		for(uint16_t c = 0; c < children; c++)
+			BuildNode(firstChild + c, sorted, depth + 1);
+	}
+
+	// Union of the postings of the tokens within bound of word, ascending.
+	void MatchWord(const std::string& word, uint32_t bound, bool bPrefix, std::vector<uint32_t>& rows)
+	{
+		m_word = word;
+		m_bound = bound;
+		m_bPrefix = bPrefix;
+		m_tokens.clear();
+		for(size_t j = 0; j <= word.size(); j++)
+			m_rows[0][j] = (uint8_t)j;
+		if(bPrefix && word.size() <= bound)
+			AddTokens(m_nodes[0].tokenFirst, m_nodes[0].tokenEnd);
+		else
+			Visit(0, 0);
+		m_stats.tokensMatched += m_tokens.size();
+
+		rows.clear();
+		for(size_t i = 0; i < m_tokens.size(); i++) {
+			uint32_t t = m_tokens[i];
+			rows.insert(rows.end(), m_postings.begin() + m_tokenStarts[t], m_postings.begin() + m_tokenStarts[t + 1]);
+		}
+		if(m_tokens.size() > 1) {
+			std::sort(rows.begin(), rows.end());
+			rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+		}
+	}
+
+	// children of the node at depth, whose distance row is m_rows[depth]
+	void Visit(uint32_t index, size_t depth)
+	{
+		if(depth >= MaxTokenBytes)
+			return;
+		const Node& node = m_nodes[index];
+		size_t m = m_word.size();
+		for(uint16_t c = 0; c < node.childCount; c++) {
+			uint32_t childIndex = node.firstChild + c;
+			const Node& child = m_nodes[childIndex];
+			m_stats.nodesVisited++;
+			m_path[depth] = child.label;
+			if(!NextRow(m_word.data(), m, child.label, depth > 0 ? m_path[depth - 1] : 0, m_rows[depth],
+				depth > 0 ? m_rows[depth - 1] : NULL, m_rows[depth + 1], (uint8_t)(depth + 1), (uint32_t)m_bound))
+				continue;
+			const uint8_t* pRow = m_rows[depth + 1];
+			if(m_bPrefix && pRow[m] <= m_bound) {
+				AddTokens(child.tokenFirst, child.tokenEnd);    // every word below starts close enough
+				continue;
+			}
+			if(child.bTerminal && pRow[m] <= m_bound)
+				m_tokens.push_back(child.tokenFirst);
+			Visit(childIndex, depth + 1);
+		}
+	}
+
+	void AddTokens(uint32_t first, uint32_t end)
+	{
+		for(uint32_t t = first; t < end; t++)
+			m_tokens.push_back(t);
+	}
+
+	// The automaton's step on byte c (after previous byte prev): the next
+	// distance row from pUp and, for transpositions, pUpUp (NULL on the
+	// first level). False when every entry is over bound, as then no word
+	// below can come back within it.
+	static bool NextRow(const char* pWord, size_t m, uint8_t c, uint8_t prev, const uint8_t* pUp,
+		const uint8_t* pUpUp, uint8_t* pRow, uint8_t first, uint32_t bound)
+	{
+		pRow[0] = first;
+		uint32_t least = first;
+		for(size_t j = 1; j <= m; j++) {
+			uint8_t q = (uint8_t)pWord[j - 1];
+			uint32_t cost = pUp[j - 1] + (q == c ? 0 : 1);
+			if(pUp[j] + 1u < cost)
+				cost = pUp[j] + 1u;
+			if(pRow[j - 1] + 1u < cost)
+				cost = pRow[j - 1] + 1u;
+			if(pUpUp != NULL && j >= 2 && q == prev && (uint8_t)pWord[j - 2] == c && pUpUp[j - 2] + 1u < cost)
+				cost = pUpUp[j - 2] + 1u;
+			pRow[j] = (uint8_t)(cost < 255 ? cost : 255);
+			if(cost < least)
+				least = cost;
+		}
+		return least <= bound;
+	}
+
+	// the row's current text against the query, for rows edited since the build
+	bool MatchRow(uint32_t row, const std::vector<std::string>& queryWords, bool bPrefixLast)
+	{
+		const std::wstring& text = m_store.GetField(row, m_field);
+		std::string key;
+		m_collator.AppendPrimaryKey(text.data(), text.size(), key);
+		std::vector<std::string> words;
+		SplitWords(key, words);
+		for(size_t q = 0; q < queryWords.size(); q++) {
+			bool bPrefix = bPrefixLast && q + 1 == queryWords.size();
+			uint32_t bound = GetDefaultMaxEdits(queryWords[q].size());
+			bool bFound = false;
+			for(size_t w = 0; w < words.size() && !bFound; w++)
+				bFound = GetDistance(queryWords[q], words[w], bound, bPrefix) <= bound;
+			if(!bFound)
+				return false;
+		}
+		return true;
+	}
+
+	CFuzzyIndex(const CFuzzyIndex&);
+	CFuzzyIndex& operator=(const CFuzzyIndex&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CFuzzyCursor - the rows of a fuzzy search as a result cursor
+
+class CFuzzyCursor : public IResultCursor
+{
+public:
+	enum { FetchRows = 4096 };
+
+	CFuzzyCursor(CFuzzyIndex& index, const std::wstring& text) :
+		m_index(index), m_text(text), m_bSearched(false), m_next(0)
+	{
+	}
+
+	// the search runs on the first call, the rows come a batch at a time
+	virtual bool Fetch(std::vector<uint32_t>& rows)
+	{
+		if(!m_bSearched) {
+			m_index.Search(m_text, m_rows);
+			m_bSearched = true;
+		}
+		size_t end = m_rows.size() - m_next > FetchRows ? m_next + FetchRows : m_rows.size();
+		rows.insert(rows.end(), m_rows.begin() + m_next, m_rows.begin() + end);
+		m_next = end;
+		return m_next < m_rows.size();
+	}
+
+private:
+	CFuzzyIndex& m_index;
+	std::wstring m_text;
+	bool m_bSearched;
+	std::vector<uint32_t> m_rows;
+	size_t m_next;
+
+	CFuzzyCursor(const CFuzzyCursor&);
+	CFuzzyCursor& operator=(const CFuzzyCursor&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CFallbackCursor - exact matches, fuzzy ones when there are none
+
+class CFallbackCursor : public IResultCursor
+{
+public:
+	// takes both cursors; pFallback only runs when pExact found nothing
+	CFallbackCursor(IResultCursor* pExact, IResultCursor* pFallback) :
+		m_pExact(pExact), m_pFallback(pFallback), m_found(0), m_bFallingBack(false)
+	{
+	}
+
+	virtual ~CFallbackCursor()
+	{
+		delete m_pExact;
+		delete m_pFallback;
+	}
+
+	virtual bool Fetch(std::vector<uint32_t>& rows)
+	{
+		if(m_bFallingBack)
+			return m_pFallback->Fetch(rows);
+		size_t before = rows.size();
+		bool bMore = m_pExact->Fetch(rows);
+		m_found += rows.size() - before;
+		if(bMore || m_found > 0)
+			return bMore;
+		m_bFallingBack = true;
+		return true;
+	}
+
+	// true once the exact search came up empty
+	bool IsFallingBack() const
+	{
+		return m_bFallingBack;
+	}
+
+private:
+	IResultCursor* m_pExact;
+	IResultCursor* m_pFallback;
+	size_t m_found;
+	bool m_bFallingBack;
+
+	CFallbackCursor(const CFallbackCursor&);
+	CFallbackCursor& operator=(const CFallbackCursor&);
+};
+
+}; // namespace Synrc
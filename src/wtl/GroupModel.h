@@ -0,0 +1,667 @@
+// GroupModel.h
+//
+//  Grouping of the owner-data list by the value of one field (company,
+//  city, ...). With thousands of groups, creating every LVGROUP up front
+//  and recounting membership on each edit does not scale, so:
+//   - counts are kept per group and patched as contacts change;
+//   - item positions come from a Fenwick tree over the visible group
+//     sizes, so item <-> group lookups and collapse/expand are O(log groups)
+//     and never walk the members;
+//   - list view headers are only created for groups that come into view;
+//     a second tree over the created ones gives each its LVGROUP index.
+//
+//  Groups are ordered by the primary collation key of their value, so
+//  values differing in case or accents share a group. Members of a group
+//  are kept in store row order.
+//
+//  A few groups can be pinned above the others, in slot order, with rows
+//  the caller picks in the caller's order: the most used contacts (see
+//  UsageTracker.h), upcoming birthdays (see DateIndex.h). Those rows show
+//  there and in their own group as well.
+
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Platform.h"
+#include "Collation.h"
+#include "ContactStore.h"
+#include "EventTrace.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CFenwickTree - prefix sums with O(log n) update and search
+// CGroupModel - incrementally maintained groups of the list
+
+namespace Synrc
+{
+
+class CFenwickTree
+{
+public:
+	void Reset(const std::vector<uint32_t>& values)
+	{
+		m_tree.assign(values.size() + 1, 0);
+		for(size_t i = 0; i < values.size(); i++) {
+			m_tree[i + 1] += values[i];
+			size_t parent = (i + 1) + ((i + 1) & (0 - (i + 1)));
+			if(parent < m_tree.size())
+				m_tree[parent] += m_tree[i + 1];
+		}
+	}
+
+	size_t GetSize() const
+	{
+		return m_tree.empty() ? 0 : m_tree.size() - 1;
+	}
+
+	void Add(size_t index, int64_t delta)
+	{
+		for(size_t i = index + 1; i < m_tree.size(); i += i & (0 - i))
+			m_tree[i] = (uint32_t)((int64_t)m_tree[i] + delta);
+	}
+
+	// sum of the first count values
+	uint32_t GetPrefix(size_t count) const
+	{
+		uint32_t sum = 0;
+		for(size_t i = count; i > 0; i -= i & (0 - i))
+			sum += m_tree[i];
+		return sum;
+	}
+
+	// index of the value covering offset, i.e. the last index whose prefix is <= offset
+	size_t Find(uint32_t offset) const
+	{
+		size_t index = 0;
+		size_t step = 1;
+		while(step * 2 < m_tree.size())
+			step *= 2;
+		for(; step > 0; step /= 2) {
+			if(index + step < m_tree.size() && m_tree[index + step] <= offset) {
+				index += step;
+				offset -= m_tree[index];
+			}
+		}
+		return index;
+	}
+
+private:
+	std::vector<uint32_t> m_tree;       // 1-based
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CGroupModel - incrementally maintained groups of the list
+
+class CGroupModel : public IContactStoreObserver
+{
+public:
+	enum { NoGroup = 0xFFFFFFFF };
+
+	// pCollator must outlive the model, NULL for the root collation
+	CGroupModel(CContactStore& store, ContactField field, const CCollator* pCollator = NULL) :
+		m_store(store), m_field(field), m_pCollator(pCollator ? pCollator : &m_collator), m_visibleItems(0),
+		m_layoutVersion(0)
+	{
+		m_store.AddObserver(this);
+		Rebuild();
+	}
+
+	~CGroupModel()
+	{
+		m_store.RemoveObserver(this);
+	}
+
+	// Full build from the store; edits after that are patched in.
+	void Rebuild()
+	{
+		CTraceScope trace("index.groups", "index");
+		for(uint32_t id = 0; id < m_groups.size(); id++) {
+			if(m_groups[id].bHeader)
+				m_removedHeaders.push_back(id);
+		}
+		std::vector<std::wstring> pinnedLabels(m_pinnedIds.size());
+		std::vector<std::vector<uint32_t> > pinnedRows(m_pinnedIds.size());
+		for(size_t slot = 0; slot < m_pinnedIds.size(); slot++) {
+			if(m_pinnedIds[slot] != NoGroup) {
+				pinnedLabels[slot].swap(m_groups[m_pinnedIds[slot]].label);
+				pinnedRows[slot].swap(m_groups[m_pinnedIds[slot]].rows);
+			}
+		}
+		m_pinnedIds.clear();
+		m_resizedHeaders.clear();
+		m_groups.clear();
+		m_groupByKey.clear();
+		m_rowGroup.assign(m_store.GetRowCount(), (uint32_t)NoGroup);
+		for(uint32_t row = 0; row < m_store.GetRowCount(); row++) {
+			if(!m_store.IsLive(row))
+				continue;
+			uint32_t id = FindOrAddGroup(row);
+			m_groups[id].rows.push_back(row);
+			m_rowGroup[row] = id;
+		}
+		Reorder();
+		for(uint32_t slot = 0; slot < pinnedRows.size(); slot++) {
+			if(!pinnedRows[slot].empty())
+				SetPinnedRows(slot, pinnedLabels[slot], pinnedRows[slot]);
+		}
+	}
+
+	// Shows the live ones of rows, in this order, in a group above all the
+	// others and the pinned groups of later slots; they stay in their own
+	// groups too. No rows hides the group. Only a change of size touches
+	// the positions: O(log groups).
+	void SetPinnedRows(uint32_t slot, const std::wstring& label, const std::vector<uint32_t>& rows)
+	{
+		if(slot >= m_pinnedIds.size())
+			m_pinnedIds.resize(slot + 1, (uint32_t)NoGroup);
+		if(m_pinnedIds[slot] == NoGroup) {
+			Group group;
+			group.position = (uint32_t)NoGroup;
+			group.pinnedSlot = slot;
+			group.bCollapsed = false;
+			group.bHeader = false;
+			group.bResized = false;
+			m_pinnedIds[slot] = (uint32_t)m_groups.size();
+			m_groups.push_back(group);
+		}
+		uint32_t id = m_pinnedIds[slot];
+		Group& group = m_groups[id];
+		group.label = label;
+		size_t oldSize = group.rows.size();
+		group.rows.clear();
+		for(size_t i = 0; i < rows.size(); i++) {
+			if(rows[i] < m_rowGroup.size() && m_rowGroup[rows[i]] != NoGroup)
+				group.rows.push_back(rows[i]);
+		}
+		OnPinnedResized(id, oldSize);
+	}
+
+	bool IsPinned(uint32_t position) const
+	{
+		return m_groups[m_order[position]].pinnedSlot != NoGroup;
+	}
+
+	// non-empty groups, in display order
+	uint32_t GetGroupCount() const
+	{
+		return (uint32_t)m_order.size();
+	}
+
+	// items shown, members of collapsed groups excluded
+	uint32_t GetItemCount() const
+	{
+		return m_visibleItems;
+	}
+
+	// stable for the life of the group, usable as LVGROUP::iGroupId
+	uint32_t GetGroupId(uint32_t position) const
+	{
+		return m_order[position];
+	}
+
+	const std::wstring& GetGroupLabel(uint32_t position) const
+	{
+		return m_groups[m_order[position]].label;
+	}
+
+	uint32_t GetGroupSize(uint32_t position) const
+	{
+		return (uint32_t)m_groups[m_order[position]].rows.size();
+	}
+
+	// members in the order they are shown, collapsed or not
+	const std::vector<uint32_t>& GetGroupRows(uint32_t position) const
+	{
+		return m_groups[m_order[position]].rows;
+	}
+
+	// first item of the group; where it would be if collapsed
+	uint32_t GetGroupStart(uint32_t position) const
+	{
+		return m_visible.GetPrefix(position);
+	}
+
+	bool IsCollapsed(uint32_t position) const
+	{
+		return m_groups[m_order[position]].bCollapsed;
+	}
+
+	// Only the position mapping changes; membership is left alone.
+	void SetCollapsed(uint32_t position, bool bCollapsed)
+	{
+		Group& group = m_groups[m_order[position]];
+		if(group.bCollapsed == bCollapsed)
+			return;
+		group.bCollapsed = bCollapsed;
+		m_layoutVersion++;
+		int64_t delta = bCollapsed ? -(int64_t)group.rows.size() : (int64_t)group.rows.size();
+		m_visible.Add(position, delta);
+		m_visibleItems = (uint32_t)(m_visibleItems + delta);
+	}
+
+	// group position of a visible item, NoGroup past the end
+	uint32_t GetItemGroup(uint32_t item) const
+	{
+		if(item >= m_visibleItems)
+			return NoGroup;
+		return (uint32_t)m_visible.Find(item);
+	}
+
+	uint32_t GetItemInGroup(uint32_t position, uint32_t index) const
+	{
+		return GetGroupStart(position) + index;
+	}
+
+	// store row shown at a visible item
+	uint32_t GetRow(uint32_t item) const
+	{
+		uint32_t position = GetItemGroup(item);
+		if(position == NoGroup)
+			return CContactStore::NoRow;
+		return m_groups[m_order[position]].rows[item - GetGroupStart(position)];
+	}
+
+	// Item showing the row in its own group, not a pinned one; NoGroup when
+	// the row is not shown. O(log groups + log members).
+	uint32_t GetRowItem(uint32_t row) const
+	{
+		if(row >= m_rowGroup.size() || m_rowGroup[row] == NoGroup)
+			return NoGroup;
+		const Group& group = m_groups[m_rowGroup[row]];
+		if(group.bCollapsed || group.position == NoGroup)
+			return NoGroup;
+		std::vector<uint32_t>::const_iterator it = std::lower_bound(group.rows.begin(), group.rows.end(), row);
+		return GetGroupStart(group.position) + (uint32_t)(it - group.rows.begin());
+	}
+
+	// changes whenever items may show other rows than before: edits,
+	// collapsing, pinned rows; a selection by item is stale after it
+	uint32_t GetLayoutVersion() const
+	{
+		return m_layoutVersion;
+	}
+
+	// Groups overlapping the items [first, last] that have no list view
+	// header yet, in position order; they count as created from now on, so
+	// insert them in that order. Called with cache hints.
+	void TakeMissingHeaders(uint32_t first, uint32_t last, std::vector<uint32_t>& positions)
+	{
+		positions.clear();
+		if(m_visibleItems == 0)
+			return;
+		uint32_t position = GetItemGroup(std::min(first, m_visibleItems - 1));
+		uint32_t end = GetItemGroup(std::min(last, m_visibleItems - 1));
+		for(; position <= end && position < m_order.size(); position++) {
+			if(!m_groups[m_order[position]].bHeader) {
+				MarkHeader(position);
+				positions.push_back(position);
+			}
+		}
+	}
+
+	// for a group asked about before any cache hint covered it
+	bool TakeMissingHeader(uint32_t position)
+	{
+		if(m_groups[m_order[position]].bHeader)
+			return false;
+		MarkHeader(position);
+		return true;
+	}
+
+	bool HasHeader(uint32_t position) const
+	{
+		return m_groups[m_order[position]].bHeader;
+	}
+
+	// index of the group among the created headers, i.e. in the list view
+	uint32_t GetHeaderIndex(uint32_t position) const
+	{
+		return m_headers.GetPrefix(position);
+	}
+
+	// position of the group with a created header at index
+	uint32_t GetHeaderPosition(uint32_t index) const
+	{
+		return (uint32_t)m_headers.Find(index);
+	}
+
+	// Created headers that went away (ids) and whose size changed
+	// (positions) since the last call.
+	void TakeHeaderChanges(std::vector<uint32_t>& removedIds, std::vector<uint32_t>& resizedPositions)
+	{
+		removedIds.swap(m_removedHeaders);
+		m_removedHeaders.clear();
+		resizedPositions.clear();
+		for(size_t i = 0; i < m_resizedHeaders.size(); i++) {
+			Group& group = m_groups[m_resizedHeaders[i]];
+			group.bResized = false;
+			if(group.bHeader && group.position != NoGroup)
+				resizedPositions.push_back(group.position);
+		}
+		m_resizedHeaders.clear();
+	}
+
+	// forget created headers, e.g. after the list view removed its groups
+	void ResetHeaders()
+	{
+		for(size_t i = 0; i < m_groups.size(); i++) {
+			m_groups[i].bHeader = false;
+			m_groups[i].bResized = false;
+		}
+		m_removedHeaders.clear();
+		m_resizedHeaders.clear();
+		RenumberFrom(m_order.size());
+	}
+
+	size_t GetMemoryUsage() const
+	{
+		size_t total = m_rowGroup.capacity() * sizeof(uint32_t) + m_order.capacity() * sizeof(uint32_t) * 3;
+		for(size_t i = 0; i < m_groups.size(); i++)
+			total += sizeof(Group) + m_groups[i].rows.capacity() * sizeof(uint32_t) + m_groups[i].key.capacity() +
+				m_groups[i].label.capacity() * sizeof(wchar_t);
+		return total;
+	}
+
+	virtual void OnContactChanged(uint32_t row, ContactChange change)
+	{
+		switch(change) {
+		case ContactAdded:
+			if(row >= m_rowGroup.size())
+				m_rowGroup.resize(row + 1, (uint32_t)NoGroup);
+			AddRow(row);
+			break;
+		case ContactUpdated:
+			if(m_rowGroup[row] != NoGroup) {
+				m_key.clear();
+				const std::wstring& text = m_store.GetField(row, m_field);
+				m_pCollator->AppendPrimaryKey(text.data(), text.size(), m_key);
+				if(m_key == m_groups[m_rowGroup[row]].key)
+					break;
+				RemoveRow(row);
+			}
+			AddRow(row);
+			break;
+		case ContactRemoved:
+			if(row < m_rowGroup.size() && m_rowGroup[row] != NoGroup)
+				RemoveRow(row);
+			RemovePinned(row);
+			break;
+		case ContactsRemoved:
+			for(size_t i = 0; i < m_groups.size(); i++) {
+				std::vector<uint32_t>& rows = m_groups[i].rows;
+				rows.erase(std::remove_if(rows.begin(), rows.end(), RowDead(m_store, m_rowGroup)), rows.end());
+			}
+			Reorder();
+			break;
+		case ContactsCleared:
+			Rebuild();
+			break;
+		}
+	}
+
+private:
+	struct Group
+	{
+		std::string key;
+		std::wstring label;             // value of the first member, as typed
+		std::vector<uint32_t> rows;     // ascending, but for the pinned group
+		uint32_t position;              // in m_order, NoGroup while empty
+		uint32_t pinnedSlot;            // first of all by slot, rows from SetPinnedRows(); NoGroup if not
+		bool bCollapsed;
+		bool bHeader;                   // the list view has an LVGROUP for it
+		bool bResized;                  // queued in m_resizedHeaders
+	};
+
+	typedef std::unordered_map<std::string, uint32_t> GroupMap;
+
+	CContactStore& m_store;
+	ContactField m_field;
+	CCollator m_collator;
+	const CCollator* m_pCollator;
+	std::vector<Group> m_groups;        // by id, empty groups included
+	GroupMap m_groupByKey;
+	std::vector<uint32_t> m_order;      // ids of the non-empty groups by key
+	std::vector<uint32_t> m_rowGroup;   // group id per store row, never a pinned one
+	std::vector<uint32_t> m_pinnedIds;  // group id per pinned slot, NoGroup if unused
+	CFenwickTree m_visible;             // visible items per position
+	CFenwickTree m_headers;             // 1 per position with a created header
+	uint32_t m_visibleItems;
+	uint32_t m_layoutVersion;
+	std::vector<uint32_t> m_removedHeaders;
+	std::vector<uint32_t> m_resizedHeaders;
+	std::string m_key;
+
+	struct RowDead
+	{
+		const CContactStore& store;
+		std::vector<uint32_t>& rowGroup;
+
+		RowDead(const CContactStore& s, std::vector<uint32_t>& r) : store(s), rowGroup(r)
+		{
+		}
+
+		bool operator()(uint32_t row) const
+		{
+			if(store.IsLive(row))
+				return false;
+			rowGroup[row] = (uint32_t)NoGroup;
+			return true;
+		}
+
+	private:
+		RowDead& operator=(const RowDead&);
+	};
+
+	struct KeyLess
+	{
+		const std::vector<Group>& groups;
+
+		explicit KeyLess(const std::vector<Group>& g) : groups(g)
+		{
+		}
+
+		bool operator()(uint32_t a, uint32_t b) const
+		{
+			if(groups[a].pinnedSlot != groups[b].pinnedSlot)
+				return groups[a].pinnedSlot < groups[b].pinnedSlot;
+			return groups[a].key < groups[b].key;
+		}
+
+	private:
+		KeyLess& operator=(const KeyLess&);
+	};
+
+	uint32_t FindOrAddGroup(uint32_t row)
+	{
+		const std::wstring& text = m_store.GetField(row, m_field);
+		m_key.clear();
+		m_pCollator->AppendPrimaryKey(text.data(), text.size(), m_key);
+		GroupMap::const_iterator it = m_groupByKey.find(m_key);
+		if(it != m_groupByKey.end())
+			return it->second;
+
+		Group group;
+		group.key = m_key;
+		group.label = text;
+		group.position = (uint32_t)NoGroup;
+		group.pinnedSlot = (uint32_t)NoGroup;
+		group.bCollapsed = false;
+		group.bHeader = false;
+		group.bResized = false;
+		uint32_t id = (uint32_t)m_groups.size();
+		m_groups.push_back(group);
+		m_groupByKey[m_key] = id;
+		return id;
+	}
+
+	// order, positions and visible sizes from scratch: O(groups)
+	void Reorder()
+	{
+		m_layoutVersion++;
+		m_order.clear();
+		for(uint32_t id = 0; id < m_groups.size(); id++) {
+			Group& group = m_groups[id];
+			if(!group.rows.empty()) {
+				m_order.push_back(id);
+				if(group.bHeader)
+					QueueResized(id);
+				continue;
+			}
+			group.position = (uint32_t)NoGroup;
+			if(group.bHeader) {
+				group.bHeader = false;
+				m_removedHeaders.push_back(id);
+			}
+		}
+		std::sort(m_order.begin(), m_order.end(), KeyLess(m_groups));
+		RenumberFrom(0);
+	}
+
+	void RenumberFrom(size_t first)
+	{
+		std::vector<uint32_t> sizes(m_order.size());
+		std::vector<uint32_t> headers(m_order.size());
+		m_visibleItems = 0;
+		for(size_t i = 0; i < m_order.size(); i++) {
+			Group& group = m_groups[m_order[i]];
+			if(i >= first)
+				group.position = (uint32_t)i;
+			sizes[i] = group.bCollapsed ? 0 : (uint32_t)group.rows.size();
+			headers[i] = group.bHeader ? 1 : 0;
+			m_visibleItems += sizes[i];
+		}
+		m_visible.Reset(sizes);
+		m_headers.Reset(headers);
+	}
+
+	void MarkHeader(uint32_t position)
+	{
+		m_groups[m_order[position]].bHeader = true;
+		m_headers.Add(position, 1);
+	}
+
+	void QueueResized(uint32_t id)
+	{
+		Group& group = m_groups[id];
+		if(group.bHeader && !group.bResized) {
+			group.bResized = true;
+			m_resizedHeaders.push_back(id);
+		}
+	}
+
+	void AddRow(uint32_t row)
+	{
+		uint32_t id = FindOrAddGroup(row);
+		Group& group = m_groups[id];
+		m_rowGroup[row] = id;
+		m_layoutVersion++;
+		if(group.rows.empty() || group.rows.back() < row)
+			group.rows.push_back(row);
+		else
+			group.rows.insert(std::lower_bound(group.rows.begin(), group.rows.end(), row), row);
+
+		if(group.position == NoGroup) {
+			// a new group shifts the positions after it
+			std::vector<uint32_t>::iterator it = std::lower_bound(m_order.begin(), m_order.end(), id, KeyLess(m_groups));
+			size_t position = it - m_order.begin();
+			m_order.insert(it, id);
+			RenumberFrom(position);
+		}
+		else {
+			if(!group.bCollapsed) {
+				m_visible.Add(group.position, 1);
+				m_visibleItems++;
+			}
+			QueueResized(id);
+		}
+	}
+
+	void RemoveRow(uint32_t row)
+	{
+		uint32_t id = m_rowGroup[row];
+		Group& group = m_groups[id];
+		m_rowGroup[row] = (uint32_t)NoGroup;
+		m_layoutVersion++;
+		std::vector<uint32_t>::iterator it = std::lower_bound(group.rows.begin(), group.rows.end(), row);
+		if(it != group.rows.end() && *it == row)
+			group.rows.erase(it);
+
+		if(group.rows.empty()) {
+			size_t position = group.position;
+			m_order.erase(m_order.begin() + position);
+			group.position = (uint32_t)NoGroup;
+			if(group.bHeader) {
+				group.bHeader = false;
+				m_removedHeaders.push_back(id);
+			}
+			RenumberFrom(position);
+		}
+		else {
+			if(!group.bCollapsed) {
+				m_visible.Add(group.position, -1);
+				m_visibleItems--;
+			}
+			QueueResized(id);
+		}
+	}
+
+	void RemovePinned(uint32_t row)
+	{
+		for(size_t slot = 0; slot < m_pinnedIds.size(); slot++) {
+			if(m_pinnedIds[slot] == NoGroup)
+				continue;
+			std::vector<uint32_t>& rows = m_groups[m_pinnedIds[slot]].rows;
+			std::vector<uint32_t>::iterator it = std::find(rows.begin(), rows.end(), row);
+			if(it == rows.end())
+				continue;
+			rows.erase(it);
+			OnPinnedResized(m_pinnedIds[slot], rows.size() + 1);
+		}
+	}
+
+	// A pinned group is among the first positions while it has rows.
+	void OnPinnedResized(uint32_t id, size_t oldSize)
+	{
+		Group& group = m_groups[id];
+		m_layoutVersion++;     // the rows may differ at the same size
+		if(group.rows.empty()) {
+			if(group.position == NoGroup)
+				return;
+			size_t position = group.position;
+			m_order.erase(m_order.begin() + position);
+			group.position = (uint32_t)NoGroup;
+			if(group.bHeader) {
+				group.bHeader = false;
+				m_removedHeaders.push_back(id);
+			}
+			RenumberFrom(position);
+			return;
+		}
+		if(group.position == NoGroup) {
+			std::vector<uint32_t>::iterator it = std::lower_bound(m_order.begin(), m_order.end(), id, KeyLess(m_groups));
+			size_t position = it - m_order.begin();
+			m_order.insert(it, id);
+			RenumberFrom(position);
+			return;
+		}
+		if(group.rows.size() == oldSize)
+			return;
+		if(!group.bCollapsed) {
+			int64_t delta = (int64_t)group.rows.size() - (int64_t)oldSize;
+			m_visible.Add(group.position, delta);
+			m_visibleItems = (uint32_t)(m_visibleItems + delta);
+		}
+		QueueResized(id);
+	}
+
+	CGroupModel(const CGroupModel&);
+	CGroupModel& operator=(const CGroupModel&);
+};
+
+}; // namespace Synrc
@@ -0,0 +1,288 @@
+// Latency.h
+//
+//  Latency histograms for the UI thread's message handlers (display info,
+//  custom draw stages, sizing, search updates). Each handler records its
+//  duration into a named histogram; the frame dumps snapshots when idle or
+//  on request, one JSON line per histogram.
+//
+//  The histograms are HDR style: 32 linear sub-buckets per power of two,
+//  so any value is kept to about 3% from 1 ns to a minute in 8 KB. Recording
+//  is a bucket index and an atomic add, no lock, from any thread; taking a
+//  snapshot subtracts what it read, so samples recorded meanwhile are kept
+//  for the next one.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+	#include <intrin.h>
+#endif
+
+#include "Platform.h"
+#include "Benchmark.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CLatencyHistogram - lock-free log-linear histogram of durations in ns
+// CLatencyRegistry - named histograms and their JSON snapshots
+// CLatencyScope - times a block into a histogram
+
+namespace Synrc
+{
+
+struct LatencySnapshot
+{
+	uint64_t count;
+	uint64_t sumNs;
+	uint64_t maxNs;
+
+	LatencySnapshot() : count(0), sumNs(0), maxNs(0)
+	{
+	}
+
+	double GetMeanNs() const
+	{
+		return count > 0 ? (double)sumNs / count : 0.0;
+	}
+};
+
+class CLatencyHistogram
+{
+public:
+	enum
+	{
+		SubBucketBits = 5,
+		SubBuckets = 1 << SubBucketBits,
+		MaxValueBits = 36,      // about 68 s; longer samples land in the top bucket
+		BucketCount = (MaxValueBits - SubBucketBits + 1) * SubBuckets
+	};
+
+	CLatencyHistogram()
+	{
+		Clear();
+	}
+
+	void Record(uint64_t ns)
+	{
+		AtomicAdd64(&m_counts[GetBucket(ns)], 1);
+		AtomicAdd64(&m_sumNs, (int64_t)ns);
+		int64_t max = AtomicLoad64(&m_maxNs);
+		while((int64_t)ns > max) {
+			int64_t previous = AtomicCompareExchange64(&m_maxNs, (int64_t)ns, max);
+			if(previous == max)
+				break;
+			max = previous;
+		}
+	}
+
+	// Copies the counts into counts (BucketCount of them); with bReset the
+	// copied samples are taken out, so the next snapshot is an interval.
+	void Snapshot(std::vector<uint64_t>& counts, LatencySnapshot& snapshot, bool bReset)
+	{
+		counts.resize(BucketCount);
+		snapshot.count = 0;
+		for(int i = 0; i < BucketCount; i++) {
+			int64_t count = AtomicLoad64(&m_counts[i]);
+			if(bReset && count != 0)
+				AtomicAdd64(&m_counts[i], -count);
+			counts[i] = (uint64_t)count;
+			snapshot.count += count;
+		}
+		int64_t sum = AtomicLoad64(&m_sumNs);
+		int64_t max = AtomicLoad64(&m_maxNs);
+		if(bReset) {
+			AtomicAdd64(&m_sumNs, -sum);
+			AtomicCompareExchange64(&m_maxNs, 0, max);
+		}
+		snapshot.sumNs = (uint64_t)sum;
+		snapshot.maxNs = (uint64_t)max;
+	}
+
+	void Clear()
+	{
+		for(int i = 0; i < BucketCount; i++)
+			AtomicStore64(&m_counts[i], 0);
+		AtomicStore64(&m_sumNs, 0);
+		AtomicStore64(&m_maxNs, 0);
+	}
+
+	static int GetBucket(uint64_t ns)
+	{
+		if(ns < SubBuckets)
+			return (int)ns;
+		int exponent = HighBit(ns) - SubBucketBits;
+		if(exponent >= MaxValueBits - SubBucketBits)
+			return BucketCount - 1;
+		return (exponent + 1) * SubBuckets + (int)(ns >> exponent) - SubBuckets;
+	}
+
+	// smallest value of a bucket
+	static uint64_t GetBucketFloor(int bucket)
+	{
+		if(bucket < SubBuckets)
+			return (uint64_t)bucket;
+		int exponent = bucket / SubBuckets - 1;
+		return (uint64_t)(bucket % SubBuckets + SubBuckets) << exponent;
+	}
+
+	// Value at quantile q (0..1) of snapshot counts, as the middle of its
+	// bucket; 0 for an empty snapshot.
+	static uint64_t GetQuantile(const std::vector<uint64_t>& counts, uint64_t total, double q)
+	{
+		if(total == 0)
+			return 0;
+		uint64_t rank = (uint64_t)(q * (total - 1)) + 1;
+		uint64_t seen = 0;
+		for(int i = 0; i < (int)counts.size(); i++) {
+			seen += counts[i];
+			if(seen >= rank) {
+				uint64_t floor = GetBucketFloor(i);
+				uint64_t next = i + 1 < BucketCount ? GetBucketFloor(i + 1) : floor + 1;
+				return floor + (next - floor) / 2;
+			}
+		}
+		return GetBucketFloor(BucketCount - 1);
+	}
+
+private:
+	volatile int64_t m_counts[BucketCount];
+	volatile int64_t m_sumNs;
+	volatile int64_t m_maxNs;
+
+	static int HighBit(uint64_t value)
+	{
+#ifdef _WIN32
+		unsigned long index;
+	#ifdef _WIN64
+		_BitScanReverse64(&index, value);
+	#else
+		if(value >> 32) {
+			_BitScanReverse(&index, (unsigned long)(value >> 32));
+			return (int)index + 32;
+		}
+		_BitScanReverse(&index, (unsigned long)value);
+	#endif
+		return (int)index;
+#else
+		return 63 - __builtin_clzll(value);
+#endif
+	}
+
+	CLatencyHistogram(const CLatencyHistogram&);
+	CLatencyHistogram& operator=(const CLatencyHistogram&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CLatencyRegistry - named histograms and their JSON snapshots
+
+class CLatencyRegistry
+{
+public:
+	enum { MaxHistograms = 64 };
+
+	CLatencyRegistry() : m_count(0)
+	{
+	}
+
+	~CLatencyRegistry()
+	{
+		for(int32_t i = 0; i < m_count; i++)
+			delete m_entries[i].pHistogram;
+	}
+
+	static CLatencyRegistry& GetDefault()
+	{
+		static CLatencyRegistry s_registry;
+		return s_registry;
+	}
+
+	// Histogram of a name, created on first use; look it up once and keep
+	// the pointer, it lives as long as the registry. NULL when full.
+	CLatencyHistogram* Get(const char* pName)
+	{
+		CAutoLock lock(m_cs);
+		for(int32_t i = 0; i < m_count; i++) {
+			if(m_entries[i].name == pName)
+				return m_entries[i].pHistogram;
+		}
+		if(m_count == MaxHistograms)
+			return NULL;
+		m_entries[m_count].name = pName;
+		m_entries[m_count].pHistogram = new CLatencyHistogram();
+		return m_entries[m_count++].pHistogram;
+	}
+
+	// One JSON line per histogram with samples, oldest registered first:
+	// {"name":...,"count":...,"mean_ns":...,"p50_ns":...,"p90_ns":...,
+	//  "p99_ns":...,"p999_ns":...,"max_ns":...}
+	// With bReset each dump covers the time since the previous one.
+	size_t Dump(std::string& output, bool bReset = true)
+	{
+		CAutoLock lock(m_cs);
+		size_t lines = 0;
+		LatencySnapshot snapshot;
+		for(int32_t i = 0; i < m_count; i++) {
+			m_entries[i].pHistogram->Snapshot(m_counts, snapshot, bReset);
+			if(snapshot.count == 0)
+				continue;
+			CBenchmarkRunner::Append(output, "{\"name\":\"%s\",\"count\":%llu,\"mean_ns\":%.0f",
+				m_entries[i].name.c_str(), (unsigned long long)snapshot.count, snapshot.GetMeanNs());
+			static const double s_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+			static const char* const s_names[] = { "p50_ns", "p90_ns", "p99_ns", "p999_ns" };
+			for(int q = 0; q < 4; q++) {
+				CBenchmarkRunner::Append(output, ",\"%s\":%llu", s_names[q],
+					(unsigned long long)CLatencyHistogram::GetQuantile(m_counts, snapshot.count, s_quantiles[q]));
+			}
+			CBenchmarkRunner::Append(output, ",\"max_ns\":%llu}\n", (unsigned long long)snapshot.maxNs);
+			lines++;
+		}
+		return lines;
+	}
+
+private:
+	struct Entry
+	{
+		std::string name;
+		CLatencyHistogram* pHistogram;
+	};
+
+	CCritSec m_cs;
+	Entry m_entries[MaxHistograms];
+	int32_t m_count;
+	std::vector<uint64_t> m_counts;     // snapshot scratch
+
+	CLatencyRegistry(const CLatencyRegistry&);
+	CLatencyRegistry& operator=(const CLatencyRegistry&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CLatencyScope - times a block into a histogram
+
+class CLatencyScope
+{
+public:
+	// pHistogram may be NULL, then nothing is timed
+	explicit CLatencyScope(CLatencyHistogram* pHistogram) :
+		m_pHistogram(pHistogram), m_startNs(pHistogram != NULL ? GetTimeNs() : 0)
+	{
+	}
+
+	~CLatencyScope()
+	{
+		if(m_pHistogram != NULL)
+			m_pHistogram->Record(GetTimeNs() - m_startNs);
+	}
+
+private:
+	CLatencyHistogram* m_pHistogram;
+	uint64_t m_startNs;
+
+	CLatencyScope(const CLatencyScope&);
+	CLatencyScope& operator=(const CLatencyScope&);
+};
+
+}; // namespace Synrc
@@ -0,0 +1,387 @@
+// ListDataSource.h
+//
+//  The data side of the owner-data list, apart from the window: which
+//  store row an item shows, its text, its group and when group headers
+//  have to be created, removed or resized. The list view forwards its
+//  callbacks (LVN_GETDISPINFO, OnCacheHint, GetItemGroup, GetItemInGroup)
+//  here and applies what the source asks of it through IListHost; a
+//  headless host can drive the same code without a desktop. With a trace
+//  recorder attached every call is recorded for later replay. Painting
+//  reads an item's texts and search highlight spans from here too, and
+//  type-to-jump (LVN_ODFINDITEM) is answered in the order items are shown.
+//  Selected items become store rows here as well.
+
+#pragma once
+
+#include <vector>
+
+#include "Platform.h"
+#include "ContactStore.h"
+#include "FindService.h"
+#include "GroupModel.h"
+#include "ListTrace.h"
+#include "ProgressiveResults.h"
+#include "Selection.h"
+#include "StringPool.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// IListHost - the control side: item count and group headers
+// CListDataSource - items, text and groups of the list from the models
+
+namespace Synrc
+{
+
+class IListHost
+{
+public:
+	virtual ~IListHost()
+	{
+	}
+
+	virtual void OnItemCountChanged(uint32_t count) = 0;
+
+	// Create the header of the group at position; it goes at the model's
+	// GetHeaderIndex(position) among the created ones.
+	virtual void OnGroupHeaderCreated(uint32_t position) = 0;
+
+	// the header with this group id goes; ids of removed groups are reused
+	virtual void OnGroupHeaderRemoved(uint32_t id) = 0;
+
+	// the member count of a created header changed
+	virtual void OnGroupHeaderResized(uint32_t position) = 0;
+};
+
+// what the list asked for and how much of it was already there
+struct ListDataStats
+{
+	uint64_t groupLookups;
+	uint64_t groupHeaderHits;   // lookups whose header existed already
+	uint64_t textFetches;
+	uint64_t textHits;          // fetches answered from the string pool
+
+	ListDataStats() : groupLookups(0), groupHeaderHits(0), textFetches(0), textHits(0)
+	{
+	}
+};
+
+class CListDataSource
+{
+public:
+	enum { NoCount = 0xFFFFFFFF };
+	enum { NoItem = 0xFFFFFFFF };
+
+	CListDataSource() : m_pHost(NULL), m_pGroups(NULL), m_pResults(NULL), m_pStrings(NULL),
+		m_text(DisplayName), m_reportedCount(NoCount), m_pTrace(NULL)
+	{
+	}
+
+	void SetHost(IListHost* pHost)
+	{
+		m_pHost = pHost;
+	}
+
+	// Items come from the group model when there is one, else from the
+	// result set. A new model starts without created headers; the next
+	// UpdateItemCount() reports the count whatever it is.
+	void SetGroupModel(CGroupModel* pGroups)
+	{
+		m_pGroups = pGroups;
+		if(m_pGroups != NULL)
+			m_pGroups->ResetHeaders();
+		m_reportedCount = NoCount;
+	}
+
+	CGroupModel* GetGroupModel() const
+	{
+		return m_pGroups;
+	}
+
+	void SetResults(CProgressiveResults* pResults)
+	{
+		m_pResults = pResults;
+		m_reportedCount = NoCount;
+	}
+
+	void SetDisplayStrings(CDisplayStringPool* pStrings, DisplayString text = DisplayName)
+	{
+		m_pStrings = pStrings;
+		m_text = text;
+	}
+
+	// NULL stops recording
+	void SetTraceRecorder(CListTraceRecorder* pTrace)
+	{
+		m_pTrace = pTrace;
+	}
+
+	CListTraceRecorder* GetTraceRecorder() const
+	{
+		return m_pTrace;
+	}
+
+	uint32_t GetItemCount() const
+	{
+		if(m_pGroups != NULL)
+			return m_pGroups->GetItemCount();
+		if(m_pResults != NULL)
+			return m_pResults->GetVisibleCount();
+		return 0;
+	}
+
+	// tells the host when the item count differs from the last one told
+	void UpdateItemCount()
+	{
+		uint32_t count = GetItemCount();
+		if(count != m_reportedCount && m_pHost != NULL) {
+			m_reportedCount = count;
+			m_pHost->OnItemCountChanged(count);
+		}
+	}
+
+	// store row shown at an item, NoRow when the list is not data backed
+	uint32_t GetItemRow(uint32_t item) const
+	{
+		if(m_pGroups != NULL)
+			return m_pGroups->GetRow(item);
+		if(m_pResults != NULL && item < m_pResults->GetVisibleCount())
+			return m_pResults->GetRow(item);
+		return CContactStore::NoRow;
+	}
+
+	// Copies the item's text, truncated and terminated; false when there
+	// is no pooled text for it.
+	bool GetText(uint32_t item, wchar_t* pOut, size_t cchOut)
+	{
+		if(m_pTrace != NULL)
+			m_pTrace->DispInfo(item);
+		m_stats.textFetches++;
+		if(m_pStrings == NULL)
+			return false;
+		uint32_t row = GetItemRow(item);
+		if(row == CContactStore::NoRow)
+			return false;
+		m_pStrings->CopyText(row, m_text, pOut, cchOut);
+		m_stats.textHits++;
+		return true;
+	}
+
+	// A display string of the item for painting, not terminated; false
+	// when there is no pooled text for it.
+	bool GetItemText(uint32_t item, DisplayString string, const wchar_t*& pText, uint32_t& cch) const
+	{
+		if(m_pStrings == NULL)
+			return false;
+		uint32_t row = GetItemRow(item);
+		if(row == CContactStore::NoRow)
+			return false;
+		pText = m_pStrings->GetText(row, string, cch);
+		return true;
+	}
+
+	// Where the item matched the search in text, as the result set has it;
+	// none with a group model, whose items are not result positions.
+	const MatchSpan* GetItemSpans(uint32_t item, HighlightText text, uint32_t& count) const
+	{
+		count = 0;
+		if(m_pGroups != NULL || m_pResults == NULL || item >= m_pResults->GetVisibleCount())
+			return NULL;
+		return m_pResults->GetSpans(item, text, count);
+	}
+
+	// Applies group changes since the last call and creates the headers
+	// of the groups covering items [first, last]; removals go first, as ids
+	// of emptied groups can be handed out again.
+	void CacheHint(uint32_t first, uint32_t last)
+	{
+		if(m_pTrace != NULL)
+			m_pTrace->CacheHint(first, last);
+		if(m_pGroups == NULL || m_pHost == NULL)
+			return;
+		m_pGroups->TakeHeaderChanges(m_removed, m_positions);
+		for(size_t i = 0; i < m_removed.size(); i++)
+			m_pHost->OnGroupHeaderRemoved(m_removed[i]);
+		for(size_t i = 0; i < m_positions.size(); i++)
+			m_pHost->OnGroupHeaderResized(m_positions[i]);
+		UpdateItemCount();
+
+		m_pGroups->TakeMissingHeaders(first, last, m_positions);
+		for(size_t i = 0; i < m_positions.size(); i++)
+			m_pHost->OnGroupHeaderCreated(m_positions[i]);
+	}
+
+	// header index of the item's group, creating the header if the cache
+	// hint did not cover it; false past the end or without groups
+	bool GetItemGroup(uint32_t item, uint32_t& headerIndex)
+	{
+		if(m_pTrace != NULL)
+			m_pTrace->ItemGroup(item);
+		if(m_pGroups == NULL)
+			return false;
+		uint32_t position = m_pGroups->GetItemGroup(item);
+		if(position == CGroupModel::NoGroup)
+			return false;
+		m_stats.groupLookups++;
+		if(m_pGroups->TakeMissingHeader(position)) {
+			if(m_pHost != NULL)
+				m_pHost->OnGroupHeaderCreated(position);
+		}
+		else {
+			m_stats.groupHeaderHits++;
+		}
+		headerIndex = m_pGroups->GetHeaderIndex(position);
+		return true;
+	}
+
+	// item shown as the index-th member of the header at headerIndex
+	bool GetItemInGroup(uint32_t headerIndex, uint32_t index, uint32_t& item) const
+	{
+		if(m_pTrace != NULL)
+			m_pTrace->ItemInGroup(headerIndex, index);
+		if(m_pGroups == NULL)
+			return false;
+		uint32_t position = m_pGroups->GetHeaderPosition(headerIndex);
+		item = m_pGroups->GetItemInGroup(position, index);
+		return true;
+	}
+
+	// The first item at or after start whose row find matches, from the
+	// top again with FindWrap; NoItem if none. Groups show their members by
+	// row and results by rank, not in the find service's order, so the
+	// matching rows are marked and the items walked in display order, a
+	// group at a time: O(matches + items passed).
+	uint32_t FindItem(CFindService& find, const wchar_t* pText, size_t cch, uint32_t start, uint32_t flags)
+	{
+		if(m_pTrace != NULL)
+			m_pTrace->FindItem(pText, cch, start);
+		uint32_t count = GetItemCount();
+		if(count == 0 || !find.FindRunRows(pText, cch, (flags & CFindService::FindPartial) != 0, m_found))
+			return NoItem;
+		for(size_t i = 0; i < m_found.size(); i++) {
+			if(m_found[i] >= m_marks.size())
+				m_marks.resize(m_found[i] + 1, false);
+			m_marks[m_found[i]] = true;
+		}
+		IsMarked marked(m_marks);
+		uint32_t item = start < count ? VisitItems(start, count, marked) : (uint32_t)NoItem;
+		if(item == NoItem && (flags & CFindService::FindWrap) && start > 0)
+			item = VisitItems(0, start < count ? start : count, marked);
+		for(size_t i = 0; i < m_found.size(); i++)
+			m_marks[m_found[i]] = false;
+		return item;
+	}
+
+	// Store rows of the selected items in list order, a contact shown twice
+	// (pinned and in its group) once; what export, delete and relabel work
+	// on. The selection must be of the items shown now.
+	void GetSelectedRows(const CSelectionSet& selection, std::vector<uint32_t>& rows)
+	{
+		rows.clear();
+		rows.reserve(selection.GetCount());
+		uint32_t count = GetItemCount();
+		AppendUnmarked append(m_marks, rows);
+		const std::vector<SelectionRun>& runs = selection.GetRuns();
+		for(size_t i = 0; i < runs.size() && runs[i].first < count; i++)
+			VisitItems(runs[i].first, runs[i].end < count ? runs[i].end : count, append);
+		for(size_t i = 0; i < rows.size(); i++)
+			m_marks[rows[i]] = false;
+	}
+
+	const ListDataStats& GetStats() const
+	{
+		return m_stats;
+	}
+
+	void ResetStats()
+	{
+		m_stats = ListDataStats();
+	}
+
+private:
+	IListHost* m_pHost;
+	CGroupModel* m_pGroups;
+	CProgressiveResults* m_pResults;
+	CDisplayStringPool* m_pStrings;
+	DisplayString m_text;
+	uint32_t m_reportedCount;
+	std::vector<uint32_t> m_removed;
+	std::vector<uint32_t> m_positions;
+	ListDataStats m_stats;
+	CListTraceRecorder* m_pTrace;
+	std::vector<uint32_t> m_found;
+	std::vector<bool> m_marks;          // by row, set only during FindItem()
+
+	struct IsMarked
+	{
+		const std::vector<bool>& marks;
+
+		explicit IsMarked(const std::vector<bool>& m) : marks(m)
+		{
+		}
+
+		bool operator()(uint32_t row) const
+		{
+			return row < marks.size() && marks[row];
+		}
+
+	private:
+		IsMarked& operator=(const IsMarked&);
+	};
+
+	// appends the rows not seen yet and marks them, never stops the visit
+	struct AppendUnmarked
+	{
+		std::vector<bool>& marks;
+		std::vector<uint32_t>& rows;
+
+		AppendUnmarked(std::vector<bool>& m, std::vector<uint32_t>& r) : marks(m), rows(r)
+		{
+		}
+
+		bool operator()(uint32_t row)
+		{
+			if(row >= marks.size())
+				marks.resize(row + 1, false);
+			if(!marks[row]) {
+				marks[row] = true;
+				rows.push_back(row);
+			}
+			return false;
+		}
+
+	private:
+		AppendUnmarked& operator=(const AppendUnmarked&);
+	};
+
+	// Calls visit(row) for the items [first, end) of a data-backed list in
+	// order, a group at a time; the item it returned true for, NoItem if none.
+	template <class V>
+	uint32_t VisitItems(uint32_t first, uint32_t end, V& visit) const
+	{
+		if(m_pGroups == NULL) {
+			for(uint32_t item = first; item < end; item++) {
+				if(visit(m_pResults->GetRow(item)))
+					return item;
+			}
+			return NoItem;
+		}
+		uint32_t item = first;
+		for(uint32_t position = m_pGroups->GetItemGroup(first); item < end && position < m_pGroups->GetGroupCount(); position++) {
+			if(m_pGroups->IsCollapsed(position))
+				continue;
+			const std::vector<uint32_t>& rows = m_pGroups->GetGroupRows(position);
+			for(uint32_t index = item - m_pGroups->GetGroupStart(position); index < rows.size() && item < end; index++, item++) {
+				if(visit(rows[index]))
+					return item;
+			}
+		}
+		return NoItem;
+	}
+
+	CListDataSource(const CListDataSource&);
+	CListDataSource& operator=(const CListDataSource&);
+};
+
+}; // namespace Synrc
@@ -0,0 +1,200 @@
+// ListHostHarness.h
+//
+//  A list host without a window, for measuring the owner-data path on any
+//  platform. It asks CListDataSource what the list view would while
+//  painting a page: the cache hint, then for each row its group header
+//  index and its text. It also keeps the created headers in list order,
+//  as the control does, and checks that every answer agrees with the group
+//  model. Scenarios scroll, jump and resize; each paint is one frame, timed
+//  into a latency histogram.
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "Platform.h"
+#include "GroupModel.h"
+#include "Latency.h"
+#include "ListDataSource.h"
+#include "StringPool.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CHeadlessListHost - scripted list view frames against the data source
+
+namespace Synrc
+{
+
+class CHeadlessListHost : public IListHost
+{
+public:
+	enum
+	{
+		DefaultPageRows = 40,
+		MaxTextChars = 260      // the control's usual pszText buffer
+	};
+
+	// the list of a group model, with text from a string pool
+	CHeadlessListHost(CGroupModel& groups, CDisplayStringPool& strings, DisplayString text = DisplayName) :
+		m_groups(groups), m_itemCount(0), m_pageRows(DefaultPageRows), m_random(1), m_errors(0)
+	{
+		m_source.SetHost(this);
+		m_source.SetDisplayStrings(&strings, text);
+		m_source.SetGroupModel(&groups);
+		m_source.UpdateItemCount();
+	}
+
+	void SetPageRows(uint32_t rows)
+	{
+		m_pageRows = rows > 0 ? rows : 1;
+	}
+
+	// One frame: rows [top, top + page rows) as the control asks for them.
+	void Paint(uint32_t top)
+	{
+		CLatencyScope latency(&m_frames);
+		// the hint may bring edits and a new item count along
+		m_source.CacheHint(top, top + m_pageRows - 1);
+		if(m_itemCount == 0)
+			return;
+		if(top >= m_itemCount)
+			top = m_itemCount - 1;
+		uint32_t last = top + m_pageRows - 1 < m_itemCount ? top + m_pageRows - 1 : m_itemCount - 1;
+		for(uint32_t item = top; item <= last; item++) {
+			CheckGroup(item);
+			m_source.GetText(item, m_text, MaxTextChars);
+		}
+	}
+
+	// line by line from the top, rowsPerFrame at a time, wrapping at the end
+	void Scroll(uint32_t frames, uint32_t rowsPerFrame)
+	{
+		uint32_t top = 0;
+		for(uint32_t frame = 0; frame < frames; frame++) {
+			Paint(top);
+			top += rowsPerFrame;
+			if(top >= m_itemCount)
+				top = 0;
+		}
+	}
+
+	// scroll bar drags and type-to-jump: each frame somewhere else
+	void Jump(uint32_t frames)
+	{
+		for(uint32_t frame = 0; frame < frames; frame++)
+			Paint(NextRandom(m_itemCount > 0 ? m_itemCount : 1));
+	}
+
+	// window resizes: the page grows and shrinks around a few places
+	void Resize(uint32_t frames)
+	{
+		uint32_t top = 0;
+		for(uint32_t frame = 0; frame < frames; frame++) {
+			if(frame % 50 == 0)
+				top = NextRandom(m_itemCount > 0 ? m_itemCount : 1);
+			SetPageRows(10 + NextRandom(90));
+			Paint(top);
+		}
+	}
+
+	CLatencyHistogram& GetFrames()
+	{
+		return m_frames;
+	}
+
+	CListDataSource& GetSource()
+	{
+		return m_source;
+	}
+
+	uint32_t GetItemCount() const
+	{
+		return m_itemCount;
+	}
+
+	// headers created so far, as the control would hold them
+	size_t GetHeaderCount() const
+	{
+		return m_headerIds.size();
+	}
+
+	// answers that disagreed with the group model; 0 unless broken
+	uint32_t GetErrors() const
+	{
+		return m_errors;
+	}
+
+	// implementation of IListHost
+	virtual void OnItemCountChanged(uint32_t count)
+	{
+		m_itemCount = count;
+	}
+
+	virtual void OnGroupHeaderCreated(uint32_t position)
+	{
+		uint32_t index = m_groups.GetHeaderIndex(position);
+		if(index > m_headerIds.size()) {
+			m_errors++;
+			index = (uint32_t)m_headerIds.size();
+		}
+		m_headerIds.insert(m_headerIds.begin() + index, m_groups.GetGroupId(position));
+	}
+
+	virtual void OnGroupHeaderRemoved(uint32_t id)
+	{
+		std::vector<uint32_t>::iterator it = std::find(m_headerIds.begin(), m_headerIds.end(), id);
+		if(it != m_headerIds.end())
+			m_headerIds.erase(it);
+		else
+			m_errors++;
+	}
+
+	virtual void OnGroupHeaderResized(uint32_t /*position*/)
+	{
+	}
+	// implementation of IListHost
+
+private:
+	CListDataSource m_source;
+	CGroupModel& m_groups;
+	std::vector<uint32_t> m_headerIds;      // group ids of the created headers, in list order
+	uint32_t m_itemCount;
+	uint32_t m_pageRows;
+	uint32_t m_random;
+	uint32_t m_errors;
+	CLatencyHistogram m_frames;
+	wchar_t m_text[MaxTextChars];
+
+	// The control asks for the item's header, then places the item by
+	// asking the header for its members.
+	void CheckGroup(uint32_t item)
+	{
+		uint32_t headerIndex = 0;
+		if(!m_source.GetItemGroup(item, headerIndex) || headerIndex >= m_headerIds.size()) {
+			m_errors++;
+			return;
+		}
+		uint32_t position = m_groups.GetItemGroup(item);
+		if(m_headerIds[headerIndex] != m_groups.GetGroupId(position))
+			m_errors++;
+		uint32_t member = 0;
+		if(!m_source.GetItemInGroup(headerIndex, item - m_groups.GetGroupStart(position), member) || member != item)
+			m_errors++;
+	}
+
+	uint32_t NextRandom(uint32_t range)
+	{
+		m_random ^= m_random << 13;
+		m_random ^= m_random >> 17;
+		m_random ^= m_random << 5;
+		return m_random % range;
+	}
+
+	CHeadlessListHost(const CHeadlessListHost&);
+	CHeadlessListHost& operator=(const CHeadlessListHost&);
+};
+
+}; // namespace Synrc
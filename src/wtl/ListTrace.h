@@ -0,0 +1,222 @@
+// ListTrace.h
+//
+//  Traces of what the list asked of the data layer, in order and with
+//  timing: cache hints, group lookups, display info, type-to-jump and
+//  search edits. A trace recorded in a real session replays on any
+//  platform (ListTraceReplay.h), so scroll and search patterns of real use
+//  become repeatable benchmarks.
+//
+//  Format: "LTRC", version, then one record per event: the kind byte, the
+//  time since the previous event in microseconds and the arguments, all
+//  varints, texts as BinaryStream strings. Scrolling costs 3-6 bytes per
+//  callback.
+
+#pragma once
+
+#include <string>
+
+#include "Platform.h"
+#include "BinaryStream.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CListTraceRecorder - appends list callbacks to a trace
+// CListTraceReader - decodes a trace event by event
+
+namespace Synrc
+{
+
+enum ListTraceEvent
+{
+	TraceCacheHint = 1,     // a = first item, b = last item
+	TraceItemGroup,         // a = item
+	TraceItemInGroup,       // a = header index, b = index in the group
+	TraceDispInfo,          // a = item
+	TraceFindItem,          // a = start item, text = typed prefix
+	TraceSearchEdit,        // text = the search box's new text
+	TraceEventEnd
+};
+
+struct ListTraceEntry
+{
+	ListTraceEvent kind;
+	uint64_t timeUs;        // since the start of the trace
+	uint32_t a;
+	uint32_t b;
+	std::wstring text;
+};
+
+class CListTraceRecorder
+{
+public:
+	enum
+	{
+		Magic = 0x4352544C,     // "LTRC"
+		Version = 1
+	};
+
+	CListTraceRecorder() : m_lastUs(0), m_events(0)
+	{
+		Clear();
+	}
+
+	void Clear()
+	{
+		m_data.clear();
+		CByteWriter writer(m_data);
+		writer.PutU32(Magic);
+		writer.PutU32(Version);
+		m_lastUs = GetTimeUs();
+		m_events = 0;
+	}
+
+	void CacheHint(uint32_t first, uint32_t last)
+	{
+		Put(TraceCacheHint, first, last);
+	}
+
+	void ItemGroup(uint32_t item)
+	{
+		Put(TraceItemGroup, item);
+	}
+
+	void ItemInGroup(uint32_t headerIndex, uint32_t index)
+	{
+		Put(TraceItemInGroup, headerIndex, index);
+	}
+
+	void DispInfo(uint32_t item)
+	{
+		Put(TraceDispInfo, item);
+	}
+
+	void FindItem(const wchar_t* pText, size_t cch, uint32_t start)
+	{
+		Put(TraceFindItem, start);
+		CByteWriter writer(m_data);
+		writer.PutWString(pText, cch);
+	}
+
+	void SearchEdit(const std::wstring& text)
+	{
+		Put(TraceSearchEdit);
+		CByteWriter writer(m_data);
+		writer.PutWString(text);
+	}
+
+	const std::string& GetData() const
+	{
+		return m_data;
+	}
+
+	uint64_t GetEventCount() const
+	{
+		return m_events;
+	}
+
+	bool Save(const std::string& path) const
+	{
+		CNativeFile file;
+		return file.Open(path, CNativeFile::OpenCreate) && file.Write(m_data.data(), m_data.size());
+	}
+
+private:
+	std::string m_data;
+	uint64_t m_lastUs;
+	uint64_t m_events;
+
+	void Put(ListTraceEvent kind)
+	{
+		uint64_t now = GetTimeUs();
+		CByteWriter writer(m_data);
+		writer.PutU8((uint8_t)kind);
+		writer.PutVarU64(now - m_lastUs);
+		m_lastUs = now;
+		m_events++;
+	}
+
+	void Put(ListTraceEvent kind, uint32_t a)
+	{
+		Put(kind);
+		CByteWriter writer(m_data);
+		writer.PutVarU64(a);
+	}
+
+	void Put(ListTraceEvent kind, uint32_t a, uint32_t b)
+	{
+		Put(kind, a);
+		CByteWriter writer(m_data);
+		writer.PutVarU64(b);
+	}
+
+	CListTraceRecorder(const CListTraceRecorder&);
+	CListTraceRecorder& operator=(const CListTraceRecorder&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CListTraceReader - decodes a trace event by event
+
+class CListTraceReader
+{
+public:
+	explicit CListTraceReader(const std::string& data) : m_reader(data), m_timeUs(0), m_bValid(false)
+	{
+		m_bValid = m_reader.GetU32() == CListTraceRecorder::Magic &&
+			m_reader.GetU32() == CListTraceRecorder::Version && m_reader.IsOk();
+	}
+
+	// false for a foreign or newer file
+	bool IsValid() const
+	{
+		return m_bValid;
+	}
+
+	// Next event into entry; false at the end or on a damaged record.
+	bool Next(ListTraceEntry& entry)
+	{
+		if(!m_bValid || m_reader.GetRemaining() == 0)
+			return false;
+		uint8_t kind = m_reader.GetU8();
+		if(kind < TraceCacheHint || kind >= TraceEventEnd) {
+			m_bValid = false;
+			return false;
+		}
+		entry.kind = (ListTraceEvent)kind;
+		m_timeUs += m_reader.GetVarU64();
+		entry.timeUs = m_timeUs;
+		entry.a = 0;
+		entry.b = 0;
+		entry.text.clear();
+		switch(entry.kind) {
+		case TraceCacheHint:
+		case TraceItemInGroup:
+			entry.a = (uint32_t)m_reader.GetVarU64();
+			entry.b = (uint32_t)m_reader.GetVarU64();
+			break;
+		case TraceItemGroup:
+		case TraceDispInfo:
+			entry.a = (uint32_t)m_reader.GetVarU64();
+			break;
+		case TraceFindItem:
+			entry.a = (uint32_t)m_reader.GetVarU64();
+			m_reader.GetWString(entry.text);
+			break;
+		case TraceSearchEdit:
+			m_reader.GetWString(entry.text);
+			break;
+		default:
+			break;
+		}
+		m_bValid = m_reader.IsOk();
+		return m_bValid;
+	}
+
+private:
+	CByteReader m_reader;
+	uint64_t m_timeUs;
+	bool m_bValid;
+};
+
+}; // namespace Synrc
@@ -0,0 +1,185 @@
+// ListTraceReplay.h
+//
+//  Feeds a recorded list trace (ListTrace.h) into the data layer: the list
+//  data source for cache hints, group lookups and display info, the find
+//  service for type-to-jump and a full scan for search edits. As fast as
+//  possible, for throughput and per-call latency, or at the recorded pace,
+//  for what a user would have seen with background work interleaved.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "Collation.h"
+#include "ContactStore.h"
+#include "FindService.h"
+#include "Latency.h"
+#include "ListDataSource.h"
+#include "ListTrace.h"
+#include "ProgressiveResults.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CListTraceReplayer - replays a trace, one latency histogram per event kind
+
+namespace Synrc
+{
+
+class CListTraceReplayer
+{
+public:
+	enum { MaxTextChars = 260 };
+
+	explicit CListTraceReplayer(CListDataSource& source) :
+		m_source(source), m_pFind(NULL), m_pStore(NULL), m_searchField(FieldName), m_pCollator(NULL),
+		m_events(0), m_elapsedUs(0)
+	{
+		static const char* const s_names[TraceEventEnd] =
+		{
+			"replay.all", "replay.cachehint", "replay.itemgroup", "replay.itemingroup", "replay.dispinfo",
+			"replay.finditem", "replay.searchedit"
+		};
+		for(int i = 0; i < TraceEventEnd; i++)
+			m_pLatency[i] = m_registry.Get(s_names[i]);
+	}
+
+	// type-to-jump events are answered by pFind, skipped without one
+	void SetFindService(CFindService* pFind)
+	{
+		m_pFind = pFind;
+	}
+
+	// search edits scan field of the store to the end, skipped without one
+	void SetSearch(CContactStore* pStore, ContactField field, const CCollator* pCollator)
+	{
+		m_pStore = pStore;
+		m_searchField = field;
+		m_pCollator = pCollator;
+	}
+
+	// Replays the whole trace; bRealTime keeps the recorded gaps between
+	// events. False for a damaged or foreign trace; events before the
+	// damage are replayed and counted.
+	bool Replay(const std::string& trace, bool bRealTime)
+	{
+		CListTraceReader reader(trace);
+		if(!reader.IsValid())
+			return false;
+		ListTraceEntry entry;
+		uint64_t startUs = GetTimeUs();
+		while(reader.Next(entry)) {
+			if(bRealTime)
+				WaitUntil(startUs + entry.timeUs);
+			uint64_t eventStartNs = GetTimeNs();
+			Dispatch(entry);
+			uint64_t ns = GetTimeNs() - eventStartNs;
+			m_pLatency[entry.kind]->Record(ns);
+			m_pLatency[0]->Record(ns);
+			m_events++;
+		}
+		m_elapsedUs += GetTimeUs() - startUs;
+		return reader.IsValid();
+	}
+
+	bool ReplayFile(const std::string& path, bool bRealTime)
+	{
+		CNativeFile file;
+		std::string trace;
+		return file.Open(path, CNativeFile::OpenRead) && file.ReadAll(trace) && Replay(trace, bRealTime);
+	}
+
+	// "replay.all" and one histogram per event kind
+	CLatencyHistogram& GetLatency(ListTraceEvent kind)
+	{
+		return *m_pLatency[kind];
+	}
+
+	CLatencyHistogram& GetLatency()
+	{
+		return *m_pLatency[0];
+	}
+
+	uint64_t GetEventCount() const
+	{
+		return m_events;
+	}
+
+	uint64_t GetElapsedUs() const
+	{
+		return m_elapsedUs;
+	}
+
+	// latency JSON lines of the kinds that occurred, see CLatencyRegistry::Dump()
+	size_t Dump(std::string& output)
+	{
+		return m_registry.Dump(output, false);
+	}
+
+private:
+	CListDataSource& m_source;
+	CFindService* m_pFind;
+	CContactStore* m_pStore;
+	ContactField m_searchField;
+	const CCollator* m_pCollator;
+	CLatencyRegistry m_registry;
+	CLatencyHistogram* m_pLatency[TraceEventEnd];   // [0] is every event
+	uint64_t m_events;
+	uint64_t m_elapsedUs;
+	std::vector<uint32_t> m_rows;
+	wchar_t m_text[MaxTextChars];
+
+	void Dispatch(const ListTraceEntry& entry)
+	{
+		uint32_t value = 0;
+		switch(entry.kind) {
+		case TraceCacheHint:
+			m_source.CacheHint(entry.a, entry.b);
+			break;
+		case TraceItemGroup:
+			m_source.GetItemGroup(entry.a, value);
+			break;
+		case TraceItemInGroup:
+			m_source.GetItemInGroup(entry.a, entry.b, value);
+			break;
+		case TraceDispInfo:
+			m_source.GetText(entry.a, m_text, MaxTextChars);
+			break;
+		case TraceFindItem:
+			if(m_pFind != NULL)
+				m_source.FindItem(*m_pFind, entry.text.data(), entry.text.size(), entry.a,
+					CFindService::FindPartial | CFindService::FindWrap);
+			break;
+		case TraceSearchEdit:
+			if(m_pStore != NULL && m_pCollator != NULL) {
+				CContactScanCursor cursor(*m_pStore, m_searchField, entry.text, *m_pCollator);
+				m_rows.clear();
+				while(cursor.Fetch(m_rows))
+					;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	// sleeps while far off, then spins for the last two milliseconds
+	static void WaitUntil(uint64_t dueUs)
+	{
+		for(;;) {
+			uint64_t now = GetTimeUs();
+			if(now >= dueUs)
+				return;
+			if(dueUs - now > 2000)
+				SleepMs((uint32_t)((dueUs - now) / 1000) - 1);
+		}
+	}
+
+	CListTraceReplayer(const CListTraceReplayer&);
+	CListTraceReplayer& operator=(const CListTraceReplayer&);
+};
+
+}; // namespace Synrc
@@ -2,6 +2,18 @@
 #pragma once
 
 #include "Misc.h"
+#include "Collation.h"
+#include "ContactDatabase.h"
+#include "ContactSearch.h"
+#include "DateIndex.h"
+#include "EventTrace.h"
+#include "FindService.h"
+#include "GroupModel.h"
+#include "MatchHighlight.h"
+#include "ProgressiveResults.h"
+#include "SortEngine.h"
+#include "StringPool.h"
+#include "UsageTracker.h"
 #include "VirtualListView.h"
 #include "NavigationView.h"
 //#include "SearchControl.h"
@@ -16,6 +28,8 @@ class CMainFrame :
 public:
 
 	enum { CY_NAVBAR = 100 };
+	enum { LATENCY_DUMP_MS = 10000 };   // idle dumps of the handler latencies, at most this often
+	enum { TIMER_UPCOMING = 1, UPCOMING_CHECK_MS = 60000 };   // the day turning over, checked this often
 
 	DECLARE_FRAME_WND_CLASS(NULL, IDR_MAINFRAME)
 
@@ -23,23 +37,99 @@ public:
 	CNavigationView navigationBar;
 	//CContainedWindowT<CSearchEditCtrl> searchControl;
 
-	CMainFrame() //: navigationBar(this, 1)
+	// the address book lives in "contacts" under the data directory
+	CMainFrame() :
+		m_groups(m_database.GetStore(), Synrc::FieldFamilyName), m_dates(m_database.GetStore()),
+		m_upcoming(m_dates, m_groups, CGroupedVirtualModeView::PinnedUpcoming), m_usage(m_database.GetStore()), m_strings(m_database.GetStore()),
+		m_sort(m_database.GetStore()), m_find(m_sort), m_search(m_database.GetStore(), m_collator, &m_usage),
+		m_bDatabaseOpen(false), m_lastLatencyDumpMs(Synrc::GetTimeMs()) //: navigationBar(this, 1)
 	{
 	}
 
+	// false when the address book could not be opened: what the store
+	// holds is shown, but an edit would not be saved
+	bool CanEdit() const
+	{
+		return m_bDatabaseOpen;
+	}
+
+	// "Simple People" in the user's local application data, made if
+	// missing, as UTF-8; empty when there is none. Not the working
+	// directory, which depends on how the program was started.
+	static std::string GetDataDirectory()
+	{
+		wchar_t path[MAX_PATH];
+		if(FAILED(SHGetFolderPathW(NULL, CSIDL_LOCAL_APPDATA | CSIDL_FLAG_CREATE, NULL, SHGFP_TYPE_CURRENT, path)))
+			return std::string();
+		int cb = WideCharToMultiByte(CP_UTF8, 0, path, -1, NULL, 0, NULL, NULL);
+		std::string dir(cb > 0 ? cb : 1, '\0');
+		WideCharToMultiByte(CP_UTF8, 0, path, -1, &dir[0], cb, NULL, NULL);
+		dir.resize(cb > 0 ? cb - 1 : 0);
+		dir = Synrc::CNativeFile::JoinPath(dir, "Simple People");
+		return Synrc::CNativeFile::MakeDirectory(dir) ? dir : std::string();
+	}
+
 	virtual BOOL PreTranslateMessage(MSG* pMsg)
 	{
 		if(CAeroFrameImpl<CMainFrame>::PreTranslateMessage(pMsg))
 			return TRUE;
 
+		// Ctrl+Shift+L dumps the latencies now
+		if(pMsg->message == WM_KEYDOWN && pMsg->wParam == 'L' &&
+			GetKeyState(VK_CONTROL) < 0 && GetKeyState(VK_SHIFT) < 0) {
+			DumpLatencies();
+			return TRUE;
+		}
+
+		// Ctrl+Shift+T starts a timeline, or ends it and writes it to trace.json
+		if(pMsg->message == WM_KEYDOWN && pMsg->wParam == 'T' &&
+			GetKeyState(VK_CONTROL) < 0 && GetKeyState(VK_SHIFT) < 0) {
+			ToggleEventTrace();
+			return TRUE;
+		}
+
 		return false; //listView->PreTranslateMessage(pMsg);
 	}
 
 	virtual BOOL OnIdle()
 	{
+		if(Synrc::GetTimeMs() - m_lastLatencyDumpMs >= LATENCY_DUMP_MS)
+			DumpLatencies();
+		if(!m_dataDir.empty())
+			m_usage.SaveIfDue(GetUsagePath());
 		return FALSE;
 	}
 
+	// how much each contact is used, beside the address book
+	std::string GetUsagePath() const
+	{
+		return Synrc::CNativeFile::JoinPath(m_dataDir, "usage.bin");
+	}
+
+	// Appends the latencies since the last dump to latency.jsonl, one line
+	// per handler that ran.
+	void DumpLatencies()
+	{
+		m_lastLatencyDumpMs = Synrc::GetTimeMs();
+		std::string output;
+		if(Synrc::CLatencyRegistry::GetDefault().Dump(output) == 0)
+			return;
+		Synrc::CNativeFile file;
+		if(file.Open("latency.jsonl", Synrc::CNativeFile::OpenAppend))
+			file.Write(output.data(), output.size());
+	}
+
+	void ToggleEventTrace()
+	{
+		Synrc::CEventTracer& tracer = Synrc::CEventTracer::GetDefault();
+		if(!tracer.IsEnabled()) {
+			tracer.Start();
+			return;
+		}
+		tracer.Stop();
+		tracer.Save("trace.json");
+	}
+
 	//BEGIN_UPDATE_UI_MAP(CMainFrame)
 	//END_UPDATE_UI_MAP()
 
@@ -47,6 +137,8 @@ public:
 		//CHAIN_MSG_MAP(CUpdateUI<CMainFrame>)
 		MESSAGE_HANDLER(WM_CREATE, OnCreate)
 		MESSAGE_HANDLER(WM_DESTROY, OnDestroy)
+		MESSAGE_HANDLER(WM_TIMER, OnTimer)
+		COMMAND_HANDLER(IDC_SEARCHFILTER, EN_CHANGE, OnSearchChange)
 		CHAIN_MSG_MAP(CAeroFrameImpl<CMainFrame>)
 		MESSAGE_HANDLER(WM_SIZE, OnSize)
 		DEFAULT_REFLECTION_HANDLER()
@@ -55,6 +147,7 @@ public:
 
 	LRESULT OnCreate(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /*bHandled*/)
 	{
+		Synrc::CTraceScope trace("frame.OnCreate", "startup");
 		// register object for message filtering and idle updates
 		CMessageLoop* pLoop = _Module.GetMessageLoop();
 		ATLASSERT(pLoop != NULL);
@@ -69,6 +162,21 @@ public:
 				LVS_ICON | LVS_SHOWSELALWAYS | LVS_AUTOARRANGE | LVS_ALIGNTOP | LVS_OWNERDATA, 
 				/*WS_EX_CLIENTEDGE | WS_EX_TRANSPARENT*/0);
 
+		// the models follow the store as the database loads it
+		m_dataDir = GetDataDirectory();
+		m_bDatabaseOpen = !m_dataDir.empty() && m_database.Open(Synrc::CNativeFile::JoinPath(m_dataDir, "contacts"));
+		if(!m_bDatabaseOpen)
+			MessageBox(_T("The address book could not be opened. Contacts are shown as far as they loaded; changes cannot be saved."),
+				_T("Simple People"), MB_ICONWARNING | MB_OK);
+		if(!m_dataDir.empty())
+			m_usage.Load(GetUsagePath());
+		listView->SetGroupModel(&m_groups);
+		listView->SetFrequentContacts(&m_usage);
+		listView->SetUpcomingGroup(&m_upcoming);
+		SetTimer(TIMER_UPCOMING, UPCOMING_CHECK_MS);
+		listView->SetDisplayStrings(&m_strings);
+		listView->SetFindService(&m_find);
+
 		MARGINS m2 = {2,2, CY_NAVBAR, 2};
 		SetMargins(m2);
 
@@ -95,11 +203,61 @@ public:
 		ATLASSERT(pLoop != NULL);
 		pLoop->RemoveMessageFilter(this);
 		pLoop->RemoveIdleHandler(this);
+		KillTimer(TIMER_UPCOMING);
+
+		m_results.Cancel();
+		listView->SetResults(NULL);
+		listView->SetFindService(NULL);
+		listView->SetFrequentContacts(NULL);
+		listView->SetUpcomingGroup(NULL);
+		if(!m_dataDir.empty())
+			m_usage.Save(GetUsagePath());
+		m_database.Close();
 
 		bHandled = FALSE;
 		return 1;
 	}
 
+	// A new day moves the birthdays in the "Upcoming" group; the group
+	// also follows date edits here when nothing else refreshed it.
+	LRESULT OnTimer(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/, BOOL& bHandled)
+	{
+		if(wParam != TIMER_UPCOMING) {
+			bHandled = FALSE;
+			return 0;
+		}
+		listView->RefreshGroups();
+		return 0;
+	}
+
+	// The search box text as a scoped query ("name:ann phone:555"); plain
+	// words match names best first, the most used contacts ahead, and
+	// within a few typos when nothing matches exactly. The results replace
+	// the groups until the box is cleared.
+	LRESULT OnSearchChange(WORD /*wNotifyCode*/, WORD /*wID*/, HWND hWndCtl, BOOL& /*bHandled*/)
+	{
+		int cch = ::GetWindowTextLengthW(hWndCtl);
+		std::wstring text(cch + 1, L'\0');
+		::GetWindowTextW(hWndCtl, &text[0], cch + 1);
+		text.resize(cch);
+		if(text == m_searchText)
+			return 0;
+		m_searchText = text;
+
+		Synrc::IResultCursor* pCursor = m_search.CreateCursor(text);
+		if(pCursor == NULL) {
+			m_results.Cancel();
+			listView->SetResults(NULL);
+			listView->SetGroupModel(&m_groups);
+			return 0;
+		}
+		m_results.Start(pCursor, Synrc::CProgressiveResults::DefaultFirstPage,
+			new Synrc::CMatchHighlighter(m_database.GetStore(), m_collator, text));
+		listView->SetGroupModel(NULL);
+		listView->SetResults(&m_results);
+		return 0;
+	}
+
 	LRESULT OnSize(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam, BOOL& /*bHandled*/)
 	{
 		CRect rect;
@@ -111,5 +269,20 @@ public:
 		return 0;
 	}
 
-
+private:
+	std::string m_dataDir;
+	Synrc::CContactDatabase m_database;
+	Synrc::CGroupModel m_groups;
+	Synrc::CDateIndex m_dates;
+	Synrc::CUpcomingGroup m_upcoming;
+	Synrc::CUsageTracker m_usage;
+	Synrc::CDisplayStringPool m_strings;
+	Synrc::CSortEngine m_sort;
+	Synrc::CFindService m_find;
+	Synrc::CCollator m_collator;
+	Synrc::CContactSearch m_search;
+	Synrc::CProgressiveResults m_results;
+	std::wstring m_searchText;
+	bool m_bDatabaseOpen;
+	uint32_t m_lastLatencyDumpMs;
 };
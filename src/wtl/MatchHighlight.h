@@ -0,0 +1,277 @@
+// MatchHighlight.h
+//
+//  Where a search hit matched, so the list can paint it. The search
+//  compares primary keys, which drop case, accents and separators and may
+//  spell one character with two bytes, so a hit in the key is not a range
+//  of the text; the text is keyed here a character at a time, from a table
+//  of the collator's single-character keys, to map it back. This runs on the producer thread for each published batch (see
+//  CProgressiveResults), and the spans - a few bytes per row - are kept
+//  with the result rows: painting an item is a lookup, never a match.
+//
+//  Terms highlight the texts they search: a scoped term its field, the
+//  others name, email and phone alike. Phone numbers match by digits, as in
+//  CFieldIndex. Hits of all the terms are merged into ascending,
+//  non-overlapping character spans, with combining accents after a hit
+//  kept inside it.
+
+#pragma once
+
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "Collation.h"
+#include "ContactStore.h"
+#include "ProgressiveResults.h"
+#include "SearchQuery.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CMatchHighlighter - match spans of result rows for a query
+
+namespace Synrc
+{
+
+class CMatchHighlighter : public IResultHighlighter
+{
+public:
+	enum
+	{
+		LockRows = 1024,        // rows highlighted per hold of the store lock
+		MaxChars = 0xFFFF,      // spans end within this many characters
+		MaxCharBytes = 6        // key bytes of a character, with a separator before it
+	};
+
+	CMatchHighlighter(CContactStore& store, const CCollator& collator, const std::wstring& query) :
+		m_store(store), m_collator(collator)
+	{
+		// what each mapped character becomes on its own: a separator or an
+		// ignorable character has no key, only a separator splits words
+		std::string key;
+		for(uint32_t c = 0; c < CCollator::TableSize; c++) {
+			wchar_t text[3] = { L'a', (wchar_t)c, L'a' };
+			key.clear();
+			m_collator.AppendPrimaryKey(&text[1], 1, key);
+			m_charKeys[c].length = 0;
+			if(!key.empty() && key.size() <= sizeof(m_charKeys[c].bytes)) {
+				m_charKinds[c] = CharKeyed;
+				m_charKeys[c].length = (uint8_t)key.size();
+				memcpy(m_charKeys[c].bytes, key.data(), key.size());
+				continue;
+			}
+			if(!key.empty()) {
+				m_charKinds[c] = CharKeyed;     // keyed by the collator each time
+				continue;
+			}
+			m_collator.AppendPrimaryKey(text, 3, key);
+			std::string letters;
+			m_collator.AppendPrimaryKey(text, 1, letters);
+			m_collator.AppendPrimaryKey(text, 1, letters);
+			m_charKinds[c] = key.size() > letters.size() ? CharSeparator : CharIgnorable;
+		}
+
+		std::vector<SearchTerm> terms;
+		CSearchQuery::Parse(query, terms);
+		for(size_t i = 0; i < terms.size(); i++) {
+			for(int text = 0; text < HighlightTextCount; text++) {
+				if(terms[i].field != FieldCount && terms[i].field != GetTextField((HighlightText)text))
+					continue;
+				key.clear();
+				m_collator.AppendPrimaryKey(terms[i].text.data(), terms[i].text.size(), key);
+				if(text == HighlightPhone)
+					KeepDigits(key);
+				if(!key.empty())
+					m_keys[text].push_back(key);
+			}
+		}
+	}
+
+	static ContactField GetTextField(HighlightText text)
+	{
+		static const ContactField s_fields[HighlightTextCount] = { FieldName, FieldEmail, FieldPhone };
+		return s_fields[text];
+	}
+
+	// implementation of IResultHighlighter
+	virtual void AddSpans(const std::vector<uint32_t>& rows, CMatchSpanTable& table)
+	{
+		std::vector<MatchSpan> spans[HighlightTextCount];
+		for(size_t first = 0; first < rows.size(); first += LockRows) {
+			size_t last = rows.size() - first > LockRows ? first + LockRows : rows.size();
+			CAutoLock storeLock(m_store.GetLock());
+			for(size_t i = first; i < last; i++) {
+				bool bLive = m_store.IsLive(rows[i]);
+				for(int text = 0; text < HighlightTextCount; text++) {
+					spans[text].clear();
+					if(bLive && !m_keys[text].empty())
+						GetSpans(m_store.GetField(rows[i], GetTextField((HighlightText)text)), (HighlightText)text, spans[text]);
+				}
+				table.AddRow(spans);
+			}
+		}
+	}
+	// implementation of IResultHighlighter
+
+	// Where the query's terms for text occur in value, as ascending,
+	// non-overlapping character spans appended to spans.
+	void GetSpans(const std::wstring& value, HighlightText text, std::vector<MatchSpan>& spans)
+	{
+		const std::vector<std::string>& keys = m_keys[text];
+		if(keys.empty())
+			return;
+		size_t cch = value.size() < MaxChars ? value.size() : (size_t)MaxChars;
+		size_t size = BuildKey(value.data(), cch, text == HighlightPhone);
+		m_ranges.clear();
+		for(size_t k = 0; k < keys.size(); k++) {
+			const std::string& key = keys[k];
+			size_t pos = 0;
+			while(pos + key.size() <= size) {
+				const char* pHit = (const char*)memchr(&m_key[pos], key[0], size - pos - key.size() + 1);
+				if(pHit == NULL)
+					break;
+				pos = pHit - &m_key[0];
+				if(memcmp(pHit, key.data(), key.size()) != 0) {
+					pos++;
+					continue;
+				}
+				uint32_t start = m_charOf[pos];
+				uint32_t end = m_charOf[pos + key.size() - 1] + 1;
+				while(end < cch && GetCharKind(value[end]) == CharIgnorable)
+					end++;
+				m_ranges.push_back(std::make_pair(start, end));
+				pos += key.size();
+			}
+		}
+		if(m_ranges.empty())
+			return;
+		if(m_ranges.size() > 1)
+			std::sort(m_ranges.begin(), m_ranges.end());
+		for(size_t i = 0; i < m_ranges.size(); i++) {
+			if(!spans.empty() && m_ranges[i].first <= (uint32_t)spans.back().start + spans.back().length) {
+				uint32_t end = m_ranges[i].second;
+				if(end > (uint32_t)spans.back().start + spans.back().length)
+					spans.back().length = (uint16_t)(end - spans.back().start);
+				continue;
+			}
+			MatchSpan span = { (uint16_t)m_ranges[i].first, (uint16_t)(m_ranges[i].second - m_ranges[i].first) };
+			spans.push_back(span);
+		}
+	}
+
+	// the query keys searched for in text
+	const std::vector<std::string>& GetKeys(HighlightText text) const
+	{
+		return m_keys[text];
+	}
+
+private:
+	enum CharKind
+	{
+		CharKeyed,
+		CharSeparator,
+		CharIgnorable
+	};
+
+	// the primary key of a character on its own
+	struct CharKey
+	{
+		uint8_t length;
+		char bytes[3];
+	};
+
+	CContactStore& m_store;
+	const CCollator& m_collator;
+	uint8_t m_charKinds[CCollator::TableSize];
+	CharKey m_charKeys[CCollator::TableSize];
+	std::vector<std::string> m_keys[HighlightTextCount];
+	std::vector<char> m_key;            // of the text being highlighted
+	std::vector<uint32_t> m_charOf;     // per byte of m_key, the character it came from
+	std::string m_scratch;
+	std::vector<std::pair<uint32_t, uint32_t> > m_ranges;
+
+	CharKind GetCharKind(wchar_t c) const
+	{
+		return (uint32_t)c < CCollator::TableSize ? (CharKind)m_charKinds[c] : CharKeyed;
+	}
+
+	static bool IsDigit(uint8_t weight)
+	{
+		return weight >= CCollator::WeightDigit && weight < CCollator::WeightDigit + 10;
+	}
+
+	// as CFieldIndex keys phone numbers
+	static void KeepDigits(std::string& key)
+	{
+		size_t out = 0;
+		for(size_t i = 0; i < key.size(); i++) {
+			uint8_t weight = (uint8_t)key[i];
+			if(weight == CCollator::WeightOther)
+				i += CCollator::OtherBytes;
+			else if(IsDigit(weight))
+				key[out++] = key[i];
+		}
+		key.resize(out);
+	}
+
+	// Puts the primary key of the text, as the collator builds it for the
+	// whole string, in m_key and the character of each byte in m_charOf;
+	// returns the key's size.
+	size_t BuildKey(const wchar_t* pText, size_t cch, bool bDigits)
+	{
+		size_t capacity = cch * MaxCharBytes;
+		if(m_key.size() < capacity) {
+			m_key.resize(capacity);
+			m_charOf.resize(capacity);
+		}
+		char* pKey = m_key.empty() ? NULL : &m_key[0];
+		uint32_t* pCharOf = m_charOf.empty() ? NULL : &m_charOf[0];
+		size_t size = 0;
+		bool bSeparator = false;
+		for(size_t i = 0; i < cch; i++) {
+			uint32_t c = (uint32_t)pText[i];
+			const char* pBytes;
+			size_t length;
+			if(c < CCollator::TableSize && m_charKeys[c].length > 0) {
+				pBytes = m_charKeys[c].bytes;
+				length = m_charKeys[c].length;
+			}
+			else if(c < CCollator::TableSize && m_charKinds[c] != CharKeyed) {
+				if(m_charKinds[c] == CharSeparator)
+					bSeparator = size > 0;
+				continue;
+			}
+			else {
+				m_scratch.clear();
+				m_collator.AppendPrimaryKey(pText + i, 1, m_scratch);
+				pBytes = m_scratch.data();
+				length = m_scratch.size();
+			}
+			if(bDigits) {
+				if(length == 1 && IsDigit((uint8_t)pBytes[0])) {
+					pKey[size] = pBytes[0];
+					pCharOf[size++] = (uint32_t)i;
+				}
+				continue;
+			}
+			if(bSeparator) {
+				pKey[size] = (char)CCollator::WeightSeparator;
+				pCharOf[size++] = (uint32_t)i;
+				bSeparator = false;
+			}
+			for(size_t b = 0; b < length; b++) {
+				pKey[size] = pBytes[b];
+				pCharOf[size++] = (uint32_t)i;
+			}
+		}
+		return size;
+	}
+
+	CMatchHighlighter(const CMatchHighlighter&);
+	CMatchHighlighter& operator=(const CMatchHighlighter&);
+};
+
+}; // namespace Synrc
@@ -0,0 +1,669 @@
+// PhoneticSearch.h
+//
+//  Sound-alike names: "Smirnoff" finds "Smirnov", "Kuznecov" finds
+//  "Kuznetsov", "Julia" finds "Yulia". Each word of a name gets two
+//  phonetic codes in the manner of Double Metaphone: consonant sounds only,
+//  vowels dropped except at the start, a primary code for the common
+//  reading of a spelling and an alternate for the other one ("ch" as in
+//  "church" or as in "Bach", "c" as in "Carl" or as in "Kuznecov").
+//  Two words sound alike when either code of one equals either of the
+//  other's. Words in Cyrillic and Greek are transliterated first (see
+//  GetLatin() in TranslitSearch.h) and the rules know the spellings that
+//  gives: "kh", "zh", "ts", "shch".
+//
+//  Codes are six symbols at most, four bits each, so a code is a number.
+//  The index encodes every word of the field in one pass and keeps, per
+//  code, the rows having it, sorted by code in one array with a hash from
+//  code to its range. The same codes group rows whose names sound the
+//  same, for finding duplicates.
+//
+//  Edits after the build are checked one by one until there are enough of
+//  them to rebuild, as in FuzzySearch.h.
+//
+//  Threading: the index has its own lock, then the store's.
+
+#pragma once
+
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Platform.h"
+#include "ContactStore.h"
+#include "EventTrace.h"
+#include "ProgressiveResults.h"
+#include "TranslitSearch.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CPhoneticEncoder - primary and alternate sound codes of a word
+// CPhoneticIndex - rows by the sound codes of a field's words
+// CPhoneticCursor - the rows of a sound-alike search as a result cursor
+
+namespace Synrc
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// CPhoneticEncoder - primary and alternate sound codes of a word
+
+struct PhoneticCodes
+{
+	uint32_t primary;
+	uint32_t alternate;     // the primary when the spelling reads one way only
+};
+
+class CPhoneticEncoder
+{
+public:
+	enum
+	{
+		MaxSymbols = 6,
+		MaxWord = 64            // letters of a word looked at
+	};
+
+	// Appends the codes of each word of the text.
+	static void EncodeText(const wchar_t* pText, size_t cch, std::vector<PhoneticCodes>& codes)
+	{
+		char word[MaxWord];
+		size_t length = 0;
+		for(size_t i = 0; i <= cch; i++) {
+			const char* pLatin = i < cch ? CTranslitIndex::GetLatin(pText[i]) : NULL;
+			if(pLatin != NULL) {
+				for(; *pLatin != 0 && length < MaxWord; pLatin++) {
+					if(*pLatin < '0' || *pLatin > '9')
+						word[length++] = *pLatin;
+				}
+				continue;
+			}
+			if(length > 0) {
+				codes.push_back(EncodeWord(word, length));
+				length = 0;
+			}
+		}
+	}
+
+	// codes of a word of lower case Latin letters
+	static PhoneticCodes EncodeWord(const char* pWord, size_t cch)
+	{
+		CCodeBuilder code;
+		size_t i = 0;
+		if(cch >= 2 && IsSilentStart(pWord[0], pWord[1]))
+			i = 1;
+		else if(cch >= 1 && pWord[0] == 'x') {
+			code.Add('S');
+			i = 1;
+		}
+		while(i < cch && !code.IsFull()) {
+			char c = pWord[i];
+			char next = At(pWord, cch, i + 1);
+			char after = At(pWord, cch, i + 2);
+			if(i > 0 && pWord[i - 1] == c) {
+				i++;            // doubled letters sound once
+				continue;
+			}
+			size_t length = 1;
+			switch(c) {
+			case 'a': case 'e': case 'i': case 'o': case 'u': case 'y':
+				if(i == 0)
+					code.Add('A');
+				break;
+			case 'b':
+				code.Add('P');
+				break;
+			case 'c':
+				if(next == 'h') {
+					code.Add('X', 'K');
+					length = 2;
+				}
+				else if(next == 'k') {
+					code.Add('K');
+					length = 2;
+				}
+				else if(next == 'z') {
+					code.Add('S', 'X');
+					length = 2;
+				}
+				else if(next == 'e' || next == 'i' || next == 'y') {
+					code.Add('S');
+				}
+				else {
+					code.Add('K', 'S');
+				}
+				break;
+			case 'd':
+				if(next == 'g' && (after == 'e' || after == 'i' || after == 'y')) {
+					code.Add('J');
+					length = 2;
+				}
+				else if(next == 'z') {
+					code.Add('J');
+					length = after == 'h' ? 3 : 2;
+				}
+				else {
+					code.Add('T');
+				}
+				break;
+			case 'f': case 'v': case 'w':
+				code.Add('F');
+				break;
+			case 'g':
+				if(next == 'h') {
+					if(i == 0 || IsVowel(after))
+						code.Add('K');      // silent in "Knight", "Wright"
+					length = 2;
+				}
+				else if(next == 'e' || next == 'i' || next == 'y') {
+					code.Add('K', 'J');
+				}
+				else {
+					code.Add('K');
+				}
+				break;
+			case 'h':
+				if((i == 0 || IsVowel(pWord[i - 1])) && IsVowel(next))
+					code.Add('H');
+				break;
+			case 'j':
+				code.Add('J', i == 0 ? 'A' : 0);
+				break;
+			case 'k':
+				if(next == 'h') {
+					code.Add('K', 'H');
+					length = 2;
+				}
+				else {
+					code.Add('K');
+				}
+				break;
+			case 'l': case 'm': case 'n': case 'r':
+				code.Add((char)(c - 'a' + 'A'));
+				break;
+			case 'p':
+				if(next == 'h') {
+					code.Add('F');
+					length = 2;
+				}
+				else {
+					code.Add('P');
+				}
+				break;
+			case 'q':
+				code.Add('K');
+				break;
+			case 's':
+				if(next == 'h') {
+					code.Add('X');
+					length = after == 'c' && At(pWord, cch, i + 3) == 'h' ? 4 : 2;
+				}
+				else if(next == 'c' && after == 'h') {
+					code.Add('X', 'S');
+					if(IsVowel(At(pWord, cch, i + 3)))
+						code.Add(0, 'K');   // "Schiller" as "Skiller", "Schmidt" as "Smidt"
+					length = 3;
+				}
+				else if(next == 'z') {
+					code.Add('S', 'X');
+					length = 2;
+				}
+				else if(next == 'i' && (after == 'a' || after == 'o')) {
+					code.Add('X', 'S');
+				}
+				else {
+					code.Add('S');
+				}
+				break;
+			case 't':
+				if(next == 'h') {
+					code.Add('0', 'T');
+					length = 2;
+				}
+				else if(next == 'c' && after == 'h') {
+					code.Add('X');
+					length = 3;
+				}
+				else if(next == 's' || next == 'z') {
+					code.Add('S');
+					length = 2;
+				}
+				else {
+					code.Add('T');
+				}
+				break;
+			case 'x':
+				code.Add('K');
+				code.Add('S');
+				break;
+			case 'z':
+				if(next == 'h') {
+					code.Add('J');
+					length = 2;
+				}
+				else {
+					code.Add('S');
+				}
+				break;
+			}
+			i += length;
+		}
+		return code.GetCodes();
+	}
+
+	// the symbols of a code, for tracing
+	static void GetSymbols(uint32_t code, std::string& symbols)
+	{
+		symbols.clear();
+		for(int shift = (MaxSymbols - 1) * 4; shift >= 0; shift -= 4) {
+			uint32_t symbol = (code >> shift) & 15;
+			if(symbol != 0)
+				symbols.push_back(GetSymbolTable()[symbol]);
+		}
+	}
+
+private:
+	// a code's symbols by number; symbol 0 ends a code
+	static const char* GetSymbolTable()
+	{
+		return "-ABFHJKLMNPRSTX0";
+	}
+
+	// both codes as they are built; a zero symbol adds nothing, nor does a
+	// repeated one ("dt" sounds as one T)
+	class CCodeBuilder
+	{
+	public:
+		CCodeBuilder() : m_primary(0), m_alternate(0), m_primaryCount(0), m_alternateCount(0)
+		{
+		}
+
+		void Add(char primary)
+		{
+			Add(primary, primary);
+		}
+
+		void Add(char primary, char alternate)
+		{
+			Append(m_primary, m_primaryCount, primary);
+			Append(m_alternate, m_alternateCount, alternate);
+		}
+
+		bool IsFull() const
+		{
+			return m_primaryCount >= MaxSymbols && m_alternateCount >= MaxSymbols;
+		}
+
+		PhoneticCodes GetCodes() const
+		{
+			PhoneticCodes codes = { m_primary, m_alternate };
+			return codes;
+		}
+
+	private:
+		uint32_t m_primary;
+		uint32_t m_alternate;
+		int m_primaryCount;
+		int m_alternateCount;
+
+		static void Append(uint32_t& code, int& count, char symbol)
+		{
+			if(symbol == 0 || count >= MaxSymbols)
+				return;
+			const char* pSymbols = GetSymbolTable();
+			uint32_t number = (uint32_t)(strchr(pSymbols + 1, symbol) - pSymbols);
+			if(count > 0 && (code & 15) == number)
+				return;
+			code = (code << 4) | number;
+			count++;
+		}
+	};
+
+	static char At(const char* pWord, size_t cch, size_t i)
+	{
+		return i < cch ? pWord[i] : 0;
+	}
+
+	static bool IsVowel(char c)
+	{
+		return c == 'a' || c == 'e' || c == 'i' || c == 'o' || c == 'u' || c == 'y';
+	}
+
+	// "kn", "gn", "pn", "wr" and "ps" at the start sound as their second letter
+	static bool IsSilentStart(char first, char second)
+	{
+		return (second == 'n' && (first == 'k' || first == 'g' || first == 'p')) ||
+			(first == 'w' && second == 'r') || (first == 'p' && second == 's');
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CPhoneticIndex - rows by the sound codes of a field's words
+
+struct PhoneticIndexStats
+{
+	uint64_t searches;
+	uint64_t rebuilds;
+	uint64_t encodeNs;          // of the last build
+	uint64_t words;             // encoded by the last build
+
+	PhoneticIndexStats() : searches(0), rebuilds(0), encodeNs(0), words(0)
+	{
+	}
+};
+
+class CPhoneticIndex : public IContactStoreObserver
+{
+public:
+	enum { RebuildRows = 4096 };    // edited rows checked one by one before a rebuild
+
+	CPhoneticIndex(CContactStore& store, ContactField field) : m_store(store), m_field(field), m_bStale(true)
+	{
+		m_store.AddObserver(this);
+	}
+
+	~CPhoneticIndex()
+	{
+		m_store.RemoveObserver(this);
+	}
+
+	void Rebuild()
+	{
+		CAutoLock lock(m_cs);
+		CAutoLock storeLock(m_store.GetLock());
+		Build();
+	}
+
+	// Appends the live rows, ascending, with a word sounding like each
+	// word of the text.
+	void Search(const std::wstring& text, std::vector<uint32_t>& rows)
+	{
+		CTraceScope trace("search.phonetic", "search");
+		std::vector<PhoneticCodes> query;
+		CPhoneticEncoder::EncodeText(text.data(), text.size(), query);
+		if(query.empty())
+			return;
+
+		CAutoLock lock(m_cs);
+		CAutoLock storeLock(m_store.GetLock());
+		if(m_bStale)
+			Build();
+		m_stats.searches++;
+		std::vector<uint32_t> found;
+		std::vector<uint32_t> word;
+		for(size_t q = 0; q < query.size(); q++) {
+			word.clear();
+			AppendPostings(query[q].primary, word);
+			if(query[q].alternate != query[q].primary) {
+				size_t middle = word.size();
+				AppendPostings(query[q].alternate, word);
+				std::inplace_merge(word.begin(), word.begin() + middle, word.end());
+				word.erase(std::unique(word.begin(), word.end()), word.end());
+			}
+			if(q == 0)
+				found.swap(word);
+			else
+				found.erase(std::set_intersection(found.begin(), found.end(), word.begin(), word.end(), found.begin()), found.end());
+		}
+
+		size_t first = rows.size();
+		for(size_t i = 0; i < found.size(); i++) {
+			if(m_store.IsLive(found[i]) && !std::binary_search(m_dirty.begin(), m_dirty.end(), found[i]))
+				rows.push_back(found[i]);
+		}
+		size_t clean = rows.size();
+		std::vector<PhoneticCodes> codes;
+		for(size_t i = 0; i < m_dirty.size(); i++) {
+			if(!m_store.IsLive(m_dirty[i]))
+				continue;
+			codes.clear();
+			const std::wstring& value = m_store.GetField(m_dirty[i], m_field);
+			CPhoneticEncoder::EncodeText(value.data(), value.size(), codes);
+			if(SoundsLikeAll(codes, query))
+				rows.push_back(m_dirty[i]);
+		}
+		std::inplace_merge(rows.begin() + first, rows.begin() + clean, rows.end());
+	}
+
+	// Live rows whose words have the same primary codes, in any order: the
+	// rows of group g are rows[groupStarts[g]] up to groupStarts[g + 1].
+	// Only groups of two or more.
+	void FindSoundAlikes(std::vector<uint32_t>& rows, std::vector<uint32_t>& groupStarts)
+	{
+		CTraceScope trace("index.phonetic.duplicates", "index");
+		rows.clear();
+		groupStarts.clear();
+		CAutoLock lock(m_cs);
+		CAutoLock storeLock(m_store.GetLock());
+		if(m_bStale)
+			Build();
+		uint32_t count = (uint32_t)m_store.GetRowCount();
+		std::vector<std::pair<uint64_t, uint32_t> > names;
+		names.reserve(m_store.GetLiveCount());
+		std::vector<uint32_t> sorted;
+		for(uint32_t row = 0; row < count; row++) {
+			if(!m_store.IsLive(row) || !GetPrimaryCodes(row, sorted))
+				continue;
+			uint64_t hash = 14695981039346656037ULL;
+			for(size_t i = 0; i < sorted.size(); i++)
+				hash = (hash ^ sorted[i]) * 1099511628211ULL;
+			names.push_back(std::make_pair(hash, row));
+		}
+		std::sort(names.begin(), names.end());
+
+		std::vector<uint32_t> head;
+		for(size_t i = 0; i < names.size(); ) {
+			size_t end = i + 1;
+			while(end < names.size() && names[end].first == names[i].first)
+				end++;
+			if(end - i >= 2) {
+				// equal hashes: the first row's codes decide, others go
+				GetPrimaryCodes(names[i].second, head);
+				size_t start = rows.size();
+				rows.push_back(names[i].second);
+				for(size_t k = i + 1; k < end; k++) {
+					if(GetPrimaryCodes(names[k].second, sorted) && sorted == head)
+						rows.push_back(names[k].second);
+				}
+				if(rows.size() - start >= 2)
+					groupStarts.push_back((uint32_t)start);
+				else
+					rows.resize(start);
+			}
+			i = end;
+		}
+		groupStarts.push_back((uint32_t)rows.size());
+	}
+
+	uint32_t GetCodeCount()
+	{
+		CAutoLock lock(m_cs);
+		return (uint32_t)m_ranges.size();
+	}
+
+	size_t GetMemoryUsage()
+	{
+		CAutoLock lock(m_cs);
+		return (m_postings.capacity() + m_rowStarts.capacity() + m_dirty.capacity()) * sizeof(uint32_t) +
+			m_rowCodes.capacity() * sizeof(PhoneticCodes) +
+			m_ranges.size() * (sizeof(RangeMap::value_type) + 2 * sizeof(void*)) + m_ranges.bucket_count() * sizeof(void*);
+	}
+
+	PhoneticIndexStats GetStats()
+	{
+		CAutoLock lock(m_cs);
+		return m_stats;
+	}
+
+	// implementation of IContactStoreObserver
+	virtual void OnContactChanged(uint32_t row, ContactChange change)
+	{
+		CAutoLock lock(m_cs);
+		if(m_bStale)
+			return;
+		switch(change) {
+		case ContactAdded:
+		case ContactUpdated:
+			if(m_dirty.size() >= RebuildRows) {
+				m_bStale = true;
+				break;
+			}
+			if(!std::binary_search(m_dirty.begin(), m_dirty.end(), row))
+				m_dirty.insert(std::lower_bound(m_dirty.begin(), m_dirty.end(), row), row);
+			break;
+		case ContactRemoved:
+		case ContactsRemoved:
+			break;              // dead rows are skipped
+		case ContactsCleared:
+			m_bStale = true;
+			break;
+		}
+	}
+	// implementation of IContactStoreObserver
+
+private:
+	typedef std::unordered_map<uint32_t, std::pair<uint32_t, uint32_t> > RangeMap;
+
+	CContactStore& m_store;
+	ContactField m_field;
+	CCritSec m_cs;
+	bool m_bStale;
+	std::vector<PhoneticCodes> m_rowCodes;  // the codes of each row's words, row after row
+	std::vector<uint32_t> m_rowStarts;      // per row its first codes, and the end
+	std::vector<uint32_t> m_postings;       // rows by code, ascending within one
+	RangeMap m_ranges;                      // code to its postings
+	std::vector<uint32_t> m_dirty;          // rows edited since the build, ascending
+	PhoneticIndexStats m_stats;
+
+	void AppendPostings(uint32_t code, std::vector<uint32_t>& rows) const
+	{
+		RangeMap::const_iterator found = m_ranges.find(code);
+		if(found != m_ranges.end())
+			rows.insert(rows.end(), m_postings.begin() + found->second.first, m_postings.begin() + found->second.second);
+	}
+
+	static bool SoundsLike(const PhoneticCodes& a, const PhoneticCodes& b)
+	{
+		return a.primary == b.primary || a.primary == b.alternate || a.alternate == b.primary || a.alternate == b.alternate;
+	}
+
+	static bool SoundsLikeAll(const std::vector<PhoneticCodes>& codes, const std::vector<PhoneticCodes>& query)
+	{
+		for(size_t q = 0; q < query.size(); q++) {
+			size_t i = 0;
+			while(i < codes.size() && !SoundsLike(codes[i], query[q]))
+				i++;
+			if(i == codes.size())
+				return false;
+		}
+		return true;
+	}
+
+	// the primary codes of the row's words, sorted; false without words
+	bool GetPrimaryCodes(uint32_t row, std::vector<uint32_t>& sorted)
+	{
+		sorted.clear();
+		if(row + 1 >= m_rowStarts.size() || std::binary_search(m_dirty.begin(), m_dirty.end(), row)) {
+			std::vector<PhoneticCodes> codes;
+			const std::wstring& value = m_store.GetField(row, m_field);
+			CPhoneticEncoder::EncodeText(value.data(), value.size(), codes);
+			for(size_t i = 0; i < codes.size(); i++)
+				sorted.push_back(codes[i].primary);
+		}
+		else {
+			for(uint32_t i = m_rowStarts[row]; i < m_rowStarts[row + 1]; i++)
+				sorted.push_back(m_rowCodes[i].primary);
+		}
+		std::sort(sorted.begin(), sorted.end());
+		return !sorted.empty();
+	}
+
+	void Build()
+	{
+		CTraceScope trace("index.phonetic", "index");
+		uint32_t count = (uint32_t)m_store.GetRowCount();
+		m_rowCodes.clear();
+		m_rowStarts.resize(count + 1);
+		uint64_t startNs = GetTimeNs();
+		for(uint32_t row = 0; row < count; row++) {
+			m_rowStarts[row] = (uint32_t)m_rowCodes.size();
+			if(m_store.IsLive(row)) {
+				const std::wstring& value = m_store.GetField(row, m_field);
+				CPhoneticEncoder::EncodeText(value.data(), value.size(), m_rowCodes);
+			}
+		}
+		m_rowStarts[count] = (uint32_t)m_rowCodes.size();
+		m_stats.encodeNs = GetTimeNs() - startNs;
+		m_stats.words = m_rowCodes.size();
+
+		// code and row in one number, sorted: the postings of each code in
+		// row order, duplicates next to each other
+		std::vector<uint64_t> pairs;
+		pairs.reserve(m_rowCodes.size() * 2);
+		for(uint32_t row = 0; row < count; row++) {
+			for(uint32_t i = m_rowStarts[row]; i < m_rowStarts[row + 1]; i++) {
+				pairs.push_back(((uint64_t)m_rowCodes[i].primary << 32) | row);
+				if(m_rowCodes[i].alternate != m_rowCodes[i].primary)
+					pairs.push_back(((uint64_t)m_rowCodes[i].alternate << 32) | row);
+			}
+		}
+		std::sort(pairs.begin(), pairs.end());
+		pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+		m_postings.resize(pairs.size());
+		m_ranges.clear();
+		for(size_t i = 0; i < pairs.size(); ) {
+			uint32_t code = (uint32_t)(pairs[i] >> 32);
+			size_t end = i;
+			for(; end < pairs.size() && (uint32_t)(pairs[end] >> 32) == code; end++)
+				m_postings[end] = (uint32_t)pairs[end];
+			m_ranges[code] = std::make_pair((uint32_t)i, (uint32_t)end);
+			i = end;
+		}
+		m_dirty.clear();
+		m_stats.rebuilds++;
+		m_bStale = false;
+	}
+
+	CPhoneticIndex(const CPhoneticIndex&);
+	CPhoneticIndex& operator=(const CPhoneticIndex&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CPhoneticCursor - the rows of a sound-alike search as a result cursor
+
+class CPhoneticCursor : public IResultCursor
+{
+public:
+	enum { FetchRows = 4096 };
+
+	CPhoneticCursor(CPhoneticIndex& index, const std::wstring& text) :
+		m_index(index), m_text(text), m_bSearched(false), m_next(0)
+	{
+	}
+
+	// the search runs on the first call, the rows come a batch at a time
+	virtual bool Fetch(std::vector<uint32_t>& rows)
+	{
+		if(!m_bSearched) {
+			m_index.Search(m_text, m_rows);
+			m_bSearched = true;
+		}
+		size_t end = m_rows.size() - m_next > FetchRows ? m_next + FetchRows : m_rows.size();
+		rows.insert(rows.end(), m_rows.begin() + m_next, m_rows.begin() + end);
+		m_next = end;
+		return m_next < m_rows.size();
+	}
+
+private:
+	CPhoneticIndex& m_index;
+	std::wstring m_text;
+	bool m_bSearched;
+	std::vector<uint32_t> m_rows;
+	size_t m_next;
+
+	CPhoneticCursor(const CPhoneticCursor&);
+	CPhoneticCursor& operator=(const CPhoneticCursor&);
+};
+
+}; // namespace Synrc
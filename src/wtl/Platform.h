@@ -0,0 +1,739 @@
+// Platform.h
+//
+//  Portable threading, timing and atomic primitives for the native engine.
+//  Everything in here builds both inside the WTL application (Win32) and on
+//  POSIX systems, so engine code can be exercised without a Windows desktop.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+	#ifndef _WINDOWS_
+		#include <windows.h>
+	#endif
+	#include <process.h>
+#else
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <pthread.h>
+	#include <sched.h>
+	#include <stdio.h>
+	#include <sys/stat.h>
+	#include <time.h>
+	#include <unistd.h>
+#endif
+
+#include <string>
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CCritSec - non-recursive lock (critical section / pthread mutex)
+// CAutoLock - scoped CCritSec owner
+// CCondVar - condition variable bound to a CCritSec
+// CNativeThread - joinable thread running a plain function
+// CNativeFile - unbuffered file with explicit durability (fsync)
+
+#ifdef _WIN32
+	#define SYNRC_THREAD_LOCAL __declspec(thread)
+#else
+	#define SYNRC_THREAD_LOCAL __thread
+#endif
+
+namespace Synrc
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// Atomics
+
+inline int32_t AtomicIncrement(volatile int32_t* p)
+{
+#ifdef _WIN32
+	return InterlockedIncrement(reinterpret_cast<volatile LONG*>(p));
+#else
+	return __sync_add_and_fetch(p, 1);
+#endif
+}
+
+inline int32_t AtomicDecrement(volatile int32_t* p)
+{
+#ifdef _WIN32
+	return InterlockedDecrement(reinterpret_cast<volatile LONG*>(p));
+#else
+	return __sync_sub_and_fetch(p, 1);
+#endif
+}
+
+// returns the new value
+inline int32_t AtomicAdd(volatile int32_t* p, int32_t value)
+{
+#ifdef _WIN32
+	return InterlockedExchangeAdd(reinterpret_cast<volatile LONG*>(p), value) + value;
+#else
+	return __sync_add_and_fetch(p, value);
+#endif
+}
+
+inline int64_t AtomicAdd64(volatile int64_t* p, int64_t value)
+{
+#ifdef _WIN32
+	return InterlockedExchangeAdd64(reinterpret_cast<volatile LONGLONG*>(p), value) + value;
+#else
+	return __sync_add_and_fetch(p, value);
+#endif
+}
+
+// returns the value that was in *p before the call
+inline int32_t AtomicCompareExchange(volatile int32_t* p, int32_t exchange, int32_t comparand)
+{
+#ifdef _WIN32
+	return InterlockedCompareExchange(reinterpret_cast<volatile LONG*>(p), exchange, comparand);
+#else
+	return __sync_val_compare_and_swap(p, comparand, exchange);
+#endif
+}
+
+inline int64_t AtomicCompareExchange64(volatile int64_t* p, int64_t exchange, int64_t comparand)
+{
+#ifdef _WIN32
+	return InterlockedCompareExchange64(reinterpret_cast<volatile LONGLONG*>(p), exchange, comparand);
+#else
+	return __sync_val_compare_and_swap(p, comparand, exchange);
+#endif
+}
+
+inline void* AtomicCompareExchangePointer(void* volatile* p, void* exchange, void* comparand)
+{
+#ifdef _WIN32
+	return InterlockedCompareExchangePointer(p, exchange, comparand);
+#else
+	return __sync_val_compare_and_swap(p, comparand, exchange);
+#endif
+}
+
+inline void FullBarrier()
+{
+#ifdef _WIN32
+	MemoryBarrier();
+#else
+	__sync_synchronize();
+#endif
+}
+
+inline int32_t AtomicLoad(const volatile int32_t* p)
+{
+#ifdef _WIN32
+	int32_t value = *p;
+	FullBarrier();
+	return value;
+#else
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+#endif
+}
+
+inline void AtomicStore(volatile int32_t* p, int32_t value)
+{
+#ifdef _WIN32
+	InterlockedExchange(reinterpret_cast<volatile LONG*>(p), value);
+#else
+	__atomic_store_n(p, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+inline int64_t AtomicLoad64(const volatile int64_t* p)
+{
+#ifdef _WIN32
+	// a CAS that never succeeds is the portable way to get an untorn 64-bit read on x86
+	return AtomicCompareExchange64(const_cast<volatile int64_t*>(p), 0, 0);
+#else
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+#endif
+}
+
+inline void AtomicStore64(volatile int64_t* p, int64_t value)
+{
+#ifdef _WIN32
+	int64_t current = *p;
+	for(;;) {
+		int64_t seen = AtomicCompareExchange64(p, value, current);
+		if(seen == current)
+			break;
+		current = seen;
+	}
+#else
+	__atomic_store_n(p, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+inline void* AtomicLoadPointer(void* const volatile* p)
+{
+#ifdef _WIN32
+	void* value = *p;
+	FullBarrier();
+	return value;
+#else
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Time
+
+// Monotonic clock in nanoseconds. Only differences are meaningful.
+inline uint64_t GetTimeNs()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER s_freq = { 0 };
+	if(s_freq.QuadPart == 0)
+		QueryPerformanceFrequency(&s_freq);
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	uint64_t seconds = now.QuadPart / s_freq.QuadPart;
+	uint64_t remainder = now.QuadPart % s_freq.QuadPart;
+	return seconds * 1000000000ULL + remainder * 1000000000ULL / s_freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+inline uint64_t GetTimeUs()
+{
+	return GetTimeNs() / 1000;
+}
+
+inline uint32_t GetTimeMs()
+{
+	return (uint32_t)(GetTimeNs() / 1000000);
+}
+
+inline void SleepMs(uint32_t ms)
+{
+#ifdef _WIN32
+	::Sleep(ms);
+#else
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+	while(nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+#endif
+}
+
+inline void YieldThread()
+{
+#ifdef _WIN32
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+inline unsigned GetProcessorCount()
+{
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors > 0 ? si.dwNumberOfProcessors : 1;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned)n : 1;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CCritSec - non-recursive lock
+
+class CCritSec
+{
+public:
+	CCritSec()
+	{
+#ifdef _WIN32
+		InitializeCriticalSectionAndSpinCount(&m_cs, 4000);
+#else
+		pthread_mutex_init(&m_cs, NULL);
+#endif
+	}
+
+	~CCritSec()
+	{
+#ifdef _WIN32
+		DeleteCriticalSection(&m_cs);
+#else
+		pthread_mutex_destroy(&m_cs);
+#endif
+	}
+
+	void Lock()
+	{
+#ifdef _WIN32
+		EnterCriticalSection(&m_cs);
+#else
+		pthread_mutex_lock(&m_cs);
+#endif
+	}
+
+	bool TryLock()
+	{
+#ifdef _WIN32
+		return TryEnterCriticalSection(&m_cs) != FALSE;
+#else
+		return pthread_mutex_trylock(&m_cs) == 0;
+#endif
+	}
+
+	void Unlock()
+	{
+#ifdef _WIN32
+		LeaveCriticalSection(&m_cs);
+#else
+		pthread_mutex_unlock(&m_cs);
+#endif
+	}
+
+private:
+	friend class CCondVar;
+#ifdef _WIN32
+	CRITICAL_SECTION m_cs;
+#else
+	pthread_mutex_t m_cs;
+#endif
+
+	CCritSec(const CCritSec&);
+	CCritSec& operator=(const CCritSec&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CAutoLock - scoped CCritSec owner
+
+class CAutoLock
+{
+public:
+	explicit CAutoLock(CCritSec& cs) : m_cs(cs)
+	{
+		m_cs.Lock();
+	}
+
+	~CAutoLock()
+	{
+		m_cs.Unlock();
+	}
+
+private:
+	CCritSec& m_cs;
+
+	CAutoLock(const CAutoLock&);
+	CAutoLock& operator=(const CAutoLock&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CCondVar - condition variable bound to a CCritSec
+
+class CCondVar
+{
+public:
+	enum { INFINITE_WAIT = 0xFFFFFFFF };
+
+	CCondVar()
+	{
+#ifdef _WIN32
+		InitializeConditionVariable(&m_cv);
+#else
+		pthread_condattr_t attr;
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&m_cv, &attr);
+		pthread_condattr_destroy(&attr);
+#endif
+	}
+
+	~CCondVar()
+	{
+#ifndef _WIN32
+		pthread_cond_destroy(&m_cv);
+#endif
+	}
+
+	// cs must be held by the caller; returns false on timeout
+	bool Wait(CCritSec& cs, uint32_t timeoutMs = INFINITE_WAIT)
+	{
+#ifdef _WIN32
+		return SleepConditionVariableCS(&m_cv, &cs.m_cs, timeoutMs == INFINITE_WAIT ? INFINITE : timeoutMs) != FALSE;
+#else
+		if(timeoutMs == INFINITE_WAIT)
+			return pthread_cond_wait(&m_cv, &cs.m_cs) == 0;
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_sec += timeoutMs / 1000;
+		ts.tv_nsec += (long)(timeoutMs % 1000) * 1000000L;
+		if(ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		return pthread_cond_timedwait(&m_cv, &cs.m_cs, &ts) == 0;
+#endif
+	}
+
+	void Signal()
+	{
+#ifdef _WIN32
+		WakeConditionVariable(&m_cv);
+#else
+		pthread_cond_signal(&m_cv);
+#endif
+	}
+
+	void Broadcast()
+	{
+#ifdef _WIN32
+		WakeAllConditionVariable(&m_cv);
+#else
+		pthread_cond_broadcast(&m_cv);
+#endif
+	}
+
+private:
+#ifdef _WIN32
+	CONDITION_VARIABLE m_cv;
+#else
+	pthread_cond_t m_cv;
+#endif
+
+	CCondVar(const CCondVar&);
+	CCondVar& operator=(const CCondVar&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CNativeThread - joinable thread running a plain function
+
+class CNativeThread
+{
+public:
+	typedef void (*ThreadProc)(void* pParam);
+
+	CNativeThread() : m_pProc(NULL), m_pParam(NULL), m_bStarted(false)
+	{
+	}
+
+	~CNativeThread()
+	{
+		Join();
+	}
+
+	bool Start(ThreadProc pProc, void* pParam)
+	{
+		if(m_bStarted)
+			return false;
+		m_pProc = pProc;
+		m_pParam = pParam;
+#ifdef _WIN32
+		m_hThread = (HANDLE)_beginthreadex(NULL, 0, ThreadEntry, this, 0, NULL);
+		m_bStarted = m_hThread != NULL;
+#else
+		m_bStarted = pthread_create(&m_thread, NULL, ThreadEntry, this) == 0;
+#endif
+		return m_bStarted;
+	}
+
+	void Join()
+	{
+		if(!m_bStarted)
+			return;
+#ifdef _WIN32
+		WaitForSingleObject(m_hThread, INFINITE);
+		CloseHandle(m_hThread);
+#else
+		pthread_join(m_thread, NULL);
+#endif
+		m_bStarted = false;
+	}
+
+	bool IsStarted() const
+	{
+		return m_bStarted;
+	}
+
+private:
+#ifdef _WIN32
+	static unsigned __stdcall ThreadEntry(void* p)
+	{
+		CNativeThread* pThis = static_cast<CNativeThread*>(p);
+		pThis->m_pProc(pThis->m_pParam);
+		return 0;
+	}
+
+	HANDLE m_hThread;
+#else
+	static void* ThreadEntry(void* p)
+	{
+		CNativeThread* pThis = static_cast<CNativeThread*>(p);
+		pThis->m_pProc(pThis->m_pParam);
+		return NULL;
+	}
+
+	pthread_t m_thread;
+#endif
+
+	ThreadProc m_pProc;
+	void* m_pParam;
+	bool m_bStarted;
+
+	CNativeThread(const CNativeThread&);
+	CNativeThread& operator=(const CNativeThread&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CNativeFile - unbuffered file with explicit durability
+//
+// Paths are UTF-8 on every platform.
+
+class CNativeFile
+{
+public:
+	enum OpenMode
+	{
+		OpenRead,       // existing file, read only
+		OpenCreate,     // create or truncate, read/write
+		OpenAppend      // create if missing, writes go to the end
+	};
+
+	CNativeFile()
+	{
+#ifdef _WIN32
+		m_hFile = INVALID_HANDLE_VALUE;
+#else
+		m_fd = -1;
+#endif
+	}
+
+	~CNativeFile()
+	{
+		Close();
+	}
+
+	bool Open(const std::string& path, OpenMode mode)
+	{
+		Close();
+#ifdef _WIN32
+		DWORD access = mode == OpenRead ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE;
+		DWORD disposition = mode == OpenRead ? OPEN_EXISTING : mode == OpenCreate ? CREATE_ALWAYS : OPEN_ALWAYS;
+		m_hFile = CreateFileW(Widen(path).c_str(), access, FILE_SHARE_READ, NULL, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+		if(m_hFile == INVALID_HANDLE_VALUE)
+			return false;
+		if(mode == OpenAppend) {
+			LARGE_INTEGER zero = { 0 };
+			SetFilePointerEx(m_hFile, zero, NULL, FILE_END);
+		}
+		return true;
+#else
+		int flags = mode == OpenRead ? O_RDONLY : mode == OpenCreate ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR | O_CREAT | O_APPEND;
+		m_fd = open(path.c_str(), flags, 0644);
+		return m_fd != -1;
+#endif
+	}
+
+	bool IsOpen() const
+	{
+#ifdef _WIN32
+		return m_hFile != INVALID_HANDLE_VALUE;
+#else
+		return m_fd != -1;
+#endif
+	}
+
+	void Close()
+	{
+		if(!IsOpen())
+			return;
+#ifdef _WIN32
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+#else
+		close(m_fd);
+		m_fd = -1;
+#endif
+	}
+
+	bool Write(const void* pData, size_t cb)
+	{
+		const char* p = static_cast<const char*>(pData);
+		while(cb > 0) {
+			size_t chunk = cb > 0x40000000 ? 0x40000000 : cb;
+#ifdef _WIN32
+			DWORD written = 0;
+			if(!WriteFile(m_hFile, p, (DWORD)chunk, &written, NULL) || written == 0)
+				return false;
+#else
+			ssize_t written = write(m_fd, p, chunk);
+			if(written < 0 && errno == EINTR)
+				continue;
+			if(written <= 0)
+				return false;
+#endif
+			p += written;
+			cb -= written;
+		}
+		return true;
+	}
+
+	// reads up to cb bytes, returns the count (0 at end of file)
+	size_t Read(void* pData, size_t cb)
+	{
+		char* p = static_cast<char*>(pData);
+		size_t total = 0;
+		while(total < cb) {
+			size_t chunk = cb - total > 0x40000000 ? 0x40000000 : cb - total;
+#ifdef _WIN32
+			DWORD got = 0;
+			if(!ReadFile(m_hFile, p + total, (DWORD)chunk, &got, NULL) || got == 0)
+				break;
+#else
+			ssize_t got = read(m_fd, p + total, chunk);
+			if(got < 0 && errno == EINTR)
+				continue;
+			if(got <= 0)
+				break;
+#endif
+			total += got;
+		}
+		return total;
+	}
+
+	bool ReadAll(std::string& data)
+	{
+		int64_t size = GetSize();
+		if(size < 0)
+			return false;
+		data.resize((size_t)size);
+		return size == 0 || Read(&data[0], data.size()) == data.size();
+	}
+
+	// flushes data (and the metadata needed to read it back) to stable storage
+	bool Sync()
+	{
+#ifdef _WIN32
+		return FlushFileBuffers(m_hFile) != FALSE;
+#elif defined(__APPLE__)
+		return fcntl(m_fd, F_FULLFSYNC) == 0 || fsync(m_fd) == 0;
+#else
+		return fdatasync(m_fd) == 0;
+#endif
+	}
+
+	int64_t GetSize() const
+	{
+#ifdef _WIN32
+		LARGE_INTEGER size;
+		return GetFileSizeEx(m_hFile, &size) ? size.QuadPart : -1;
+#else
+		struct stat st;
+		return fstat(m_fd, &st) == 0 ? (int64_t)st.st_size : -1;
+#endif
+	}
+
+	bool Truncate(int64_t size)
+	{
+#ifdef _WIN32
+		LARGE_INTEGER pos;
+		pos.QuadPart = size;
+		return SetFilePointerEx(m_hFile, pos, NULL, FILE_BEGIN) && SetEndOfFile(m_hFile);
+#else
+		return ftruncate(m_fd, size) == 0;
+#endif
+	}
+
+	static bool Exists(const std::string& path)
+	{
+#ifdef _WIN32
+		return GetFileAttributesW(Widen(path).c_str()) != INVALID_FILE_ATTRIBUTES;
+#else
+		struct stat st;
+		return stat(path.c_str(), &st) == 0;
+#endif
+	}
+
+	static bool Delete(const std::string& path)
+	{
+#ifdef _WIN32
+		return DeleteFileW(Widen(path).c_str()) != FALSE;
+#else
+		return unlink(path.c_str()) == 0;
+#endif
+	}
+
+	// atomically replaces to with from, durable once this returns true
+	static bool Replace(const std::string& from, const std::string& to)
+	{
+#ifdef _WIN32
+		return MoveFileExW(Widen(from).c_str(), Widen(to).c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE;
+#else
+		if(rename(from.c_str(), to.c_str()) != 0)
+			return false;
+		// the rename itself lives in the directory, sync that too
+		std::string dir = to;
+		size_t slash = dir.rfind('/');
+		dir = slash == std::string::npos ? "." : dir.substr(0, slash + 1);
+		int fd = open(dir.c_str(), O_RDONLY);
+		if(fd != -1) {
+			fsync(fd);
+			close(fd);
+		}
+		return true;
+#endif
+	}
+
+	static bool MakeDirectory(const std::string& path)
+	{
+#ifdef _WIN32
+		return CreateDirectoryW(Widen(path).c_str(), NULL) != FALSE || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+		return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+	}
+
+	// removes an empty directory
+	static bool DeleteDirectory(const std::string& path)
+	{
+#ifdef _WIN32
+		return RemoveDirectoryW(Widen(path).c_str()) != FALSE;
+#else
+		return rmdir(path.c_str()) == 0;
+#endif
+	}
+
+	static std::string JoinPath(const std::string& dir, const std::string& name)
+	{
+		if(dir.empty())
+			return name;
+		char last = dir[dir.size() - 1];
+		if(last == '/' || last == '\\')
+			return dir + name;
+		return dir + "/" + name;
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE m_hFile;
+
+	static std::wstring Widen(const std::string& utf8)
+	{
+		int cch = MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), -1, NULL, 0);
+		std::wstring wide(cch > 0 ? cch : 1, L'\0');
+		MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), -1, &wide[0], cch);
+		wide.resize(cch > 0 ? cch - 1 : 0);
+		return wide;
+	}
+#else
+	int m_fd;
+#endif
+
+	CNativeFile(const CNativeFile&);
+	CNativeFile& operator=(const CNativeFile&);
+};
+
+}; // namespace Synrc
@@ -0,0 +1,427 @@
+// ProgressiveResults.h
+//
+//  Progressive result sets for search and import. A cursor produces
+//  matching store rows on the task pool; the list shows the first page as
+//  soon as it exists and keeps counting the rest, and the footer offers
+//  "N more, load all". The list only ever grows its item count, so the
+//  time to first results depends on the page size, not on the match count.
+//
+//  With a highlighter the producer also works out where each row matched,
+//  as character spans of its name, email and phone, and publishes them
+//  with the rows; painting reads them back per item instead of matching.
+//
+//  Threading: the producer runs on a pool thread and publishes batches
+//  under a lock; the owning (UI) thread takes them with Poll() after the
+//  observer's wake-up and is the only one reading the row list.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "Collation.h"
+#include "ContactStore.h"
+#include "TaskPool.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// IResultCursor - source of matching rows, read on a pool thread
+// CContactScanCursor - rows whose field contains a text, ignoring case and accents
+// CMatchSpanTable - highlight spans of result rows, by position
+// IResultHighlighter - works out the spans of rows, on the producer thread
+// IProgressiveResultsObserver - wake-up when a batch is published
+// CProgressiveResults - first page now, the rest streamed in the background
+
+namespace Synrc
+{
+
+class IResultCursor
+{
+public:
+	virtual ~IResultCursor()
+	{
+	}
+
+	// Appends the next few matches to rows; false once the source is done.
+	// Each call should be short so cancellation is noticed quickly.
+	virtual bool Fetch(std::vector<uint32_t>& rows) = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CContactScanCursor - rows whose field contains a text, ignoring case and accents
+
+class CContactScanCursor : public IResultCursor
+{
+public:
+	enum { ScanRows = 4096 };    // rows looked at per Fetch, under the store lock
+
+	CContactScanCursor(CContactStore& store, ContactField field, const std::wstring& text,
+		const CCollator& collator) :
+		m_store(store), m_field(field), m_collator(collator), m_next(0)
+	{
+		m_collator.AppendPrimaryKey(text.data(), text.size(), m_query);
+	}
+
+	virtual bool Fetch(std::vector<uint32_t>& rows)
+	{
+		CAutoLock lock(m_store.GetLock());
+		uint32_t count = (uint32_t)m_store.GetRowCount();
+		uint32_t end = count - m_next > ScanRows ? m_next + ScanRows : count;
+		for(; m_next < end; m_next++) {
+			if(!m_store.IsLive(m_next))
+				continue;
+			const std::wstring& text = m_store.GetField(m_next, m_field);
+			m_key.clear();
+			m_collator.AppendPrimaryKey(text.data(), text.size(), m_key);
+			if(m_key.find(m_query) != std::string::npos)
+				rows.push_back(m_next);
+		}
+		return m_next < count;
+	}
+
+private:
+	CContactStore& m_store;
+	ContactField m_field;
+	const CCollator& m_collator;
+	std::string m_query;
+	std::string m_key;
+	uint32_t m_next;
+
+	CContactScanCursor(const CContactScanCursor&);
+	CContactScanCursor& operator=(const CContactScanCursor&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CMatchSpanTable - highlight spans of result rows, by position
+
+// the texts of a row that are highlighted
+enum HighlightText
+{
+	HighlightName = 0,
+	HighlightEmail,
+	HighlightPhone,
+	HighlightTextCount
+};
+
+// characters [start, start + length) of a text matched the query
+struct MatchSpan
+{
+	uint16_t start;
+	uint16_t length;
+};
+
+class CMatchSpanTable
+{
+public:
+	// spans of the next position, for each text
+	void AddRow(const std::vector<MatchSpan> spans[HighlightTextCount])
+	{
+		for(int text = 0; text < HighlightTextCount; text++) {
+			m_spans.insert(m_spans.end(), spans[text].begin(), spans[text].end());
+			m_ends.push_back((uint32_t)m_spans.size());
+		}
+	}
+
+	// moves the rows of other after these
+	void Append(CMatchSpanTable& other)
+	{
+		if(m_ends.empty()) {
+			Swap(other);
+			return;
+		}
+		uint32_t base = (uint32_t)m_spans.size();
+		m_spans.insert(m_spans.end(), other.m_spans.begin(), other.m_spans.end());
+		for(size_t i = 0; i < other.m_ends.size(); i++)
+			m_ends.push_back(base + other.m_ends[i]);
+		other.Clear();
+	}
+
+	void Swap(CMatchSpanTable& other)
+	{
+		m_ends.swap(other.m_ends);
+		m_spans.swap(other.m_spans);
+	}
+
+	void Clear()
+	{
+		m_ends.clear();
+		m_spans.clear();
+	}
+
+	uint32_t GetRowCount() const
+	{
+		return (uint32_t)(m_ends.size() / HighlightTextCount);
+	}
+
+	// the spans of a text at position, ascending; NULL past the rows
+	const MatchSpan* Get(uint32_t position, HighlightText text, uint32_t& count) const
+	{
+		size_t index = (size_t)position * HighlightTextCount + text;
+		if(index >= m_ends.size()) {
+			count = 0;
+			return NULL;
+		}
+		uint32_t first = index > 0 ? m_ends[index - 1] : 0;
+		count = m_ends[index] - first;
+		return count > 0 ? &m_spans[first] : NULL;
+	}
+
+	size_t GetMemoryUsage() const
+	{
+		return m_ends.capacity() * sizeof(uint32_t) + m_spans.capacity() * sizeof(MatchSpan);
+	}
+
+private:
+	std::vector<uint32_t> m_ends;       // per position and text, the end of its spans
+	std::vector<MatchSpan> m_spans;
+};
+
+class IResultHighlighter
+{
+public:
+	virtual ~IResultHighlighter()
+	{
+	}
+
+	// Appends a row of spans to table for each of rows, on the producer
+	// thread; reads the store under its lock.
+	virtual void AddSpans(const std::vector<uint32_t>& rows, CMatchSpanTable& table) = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CProgressiveResults - first page now, the rest streamed in the background
+
+class IProgressiveResultsObserver
+{
+public:
+	virtual ~IProgressiveResultsObserver()
+	{
+	}
+
+	// Called on the producer thread, once until the next Poll(); post a
+	// message to the owning thread and Poll() there.
+	virtual void OnResultsAvailable() = 0;
+};
+
+class CProgressiveResults
+{
+public:
+	enum
+	{
+		DefaultFirstPage = 200,
+		MaxBatchRows = 65536,   // published batches double from the first page up to this
+		PublishMs = 100         // a smaller batch is published after this long
+	};
+
+	explicit CProgressiveResults(CTaskPool& pool = CTaskPool::GetDefault()) :
+		m_group(pool), m_pCursor(NULL), m_pHighlighter(NULL), m_pObserver(NULL), m_firstPage(DefaultFirstPage),
+		m_startUs(0), m_bComplete(true), m_bShowAll(false), m_firstResultsUs(0), m_spanNs(0), m_bSignalled(false),
+		m_bDone(true), m_bCancel(0)
+	{
+	}
+
+	~CProgressiveResults()
+	{
+		Cancel();
+	}
+
+	void SetObserver(IProgressiveResultsObserver* pObserver)
+	{
+		m_pObserver = pObserver;
+	}
+
+	// Drops the previous result set and starts streaming from pCursor;
+	// with pHighlighter the rows come with their match spans. Both are
+	// deleted when done.
+	void Start(IResultCursor* pCursor, uint32_t firstPage = DefaultFirstPage, IResultHighlighter* pHighlighter = NULL)
+	{
+		Cancel();
+		m_rows.clear();
+		m_published.clear();
+		m_spans.Clear();
+		m_publishedSpans.Clear();
+		m_spanNs = 0;
+		m_pCursor = pCursor;
+		m_pHighlighter = pHighlighter;
+		m_firstPage = firstPage > 0 ? firstPage : 1;
+		m_bSignalled = false;
+		m_bDone = false;
+		m_bComplete = false;
+		m_bShowAll = false;
+		m_firstResultsUs = 0;
+		m_startUs = GetTimeUs();
+		AtomicStore(&m_bCancel, 0);
+		m_group.Run(ProduceProc, this, PrioritySearch);
+	}
+
+	// stops the producer; the rows taken so far stay
+	void Cancel()
+	{
+		AtomicStore(&m_bCancel, 1);
+		m_group.Wait();
+		delete m_pCursor;
+		m_pCursor = NULL;
+		delete m_pHighlighter;
+		m_pHighlighter = NULL;
+	}
+
+	// Takes the published batches; true when the list or footer changed.
+	bool Poll()
+	{
+		CAutoLock lock(m_cs);
+		if(m_published.empty() && m_bDone == m_bComplete)
+			return false;
+		if(m_rows.empty())
+			m_rows.swap(m_published);
+		else
+			m_rows.insert(m_rows.end(), m_published.begin(), m_published.end());
+		m_published.clear();
+		m_spans.Append(m_publishedSpans);
+		m_bComplete = m_bDone;
+		m_bSignalled = false;
+		return true;
+	}
+
+	// item count of the list: the first page until LoadAll()
+	uint32_t GetVisibleCount() const
+	{
+		if(m_bShowAll || m_rows.size() < m_firstPage)
+			return (uint32_t)m_rows.size();
+		return m_firstPage;
+	}
+
+	// the "N more" of the footer
+	uint32_t GetMoreCount() const
+	{
+		return (uint32_t)m_rows.size() - GetVisibleCount();
+	}
+
+	uint32_t GetLoadedCount() const
+	{
+		return (uint32_t)m_rows.size();
+	}
+
+	// no more rows will come; GetMoreCount() is final
+	bool IsComplete() const
+	{
+		return m_bComplete;
+	}
+
+	void LoadAll()
+	{
+		m_bShowAll = true;
+	}
+
+	bool IsShowingAll() const
+	{
+		return m_bShowAll;
+	}
+
+	uint32_t GetRow(uint32_t position) const
+	{
+		return m_rows[position];
+	}
+
+	// where the row at position matched, none without a highlighter
+	const MatchSpan* GetSpans(uint32_t position, HighlightText text, uint32_t& count) const
+	{
+		return m_spans.Get(position, text, count);
+	}
+
+	const CMatchSpanTable& GetSpanTable() const
+	{
+		return m_spans;
+	}
+
+	// producer time spent on spans so far
+	uint64_t GetSpanNs()
+	{
+		CAutoLock lock(m_cs);
+		return m_spanNs;
+	}
+
+	// from Start() to the first published batch, 0 until then
+	uint64_t GetFirstResultsUs()
+	{
+		CAutoLock lock(m_cs);
+		return m_firstResultsUs;
+	}
+
+private:
+	CTaskGroup m_group;
+	IResultCursor* m_pCursor;
+	IResultHighlighter* m_pHighlighter;
+	IProgressiveResultsObserver* m_pObserver;
+	uint32_t m_firstPage;
+	uint64_t m_startUs;
+	std::vector<uint32_t> m_rows;           // owner thread only
+	CMatchSpanTable m_spans;                // owner thread only
+	bool m_bComplete;
+	bool m_bShowAll;
+
+	CCritSec m_cs;                          // guards the members below
+	std::vector<uint32_t> m_published;
+	CMatchSpanTable m_publishedSpans;
+	uint64_t m_firstResultsUs;
+	uint64_t m_spanNs;
+	bool m_bSignalled;
+	bool m_bDone;
+
+	volatile int32_t m_bCancel;
+
+	static void ProduceProc(void* p)
+	{
+		static_cast<CProgressiveResults*>(p)->Produce();
+	}
+
+	void Produce()
+	{
+		std::vector<uint32_t> batch;
+		CMatchSpanTable spans;
+		uint64_t spanNs = 0;
+		size_t threshold = m_firstPage;
+		uint32_t lastPublishMs = GetTimeMs();
+		bool bMore = true;
+		while(bMore && !AtomicLoad(&m_bCancel)) {
+			bMore = m_pCursor->Fetch(batch);
+			uint32_t now = GetTimeMs();
+			if(!bMore || batch.size() >= threshold || (!batch.empty() && now - lastPublishMs >= PublishMs)) {
+				if(m_pHighlighter != NULL) {
+					uint64_t startNs = GetTimeNs();
+					m_pHighlighter->AddSpans(batch, spans);
+					spanNs = GetTimeNs() - startNs;
+				}
+				Publish(batch, spans, spanNs, !bMore);
+				batch.clear();
+				threshold = threshold * 2 < MaxBatchRows ? threshold * 2 : (size_t)MaxBatchRows;
+				lastPublishMs = now;
+			}
+		}
+	}
+
+	void Publish(const std::vector<uint32_t>& batch, CMatchSpanTable& spans, uint64_t spanNs, bool bDone)
+	{
+		bool bNotify;
+		{
+			CAutoLock lock(m_cs);
+			m_published.insert(m_published.end(), batch.begin(), batch.end());
+			m_publishedSpans.Append(spans);
+			m_spanNs += spanNs;
+			m_bDone = bDone;
+			if(m_firstResultsUs == 0 && (!batch.empty() || bDone))
+				m_firstResultsUs = GetTimeUs() - m_startUs;
+			bNotify = !m_bSignalled;
+			m_bSignalled = true;
+		}
+		if(bNotify && m_pObserver != NULL)
+			m_pObserver->OnResultsAvailable();
+	}
+
+	CProgressiveResults(const CProgressiveResults&);
+	CProgressiveResults& operator=(const CProgressiveResults&);
+};
+
+}; // namespace Synrc
@@ -150,11 +150,13 @@ public:
 		return 0;
 	}
 
-	LRESULT OnEditChange(WORD /*wNotifyCode*/, WORD /*wID*/, HWND /*hWndCtl*/, BOOL& bHandled)
+	LRESULT OnEditChange(WORD wNotifyCode, WORD /*wID*/, HWND /*hWndCtl*/, BOOL& bHandled)
 	{
 		m_ctrlSearchButton.ChangeBitmap(IDC_SEARCHDROP, m_ctrlEdit.GetWindowTextLength() > 0 ? 1 : 0);
 		_Invalidate();
-		// TODO: Notify someone about SEARCH filter change!
+		// the frame runs the search
+		if( wNotifyCode == EN_CHANGE )
+			GetTopLevelParent().SendMessage(WM_COMMAND, MAKEWPARAM(IDC_SEARCHFILTER, EN_CHANGE), (LPARAM) m_ctrlEdit.m_hWnd);
 		bHandled = FALSE;
 		return 0;
 	}
@@ -0,0 +1,246 @@
+// SearchCache.h
+//
+//  Recent search results for the search-as-you-type pipeline. People type,
+//  backspace and retype, and flip between the same few filters; each of
+//  those asks a field index for a match set it has just computed. Entries
+//  are keyed by field and normalized query (the index's query key, so
+//  "Anna", "ANNA" and "anna" share one) and tagged with the store's epoch:
+//  any change to the store makes them stale.
+//
+//  A query found as is returns its rows, which is what backspacing does. A
+//  query that extends a cached one narrows those rows instead of searching
+//  the field: a field containing "anna" contains "ann", so the rows of
+//  "ann" are a superset. Entries are evicted least recently used first
+//  once the row lists pass a memory budget.
+//
+//  Threading: lookups come from search tasks on the pool; the cache has
+//  its own lock and never holds it while searching.
+
+#pragma once
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Platform.h"
+#include "ContactStore.h"
+#include "SearchQuery.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CQueryResultCache - match sets by field and query, bounded by memory
+
+namespace Synrc
+{
+
+struct QueryCacheStats
+{
+	uint64_t lookups;
+	uint64_t hits;              // returned as cached
+	uint64_t narrowed;          // filtered from a cached superset
+	uint64_t misses;            // searched the field
+	uint64_t stale;             // entries dropped for an older epoch
+	uint64_t evictions;         // entries dropped for the budget
+	size_t entries;
+	size_t bytes;
+
+	QueryCacheStats() : lookups(0), hits(0), narrowed(0), misses(0), stale(0), evictions(0), entries(0), bytes(0)
+	{
+	}
+
+	double GetHitRate() const
+	{
+		return lookups > 0 ? (double)(hits + narrowed) / lookups : 0.0;
+	}
+};
+
+class CQueryResultCache : public IMatchCache
+{
+public:
+	enum CacheResult
+	{
+		CacheMiss,
+		CacheHit,
+		CacheNarrowed
+	};
+
+	enum
+	{
+		DefaultBudget = 32 * 1024 * 1024,
+		EntryOverhead = 96      // list node, map slot and strings, roughly
+	};
+
+	explicit CQueryResultCache(CContactStore& store, size_t budget = DefaultBudget) :
+		m_store(store), m_budget(budget), m_bytes(0)
+	{
+	}
+
+	// The rows of index.Search(key), ascending, from the cache when they
+	// are there or can be narrowed from a cached superset.
+	CacheResult SearchIndex(CFieldIndex& index, const std::string& key, std::vector<uint32_t>& rows)
+	{
+		rows.clear();
+		if(key.empty())
+			return CacheMiss;   // matches nothing, and would be inside every key
+		uint64_t epoch;
+		{
+			CAutoLock storeLock(m_store.GetLock());
+			epoch = m_store.GetEpoch();     // before searching: a later change makes the entry stale
+		}
+		std::string name = GetName(index.GetField(), key);
+		CacheResult result = Find(name, key, epoch, rows);
+		if(result == CacheHit)
+			return result;
+		if(result == CacheNarrowed)
+			index.Filter(key, rows);
+		else
+			index.Search(key, rows);
+		Add(name, epoch, rows);
+		return result;
+	}
+
+	// implementation of IMatchCache
+	virtual void Search(CFieldIndex& index, const std::string& key, std::vector<uint32_t>& rows)
+	{
+		SearchIndex(index, key, rows);
+	}
+	// implementation of IMatchCache
+
+	void Clear()
+	{
+		CAutoLock lock(m_cs);
+		m_entries.clear();
+		m_names.clear();
+		m_bytes = 0;
+	}
+
+	// evicts at once down to the new budget
+	void SetBudget(size_t budget)
+	{
+		CAutoLock lock(m_cs);
+		m_budget = budget;
+		Trim();
+	}
+
+	QueryCacheStats GetStats()
+	{
+		CAutoLock lock(m_cs);
+		QueryCacheStats stats = m_stats;
+		stats.entries = m_entries.size();
+		stats.bytes = m_bytes;
+		return stats;
+	}
+
+private:
+	struct Entry
+	{
+		std::string name;       // field byte, then the query key
+		uint64_t epoch;
+		std::vector<uint32_t> rows;
+	};
+
+	typedef std::list<Entry> EntryList;     // most recently used first
+	typedef std::unordered_map<std::string, EntryList::iterator> NameMap;
+
+	CContactStore& m_store;
+	CCritSec m_cs;
+	size_t m_budget;
+	size_t m_bytes;
+	EntryList m_entries;
+	NameMap m_names;
+	QueryCacheStats m_stats;
+
+	static std::string GetName(ContactField field, const std::string& key)
+	{
+		std::string name(1, (char)field);
+		name += key;
+		return name;
+	}
+
+	static size_t GetSize(const Entry& entry)
+	{
+		return entry.rows.capacity() * sizeof(uint32_t) + entry.name.capacity() + EntryOverhead;
+	}
+
+	// The entry of name, or else the smallest one of the same field whose
+	// key is inside key; copies its rows.
+	CacheResult Find(const std::string& name, const std::string& key, uint64_t epoch, std::vector<uint32_t>& rows)
+	{
+		CAutoLock lock(m_cs);
+		m_stats.lookups++;
+		NameMap::iterator found = m_names.find(name);
+		if(found != m_names.end() && found->second->epoch == epoch) {
+			m_entries.splice(m_entries.begin(), m_entries, found->second);
+			rows = found->second->rows;
+			m_stats.hits++;
+			return CacheHit;
+		}
+
+		EntryList::iterator best = m_entries.end();
+		for(EntryList::iterator it = m_entries.begin(); it != m_entries.end(); ) {
+			if(it->epoch != epoch) {
+				m_stats.stale++;
+				it = Remove(it);
+				continue;
+			}
+			if(it->name[0] == name[0] && it->name.size() < name.size() &&
+				key.find(it->name.c_str() + 1, 0, it->name.size() - 1) != std::string::npos &&
+				(best == m_entries.end() || it->rows.size() < best->rows.size()))
+				best = it;
+			++it;
+		}
+		if(best == m_entries.end()) {
+			m_stats.misses++;
+			return CacheMiss;
+		}
+		m_entries.splice(m_entries.begin(), m_entries, best);
+		rows = best->rows;
+		m_stats.narrowed++;
+		return CacheNarrowed;
+	}
+
+	void Add(const std::string& name, uint64_t epoch, const std::vector<uint32_t>& rows)
+	{
+		CAutoLock lock(m_cs);
+		NameMap::iterator found = m_names.find(name);
+		if(found != m_names.end())
+			Remove(found->second);
+		Entry entry;
+		entry.name = name;
+		entry.epoch = epoch;
+		entry.rows = rows;
+		size_t size = GetSize(entry);
+		if(size > m_budget / 4)
+			return;             // one result would push out most of the others
+		m_entries.push_front(Entry());
+		m_entries.front().name.swap(entry.name);
+		m_entries.front().epoch = epoch;
+		m_entries.front().rows.swap(entry.rows);
+		m_names[name] = m_entries.begin();
+		m_bytes += size;
+		Trim();
+	}
+
+	void Trim()
+	{
+		while(m_bytes > m_budget && !m_entries.empty()) {
+			Remove(--m_entries.end());
+			m_stats.evictions++;
+		}
+	}
+
+	EntryList::iterator Remove(EntryList::iterator it)
+	{
+		m_bytes -= GetSize(*it);
+		m_names.erase(it->name);
+		return m_entries.erase(it);
+	}
+
+	CQueryResultCache(const CQueryResultCache&);
+	CQueryResultCache& operator=(const CQueryResultCache&);
+};
+
+}; // namespace Synrc
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Misc.h"
+#include "SearchQuery.h"
 
 class CSearchEditCtrl : 
 	public ATL::CWindowImpl<CSearchEditCtrl>,
@@ -15,8 +16,9 @@ public:
 	CRect m_rcButton;            // Size of button (w. dropdown)
 	bool m_bDropped;             // Is dropdown activated? (sadly there is no runtime state for this)
 	bool m_bTracking;            // Is button hot?
+	int m_nScope;                // CSearchQuery scope of the text, -1 for all fields
 
-	CSearchEditCtrl() : m_ctrlEdit(this, 1), m_bDropped(false), m_bTracking(false)
+	CSearchEditCtrl() : m_ctrlEdit(this, 1), m_bDropped(false), m_bTracking(false), m_nScope(-1)
 	{
 	}
 
@@ -90,13 +92,18 @@ public:
 		CMenu menu;
 		menu.LoadMenu(IDM_SEARCHALL);
 		CMenuHandle submenu = menu.GetSubMenu(0);
+		submenu.CheckMenuRadioItem(ID_SEARCH_SCOPE_ALL, ID_SEARCH_SCOPE_LABEL, ID_SEARCH_SCOPE_ALL + 1 + m_nScope, MF_BYCOMMAND);
 		RECT rcItem = { 0 };
 		m_ctrlToolBar.GetItemRect(m_ctrlToolBar.CommandToIndex(IDC_SEARCHDROP), &rcItem);
 		::MapWindowPoints(m_ctrlToolBar, HWND_DESKTOP, (LPPOINT) &rcItem, 2);
 		TPMPARAMS tpmp = { sizeof(tpmp) };
 		rcItem.bottom -= 6;
 		tpmp.rcExclude = rcItem;
-		TrackPopupMenuEx(submenu, TPM_LEFTBUTTON | TPM_RIGHTALIGN, rcItem.right, rcItem.bottom, m_hWnd, &tpmp);
+		UINT nCmd = TrackPopupMenuEx(submenu, TPM_LEFTBUTTON | TPM_RIGHTALIGN | TPM_RETURNCMD, rcItem.right, rcItem.bottom, m_hWnd, &tpmp);
+		if( nCmd >= ID_SEARCH_SCOPE_ALL && nCmd <= ID_SEARCH_SCOPE_LABEL )
+			SetScope((int) (nCmd - ID_SEARCH_SCOPE_ALL) - 1);
+		else if( nCmd != 0 )
+			SendMessage(WM_COMMAND, nCmd);
 
 		m_bDropped = false;
 		m_ctrlToolBar.Invalidate();
@@ -107,10 +114,30 @@ public:
 	LRESULT OnEditChange(WORD /*wNotifyCode*/, WORD /*wID*/, HWND /*hWndCtl*/, BOOL& /*bHandled*/)
 	{
 		m_ctrlToolBar.ChangeBitmap(IDC_SEARCHDROP, m_ctrlEdit.GetWindowTextLength() > 0 ? 1 : 0);
-		// TODO: Notify someone about SEARCH filter change!
+		std::wstring text;
+		_GetEditText(text);
+		size_t cchPrefix = Synrc::CSearchQuery::GetScopePrefixLength(text);
+		m_nScope = cchPrefix > 0 ? Synrc::CSearchQuery::FindScope(text.c_str(), cchPrefix - 1) : -1;
+		// the frame runs the search
+		GetTopLevelParent().SendMessage(WM_COMMAND, MAKEWPARAM(IDC_SEARCHFILTER, EN_CHANGE), (LPARAM) m_ctrlEdit.m_hWnd);
 		return 0;
 	}
 
+	// Puts "scope:" in front of the query, replacing the one there; the
+	// text is what CScopedSearchCursor parses. -1 searches all fields.
+	void SetScope(int nScope)
+	{
+		std::wstring text;
+		_GetEditText(text);
+		text.erase(0, Synrc::CSearchQuery::GetScopePrefixLength(text));
+		if( nScope >= 0 )
+			text.insert(0, std::wstring(Synrc::CSearchQuery::GetScopeName(nScope)) + L":");
+		m_nScope = nScope;
+		::SetWindowTextW(m_ctrlEdit, text.c_str());
+		m_ctrlEdit.SetSel((int) text.size(), (int) text.size());
+		m_ctrlEdit.SetFocus();
+	}
+
 	// Edit messages
 
 	LRESULT OnMouseMove(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& bHandled)
@@ -251,4 +278,12 @@ public:
 		tme.hwndTrack = m_ctrlEdit;
 		return _TrackMouseEvent(&tme);
 	}
+
+	void _GetEditText(std::wstring& text)
+	{
+		int cch = ::GetWindowTextLengthW(m_ctrlEdit);
+		text.assign(cch + 1, L'\0');
+		::GetWindowTextW(m_ctrlEdit, &text[0], cch + 1);
+		text.resize(cch);
+	}
 };
@@ -0,0 +1,679 @@
+// SearchQuery.h
+//
+//  Field-scoped search: "name:ivan company:synrc" or "email:gmail AND
+//  label:family". Every term is a substring of one field, ignoring case and
+//  accents; words without a scope look in all the scoped fields. Terms are
+//  ANDed.
+//
+//  Each field has its own index: the primary keys of the column, computed
+//  once, back to back in one buffer. A term searches that buffer with
+//  memchr/memcmp and maps hits back to rows, so it never touches other
+//  fields or recomputes keys. The first term is searched in full; when it
+//  leaves few rows, later terms are only checked on those. Phone numbers
+//  are indexed by their digits alone, so "5551234" finds "555-12-34".
+//
+//  Rows edited after an index was built are checked against their current
+//  text until there are enough of them to rebuild, as in FuzzySearch.h.
+//  Locking: an index's lock first, then the store's.
+
+#pragma once
+
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "Collation.h"
+#include "ContactStore.h"
+#include "EventTrace.h"
+#include "ProgressiveResults.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CFieldIndex - primary keys of one field, searched for substrings
+// CFieldIndexSet - the indexes of the scoped fields, built on first use
+// IMatchCache - field searches kept for reuse, see SearchCache.h
+// CSearchQuery - parses scoped queries into terms
+// CScopedSearchCursor - rows matching every term of a query
+
+namespace Synrc
+{
+
+// how a field matched a query, the better the higher
+enum MatchKind
+{
+	MatchNone = 0,
+	MatchFuzzy,             // only within a few edits of one of its words
+	MatchSubstring,
+	MatchWordPrefix,        // a word of the field starts with the query
+	MatchPrefix,
+	MatchExact
+};
+
+class CFieldIndex : public IContactStoreObserver
+{
+public:
+	enum { RebuildRows = 4096 };    // edited rows checked one by one before a rebuild
+
+	CFieldIndex(CContactStore& store, ContactField field, const CCollator& collator) :
+		m_store(store), m_field(field), m_collator(collator), m_bStale(true)
+	{
+		m_store.AddObserver(this);
+	}
+
+	~CFieldIndex()
+	{
+		m_store.RemoveObserver(this);
+	}
+
+	ContactField GetField() const
+	{
+		return m_field;
+	}
+
+	// The text as this index compares it: its primary key, digits only
+	// for phone numbers.
+	void GetQueryKey(const std::wstring& text, std::string& key) const
+	{
+		key.clear();
+		AppendFieldKey(text, key);
+	}
+
+	void Rebuild()
+	{
+		CAutoLock lock(m_cs);
+		CAutoLock storeLock(m_store.GetLock());
+		Build();
+	}
+
+	// Appends the live rows, ascending, whose field contains key (from
+	// GetQueryKey()); an empty key matches no row.
+	void Search(const std::string& key, std::vector<uint32_t>& rows)
+	{
+		if(key.empty())
+			return;
+		CAutoLock lock(m_cs);
+		CAutoLock storeLock(m_store.GetLock());
+		if(m_bStale)
+			Build();
+		size_t first = rows.size();
+		const char* pKeys = m_keys.data();
+		size_t size = m_keys.size();
+		// memchr for the key's rarest byte stops least often
+		size_t anchor = 0;
+		for(size_t i = 1; i < key.size(); i++) {
+			if(m_byteCounts[(uint8_t)key[i]] < m_byteCounts[(uint8_t)key[anchor]])
+				anchor = i;
+		}
+		size_t pos = 0;
+		while(pos + key.size() <= size) {
+			const char* pHit = (const char*)memchr(pKeys + pos + anchor, key[anchor], size - pos - key.size() + 1);
+			if(pHit == NULL)
+				break;
+			pos = pHit - pKeys - anchor;
+			if(memcmp(pKeys + pos, key.data(), key.size()) != 0) {
+				pos++;
+				continue;
+			}
+			uint32_t row = (uint32_t)(std::upper_bound(m_starts.begin(), m_starts.end(), (uint32_t)pos) - m_starts.begin() - 1);
+			if(pos + key.size() > m_starts[row + 1]) {
+				pos++;          // runs into the next row's key
+				continue;
+			}
+			if(m_store.IsLive(row) && !std::binary_search(m_dirty.begin(), m_dirty.end(), row))
+				rows.push_back(row);
+			pos = m_starts[row + 1];
+		}
+		size_t clean = rows.size();
+		for(size_t i = 0; i < m_dirty.size(); i++) {
+			if(m_store.IsLive(m_dirty[i]) && ContainsCurrent(m_dirty[i], key))
+				rows.push_back(m_dirty[i]);
+		}
+		std::inplace_merge(rows.begin() + first, rows.begin() + clean, rows.end());
+	}
+
+	// Keeps the rows, ascending, whose field contains key; for narrowing a
+	// few candidates without searching the whole field.
+	void Filter(const std::string& key, std::vector<uint32_t>& rows)
+	{
+		CAutoLock lock(m_cs);
+		CAutoLock storeLock(m_store.GetLock());
+		if(m_bStale)
+			Build();
+		size_t kept = 0;
+		for(size_t i = 0; i < rows.size(); i++) {
+			if(Contains(rows[i], key))
+				rows[kept++] = rows[i];
+		}
+		rows.resize(kept);
+	}
+
+	// How the field of each row matches key, for ranking what Search()
+	// found; kinds gets one entry per row.
+	void GetMatchKinds(const std::string& key, const std::vector<uint32_t>& rows, std::vector<uint8_t>& kinds)
+	{
+		CAutoLock lock(m_cs);
+		CAutoLock storeLock(m_store.GetLock());
+		if(m_bStale)
+			Build();
+		kinds.resize(rows.size());
+		for(size_t i = 0; i < rows.size(); i++) {
+			uint32_t row = rows[i];
+			if(!m_store.IsLive(row)) {
+				kinds[i] = MatchNone;
+			}
+			else if(row + 1 >= m_starts.size() || std::binary_search(m_dirty.begin(), m_dirty.end(), row)) {
+				m_key.clear();
+				AppendFieldKey(m_store.GetField(row, m_field), m_key);
+				kinds[i] = (uint8_t)GetMatchKind(m_key.data(), m_key.size(), key);
+			}
+			else {
+				kinds[i] = (uint8_t)GetMatchKind(m_keys.data() + m_starts[row], m_starts[row + 1] - m_starts[row], key);
+			}
+		}
+	}
+
+	// best match of query in the cch bytes of a field key
+	static MatchKind GetMatchKind(const char* pKey, size_t cch, const std::string& query)
+	{
+		if(query.empty() || cch < query.size())
+			return MatchNone;
+		if(memcmp(pKey, query.data(), query.size()) == 0)
+			return cch == query.size() ? MatchExact : MatchPrefix;
+		MatchKind kind = MatchNone;
+		const char* pEnd = pKey + cch;
+		for(const char* p = pKey + 1; ; p++) {
+			p = std::search(p, pEnd, query.begin(), query.end());
+			if(p == pEnd)
+				break;
+			if((uint8_t)p[-1] == CCollator::WeightSeparator)
+				return MatchWordPrefix;
+			kind = MatchSubstring;
+		}
+		return kind;
+	}
+
+	size_t GetMemoryUsage() const
+	{
+		return m_keys.capacity() + (m_starts.capacity() + m_dirty.capacity()) * sizeof(uint32_t);
+	}
+
+	// implementation of IContactStoreObserver
+	virtual void OnContactChanged(uint32_t row, ContactChange change)
+	{
+		CAutoLock lock(m_cs);
+		if(m_bStale)
+			return;
+		switch(change) {
+		case ContactAdded:
+		case ContactUpdated:
+			if(m_dirty.size() >= RebuildRows) {
+				m_bStale = true;
+				break;
+			}
+			if(!std::binary_search(m_dirty.begin(), m_dirty.end(), row))
+				m_dirty.insert(std::lower_bound(m_dirty.begin(), m_dirty.end(), row), row);
+			break;
+		case ContactRemoved:
+		case ContactsRemoved:
+			break;              // dead rows are skipped
+		case ContactsCleared:
+			m_bStale = true;
+			break;
+		}
+	}
+	// implementation of IContactStoreObserver
+
+private:
+	CContactStore& m_store;
+	ContactField m_field;
+	const CCollator& m_collator;
+	CCritSec m_cs;
+	bool m_bStale;
+	std::string m_keys;                 // keys of all rows at build, back to back
+	std::vector<uint32_t> m_starts;     // per row its key's offset, and the end
+	std::vector<uint32_t> m_dirty;      // rows edited since the build, ascending
+	uint32_t m_byteCounts[256];         // of m_keys
+	std::string m_key;                  // scratch, under m_cs
+
+	void AppendFieldKey(const std::wstring& text, std::string& key) const
+	{
+		size_t start = key.size();
+		m_collator.AppendPrimaryKey(text.data(), text.size(), key);
+		if(m_field != FieldPhone)
+			return;
+		size_t out = start;
+		for(size_t i = start; i < key.size(); i++) {
+			uint8_t weight = (uint8_t)key[i];
+			if(weight == CCollator::WeightOther)
+				i += CCollator::OtherBytes;     // the code unit, which may look like a digit
+			else if(weight >= CCollator::WeightDigit && weight < CCollator::WeightDigit + 10)
+				key[out++] = key[i];
+		}
+		key.resize(out);
+	}
+
+	void Build()
+	{
+		CTraceScope trace("index.field", "index");
+		uint32_t count = (uint32_t)m_store.GetRowCount();
+		m_keys.clear();
+		m_starts.resize(count + 1);
+		for(uint32_t row = 0; row < count; row++) {
+			m_starts[row] = (uint32_t)m_keys.size();
+			if(m_store.IsLive(row))
+				AppendFieldKey(m_store.GetField(row, m_field), m_keys);
+		}
+		m_starts[count] = (uint32_t)m_keys.size();
+		memset(m_byteCounts, 0, sizeof(m_byteCounts));
+		for(size_t i = 0; i < m_keys.size(); i++)
+			m_byteCounts[(uint8_t)m_keys[i]]++;
+		m_dirty.clear();
+		m_bStale = false;
+	}
+
+	bool Contains(uint32_t row, const std::string& key)
+	{
+		if(!m_store.IsLive(row))
+			return false;
+		if(row + 1 >= m_starts.size() || std::binary_search(m_dirty.begin(), m_dirty.end(), row))
+			return ContainsCurrent(row, key);
+		const char* pBegin = m_keys.data() + m_starts[row];
+		const char* pEnd = m_keys.data() + m_starts[row + 1];
+		return std::search(pBegin, pEnd, key.begin(), key.end()) != pEnd;
+	}
+
+	bool ContainsCurrent(uint32_t row, const std::string& key)
+	{
+		m_key.clear();
+		AppendFieldKey(m_store.GetField(row, m_field), m_key);
+		return m_key.find(key) != std::string::npos;
+	}
+
+	CFieldIndex(const CFieldIndex&);
+	CFieldIndex& operator=(const CFieldIndex&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CFieldIndexSet - the indexes of the scoped fields, built on first use
+
+class CFieldIndexSet
+{
+public:
+	CFieldIndexSet(CContactStore& store, const CCollator& collator) : m_store(store), m_collator(collator)
+	{
+		for(int i = 0; i < FieldCount; i++)
+			m_pIndexes[i] = NULL;
+	}
+
+	~CFieldIndexSet()
+	{
+		for(int i = 0; i < FieldCount; i++)
+			delete m_pIndexes[i];
+	}
+
+	// from any thread; the index is made on first use and kept
+	CFieldIndex& GetIndex(ContactField field)
+	{
+		CAutoLock lock(m_cs);
+		if(m_pIndexes[field] == NULL)
+			m_pIndexes[field] = new CFieldIndex(m_store, field, m_collator);
+		return *m_pIndexes[field];
+	}
+
+	size_t GetMemoryUsage()
+	{
+		CAutoLock lock(m_cs);
+		size_t size = 0;
+		for(int i = 0; i < FieldCount; i++) {
+			if(m_pIndexes[i] != NULL)
+				size += m_pIndexes[i]->GetMemoryUsage();
+		}
+		return size;
+	}
+
+private:
+	CContactStore& m_store;
+	const CCollator& m_collator;
+	CCritSec m_cs;
+	CFieldIndex* m_pIndexes[FieldCount];
+
+	CFieldIndexSet(const CFieldIndexSet&);
+	CFieldIndexSet& operator=(const CFieldIndexSet&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// IMatchCache - field searches kept for reuse, see SearchCache.h
+
+class IMatchCache
+{
+public:
+	virtual ~IMatchCache()
+	{
+	}
+
+	// sets rows to what index.Search(key) finds, from any thread
+	virtual void Search(CFieldIndex& index, const std::string& key, std::vector<uint32_t>& rows) = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CSearchQuery - parses scoped queries into terms
+
+struct SearchTerm
+{
+	ContactField field;     // FieldCount for any scoped field
+	std::wstring text;
+};
+
+class CSearchQuery
+{
+public:
+	enum { ScopeCount = 5 };
+
+	// The scopes in menu order: name, email, phone, company, label.
+	static ContactField GetScopeField(int scope)
+	{
+		static const ContactField s_fields[ScopeCount] = { FieldName, FieldEmail, FieldPhone, FieldCompany, FieldLabel };
+		return s_fields[scope];
+	}
+
+	static const wchar_t* GetScopeName(int scope)
+	{
+		static const wchar_t* const s_names[ScopeCount] = { L"name", L"email", L"phone", L"company", L"label" };
+		return s_names[scope];
+	}
+
+	// Scope whose name, ASCII case ignored, is the cch characters at pText;
+	// -1 for none.
+	static int FindScope(const wchar_t* pText, size_t cch)
+	{
+		for(int scope = 0; scope < ScopeCount; scope++) {
+			const wchar_t* pName = GetScopeName(scope);
+			size_t i = 0;
+			while(i < cch && pName[i] != 0 && (pText[i] | 0x20) == pName[i])
+				i++;
+			if(i == cch && pName[i] == 0)
+				return scope;
+		}
+		return -1;
+	}
+
+	// Length of a leading "scope:" in text, 0 when it does not start with one.
+	static size_t GetScopePrefixLength(const std::wstring& text)
+	{
+		size_t colon = text.find(L':');
+		if(colon == std::wstring::npos || FindScope(text.data(), colon) < 0)
+			return 0;
+		return colon + 1;
+	}
+
+	// Terms of text, ANDed: "scope:value" with the value quoted when it has
+	// blanks, or after the colon as the next word; an "AND" between terms
+	// is allowed. Consecutive unscoped words make one any-field term, so
+	// "van der" still matches as written. Empty values are dropped.
+	static void Parse(const std::wstring& text, std::vector<SearchTerm>& terms)
+	{
+		terms.clear();
+		std::vector<std::wstring> words;
+		Split(text, words);
+		bool bJoin = false;
+		for(size_t i = 0; i < words.size(); i++) {
+			const std::wstring& word = words[i];
+			if(word == L"AND") {
+				bJoin = false;
+				continue;
+			}
+			size_t prefix = GetScopePrefixLength(word);
+			if(prefix > 0) {
+				SearchTerm term;
+				term.field = GetScopeField(FindScope(word.data(), prefix - 1));
+				term.text = Unquote(word.substr(prefix));
+				if(term.text.empty() && i + 1 < words.size() && words[i + 1] != L"AND" &&
+					GetScopePrefixLength(words[i + 1]) == 0)
+					term.text = Unquote(words[++i]);
+				if(!term.text.empty())
+					terms.push_back(term);
+				bJoin = false;
+				continue;
+			}
+			std::wstring value = Unquote(word);
+			if(bJoin) {
+				terms.back().text += L' ';
+				terms.back().text += value;
+			}
+			else if(!value.empty()) {
+				SearchTerm term;
+				term.field = FieldCount;
+				term.text = value;
+				terms.push_back(term);
+				bJoin = true;
+			}
+		}
+	}
+
+private:
+	// blank separated words; a double quoted run stays in its word
+	static void Split(const std::wstring& text, std::vector<std::wstring>& words)
+	{
+		words.clear();
+		bool bQuoted = false;
+		bool bWord = false;
+		for(size_t i = 0; i < text.size(); i++) {
+			wchar_t c = text[i];
+			if(!bQuoted && (c == L' ' || c == L'\t')) {
+				bWord = false;
+				continue;
+			}
+			if(c == L'"')
+				bQuoted = !bQuoted;
+			if(!bWord)
+				words.push_back(std::wstring());
+			words.back() += c;
+			bWord = true;
+		}
+	}
+
+	static std::wstring Unquote(const std::wstring& word)
+	{
+		std::wstring value;
+		for(size_t i = 0; i < word.size(); i++) {
+			if(word[i] != L'"')
+				value += word[i];
+		}
+		return value;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CScopedSearchCursor - rows matching every term of a query
+
+// what one term did: rows it was tried on and how many it kept
+struct SearchTermStats
+{
+	ContactField field;     // FieldCount for any scoped field
+	uint32_t examined;
+	uint32_t matched;
+	bool bScanned;          // searched the whole field rather than candidates
+
+	SearchTermStats() : field(FieldCount), examined(0), matched(0), bScanned(false)
+	{
+	}
+
+	double GetSelectivity() const
+	{
+		return examined > 0 ? (double)matched / examined : 0.0;
+	}
+};
+
+class CScopedSearchCursor : public IResultCursor
+{
+public:
+	enum
+	{
+		FetchRows = 4096,
+		FilterRatio = 16        // later terms check candidates below 1/16 of the rows
+	};
+
+	// field searches go through pCache when there is one
+	CScopedSearchCursor(CFieldIndexSet& indexes, CContactStore& store, const std::wstring& text,
+		IMatchCache* pCache = NULL) :
+		m_indexes(indexes), m_store(store), m_pCache(pCache), m_bSearched(false), m_next(0)
+	{
+		CSearchQuery::Parse(text, m_terms);
+	}
+
+	// the search runs on the first call, the rows come a batch at a time
+	virtual bool Fetch(std::vector<uint32_t>& rows)
+	{
+		if(!m_bSearched) {
+			Search();
+			m_bSearched = true;
+		}
+		size_t end = m_rows.size() - m_next > FetchRows ? m_next + FetchRows : m_rows.size();
+		rows.insert(rows.end(), m_rows.begin() + m_next, m_rows.begin() + end);
+		m_next = end;
+		return m_next < m_rows.size();
+	}
+
+	const std::vector<SearchTerm>& GetTerms() const
+	{
+		return m_terms;
+	}
+
+	// per term in search order, once the first Fetch() returned
+	const std::vector<SearchTermStats>& GetStats() const
+	{
+		return m_stats;
+	}
+
+private:
+	CFieldIndexSet& m_indexes;
+	CContactStore& m_store;
+	IMatchCache* m_pCache;
+	std::vector<SearchTerm> m_terms;
+	std::vector<SearchTermStats> m_stats;
+	bool m_bSearched;
+	std::vector<uint32_t> m_rows;
+	size_t m_next;
+
+	// scoped terms before any-field ones, longer before shorter: the
+	// likely more selective first, so the rest may only filter
+	struct CompareTerms
+	{
+		bool operator()(const SearchTerm& a, const SearchTerm& b) const
+		{
+			bool bScopedA = a.field != FieldCount;
+			bool bScopedB = b.field != FieldCount;
+			if(bScopedA != bScopedB)
+				return bScopedA;
+			return a.text.size() > b.text.size();
+		}
+	};
+
+	void Search()
+	{
+		CTraceScope trace("search.scoped", "search");
+		if(m_terms.empty())
+			return;
+		std::stable_sort(m_terms.begin(), m_terms.end(), CompareTerms());
+		uint32_t live;
+		{
+			CAutoLock lock(m_store.GetLock());
+			live = (uint32_t)m_store.GetLiveCount();
+		}
+		std::vector<uint32_t> matches;
+		for(size_t t = 0; t < m_terms.size(); t++) {
+			SearchTermStats stats;
+			stats.field = m_terms[t].field;
+			if(t > 0 && (uint64_t)m_rows.size() * FilterRatio < live) {
+				stats.examined = (uint32_t)m_rows.size();
+				FilterTerm(m_terms[t], m_rows);
+				stats.matched = (uint32_t)m_rows.size();
+			}
+			else {
+				stats.examined = live;
+				stats.bScanned = true;
+				matches.clear();
+				ScanTerm(m_terms[t], matches);
+				stats.matched = (uint32_t)matches.size();
+				if(t == 0) {
+					m_rows.swap(matches);
+				}
+				else {
+					std::vector<uint32_t>::iterator end = std::set_intersection(m_rows.begin(), m_rows.end(),
+						matches.begin(), matches.end(), m_rows.begin());
+					m_rows.erase(end, m_rows.end());
+				}
+			}
+			m_stats.push_back(stats);
+			if(m_rows.empty())
+				break;
+		}
+	}
+
+	// the term's rows over the whole field, or fields, ascending
+	void ScanTerm(const SearchTerm& term, std::vector<uint32_t>& rows)
+	{
+		std::string key;
+		if(term.field != FieldCount) {
+			CFieldIndex& index = m_indexes.GetIndex(term.field);
+			index.GetQueryKey(term.text, key);
+			SearchField(index, key, rows);
+			return;
+		}
+		for(int scope = 0; scope < CSearchQuery::ScopeCount; scope++) {
+			CFieldIndex& index = m_indexes.GetIndex(CSearchQuery::GetScopeField(scope));
+			index.GetQueryKey(term.text, key);
+			size_t middle = rows.size();
+			SearchField(index, key, rows);
+			std::inplace_merge(rows.begin(), rows.begin() + middle, rows.end());
+		}
+		rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+	}
+
+	// appends the field's rows for key
+	void SearchField(CFieldIndex& index, const std::string& key, std::vector<uint32_t>& rows)
+	{
+		if(m_pCache == NULL) {
+			index.Search(key, rows);
+			return;
+		}
+		std::vector<uint32_t> found;
+		m_pCache->Search(index, key, found);
+		rows.insert(rows.end(), found.begin(), found.end());
+	}
+
+	void FilterTerm(const SearchTerm& term, std::vector<uint32_t>& rows)
+	{
+		std::string key;
+		if(term.field != FieldCount) {
+			CFieldIndex& index = m_indexes.GetIndex(term.field);
+			index.GetQueryKey(term.text, key);
+			index.Filter(key, rows);
+			return;
+		}
+		std::vector<uint32_t> kept;
+		for(int scope = 0; scope < CSearchQuery::ScopeCount && !rows.empty(); scope++) {
+			CFieldIndex& index = m_indexes.GetIndex(CSearchQuery::GetScopeField(scope));
+			index.GetQueryKey(term.text, key);
+			std::vector<uint32_t> found(rows);
+			index.Filter(key, found);
+			// rows found in this field are settled; the rest try the next
+			size_t middle = kept.size();
+			kept.insert(kept.end(), found.begin(), found.end());
+			std::inplace_merge(kept.begin(), kept.begin() + middle, kept.end());
+			std::vector<uint32_t>::iterator end = std::set_difference(rows.begin(), rows.end(),
+				found.begin(), found.end(), rows.begin());
+			rows.erase(end, rows.end());
+		}
+		rows.swap(kept);
+	}
+
+	CScopedSearchCursor(const CScopedSearchCursor&);
+	CScopedSearchCursor& operator=(const CScopedSearchCursor&);
+};
+
+}; // namespace Synrc
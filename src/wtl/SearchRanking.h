@@ -0,0 +1,232 @@
+// SearchRanking.h
+//
+//  Search results by relevance instead of store order. A match scores by
+//  how it matched the field - all of it, its start, the start of a word,
+//  inside a word, or only within a few typos - then by how often the
+//  contact is used, then by row. The best page is picked from the match
+//  set with a bounded heap, O(n log k), and published as the first batch;
+//  the rest follows a match kind at a time in store order, so the full
+//  match set is never sorted and the list shows its first page after one
+//  pass over the field's index.
+
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "EventTrace.h"
+#include "FuzzySearch.h"
+#include "ProgressiveResults.h"
+#include "SearchQuery.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// IUsageCounts - how often each contact was used, for ranking
+// CTopRows - the k best scored rows, kept in a bounded heap
+// CRankedSearchCursor - matches of a field, best page first
+
+namespace Synrc
+{
+
+class IUsageCounts
+{
+public:
+	virtual ~IUsageCounts()
+	{
+	}
+
+	// read from the search thread
+	virtual uint32_t GetUsageCount(uint32_t row) const = 0;
+};
+
+class CTopRows
+{
+public:
+	enum { MaxUsage = 0xFFFFFF };   // counts saturate here in the score
+
+	explicit CTopRows(size_t capacity) : m_capacity(capacity)
+	{
+		m_heap.reserve(capacity);
+	}
+
+	// Match kind, then usage, then the lower row: one comparable number.
+	static uint64_t GetScore(MatchKind kind, uint32_t usage, uint32_t row)
+	{
+		if(usage > MaxUsage)
+			usage = MaxUsage;
+		return ((uint64_t)kind << 56) | ((uint64_t)usage << 32) | (uint32_t)~row;
+	}
+
+	void Offer(uint64_t score, uint32_t row)
+	{
+		if(m_capacity == 0)
+			return;
+		Entry entry = { score, row };
+		if(m_heap.size() < m_capacity) {
+			m_heap.push_back(entry);
+			std::push_heap(m_heap.begin(), m_heap.end(), CompareEntries());
+		}
+		else if(score > m_heap.front().score) {
+			std::pop_heap(m_heap.begin(), m_heap.end(), CompareEntries());
+			m_heap.back() = entry;
+			std::push_heap(m_heap.begin(), m_heap.end(), CompareEntries());
+		}
+	}
+
+	size_t GetCount() const
+	{
+		return m_heap.size();
+	}
+
+	// Appends the rows, best first, and empties the heap.
+	void Take(std::vector<uint32_t>& rows)
+	{
+		std::sort_heap(m_heap.begin(), m_heap.end(), CompareEntries());
+		for(size_t i = 0; i < m_heap.size(); i++)
+			rows.push_back(m_heap[i].row);
+		m_heap.clear();
+	}
+
+private:
+	struct Entry
+	{
+		uint64_t score;
+		uint32_t row;
+	};
+
+	// the worst kept entry on top
+	struct CompareEntries
+	{
+		bool operator()(const Entry& a, const Entry& b) const
+		{
+			return a.score > b.score;
+		}
+	};
+
+	size_t m_capacity;
+	std::vector<Entry> m_heap;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CRankedSearchCursor - matches of a field, best page first
+
+class CRankedSearchCursor : public IResultCursor
+{
+public:
+	enum { FetchRows = 4096 };
+
+	// pFuzzy, on the same field, adds typo matches when the substring
+	// matches do not fill the page; pUsage breaks ties within a kind; the
+	// field search goes through pCache when there is one.
+	CRankedSearchCursor(CFieldIndex& index, const std::wstring& text, uint32_t pageSize = CProgressiveResults::DefaultFirstPage,
+		CFuzzyIndex* pFuzzy = NULL, const IUsageCounts* pUsage = NULL, IMatchCache* pCache = NULL) :
+		m_index(index), m_text(text), m_pageSize(pageSize), m_pFuzzy(pFuzzy), m_pUsage(pUsage), m_pCache(pCache),
+		m_bRanked(false), m_next(0)
+	{
+		for(int kind = 0; kind <= MatchExact; kind++)
+			m_kindCounts[kind] = 0;
+	}
+
+	// The first call ranks and returns the best page; later ones the rest.
+	virtual bool Fetch(std::vector<uint32_t>& rows)
+	{
+		size_t end;
+		if(!m_bRanked) {
+			Rank();
+			m_bRanked = true;
+			end = m_pageSize < m_rows.size() ? m_pageSize : m_rows.size();
+		}
+		else {
+			if(!m_matches.empty())
+				AppendRest();
+			end = m_rows.size() - m_next > FetchRows ? m_next + FetchRows : m_rows.size();
+		}
+		rows.insert(rows.end(), m_rows.begin() + m_next, m_rows.begin() + end);
+		m_next = end;
+		return m_next < m_rows.size() || !m_matches.empty();
+	}
+
+	// matches per kind, once ranked
+	uint32_t GetKindCount(MatchKind kind) const
+	{
+		return m_kindCounts[kind];
+	}
+
+private:
+	CFieldIndex& m_index;
+	std::wstring m_text;
+	uint32_t m_pageSize;
+	CFuzzyIndex* m_pFuzzy;
+	const IUsageCounts* m_pUsage;
+	IMatchCache* m_pCache;
+	bool m_bRanked;
+	std::vector<uint32_t> m_rows;   // the best page, then the rest by kind
+	std::vector<uint32_t> m_matches;    // until the rest is appended
+	std::vector<uint8_t> m_kinds;
+	size_t m_next;
+	uint32_t m_kindCounts[MatchExact + 1];
+
+	void Rank()
+	{
+		CTraceScope trace("search.rank", "search");
+		std::string key;
+		m_index.GetQueryKey(m_text, key);
+		if(m_pCache != NULL)
+			m_pCache->Search(m_index, key, m_matches);
+		else
+			m_index.Search(key, m_matches);
+		m_index.GetMatchKinds(key, m_matches, m_kinds);
+		if(m_pFuzzy != NULL && m_matches.size() < m_pageSize) {
+			std::vector<uint32_t> fuzzy;
+			m_pFuzzy->Search(m_text, fuzzy);
+			size_t found = m_matches.size();
+			for(size_t i = 0; i < fuzzy.size(); i++) {
+				if(!std::binary_search(m_matches.begin(), m_matches.begin() + found, fuzzy[i])) {
+					m_matches.push_back(fuzzy[i]);
+					m_kinds.push_back(MatchFuzzy);
+				}
+			}
+		}
+
+		CTopRows top(m_pageSize);
+		for(size_t i = 0; i < m_matches.size(); i++) {
+			if(m_kinds[i] == MatchNone)
+				continue;       // removed since the search
+			uint32_t usage = m_pUsage != NULL ? m_pUsage->GetUsageCount(m_matches[i]) : 0;
+			top.Offer(CTopRows::GetScore((MatchKind)m_kinds[i], usage, m_matches[i]), m_matches[i]);
+			m_kindCounts[m_kinds[i]]++;
+		}
+		top.Take(m_rows);
+		if(m_rows.size() == m_matches.size() - m_kindCounts[MatchNone]) {
+			m_matches.clear();      // all on the page
+			m_kinds.clear();
+		}
+	}
+
+	// the rest by kind, each in store order, after the page went out
+	void AppendRest()
+	{
+		std::vector<uint32_t> page(m_rows);
+		std::sort(page.begin(), page.end());
+		m_rows.reserve(m_matches.size());
+		for(int kind = MatchExact; kind > MatchNone; kind--) {
+			if(m_kindCounts[kind] == 0)
+				continue;
+			for(size_t i = 0; i < m_matches.size(); i++) {
+				if(m_kinds[i] == kind && !std::binary_search(page.begin(), page.end(), m_matches[i]))
+					m_rows.push_back(m_matches[i]);
+			}
+		}
+		m_matches.clear();
+		m_kinds.clear();
+	}
+
+	CRankedSearchCursor(const CRankedSearchCursor&);
+	CRankedSearchCursor& operator=(const CRankedSearchCursor&);
+};
+
+}; // namespace Synrc
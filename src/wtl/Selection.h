@@ -0,0 +1,255 @@
+// Selection.h
+//
+//  Selection state of the owner-data list view as sorted runs of positions.
+//  List selections are range shaped: select-all is one run, a shift-click
+//  range is one run and ctrl-clicks add short ones, so a run list stays
+//  tiny where a bit or flag per item would cost a million writes. Range
+//  select, deselect and invert are O(runs); the count is kept up to date.
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "Platform.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CSelectionSet - run-length set of selected list positions
+
+namespace Synrc
+{
+
+struct SelectionRun
+{
+	uint32_t first;
+	uint32_t end;               // one past the last selected position
+};
+
+class CSelectionSet
+{
+public:
+	enum { NoPosition = 0xFFFFFFFF };
+
+	CSelectionSet() : m_count(0)
+	{
+	}
+
+	uint32_t GetCount() const
+	{
+		return m_count;
+	}
+
+	bool IsEmpty() const
+	{
+		return m_count == 0;
+	}
+
+	// ascending, disjoint and never adjacent
+	const std::vector<SelectionRun>& GetRuns() const
+	{
+		return m_runs;
+	}
+
+	bool IsSelected(uint32_t position) const
+	{
+		std::vector<SelectionRun>::const_iterator it =
+			std::upper_bound(m_runs.begin(), m_runs.end(), position, FirstLess());
+		return it != m_runs.begin() && position < (it - 1)->end;
+	}
+
+	// first selected position at or after position, NoPosition if none
+	uint32_t GetNext(uint32_t position) const
+	{
+		std::vector<SelectionRun>::const_iterator it =
+			std::upper_bound(m_runs.begin(), m_runs.end(), position, FirstLess());
+		if(it != m_runs.begin() && position < (it - 1)->end)
+			return position;
+		return it != m_runs.end() ? it->first : (uint32_t)NoPosition;
+	}
+
+	void Select(uint32_t position)
+	{
+		SelectRange(position, position + 1);
+	}
+
+	void Deselect(uint32_t position)
+	{
+		DeselectRange(position, position + 1);
+	}
+
+	void Toggle(uint32_t position)
+	{
+		if(IsSelected(position))
+			Deselect(position);
+		else
+			Select(position);
+	}
+
+	// [first, end); runs touching the range are merged into one
+	void SelectRange(uint32_t first, uint32_t end)
+	{
+		if(first >= end)
+			return;
+		std::vector<SelectionRun>::iterator lo =
+			std::lower_bound(m_runs.begin(), m_runs.end(), first, EndLess());
+		std::vector<SelectionRun>::iterator hi =
+			std::upper_bound(lo, m_runs.end(), end, FirstLess());
+		SelectionRun run = { first, end };
+		if(lo != hi) {
+			run.first = std::min(first, lo->first);
+			run.end = std::max(end, (hi - 1)->end);
+			for(std::vector<SelectionRun>::iterator it = lo; it != hi; ++it)
+				m_count -= it->end - it->first;
+			*lo = run;
+			m_runs.erase(lo + 1, hi);
+		}
+		else {
+			m_runs.insert(lo, run);
+		}
+		m_count += run.end - run.first;
+	}
+
+	void DeselectRange(uint32_t first, uint32_t end)
+	{
+		if(first >= end)
+			return;
+		std::vector<SelectionRun>::iterator lo =
+			std::upper_bound(m_runs.begin(), m_runs.end(), first, EndLess());
+		std::vector<SelectionRun>::iterator hi =
+			std::lower_bound(lo, m_runs.end(), end, FirstLess());
+		if(lo == hi)
+			return;
+
+		SelectionRun pieces[2];
+		size_t count = 0;
+		if(lo->first < first) {
+			SelectionRun left = { lo->first, first };
+			pieces[count++] = left;
+		}
+		if((hi - 1)->end > end) {
+			SelectionRun right = { end, (hi - 1)->end };
+			pieces[count++] = right;
+		}
+		for(std::vector<SelectionRun>::iterator it = lo; it != hi; ++it)
+			m_count -= it->end - it->first;
+		for(size_t i = 0; i < count; i++)
+			m_count += pieces[i].end - pieces[i].first;
+
+		size_t index = lo - m_runs.begin();
+		size_t removed = hi - lo;
+		if(removed >= count) {
+			std::copy(pieces, pieces + count, lo);
+			m_runs.erase(lo + count, hi);
+		}
+		else {
+			// one run split in two
+			*lo = pieces[0];
+			m_runs.insert(m_runs.begin() + index + 1, pieces[1]);
+		}
+	}
+
+	// selected positions in [first, end) become unselected and the other way
+	// round, in one pass over the runs
+	void InvertRange(uint32_t first, uint32_t end)
+	{
+		if(first >= end)
+			return;
+		std::vector<SelectionRun> runs;
+		runs.reserve(m_runs.size() + 1);
+		uint32_t gap = first;
+		for(size_t i = 0; i < m_runs.size(); i++) {
+			const SelectionRun& run = m_runs[i];
+			if(run.end <= first || run.first >= end) {
+				if(run.first >= end && gap < end) {
+					Push(runs, gap, end);
+					gap = end;
+				}
+				Push(runs, run.first, run.end);
+				continue;
+			}
+			if(run.first < first)
+				Push(runs, run.first, first);
+			if(gap < run.first)
+				Push(runs, gap, run.first);
+			gap = std::min(run.end, end);
+			if(run.end > end)
+				Push(runs, end, run.end);
+		}
+		if(gap < end)
+			Push(runs, gap, end);
+		m_runs.swap(runs);
+		m_count = 0;
+		for(size_t i = 0; i < m_runs.size(); i++)
+			m_count += m_runs[i].end - m_runs[i].first;
+	}
+
+	void SelectAll(uint32_t itemCount)
+	{
+		Clear();
+		SelectRange(0, itemCount);
+	}
+
+	void Invert(uint32_t itemCount)
+	{
+		InvertRange(0, itemCount);
+	}
+
+	void Clear()
+	{
+		m_runs.clear();
+		m_count = 0;
+	}
+
+	size_t GetMemoryUsage() const
+	{
+		return m_runs.capacity() * sizeof(SelectionRun);
+	}
+
+private:
+	std::vector<SelectionRun> m_runs;
+	uint32_t m_count;
+
+	// run against position, both ways round for the checked debug STL
+	struct FirstLess
+	{
+		bool operator()(const SelectionRun& run, uint32_t position) const
+		{
+			return run.first < position;
+		}
+
+		bool operator()(uint32_t position, const SelectionRun& run) const
+		{
+			return position < run.first;
+		}
+	};
+
+	struct EndLess
+	{
+		bool operator()(const SelectionRun& run, uint32_t position) const
+		{
+			return run.end < position;
+		}
+
+		bool operator()(uint32_t position, const SelectionRun& run) const
+		{
+			return position < run.end;
+		}
+	};
+
+	static void Push(std::vector<SelectionRun>& runs, uint32_t first, uint32_t end)
+	{
+		if(first >= end)
+			return;
+		if(!runs.empty() && runs.back().end == first) {
+			runs.back().end = end;
+			return;
+		}
+		SelectionRun run = { first, end };
+		runs.push_back(run);
+	}
+};
+
+}; // namespace Synrc
@@ -0,0 +1,222 @@
+// Socket.h
+//
+//  Minimal blocking TCP socket used by the native sync transport and its
+//  loopback mock server. Winsock and BSD sockets behind one interface.
+
+#pragma once
+
+#include "Platform.h"
+
+#ifdef _WIN32
+	// winsock2.h has to come before windows.h; stdafx.h takes care of that
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+	#pragma comment(lib, "ws2_32.lib")
+#else
+	#include <arpa/inet.h>
+	#include <netdb.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <sys/socket.h>
+	#include <sys/types.h>
+	#include <string.h>
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CTcpSocket - owning wrapper around a connected or listening TCP socket
+
+namespace Synrc
+{
+
+class CTcpSocket
+{
+public:
+#ifdef _WIN32
+	typedef SOCKET Handle;
+	enum { InvalidHandle = INVALID_SOCKET };
+#else
+	typedef int Handle;
+	enum { InvalidHandle = -1 };
+#endif
+
+	CTcpSocket() : m_hSocket((Handle)InvalidHandle)
+	{
+		Startup(true);
+	}
+
+	~CTcpSocket()
+	{
+		Close();
+		Startup(false);
+	}
+
+	bool IsValid() const
+	{
+		return m_hSocket != (Handle)InvalidHandle;
+	}
+
+	bool Connect(const char* host, uint16_t port)
+	{
+		Close();
+		struct sockaddr_in addr;
+		if(!Resolve(host, port, addr))
+			return false;
+		m_hSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if(!IsValid())
+			return false;
+		if(connect(m_hSocket, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+			Close();
+			return false;
+		}
+		SetNoDelay();
+		return true;
+	}
+
+	// binds to 127.0.0.1; port 0 picks an ephemeral port, returned by GetLocalPort()
+	bool Listen(uint16_t port, int backlog = 16)
+	{
+		Close();
+		m_hSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if(!IsValid())
+			return false;
+		int reuse = 1;
+		setsockopt(m_hSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(port);
+		if(bind(m_hSocket, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(m_hSocket, backlog) != 0) {
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	bool Accept(CTcpSocket& client)
+	{
+		client.Close();
+		Handle h = accept(m_hSocket, NULL, NULL);
+		if(h == (Handle)InvalidHandle)
+			return false;
+		client.m_hSocket = h;
+		client.SetNoDelay();
+		return true;
+	}
+
+	uint16_t GetLocalPort() const
+	{
+		struct sockaddr_in addr;
+		socklen_t len = sizeof(addr);
+		if(getsockname(m_hSocket, (struct sockaddr*)&addr, &len) != 0)
+			return 0;
+		return ntohs(addr.sin_port);
+	}
+
+	bool SendAll(const void* pData, size_t cb)
+	{
+		const char* p = static_cast<const char*>(pData);
+		while(cb > 0) {
+			int chunk = cb > 0x40000000 ? 0x40000000 : (int)cb;
+#ifdef _WIN32
+			int sent = send(m_hSocket, p, chunk, 0);
+#else
+			int sent = (int)send(m_hSocket, p, chunk, MSG_NOSIGNAL);
+#endif
+			if(sent <= 0)
+				return false;
+			p += sent;
+			cb -= sent;
+		}
+		return true;
+	}
+
+	bool RecvAll(void* pData, size_t cb)
+	{
+		char* p = static_cast<char*>(pData);
+		while(cb > 0) {
+			int chunk = cb > 0x40000000 ? 0x40000000 : (int)cb;
+			int got = (int)recv(m_hSocket, p, chunk, 0);
+			if(got <= 0)
+				return false;
+			p += got;
+			cb -= got;
+		}
+		return true;
+	}
+
+	// unblocks a thread sitting in RecvAll or Accept on this socket
+	void Shutdown()
+	{
+		if(!IsValid())
+			return;
+#ifdef _WIN32
+		shutdown(m_hSocket, SD_BOTH);
+#else
+		shutdown(m_hSocket, SHUT_RDWR);
+#endif
+	}
+
+	void Close()
+	{
+		if(!IsValid())
+			return;
+#ifdef _WIN32
+		closesocket(m_hSocket);
+#else
+		close(m_hSocket);
+#endif
+		m_hSocket = (Handle)InvalidHandle;
+	}
+
+private:
+	Handle m_hSocket;
+
+	void SetNoDelay()
+	{
+		int noDelay = 1;
+		setsockopt(m_hSocket, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+	}
+
+	static bool Resolve(const char* host, uint16_t port, struct sockaddr_in& addr)
+	{
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		if(inet_pton(AF_INET, host, &addr.sin_addr) == 1)
+			return true;
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		struct addrinfo* pResult = NULL;
+		if(getaddrinfo(host, NULL, &hints, &pResult) != 0 || pResult == NULL)
+			return false;
+		addr.sin_addr = ((struct sockaddr_in*)pResult->ai_addr)->sin_addr;
+		freeaddrinfo(pResult);
+		return true;
+	}
+
+	// WSAStartup/WSACleanup are reference counted by Winsock itself
+	static void Startup(bool bStart)
+	{
+#ifdef _WIN32
+		if(bStart) {
+			WSADATA wsa;
+			WSAStartup(MAKEWORD(2, 2), &wsa);
+		}
+		else
+			WSACleanup();
+#else
+		(void)bStart;
+#endif
+	}
+
+	CTcpSocket(const CTcpSocket&);
+	CTcpSocket& operator=(const CTcpSocket&);
+};
+
+}; // namespace Synrc
@@ -0,0 +1,846 @@
+// SortEngine.h
+//
+//  Row order for the owner-data list view. With LVS_OWNERDATA the control
+//  keeps no items, so SortItems has nothing to sort and the data source has
+//  to map list positions to store rows itself. Each sortable column gets a
+//  column of binary collation keys ordered by memcmp; sorting is a parallel MSD radix
+//  sort over those keys. The resulting permutation is cached per column and
+//  direction and patched in place as contacts are edited.
+
+#pragma once
+
+#include <algorithm>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "Collation.h"
+#include "ContactStore.h"
+#include "EventTrace.h"
+#include "TaskPool.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CSortKeyColumn - one key per store row in a shared byte buffer
+// CRadixSort - parallel MSD radix sort of rows by key
+// CSortEngine - cached, incrementally patched permutations per column
+
+namespace Synrc
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// CSortKeyColumn - one key per store row in a shared byte buffer
+
+class CSortKeyColumn
+{
+public:
+	CSortKeyColumn() : m_garbage(0)
+	{
+	}
+
+	size_t GetRowCount() const
+	{
+		return m_offsets.size();
+	}
+
+	const unsigned char* GetKey(uint32_t row, uint32_t& cb) const
+	{
+		cb = m_lengths[row];
+		return reinterpret_cast<const unsigned char*>(m_bytes.data()) + m_offsets[row];
+	}
+
+	size_t GetMemoryUsage() const
+	{
+		return m_bytes.capacity() + (m_offsets.capacity() + m_lengths.capacity()) * sizeof(uint32_t);
+	}
+
+	// memcmp order, a proper prefix sorts first
+	static int Compare(const unsigned char* pA, uint32_t cbA, const unsigned char* pB, uint32_t cbB)
+	{
+		int result = memcmp(pA, pB, cbA < cbB ? cbA : cbB);
+		if(result != 0)
+			return result;
+		return cbA < cbB ? -1 : cbA > cbB ? 1 : 0;
+	}
+
+	int Compare(uint32_t rowA, uint32_t rowB) const
+	{
+		uint32_t cbA, cbB;
+		const unsigned char* pA = GetKey(rowA, cbA);
+		const unsigned char* pB = GetKey(rowB, cbB);
+		return Compare(pA, cbA, pB, cbB);
+	}
+
+	bool Equals(uint32_t row, const std::string& key) const
+	{
+		return row < m_offsets.size() && m_lengths[row] == key.size() &&
+			memcmp(m_bytes.data() + m_offsets[row], key.data(), key.size()) == 0;
+	}
+
+	// row == GetRowCount() appends a row
+	void SetKey(uint32_t row, const std::string& key)
+	{
+		if(row == m_offsets.size()) {
+			m_offsets.push_back(0);
+			m_lengths.push_back(0);
+		}
+		m_garbage += m_lengths[row];
+		m_offsets[row] = (uint32_t)m_bytes.size();
+		m_lengths[row] = (uint32_t)key.size();
+		m_bytes.append(key);
+		if(m_garbage > 64 * 1024 && m_garbage > m_bytes.size() / 2)
+			Compact();
+	}
+
+	void Clear()
+	{
+		m_bytes.clear();
+		m_offsets.clear();
+		m_lengths.clear();
+		m_garbage = 0;
+	}
+
+	// keys for every text, built in parallel slices and joined
+	void Build(const std::vector<std::wstring>& texts, const ISortKeyBuilder& builder, CTaskPool& pool)
+	{
+		Clear();
+		size_t count = texts.size();
+		m_offsets.resize(count);
+		m_lengths.resize(count);
+		size_t slices = (count + SliceRows - 1) / SliceRows;
+		std::vector<std::string> parts(slices);
+		pool.ParallelFor(0, slices, 1, BuildTask(texts, builder, *this, parts), PriorityPrefetch);
+
+		size_t total = 0;
+		for(size_t i = 0; i < slices; i++)
+			total += parts[i].size();
+		m_bytes.reserve(total);
+		for(size_t i = 0; i < slices; i++) {
+			uint32_t base = (uint32_t)m_bytes.size();
+			size_t last = (i + 1) * SliceRows < count ? (i + 1) * SliceRows : count;
+			for(size_t row = i * SliceRows; row < last; row++)
+				m_offsets[row] += base;
+			m_bytes.append(parts[i]);
+		}
+	}
+
+private:
+	enum { SliceRows = 8192 };
+
+	std::string m_bytes;
+	std::vector<uint32_t> m_offsets;
+	std::vector<uint32_t> m_lengths;
+	size_t m_garbage;                   // bytes of replaced keys still in m_bytes
+
+	struct BuildTask
+	{
+		const std::vector<std::wstring>& texts;
+		const ISortKeyBuilder& builder;
+		CSortKeyColumn& column;
+		std::vector<std::string>& parts;
+
+		BuildTask(const std::vector<std::wstring>& t, const ISortKeyBuilder& b, CSortKeyColumn& c, std::vector<std::string>& p) :
+			texts(t), builder(b), column(c), parts(p)
+		{
+		}
+
+		void operator()(size_t lo, size_t hi) const
+		{
+			for(size_t slice = lo; slice < hi; slice++) {
+				std::string& part = parts[slice];
+				size_t last = (slice + 1) * SliceRows < texts.size() ? (slice + 1) * SliceRows : texts.size();
+				for(size_t row = slice * SliceRows; row < last; row++) {
+					size_t start = part.size();
+					builder.AppendKey(texts[row].data(), texts[row].size(), part);
+					column.m_offsets[row] = (uint32_t)start;
+					column.m_lengths[row] = (uint32_t)(part.size() - start);
+				}
+			}
+		}
+
+	private:
+		BuildTask& operator=(const BuildTask&);
+	};
+
+	void Compact()
+	{
+		std::string bytes;
+		bytes.reserve(m_bytes.size() - m_garbage);
+		for(size_t row = 0; row < m_offsets.size(); row++) {
+			uint32_t offset = (uint32_t)bytes.size();
+			bytes.append(m_bytes, m_offsets[row], m_lengths[row]);
+			m_offsets[row] = offset;
+		}
+		m_bytes.swap(bytes);
+		m_garbage = 0;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CRadixSort - parallel MSD radix sort of rows by key
+//
+//  Rows are sorted as (8 key bytes, row) pairs so the hot loops never touch
+//  the key buffer. The top byte is partitioned in parallel slices, the
+//  buckets are then sorted independently on the pool. Groups that still tie
+//  after 8 bytes load the next 8 and continue; keys that ran out order
+//  shorter first, then by row.
+
+class CRadixSort
+{
+public:
+	// Orders rows by key, equal keys by ascending row in either direction.
+	static void Sort(const CSortKeyColumn& keys, const std::vector<uint32_t>& rows, bool bDescending,
+		std::vector<uint32_t>& order, CTaskPool& pool)
+	{
+		size_t count = rows.size();
+		order.resize(count);
+		if(count == 0)
+			return;
+		std::vector<Item> items(count);
+		std::vector<Item> scratch(count);
+		pool.ParallelFor(0, count, 16384, LoadTask(keys, rows, items), PriorityPrefetch);
+
+		if(count < ParallelRows)
+			SortRange(keys, &items[0], &scratch[0], count, 0, 0);
+		else
+			SortParallel(keys, &items[0], &scratch[0], count, 0, pool);
+
+		for(size_t i = 0; i < count; i++)
+			order[i] = items[i].row;
+		if(bDescending)
+			ReverseKeepingTies(keys, order);
+	}
+
+private:
+	enum
+	{
+		PrefixBytes = 8,
+		InsertionRows = 24,
+		ParallelRows = 32768,
+		Slices = 32
+	};
+
+	struct Item
+	{
+		uint64_t prefix;        // 8 key bytes from the current offset, big-endian, zero padded
+		uint32_t row;
+	};
+
+	struct ItemLess
+	{
+		const CSortKeyColumn& keys;
+		size_t offset;
+
+		ItemLess(const CSortKeyColumn& k, size_t o) : keys(k), offset(o)
+		{
+		}
+
+		bool operator()(const Item& a, const Item& b) const
+		{
+			if(a.prefix != b.prefix)
+				return a.prefix < b.prefix;
+			int result = CompareTail(keys, a.row, b.row, offset + PrefixBytes);
+			return result != 0 ? result < 0 : a.row < b.row;
+		}
+
+	private:
+		ItemLess& operator=(const ItemLess&);
+	};
+
+	// for rows whose keys agree before from: the bytes after it, then the length
+	static int CompareTail(const CSortKeyColumn& keys, uint32_t rowA, uint32_t rowB, size_t from)
+	{
+		uint32_t cbA, cbB;
+		const unsigned char* pA = keys.GetKey(rowA, cbA);
+		const unsigned char* pB = keys.GetKey(rowB, cbB);
+		uint32_t common = cbA < cbB ? cbA : cbB;
+		if(common > from) {
+			int result = memcmp(pA + from, pB + from, common - from);
+			if(result != 0)
+				return result;
+		}
+		return cbA < cbB ? -1 : cbA > cbB ? 1 : 0;
+	}
+
+	static int Digit(uint64_t prefix, size_t depth)
+	{
+		return (int)(prefix >> (56 - 8 * depth)) & 0xFF;
+	}
+
+	static int Digit(const Item& item, size_t depth)
+	{
+		return Digit(item.prefix, depth);
+	}
+
+	static uint64_t LoadPrefix(const CSortKeyColumn& keys, uint32_t row, size_t offset, bool& bMore)
+	{
+		uint32_t cb;
+		const unsigned char* p = keys.GetKey(row, cb);
+		uint64_t prefix = 0;
+		for(size_t k = offset; k < offset + PrefixBytes; k++)
+			prefix = (prefix << 8) | (k < cb ? p[k] : 0);
+		if(cb > offset + PrefixBytes)
+			bMore = true;
+		return prefix;
+	}
+
+	// Sorts a[0..count) in place, tmp is scratch of the same size. The rows
+	// agree on the key bytes before offset + depth.
+	static void SortRange(const CSortKeyColumn& keys, Item* a, Item* tmp, size_t count, size_t depth, size_t offset)
+	{
+		for(;;) {
+			if(count < InsertionRows) {
+				InsertionSort(keys, a, count, offset);
+				return;
+			}
+			if(depth == PrefixBytes) {
+				offset += PrefixBytes;
+				bool bMore = false;
+				for(size_t i = 0; i < count; i++)
+					a[i].prefix = LoadPrefix(keys, a[i].row, offset, bMore);
+				if(!bMore) {
+					std::sort(a, a + count, ItemLess(keys, offset));
+					return;
+				}
+				depth = 0;
+				continue;
+			}
+
+			// skip the bytes every row shares in one pass instead of one per byte
+			uint64_t diff = 0;
+			for(size_t i = 1; i < count; i++)
+				diff |= a[i].prefix ^ a[0].prefix;
+			while(depth < PrefixBytes && Digit(diff, depth) == 0)
+				depth++;
+			if(depth == PrefixBytes)
+				continue;
+
+			size_t counts[256] = { 0 };
+			for(size_t i = 0; i < count; i++)
+				counts[Digit(a[i], depth)]++;
+
+			size_t next[256];
+			size_t sum = 0;
+			for(int b = 0; b < 256; b++) {
+				next[b] = sum;
+				sum += counts[b];
+			}
+			for(size_t i = 0; i < count; i++)
+				tmp[next[Digit(a[i], depth)]++] = a[i];
+			memcpy(a, tmp, count * sizeof(Item));
+
+			size_t start = 0;
+			for(int b = 0; b < 256; start += counts[b], b++) {
+				if(counts[b] > 1)
+					SortRange(keys, a + start, tmp + start, counts[b], depth + 1, offset);
+			}
+			return;
+		}
+	}
+
+	static void InsertionSort(const CSortKeyColumn& keys, Item* a, size_t count, size_t offset)
+	{
+		ItemLess less(keys, offset);
+		for(size_t i = 1; i < count; i++) {
+			Item item = a[i];
+			size_t j = i;
+			for(; j > 0 && less(item, a[j - 1]); j--)
+				a[j] = a[j - 1];
+			a[j] = item;
+		}
+	}
+
+	// One parallel partition pass on the digit at depth, then the buckets:
+	// large ones partition again in parallel, the rest are sorted as tasks.
+	static void SortParallel(const CSortKeyColumn& keys, Item* a, Item* tmp, size_t count, size_t depth, CTaskPool& pool)
+	{
+		if(depth == PrefixBytes || count < ParallelRows) {
+			SortRange(keys, a, tmp, count, depth, 0);
+			return;
+		}
+
+		std::vector<size_t> counts(Slices * 256);
+		size_t sliceRows = (count + Slices - 1) / Slices;
+		pool.ParallelFor(0, Slices, 1, CountTask(a, count, sliceRows, depth, counts), PriorityPrefetch);
+
+		std::vector<size_t> starts(257);
+		size_t sum = 0;
+		for(int b = 0; b < 256; b++) {
+			starts[b] = sum;
+			for(int s = 0; s < Slices; s++) {
+				size_t n = counts[s * 256 + b];
+				counts[s * 256 + b] = sum;
+				sum += n;
+			}
+		}
+		starts[256] = sum;
+
+		size_t largest = 0;
+		for(int b = 0; b < 256; b++)
+			largest = std::max(largest, starts[b + 1] - starts[b]);
+		if(largest == count) {
+			SortParallel(keys, a, tmp, count, depth + 1, pool);
+			return;
+		}
+
+		pool.ParallelFor(0, Slices, 1, ScatterTask(a, tmp, count, sliceRows, depth, counts), PriorityPrefetch);
+		pool.ParallelFor(0, count, 65536, CopyTask(tmp, a), PriorityPrefetch);
+
+		for(int b = 0; b < 256; b++) {
+			size_t n = starts[b + 1] - starts[b];
+			if(n >= ParallelRows * 4)
+				SortParallel(keys, a + starts[b], tmp + starts[b], n, depth + 1, pool);
+		}
+		pool.ParallelFor(0, 256, 1, BucketTask(keys, a, tmp, starts, depth + 1), PriorityPrefetch);
+	}
+
+	static void ReverseKeepingTies(const CSortKeyColumn& keys, std::vector<uint32_t>& order)
+	{
+		std::reverse(order.begin(), order.end());
+		for(size_t i = 0; i < order.size(); ) {
+			size_t j = i + 1;
+			while(j < order.size() && keys.Compare(order[j - 1], order[j]) == 0)
+				j++;
+			if(j - i > 1)
+				std::reverse(order.begin() + i, order.begin() + j);
+			i = j;
+		}
+	}
+
+	struct LoadTask
+	{
+		const CSortKeyColumn& keys;
+		const std::vector<uint32_t>& rows;
+		std::vector<Item>& items;
+
+		LoadTask(const CSortKeyColumn& k, const std::vector<uint32_t>& r, std::vector<Item>& i) : keys(k), rows(r), items(i)
+		{
+		}
+
+		void operator()(size_t lo, size_t hi) const
+		{
+			for(size_t i = lo; i < hi; i++) {
+				bool bMore = false;
+				items[i].prefix = LoadPrefix(keys, rows[i], 0, bMore);
+				items[i].row = rows[i];
+			}
+		}
+
+	private:
+		LoadTask& operator=(const LoadTask&);
+	};
+
+	struct CountTask
+	{
+		const Item* a;
+		size_t count, sliceRows, depth;
+		std::vector<size_t>& counts;
+
+		CountTask(const Item* a_, size_t c, size_t s, size_t d, std::vector<size_t>& counts_) :
+			a(a_), count(c), sliceRows(s), depth(d), counts(counts_)
+		{
+		}
+
+		void operator()(size_t lo, size_t hi) const
+		{
+			for(size_t s = lo; s < hi; s++) {
+				size_t* pCounts = &counts[s * 256];
+				size_t last = std::min(count, (s + 1) * sliceRows);
+				for(size_t i = s * sliceRows; i < last; i++)
+					pCounts[Digit(a[i], depth)]++;
+			}
+		}
+
+	private:
+		CountTask& operator=(const CountTask&);
+	};
+
+	struct ScatterTask
+	{
+		const Item* a;
+		Item* tmp;
+		size_t count, sliceRows, depth;
+		std::vector<size_t>& next;      // per slice and digit, the next output position
+
+		ScatterTask(const Item* a_, Item* t, size_t c, size_t s, size_t d, std::vector<size_t>& n) :
+			a(a_), tmp(t), count(c), sliceRows(s), depth(d), next(n)
+		{
+		}
+
+		void operator()(size_t lo, size_t hi) const
+		{
+			for(size_t s = lo; s < hi; s++) {
+				size_t* pNext = &next[s * 256];
+				size_t last = std::min(count, (s + 1) * sliceRows);
+				for(size_t i = s * sliceRows; i < last; i++)
+					tmp[pNext[Digit(a[i], depth)]++] = a[i];
+			}
+		}
+
+	private:
+		ScatterTask& operator=(const ScatterTask&);
+	};
+
+	struct CopyTask
+	{
+		const Item* from;
+		Item* to;
+
+		CopyTask(const Item* f, Item* t) : from(f), to(t)
+		{
+		}
+
+		void operator()(size_t lo, size_t hi) const
+		{
+			memcpy(to + lo, from + lo, (hi - lo) * sizeof(Item));
+		}
+	};
+
+	struct BucketTask
+	{
+		const CSortKeyColumn& keys;
+		Item* a;
+		Item* tmp;
+		const std::vector<size_t>& starts;
+		size_t depth;
+
+		BucketTask(const CSortKeyColumn& k, Item* a_, Item* t, const std::vector<size_t>& s, size_t d) :
+			keys(k), a(a_), tmp(t), starts(s), depth(d)
+		{
+		}
+
+		// large buckets were already sorted by SortParallel
+		void operator()(size_t lo, size_t hi) const
+		{
+			for(size_t b = lo; b < hi; b++) {
+				size_t n = starts[b + 1] - starts[b];
+				if(n > 1 && n < ParallelRows * 4)
+					SortRange(keys, a + starts[b], tmp + starts[b], n, depth, 0);
+			}
+		}
+
+	private:
+		BucketTask& operator=(const BucketTask&);
+	};
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CSortEngine - cached, incrementally patched permutations per column
+
+struct SortEngineStats
+{
+	uint64_t sorts;             // full radix sorts
+	uint64_t lastSortUs;
+	uint64_t keyBuilds;         // key columns built from scratch
+	uint64_t lastKeyBuildUs;
+	uint64_t patches;           // single row moves applied to cached orders
+
+	SortEngineStats()
+	{
+		memset(this, 0, sizeof(*this));
+	}
+};
+
+// run of a sorted order sharing one initial, for group-by-initial views
+struct InitialGroup
+{
+	wchar_t initial;            // upper case base letter, '#' for digits, 0 for anything else
+	uint32_t first;             // position in the order
+	uint32_t count;
+};
+
+class CSortEngine : public IContactStoreObserver
+{
+public:
+	// Patching one edit memmoves part of the permutation, O(rows). A burst
+	// of more edits than this before the order is read again - an import, a
+	// sync - would cost more than one sort, so the order is dropped and
+	// sorted on the next read instead. Edits read in between are patched.
+	enum { PatchLimit = 256 };
+
+	explicit CSortEngine(CContactStore& store, CTaskPool& pool = CTaskPool::GetDefault()) :
+		m_store(store), m_pool(pool)
+	{
+		for(int f = 0; f < FieldCount; f++)
+			m_pBuilders[f] = &m_collator;
+		m_store.AddObserver(this);
+	}
+
+	~CSortEngine()
+	{
+		m_store.RemoveObserver(this);
+	}
+
+	// NULL restores the root collation; the builder must outlive the engine
+	void SetKeyBuilder(ContactField field, const ISortKeyBuilder* pBuilder)
+	{
+		m_pBuilders[field] = pBuilder ? pBuilder : &m_collator;
+		DropColumn(m_columns[field]);
+	}
+
+	const ISortKeyBuilder& GetKeyBuilder(ContactField field) const
+	{
+		return *m_pBuilders[field];
+	}
+
+	// key of every store row, built on first use and kept current
+	const CSortKeyColumn& GetKeys(ContactField field)
+	{
+		Column& column = m_columns[field];
+		if(!column.bKeys) {
+			CTraceScope trace("index.keys", "index");
+			uint64_t start = GetTimeUs();
+			column.keys.Build(m_store.GetColumn(field), *m_pBuilders[field], m_pool);
+			column.bKeys = true;
+			m_stats.keyBuilds++;
+			m_stats.lastKeyBuildUs = GetTimeUs() - start;
+		}
+		return column.keys;
+	}
+
+	// live store rows in display order
+	const std::vector<uint32_t>& GetOrder(ContactField field, bool bDescending)
+	{
+		Order& order = m_columns[field].orders[bDescending ? 1 : 0];
+		order.patches = 0;
+		if(!order.bValid) {
+			const CSortKeyColumn& keys = GetKeys(field);
+			CTraceScope trace("index.sort", "index");
+			uint64_t start = GetTimeUs();
+			m_rows.clear();
+			m_rows.reserve(m_store.GetLiveCount());
+			for(uint32_t row = 0; row < m_store.GetRowCount(); row++) {
+				if(m_store.IsLive(row))
+					m_rows.push_back(row);
+			}
+			CRadixSort::Sort(keys, m_rows, bDescending, order.rows, m_pool);
+			order.bValid = true;
+			m_stats.sorts++;
+			m_stats.lastSortUs = GetTimeUs() - start;
+		}
+		return order.rows;
+	}
+
+	// Splits the order into runs by initial. Works on the first key byte
+	// alone, so pCollator must be the builder of the field (NULL for the
+	// engine's own root collation).
+	void GetInitialGroups(ContactField field, bool bDescending, std::vector<InitialGroup>& groups,
+		const CCollator* pCollator = NULL)
+	{
+		const CCollator& collator = pCollator ? *pCollator : m_collator;
+		const std::vector<uint32_t>& rows = GetOrder(field, bDescending);
+		const CSortKeyColumn& keys = GetKeys(field);
+		groups.clear();
+		for(size_t i = 0; i < rows.size(); i++) {
+			uint32_t cb = 0;
+			const unsigned char* pKey = keys.GetKey(rows[i], cb);
+			wchar_t initial = cb > 0 ? collator.GetInitialForWeight(pKey[0]) : 0;
+			if(groups.empty() || groups.back().initial != initial) {
+				InitialGroup group = { initial, (uint32_t)i, 0 };
+				groups.push_back(group);
+			}
+			groups.back().count++;
+		}
+	}
+
+	const CCollator& GetCollator() const
+	{
+		return m_collator;
+	}
+
+	bool IsOrderCached(ContactField field, bool bDescending) const
+	{
+		return m_columns[field].orders[bDescending ? 1 : 0].bValid;
+	}
+
+	void Invalidate()
+	{
+		for(int f = 0; f < FieldCount; f++)
+			DropColumn(m_columns[f]);
+	}
+
+	SortEngineStats GetStats() const
+	{
+		return m_stats;
+	}
+
+	size_t GetMemoryUsage() const
+	{
+		size_t total = 0;
+		for(int f = 0; f < FieldCount; f++) {
+			total += m_columns[f].keys.GetMemoryUsage();
+			for(int d = 0; d < 2; d++)
+				total += m_columns[f].orders[d].rows.capacity() * sizeof(uint32_t);
+		}
+		return total;
+	}
+
+	virtual void OnContactChanged(uint32_t row, ContactChange change)
+	{
+		if(change == ContactsCleared) {
+			Invalidate();
+			return;
+		}
+		if(change == ContactsRemoved) {
+			// dropping dead rows keeps an order sorted, no re-sort needed
+			for(int f = 0; f < FieldCount; f++) {
+				for(int d = 0; d < 2; d++) {
+					Order& order = m_columns[f].orders[d];
+					if(order.bValid)
+						order.rows.erase(std::remove_if(order.rows.begin(), order.rows.end(), RowDead(m_store)), order.rows.end());
+				}
+			}
+			return;
+		}
+		for(int f = 0; f < FieldCount; f++) {
+			Column& column = m_columns[f];
+			if(!column.bKeys)
+				continue;
+			m_key.clear();
+			if(change != ContactRemoved) {
+				const std::wstring& text = m_store.GetField(row, (ContactField)f);
+				m_pBuilders[f]->AppendKey(text.data(), text.size(), m_key);
+			}
+			if(change == ContactUpdated && column.keys.Equals(row, m_key))
+				continue;
+			if(change != ContactAdded) {
+				for(int d = 0; d < 2; d++)
+					Erase(column, d, row);
+			}
+			column.keys.SetKey(row, m_key);
+			if(change != ContactRemoved) {
+				for(int d = 0; d < 2; d++)
+					Insert(column, d, row, change == ContactAdded);
+			}
+		}
+	}
+
+private:
+	struct Order
+	{
+		std::vector<uint32_t> rows;
+		bool bValid;
+		size_t patches;             // since the order was last read
+
+		Order() : bValid(false), patches(0)
+		{
+		}
+	};
+
+	struct Column
+	{
+		CSortKeyColumn keys;
+		bool bKeys;
+		Order orders[2];        // ascending, descending
+
+		Column() : bKeys(false)
+		{
+		}
+	};
+
+	struct RowDead
+	{
+		const CContactStore& store;
+
+		explicit RowDead(const CContactStore& s) : store(s)
+		{
+		}
+
+		bool operator()(uint32_t row) const
+		{
+			return !store.IsLive(row);
+		}
+
+	private:
+		RowDead& operator=(const RowDead&);
+	};
+
+	struct RowLess
+	{
+		const CSortKeyColumn& keys;
+		bool bDescending;
+
+		RowLess(const CSortKeyColumn& k, bool bDesc) : keys(k), bDescending(bDesc)
+		{
+		}
+
+		bool operator()(uint32_t a, uint32_t b) const
+		{
+			int result = keys.Compare(a, b);
+			if(result != 0)
+				return bDescending ? result > 0 : result < 0;
+			return a < b;
+		}
+
+	private:
+		RowLess& operator=(const RowLess&);
+	};
+
+	CContactStore& m_store;
+	CTaskPool& m_pool;
+	CCollator m_collator;
+	const ISortKeyBuilder* m_pBuilders[FieldCount];
+	Column m_columns[FieldCount];
+	std::vector<uint32_t> m_rows;
+	std::string m_key;
+	SortEngineStats m_stats;
+
+	void DropColumn(Column& column)
+	{
+		column.keys.Clear();
+		column.bKeys = false;
+		for(int d = 0; d < 2; d++)
+			DropOrder(column.orders[d]);
+	}
+
+	static void DropOrder(Order& order)
+	{
+		std::vector<uint32_t>().swap(order.rows);
+		order.bValid = false;
+	}
+
+	bool Patch(Order& order)
+	{
+		if(!order.bValid)
+			return false;
+		if(++order.patches > PatchLimit) {
+			DropOrder(order);
+			return false;
+		}
+		m_stats.patches++;
+		return true;
+	}
+
+	// before the key changes: the row is found by its old key
+	void Erase(Column& column, int direction, uint32_t row)
+	{
+		Order& order = column.orders[direction];
+		if(!Patch(order))
+			return;
+		std::vector<uint32_t>::iterator it = std::lower_bound(order.rows.begin(), order.rows.end(), row,
+			RowLess(column.keys, direction != 0));
+		if(it == order.rows.end() || *it != row)
+			DropOrder(order);
+		else
+			order.rows.erase(it);
+	}
+
+	// after the key changed; a new row counts as a patch of its own
+	void Insert(Column& column, int direction, uint32_t row, bool bNewRow)
+	{
+		Order& order = column.orders[direction];
+		if(bNewRow ? !Patch(order) : !order.bValid)
+			return;
+		std::vector<uint32_t>::iterator it = std::lower_bound(order.rows.begin(), order.rows.end(), row,
+			RowLess(column.keys, direction != 0));
+		order.rows.insert(it, row);
+	}
+
+	CSortEngine(const CSortEngine&);
+	CSortEngine& operator=(const CSortEngine&);
+};
+
+}; // namespace Synrc
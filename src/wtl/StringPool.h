@@ -0,0 +1,393 @@
+// StringPool.h
+//
+//  Display strings of the owner-data list, prepared once per contact edit
+//  instead of once per LVN_GETDISPINFO. All of them live in one UTF-16
+//  arena and rows refer to them by 32-bit entry indices, so answering the
+//  list is a lookup and a copy: no formatting and no heap traffic while
+//  scrolling. Equal strings (companies, cities) are interned and shared.
+//
+//  Edits append the new text and leave the old one dead in the arena; once
+//  dead text outweighs half the live text the arena is compacted and the
+//  generation advances. Pointers from GetText() stay valid until the next
+//  edit of the store; compare GetGeneration() before reusing one later.
+
+#pragma once
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "ContactStore.h"
+#include "EventTrace.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CStringArena - interned UTF-16 strings in one buffer, reference counted
+// CDisplayStringPool - per-row display strings kept in step with the store
+
+namespace Synrc
+{
+
+enum DisplayString
+{
+	DisplayName = 0,        // "First Last", as stored
+	DisplayLastFirst,       // "Last, First"
+	DisplayEmail,
+	DisplayPhone,
+	DisplayCompany,
+	DisplayCity,
+	DisplayStringCount
+};
+
+class CStringArena
+{
+public:
+	enum { NoEntry = 0xFFFFFFFF };  // the empty string
+
+	CStringArena() : m_liveChars(0), m_deadChars(0), m_allocations(0)
+	{
+	}
+
+	// Entry of the text with one more reference, added if not interned yet.
+	uint32_t Intern(const wchar_t* pText, size_t cch)
+	{
+		if(cch == 0)
+			return NoEntry;
+		if(m_entries.size() * 2 >= m_table.size())
+			Rehash(m_table.empty() ? 1024 : m_table.size() * 2);
+
+		uint32_t hash = Hash(pText, cch);
+		size_t mask = m_table.size() - 1;
+		size_t slot = hash & mask;
+		for(; m_table[slot] != 0; slot = (slot + 1) & mask) {
+			Entry& entry = m_entries[m_table[slot] - 1];
+			if(entry.hash == hash && entry.length == cch && wmemcmp(&m_chars[entry.offset], pText, cch) == 0) {
+				if(entry.refs++ == 0) {
+					// released but not compacted away yet: revive it
+					m_deadChars -= entry.length;
+					m_liveChars += entry.length;
+				}
+				return m_table[slot] - 1;
+			}
+		}
+
+		Entry entry = { (uint32_t)m_chars.size(), (uint32_t)cch, hash, 1 };
+		Grow(m_chars, m_chars.size() + cch);
+		m_chars.insert(m_chars.end(), pText, pText + cch);
+		Grow(m_entries, m_entries.size() + 1);
+		m_entries.push_back(entry);
+		m_table[slot] = (uint32_t)m_entries.size();
+		m_liveChars += cch;
+		return (uint32_t)m_entries.size() - 1;
+	}
+
+	void Release(uint32_t index)
+	{
+		if(index == NoEntry)
+			return;
+		Entry& entry = m_entries[index];
+		if(--entry.refs == 0) {
+			m_liveChars -= entry.length;
+			m_deadChars += entry.length;
+		}
+	}
+
+	// not terminated
+	const wchar_t* GetText(uint32_t index, uint32_t& cch) const
+	{
+		if(index == NoEntry) {
+			cch = 0;
+			return L"";
+		}
+		const Entry& entry = m_entries[index];
+		cch = entry.length;
+		return &m_chars[entry.offset];
+	}
+
+	// worth compacting: dead text is over half the live text
+	bool IsFragmented() const
+	{
+		return m_deadChars > 65536 && m_deadChars > m_liveChars / 2;
+	}
+
+	// Drops dead entries; remap[old index] is the new index, NoEntry for
+	// the dropped ones.
+	void Compact(std::vector<uint32_t>& remap)
+	{
+		std::vector<wchar_t> chars;
+		std::vector<Entry> entries;
+		chars.reserve(m_liveChars + m_liveChars / 4);
+		entries.reserve(m_entries.size());
+		remap.assign(m_entries.size(), (uint32_t)NoEntry);
+		for(size_t i = 0; i < m_entries.size(); i++) {
+			Entry entry = m_entries[i];
+			if(entry.refs == 0)
+				continue;
+			const wchar_t* pText = &m_chars[entry.offset];
+			entry.offset = (uint32_t)chars.size();
+			chars.insert(chars.end(), pText, pText + entry.length);
+			remap[i] = (uint32_t)entries.size();
+			entries.push_back(entry);
+		}
+		m_chars.swap(chars);
+		m_entries.swap(entries);
+		m_deadChars = 0;
+		m_allocations += 2;
+		Rehash(m_table.size());
+	}
+
+	void Clear()
+	{
+		m_chars.clear();
+		m_entries.clear();
+		m_table.assign(m_table.size(), 0);
+		m_liveChars = 0;
+		m_deadChars = 0;
+	}
+
+	size_t GetLiveChars() const
+	{
+		return m_liveChars;
+	}
+
+	size_t GetDeadChars() const
+	{
+		return m_deadChars;
+	}
+
+	// buffer (re)allocations so far; none happen while only reading
+	uint64_t GetAllocationCount() const
+	{
+		return m_allocations;
+	}
+
+	size_t GetMemoryUsage() const
+	{
+		return m_chars.capacity() * sizeof(wchar_t) + m_entries.capacity() * sizeof(Entry) +
+			m_table.capacity() * sizeof(uint32_t);
+	}
+
+private:
+	struct Entry
+	{
+		uint32_t offset;
+		uint32_t length;
+		uint32_t hash;
+		uint32_t refs;
+	};
+
+	std::vector<wchar_t> m_chars;
+	std::vector<Entry> m_entries;
+	std::vector<uint32_t> m_table;      // entry index + 1, 0 for free; open addressing
+	size_t m_liveChars;
+	size_t m_deadChars;
+	uint64_t m_allocations;
+
+	// FNV-1a over the UTF-16 units
+	static uint32_t Hash(const wchar_t* pText, size_t cch)
+	{
+		uint32_t hash = 2166136261u;
+		for(size_t i = 0; i < cch; i++) {
+			hash ^= (uint32_t)pText[i];
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+
+	void Rehash(size_t size)
+	{
+		while(size < m_entries.size() * 2)
+			size *= 2;
+		if(size != m_table.size())
+			m_allocations++;
+		m_table.assign(size, 0);
+		size_t mask = size - 1;
+		for(size_t i = 0; i < m_entries.size(); i++) {
+			size_t slot = m_entries[i].hash & mask;
+			while(m_table[slot] != 0)
+				slot = (slot + 1) & mask;
+			m_table[slot] = (uint32_t)i + 1;
+		}
+	}
+
+	template <class T>
+	void Grow(std::vector<T>& items, size_t size)
+	{
+		if(size > items.capacity()) {
+			items.reserve(size + size / 2);
+			m_allocations++;
+		}
+	}
+
+	CStringArena(const CStringArena&);
+	CStringArena& operator=(const CStringArena&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CDisplayStringPool - per-row display strings kept in step with the store
+
+class CDisplayStringPool : public IContactStoreObserver
+{
+public:
+	explicit CDisplayStringPool(CContactStore& store) : m_store(store), m_generation(0)
+	{
+		m_store.AddObserver(this);
+		Rebuild();
+	}
+
+	~CDisplayStringPool()
+	{
+		m_store.RemoveObserver(this);
+	}
+
+	void Rebuild()
+	{
+		CTraceScope trace("index.strings", "index");
+		m_arena.Clear();
+		m_rowEntries.assign(m_store.GetRowCount() * DisplayStringCount, (uint32_t)CStringArena::NoEntry);
+		for(uint32_t row = 0; row < m_store.GetRowCount(); row++) {
+			if(m_store.IsLive(row))
+				SetRow(row);
+		}
+		m_generation++;
+	}
+
+	// Text of a row, not terminated; valid until the next store edit.
+	const wchar_t* GetText(uint32_t row, DisplayString string, uint32_t& cch) const
+	{
+		size_t index = (size_t)row * DisplayStringCount + string;
+		if(index >= m_rowEntries.size()) {
+			cch = 0;
+			return L"";
+		}
+		return m_arena.GetText(m_rowEntries[index], cch);
+	}
+
+	// Copies into a LVITEM::pszText style buffer, truncated and terminated;
+	// returns the characters copied.
+	size_t CopyText(uint32_t row, DisplayString string, wchar_t* pOut, size_t cchOut) const
+	{
+		if(cchOut == 0)
+			return 0;
+		uint32_t cch = 0;
+		const wchar_t* pText = GetText(row, string, cch);
+		size_t count = cch < cchOut - 1 ? cch : cchOut - 1;
+		wmemcpy(pOut, pText, count);
+		pOut[count] = 0;
+		return count;
+	}
+
+	// advances when the arena is compacted or rebuilt
+	uint32_t GetGeneration() const
+	{
+		return m_generation;
+	}
+
+	const CStringArena& GetArena() const
+	{
+		return m_arena;
+	}
+
+	size_t GetMemoryUsage() const
+	{
+		return m_arena.GetMemoryUsage() + m_rowEntries.capacity() * sizeof(uint32_t);
+	}
+
+	virtual void OnContactChanged(uint32_t row, ContactChange change)
+	{
+		switch(change) {
+		case ContactAdded:
+		case ContactUpdated:
+			ReleaseRow(row);
+			SetRow(row);
+			break;
+		case ContactRemoved:
+			ReleaseRow(row);
+			break;
+		case ContactsRemoved:
+			for(uint32_t r = 0; r < m_rowEntries.size() / DisplayStringCount; r++) {
+				if(!m_store.IsLive(r))
+					ReleaseRow(r);
+			}
+			break;
+		case ContactsCleared:
+			Rebuild();
+			return;
+		}
+		if(m_arena.IsFragmented())
+			Compact();
+	}
+
+private:
+	CContactStore& m_store;
+	CStringArena m_arena;
+	std::vector<uint32_t> m_rowEntries;     // DisplayStringCount entries per row
+	std::wstring m_scratch;
+	uint32_t m_generation;
+
+	void SetRow(uint32_t row)
+	{
+		static const ContactField s_fields[DisplayStringCount] =
+		{
+			FieldName, FieldName, FieldEmail, FieldPhone, FieldCompany, FieldCity
+		};
+
+		size_t base = (size_t)row * DisplayStringCount;
+		if(base >= m_rowEntries.size())
+			m_rowEntries.resize(base + DisplayStringCount, (uint32_t)CStringArena::NoEntry);
+		for(int s = 0; s < DisplayStringCount; s++) {
+			if(s == DisplayLastFirst) {
+				FormatLastFirst(row);
+				m_rowEntries[base + s] = m_arena.Intern(m_scratch.data(), m_scratch.size());
+			}
+			else {
+				const std::wstring& text = m_store.GetField(row, s_fields[s]);
+				m_rowEntries[base + s] = m_arena.Intern(text.data(), text.size());
+			}
+		}
+	}
+
+	// "Family, Given"; the display name when either part is missing
+	void FormatLastFirst(uint32_t row)
+	{
+		const std::wstring& family = m_store.GetField(row, FieldFamilyName);
+		const std::wstring& given = m_store.GetField(row, FieldGivenName);
+		if(family.empty() || given.empty()) {
+			m_scratch = m_store.GetField(row, FieldName);
+			return;
+		}
+		m_scratch = family;
+		m_scratch += L", ";
+		m_scratch += given;
+	}
+
+	void ReleaseRow(uint32_t row)
+	{
+		size_t base = (size_t)row * DisplayStringCount;
+		if(base >= m_rowEntries.size())
+			return;
+		for(int s = 0; s < DisplayStringCount; s++) {
+			m_arena.Release(m_rowEntries[base + s]);
+			m_rowEntries[base + s] = (uint32_t)CStringArena::NoEntry;
+		}
+	}
+
+	void Compact()
+	{
+		std::vector<uint32_t> remap;
+		m_arena.Compact(remap);
+		for(size_t i = 0; i < m_rowEntries.size(); i++) {
+			if(m_rowEntries[i] != CStringArena::NoEntry)
+				m_rowEntries[i] = remap[m_rowEntries[i]];
+		}
+		m_generation++;
+	}
+
+	CDisplayStringPool(const CDisplayStringPool&);
+	CDisplayStringPool& operator=(const CDisplayStringPool&);
+};
+
+}; // namespace Synrc
@@ -0,0 +1,381 @@
+// SyncMockServer.h
+//
+//  Loopback stand-in for a remote sync source. Speaks the CSyncTransport
+//  wire format on 127.0.0.1, holds the applied contacts in memory and delays
+//  every acknowledgement by a configurable round trip, so batching and
+//  pipelining can be measured against RTT without network access.
+//  It can also lose requests or acknowledgements and answer "busy" to
+//  exercise the retry path. Each contact remembers the batch that last wrote
+//  it, so a resend that arrives late does not undo a newer change.
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "Socket.h"
+#include "SyncTransport.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CSyncMockServer - in-memory remote source with injected latency and faults
+
+namespace Synrc
+{
+
+struct SyncMockServerOptions
+{
+	uint16_t port;                  // 0 picks an ephemeral port
+	uint32_t rttMs;                 // delay before each acknowledgement is sent
+	uint32_t jitterMs;              // uniform extra delay in [0, jitterMs]
+	uint32_t usPerChange;           // serialized apply cost charged per change
+	uint32_t dropRequestPercent;    // batch silently ignored
+	uint32_t dropAckPercent;        // batch applied but acknowledgement lost
+	uint32_t busyPercent;           // batch rejected with AckBusy
+	uint32_t faultFirstBatches;     // batches received first that meet a fault above for sure
+
+	SyncMockServerOptions() :
+		port(0), rttMs(0), jitterMs(0), usPerChange(0), dropRequestPercent(0), dropAckPercent(0), busyPercent(0),
+		faultFirstBatches(0)
+	{
+	}
+};
+
+struct SyncMockServerStats
+{
+	uint64_t batchesReceived;
+	uint64_t batchesApplied;
+	uint64_t duplicates;
+	uint64_t changesApplied;
+	uint64_t staleChanges;          // older than what the contact already holds, skipped
+	uint64_t droppedRequests;
+	uint64_t droppedAcks;
+	uint64_t busyReplies;
+	uint64_t connections;
+
+	SyncMockServerStats()
+	{
+		memset(this, 0, sizeof(*this));
+	}
+};
+
+class CSyncMockServer
+{
+public:
+	CSyncMockServer() : m_bRunning(false), m_bStop(false), m_port(0), m_busyUntilUs(0), m_random(0x9E3779B9), m_liveCount(0)
+	{
+	}
+
+	~CSyncMockServer()
+	{
+		Stop();
+	}
+
+	bool Start(const SyncMockServerOptions& options)
+	{
+		if(m_bRunning)
+			return false;
+		m_options = options;
+		if(!m_listener.Listen(options.port))
+			return false;
+		m_port = m_listener.GetLocalPort();
+		m_bStop = false;
+		m_bRunning = true;
+		m_acceptor.Start(AcceptProc, this);
+		return true;
+	}
+
+	void Stop()
+	{
+		if(!m_bRunning)
+			return;
+		{
+			CAutoLock lock(m_cs);
+			m_bStop = true;
+			for(std::list<Connection*>::iterator it = m_connections.begin(); it != m_connections.end(); ++it) {
+				(*it)->socket.Shutdown();
+				(*it)->cvOutgoing.Broadcast();
+			}
+		}
+		// shutdown() unblocks accept() on BSD sockets, Winsock needs a connection to wake it up
+		m_listener.Shutdown();
+		{
+			CTcpSocket wake;
+			wake.Connect("127.0.0.1", m_port);
+		}
+		m_acceptor.Join();
+		m_listener.Close();
+
+		// connection threads only exit once m_bStop is seen, no new ones can appear now
+		for(std::list<Connection*>::iterator it = m_connections.begin(); it != m_connections.end(); ++it) {
+			(*it)->reader.Join();
+			(*it)->writer.Join();
+			delete *it;
+		}
+		m_connections.clear();
+		m_bRunning = false;
+	}
+
+	uint16_t GetPort() const
+	{
+		return m_port;
+	}
+
+	void SetRtt(uint32_t rttMs, uint32_t jitterMs = 0)
+	{
+		CAutoLock lock(m_cs);
+		m_options.rttMs = rttMs;
+		m_options.jitterMs = jitterMs;
+	}
+
+	void SetFaults(uint32_t dropRequestPercent, uint32_t dropAckPercent, uint32_t busyPercent)
+	{
+		CAutoLock lock(m_cs);
+		m_options.dropRequestPercent = dropRequestPercent;
+		m_options.dropAckPercent = dropAckPercent;
+		m_options.busyPercent = busyPercent;
+	}
+
+	SyncMockServerStats GetStats()
+	{
+		CAutoLock lock(m_cs);
+		return m_stats;
+	}
+
+	size_t GetContactCount()
+	{
+		CAutoLock lock(m_cs);
+		return m_liveCount;
+	}
+
+	bool GetContact(const std::string& id, std::string& payload)
+	{
+		CAutoLock lock(m_cs);
+		ContactMap::const_iterator it = m_contacts.find(id);
+		if(it == m_contacts.end() || it->second.bDeleted)
+			return false;
+		payload = it->second.payload;
+		return true;
+	}
+
+private:
+	// deleted contacts stay as tombstones so a late put cannot bring them back
+	struct Contact
+	{
+		std::string payload;
+		uint64_t batchId;
+		bool bDeleted;
+
+		Contact() : batchId(0), bDeleted(true)
+		{
+		}
+	};
+
+	typedef std::map<std::string, Contact> ContactMap;
+
+	struct Connection
+	{
+		CSyncMockServer* pServer;
+		CTcpSocket socket;
+		CNativeThread reader;
+		CNativeThread writer;
+		CCondVar cvOutgoing;
+		std::multimap<uint64_t, std::string> outgoing;  // acknowledgements by due time
+		bool bClosed;
+	};
+
+	SyncMockServerOptions m_options;
+	CCritSec m_cs;
+	CTcpSocket m_listener;
+	CNativeThread m_acceptor;
+	std::list<Connection*> m_connections;
+	bool m_bRunning;
+	bool m_bStop;
+	uint16_t m_port;
+	uint64_t m_busyUntilUs;
+	uint32_t m_random;
+	std::set<uint64_t> m_appliedBatches;
+	ContactMap m_contacts;
+	size_t m_liveCount;
+	SyncMockServerStats m_stats;
+
+	// m_cs held
+	uint32_t Random(uint32_t range)
+	{
+		m_random ^= m_random << 13;
+		m_random ^= m_random >> 17;
+		m_random ^= m_random << 5;
+		return range > 0 ? m_random % range : 0;
+	}
+
+	bool Chance(uint32_t percent)
+	{
+		return percent > 0 && Random(100) < percent;
+	}
+
+	// m_cs held; false if a newer batch of the same client already wrote the contact
+	bool Apply(uint64_t batchId, SyncChange& change)
+	{
+		Contact& contact = m_contacts[change.id];
+		if((contact.batchId >> 32) == (batchId >> 32) && contact.batchId > batchId)
+			return false;
+		contact.batchId = batchId;
+		if(change.op == SyncOpDelete) {
+			if(!contact.bDeleted)
+				m_liveCount--;
+			contact.bDeleted = true;
+			contact.payload.clear();
+		}
+		else {
+			if(contact.bDeleted)
+				m_liveCount++;
+			contact.bDeleted = false;
+			contact.payload.swap(change.payload);
+		}
+		return true;
+	}
+
+	void AcceptLoop()
+	{
+		for(;;) {
+			Connection* pConn = new Connection;
+			pConn->pServer = this;
+			pConn->bClosed = false;
+			if(!m_listener.Accept(pConn->socket)) {
+				delete pConn;
+				return;
+			}
+			CAutoLock lock(m_cs);
+			if(m_bStop) {
+				delete pConn;
+				return;
+			}
+			m_stats.connections++;
+			m_connections.push_back(pConn);
+			pConn->reader.Start(ReaderProc, pConn);
+			pConn->writer.Start(WriterProc, pConn);
+		}
+	}
+
+	void ReaderLoop(Connection* pConn)
+	{
+		std::string body;
+		std::string ack;
+		std::vector<SyncChange> changes;
+		for(;;) {
+			uint8_t type = 0;
+			uint64_t batchId = 0;
+			if(!CSyncWire::ReadFrame(pConn->socket, type, body) || type != CSyncWire::FrameBatch ||
+				!CSyncWire::DecodeBatch(body, batchId, &changes))
+				break;
+
+			CAutoLock lock(m_cs);
+			m_stats.batchesReceived++;
+			// a forced batch is lost if requests may be, else answered busy
+			bool bForced = m_stats.batchesReceived <= m_options.faultFirstBatches;
+			if(Chance(m_options.dropRequestPercent) || (bForced && m_options.dropRequestPercent > 0)) {
+				m_stats.droppedRequests++;
+				continue;
+			}
+
+			uint32_t status = CSyncWire::AckApplied;
+			uint64_t nowUs = GetTimeUs();
+			uint64_t readyUs = nowUs;
+			if(Chance(m_options.busyPercent) || (bForced && m_options.busyPercent > 0)) {
+				status = CSyncWire::AckBusy;
+				m_stats.busyReplies++;
+			}
+			else if(!m_appliedBatches.insert(batchId).second) {
+				status = CSyncWire::AckDuplicate;
+				m_stats.duplicates++;
+			}
+			else {
+				for(size_t i = 0; i < changes.size(); i++) {
+					if(Apply(batchId, changes[i]))
+						m_stats.changesApplied++;
+					else
+						m_stats.staleChanges++;
+				}
+				m_stats.batchesApplied++;
+				// the remote applies batches one at a time
+				if(m_busyUntilUs < nowUs)
+					m_busyUntilUs = nowUs;
+				m_busyUntilUs += (uint64_t)m_options.usPerChange * changes.size();
+				readyUs = m_busyUntilUs;
+			}
+
+			if(status != CSyncWire::AckBusy && Chance(m_options.dropAckPercent)) {
+				m_stats.droppedAcks++;
+				continue;
+			}
+
+			uint64_t dueUs = readyUs + (uint64_t)m_options.rttMs * 1000 + (uint64_t)Random(m_options.jitterMs + 1) * 1000;
+			CSyncWire::EncodeAck(batchId, status, ack);
+			pConn->outgoing.insert(std::make_pair(dueUs, ack));
+			pConn->cvOutgoing.Signal();
+		}
+
+		CAutoLock lock(m_cs);
+		pConn->bClosed = true;
+		pConn->cvOutgoing.Broadcast();
+	}
+
+	void WriterLoop(Connection* pConn)
+	{
+		std::string frame;
+		for(;;) {
+			{
+				CAutoLock lock(m_cs);
+				for(;;) {
+					if(m_bStop || pConn->bClosed)
+						return;
+					if(!pConn->outgoing.empty()) {
+						uint64_t nowUs = GetTimeUs();
+						std::multimap<uint64_t, std::string>::iterator first = pConn->outgoing.begin();
+						if(first->first <= nowUs) {
+							frame.swap(first->second);
+							pConn->outgoing.erase(first);
+							break;
+						}
+						uint64_t waitMs = (first->first - nowUs + 999) / 1000;
+						pConn->cvOutgoing.Wait(m_cs, (uint32_t)waitMs);
+					}
+					else
+						pConn->cvOutgoing.Wait(m_cs);
+				}
+			}
+			if(!pConn->socket.SendAll(frame.data(), frame.size())) {
+				pConn->socket.Shutdown();
+				return;
+			}
+		}
+	}
+
+	static void AcceptProc(void* p)
+	{
+		static_cast<CSyncMockServer*>(p)->AcceptLoop();
+	}
+
+	static void ReaderProc(void* p)
+	{
+		Connection* pConn = static_cast<Connection*>(p);
+		pConn->pServer->ReaderLoop(pConn);
+	}
+
+	static void WriterProc(void* p)
+	{
+		Connection* pConn = static_cast<Connection*>(p);
+		pConn->pServer->WriterLoop(pConn);
+	}
+
+	CSyncMockServer(const CSyncMockServer&);
+	CSyncMockServer& operator=(const CSyncMockServer&);
+};
+
+}; // namespace Synrc
@@ -0,0 +1,636 @@
+// SyncTransport.h
+//
+//  Pipelined, batched transport for pushing contact changes to a remote
+//  sync source. Changes are packed into batches, several batches are kept in
+//  flight on one connection, and unacknowledged batches are resent with
+//  exponential backoff. Every batch carries a unique id, so the server can
+//  drop duplicates and a resend is always safe.
+//
+//  The high 32 bits of a batch id name the client and the low 32 bits count
+//  its batches, so ids from one client order its changes. A resent batch can
+//  arrive after newer ones; the server must not let it overwrite what they
+//  wrote (last writer wins by batch id, not by arrival).
+//
+//  Threading: a sender and a receiver thread of its own, not CTaskPool
+//  tasks. Both block for as long as the transport is open - on the socket,
+//  on acknowledgement timeouts, on back-pressure - and would hold two of the
+//  pool's workers, sized to the cores, for good.
+//
+//  Wire format (little endian), one frame per message:
+//
+//    uint32 length   - size of everything after this field
+//    uint8  type     - FrameBatch or FrameAck
+//    ...             - body
+//
+//    FrameBatch body: uint64 batchId, uint32 count, count * change
+//    change:          uint8 op, uint32 cbId, id, uint32 cbPayload, payload
+//    FrameAck body:   uint64 batchId, uint32 status
+
+#pragma once
+
+#include <string.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "EventTrace.h"
+#include "Socket.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// SyncChange - one contact put or delete
+// CSyncWire - frame encoding shared by the transport and the mock server
+// CSyncTransport - batching, pipelining, retrying client
+
+namespace Synrc
+{
+
+enum SyncOp
+{
+	SyncOpPut = 1,
+	SyncOpDelete = 2
+};
+
+struct SyncChange
+{
+	uint8_t op;
+	std::string id;         // contact id
+	std::string payload;    // serialized contact, empty for deletes
+
+	SyncChange() : op(SyncOpPut)
+	{
+	}
+
+	SyncChange(uint8_t op_, const std::string& id_, const std::string& payload_) : op(op_), id(id_), payload(payload_)
+	{
+	}
+
+	size_t GetWireSize() const
+	{
+		return 1 + 4 + id.size() + 4 + payload.size();
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CSyncWire - frame encoding
+
+class CSyncWire
+{
+public:
+	enum { FrameBatch = 1, FrameAck = 2 };
+	enum { AckApplied = 0, AckDuplicate = 1, AckBusy = 2 };
+	enum { HeaderSize = 5, MaxFrameSize = 64 * 1024 * 1024 };
+
+	static void PutU32(std::string& s, uint32_t v)
+	{
+		char b[4] = { (char)v, (char)(v >> 8), (char)(v >> 16), (char)(v >> 24) };
+		s.append(b, 4);
+	}
+
+	static void PutU64(std::string& s, uint64_t v)
+	{
+		PutU32(s, (uint32_t)v);
+		PutU32(s, (uint32_t)(v >> 32));
+	}
+
+	static uint32_t GetU32(const char* p)
+	{
+		const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+		return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32_t)u[3] << 24);
+	}
+
+	static uint64_t GetU64(const char* p)
+	{
+		return GetU32(p) | ((uint64_t)GetU32(p + 4) << 32);
+	}
+
+	static void EncodeBatch(uint64_t batchId, const SyncChange* pChanges, size_t count, std::string& frame)
+	{
+		size_t cb = HeaderSize + 8 + 4;
+		for(size_t i = 0; i < count; i++)
+			cb += pChanges[i].GetWireSize();
+		frame.clear();
+		frame.reserve(cb);
+		PutU32(frame, (uint32_t)(cb - 4));
+		frame.push_back((char)FrameBatch);
+		PutU64(frame, batchId);
+		PutU32(frame, (uint32_t)count);
+		for(size_t i = 0; i < count; i++) {
+			frame.push_back((char)pChanges[i].op);
+			PutU32(frame, (uint32_t)pChanges[i].id.size());
+			frame.append(pChanges[i].id);
+			PutU32(frame, (uint32_t)pChanges[i].payload.size());
+			frame.append(pChanges[i].payload);
+		}
+	}
+
+	// body is the frame without the length and type fields
+	static bool DecodeBatch(const std::string& body, uint64_t& batchId, std::vector<SyncChange>* pChanges)
+	{
+		if(body.size() < 12)
+			return false;
+		const char* p = body.data();
+		const char* pEnd = p + body.size();
+		batchId = GetU64(p);
+		uint32_t count = GetU32(p + 8);
+		p += 12;
+		if(pChanges != NULL) {
+			pChanges->clear();
+			pChanges->reserve(count);
+		}
+		for(uint32_t i = 0; i < count; i++) {
+			if(pEnd - p < 5)
+				return false;
+			uint8_t op = (uint8_t)*p;
+			uint32_t cbId = GetU32(p + 1);
+			p += 5;
+			if((size_t)(pEnd - p) < (size_t)cbId + 4)
+				return false;
+			const char* pId = p;
+			p += cbId;
+			uint32_t cbPayload = GetU32(p);
+			p += 4;
+			if((size_t)(pEnd - p) < (size_t)cbPayload)
+				return false;
+			if(pChanges != NULL)
+				pChanges->push_back(SyncChange(op, std::string(pId, cbId), std::string(p, cbPayload)));
+			p += cbPayload;
+		}
+		return p == pEnd;
+	}
+
+	static void EncodeAck(uint64_t batchId, uint32_t status, std::string& frame)
+	{
+		frame.clear();
+		PutU32(frame, 1 + 8 + 4);
+		frame.push_back((char)FrameAck);
+		PutU64(frame, batchId);
+		PutU32(frame, status);
+	}
+
+	static bool DecodeAck(const std::string& body, uint64_t& batchId, uint32_t& status)
+	{
+		if(body.size() != 12)
+			return false;
+		batchId = GetU64(body.data());
+		status = GetU32(body.data() + 8);
+		return true;
+	}
+
+	static bool ReadFrame(CTcpSocket& socket, uint8_t& type, std::string& body)
+	{
+		char header[HeaderSize];
+		if(!socket.RecvAll(header, HeaderSize))
+			return false;
+		uint32_t cb = GetU32(header);
+		if(cb < 1 || cb > MaxFrameSize)
+			return false;
+		type = (uint8_t)header[4];
+		body.resize(cb - 1);
+		return body.empty() || socket.RecvAll(&body[0], body.size());
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CSyncTransport - batching, pipelining, retrying client
+
+struct SyncTransportOptions
+{
+	std::string host;
+	uint16_t port;
+	size_t maxBatchChanges;     // changes per batch
+	size_t maxBatchBytes;       // wire bytes per batch
+	unsigned maxInFlight;       // unacknowledged batches on the wire
+	size_t maxBufferedBytes;    // queued plus in-flight bytes before Push() blocks
+	uint32_t lingerMs;          // how long a partial batch waits for company
+	uint32_t ackTimeoutMs;      // resend a batch nobody acknowledged in this time
+	uint32_t retryBaseMs;       // first backoff step, doubled per attempt
+	uint32_t retryMaxMs;
+	unsigned maxAttempts;       // give up and fail the transport after this
+
+	SyncTransportOptions() :
+		host("127.0.0.1"), port(0),
+		maxBatchChanges(256), maxBatchBytes(256 * 1024), maxInFlight(8), maxBufferedBytes(8 * 1024 * 1024),
+		lingerMs(2), ackTimeoutMs(2000), retryBaseMs(20), retryMaxMs(2000), maxAttempts(10)
+	{
+	}
+};
+
+struct SyncTransportStats
+{
+	uint64_t changesQueued;
+	uint64_t changesAcked;
+	uint64_t batchesSent;       // including resends
+	uint64_t batchesAcked;
+	uint64_t retries;
+	uint64_t reconnects;
+	uint64_t bytesSent;
+	uint64_t producerStalls;    // Push() calls that had to wait for buffer space
+	unsigned peakInFlight;
+
+	SyncTransportStats()
+	{
+		memset(this, 0, sizeof(*this));
+	}
+};
+
+class CSyncTransport
+{
+public:
+	CSyncTransport() :
+		m_bStarted(false), m_bStop(false), m_bFailed(false), m_bConnected(false), m_bReceiverParked(true),
+		m_bufferedBytes(0), m_unbatchedBytes(0), m_firstQueuedMs(0), m_flushWaiters(0), m_nextBatch(0)
+	{
+		uint32_t client = (uint32_t)(GetTimeNs() ^ (uint64_t)(size_t)this);
+		m_nextBatch = (uint64_t)client << 32;
+		m_random = client | 1;
+	}
+
+	~CSyncTransport()
+	{
+		Close();
+	}
+
+	bool Start(const SyncTransportOptions& options)
+	{
+		if(m_bStarted)
+			return false;
+		m_options = options;
+		if(m_options.maxInFlight == 0)
+			m_options.maxInFlight = 1;
+		if(m_options.maxBatchChanges == 0)
+			m_options.maxBatchChanges = 1;
+		m_bStop = m_bFailed = false;
+		m_bStarted = true;
+		m_receiver.Start(ReceiverProc, this);
+		m_sender.Start(SenderProc, this);
+		return true;
+	}
+
+	// Queues a change. Blocks while the buffer budget is exhausted (back-pressure).
+	// Returns false once the transport is closed or has failed.
+	bool Push(const SyncChange& change)
+	{
+		size_t cb = change.GetWireSize();
+		CAutoLock lock(m_cs);
+		if(m_bufferedBytes > 0 && m_bufferedBytes + cb > m_options.maxBufferedBytes) {
+			m_stats.producerStalls++;
+			while(!m_bStop && !m_bFailed && m_bufferedBytes > 0 && m_bufferedBytes + cb > m_options.maxBufferedBytes)
+				m_cvSpace.Wait(m_cs);
+		}
+		if(m_bStop || m_bFailed)
+			return false;
+		if(m_queue.empty())
+			m_firstQueuedMs = GetTimeMs();
+		m_queue.push_back(change);
+		m_bufferedBytes += cb;
+		m_unbatchedBytes += cb;
+		m_stats.changesQueued++;
+		if(m_queue.size() >= m_options.maxBatchChanges || m_unbatchedBytes >= m_options.maxBatchBytes)
+			m_cvSender.Signal();
+		return true;
+	}
+
+	// Sends partial batches right away and waits until everything queued so far is acknowledged.
+	bool Flush(uint32_t timeoutMs = CCondVar::INFINITE_WAIT)
+	{
+		CTraceScope trace("sync.flush", "sync");
+		uint32_t start = GetTimeMs();
+		CAutoLock lock(m_cs);
+		m_flushWaiters++;
+		m_cvSender.Signal();
+		while(!m_bStop && !m_bFailed && (!m_queue.empty() || !m_inFlight.empty())) {
+			uint32_t waitMs = CCondVar::INFINITE_WAIT;
+			if(timeoutMs != CCondVar::INFINITE_WAIT) {
+				uint32_t elapsed = GetTimeMs() - start;
+				if(elapsed >= timeoutMs)
+					break;
+				waitMs = timeoutMs - elapsed;
+			}
+			m_cvIdle.Wait(m_cs, waitMs);
+		}
+		m_flushWaiters--;
+		return m_queue.empty() && m_inFlight.empty();
+	}
+
+	void Close()
+	{
+		if(!m_bStarted)
+			return;
+		{
+			CAutoLock lock(m_cs);
+			m_bStop = true;
+			m_cvSender.Broadcast();
+			m_cvReceiver.Broadcast();
+			m_cvSpace.Broadcast();
+			m_cvIdle.Broadcast();
+		}
+		m_socket.Shutdown();
+		m_sender.Join();
+		m_receiver.Join();
+		m_socket.Close();
+		m_bStarted = false;
+	}
+
+	bool IsFailed()
+	{
+		CAutoLock lock(m_cs);
+		return m_bFailed;
+	}
+
+	SyncTransportStats GetStats()
+	{
+		CAutoLock lock(m_cs);
+		return m_stats;
+	}
+
+private:
+	struct Batch
+	{
+		std::string frame;
+		size_t changes;
+		size_t bytes;           // buffered bytes released on acknowledgement
+		unsigned attempts;
+		bool bOnWire;
+		uint32_t deadlineMs;    // ack timeout while on the wire, resend time otherwise
+	};
+
+	typedef std::map<uint64_t, Batch> BatchMap;
+
+	SyncTransportOptions m_options;
+	CCritSec m_cs;
+	CCondVar m_cvSender;
+	CCondVar m_cvReceiver;
+	CCondVar m_cvSpace;
+	CCondVar m_cvIdle;
+	CNativeThread m_sender;     // own threads rather than pool tasks, see above
+	CNativeThread m_receiver;
+	CTcpSocket m_socket;
+
+	bool m_bStarted;
+	bool m_bStop;
+	bool m_bFailed;
+	bool m_bConnected;
+	bool m_bReceiverParked;
+	std::deque<SyncChange> m_queue;
+	BatchMap m_inFlight;
+	size_t m_bufferedBytes;
+	size_t m_unbatchedBytes;
+	uint32_t m_firstQueuedMs;
+	int m_flushWaiters;
+	uint64_t m_nextBatch;
+	uint32_t m_random;
+	SyncTransportStats m_stats;
+
+	static bool IsDue(uint32_t deadline, uint32_t now)
+	{
+		return (int32_t)(now - deadline) >= 0;
+	}
+
+	// exponential backoff with +-25% jitter so many clients don't retry in lockstep
+	uint32_t GetBackoffMs(unsigned attempt)
+	{
+		uint32_t delay = m_options.retryBaseMs;
+		for(unsigned i = 1; i < attempt && delay < m_options.retryMaxMs; i++)
+			delay *= 2;
+		if(delay > m_options.retryMaxMs)
+			delay = m_options.retryMaxMs;
+		m_random ^= m_random << 13;
+		m_random ^= m_random >> 17;
+		m_random ^= m_random << 5;
+		uint32_t quarter = delay / 4;
+		return delay - quarter + (quarter > 0 ? m_random % (2 * quarter + 1) : 0);
+	}
+
+	void Fail()
+	{
+		m_bFailed = true;
+		m_cvSpace.Broadcast();
+		m_cvIdle.Broadcast();
+	}
+
+	// m_cs held; moves up to one batch worth of queued changes into m_inFlight
+	bool FormBatch(uint32_t now)
+	{
+		if(m_queue.empty() || m_inFlight.size() >= m_options.maxInFlight)
+			return false;
+		bool bFull = m_queue.size() >= m_options.maxBatchChanges || m_unbatchedBytes >= m_options.maxBatchBytes;
+		bool bLingered = IsDue(m_firstQueuedMs + m_options.lingerMs, now);
+		if(!bFull && !bLingered && m_flushWaiters == 0)
+			return false;
+		CTraceScope trace("sync.batch", "sync");
+
+		size_t count = 0;
+		size_t cb = 0;
+		while(count < m_queue.size() && count < m_options.maxBatchChanges) {
+			size_t cbChange = m_queue[count].GetWireSize();
+			if(count > 0 && cb + cbChange > m_options.maxBatchBytes)
+				break;
+			cb += cbChange;
+			count++;
+		}
+
+		std::vector<SyncChange> changes(m_queue.begin(), m_queue.begin() + count);
+		m_queue.erase(m_queue.begin(), m_queue.begin() + count);
+		m_unbatchedBytes -= cb;
+		if(!m_queue.empty())
+			m_firstQueuedMs = now;
+
+		uint64_t id = ++m_nextBatch;
+		Batch& batch = m_inFlight[id];
+		CSyncWire::EncodeBatch(id, &changes[0], count, batch.frame);
+		batch.changes = count;
+		batch.bytes = cb;
+		batch.attempts = 0;
+		batch.bOnWire = false;
+		batch.deadlineMs = now;
+		if(m_inFlight.size() > m_stats.peakInFlight)
+			m_stats.peakInFlight = (unsigned)m_inFlight.size();
+		return true;
+	}
+
+	bool Reconnect(unsigned& attempt)
+	{
+		CTraceScope trace("sync.connect", "sync");
+		// the receiver must be off the old socket before it is closed
+		{
+			CAutoLock lock(m_cs);
+			while(!m_bStop && !m_bReceiverParked)
+				m_cvSender.Wait(m_cs, 50);
+			if(m_bStop)
+				return false;
+		}
+		m_socket.Close();
+		if(!m_socket.Connect(m_options.host.c_str(), m_options.port)) {
+			CAutoLock lock(m_cs);
+			if(++attempt >= m_options.maxAttempts) {
+				Fail();
+				return false;
+			}
+			m_cvSender.Wait(m_cs, GetBackoffMs(attempt));
+			return false;
+		}
+
+		CAutoLock lock(m_cs);
+		if(m_stats.batchesSent > 0)
+			m_stats.reconnects++;
+		attempt = 0;
+		// whatever was on the old connection is lost, send it again in id order
+		uint32_t now = GetTimeMs();
+		for(BatchMap::iterator it = m_inFlight.begin(); it != m_inFlight.end(); ++it) {
+			if(it->second.bOnWire) {
+				it->second.bOnWire = false;
+				it->second.deadlineMs = now;
+			}
+		}
+		m_bConnected = true;
+		m_cvReceiver.Broadcast();
+		return true;
+	}
+
+	void SenderLoop()
+	{
+		unsigned connectAttempt = 0;
+		std::vector<std::string> outgoing;
+		for(;;) {
+			bool bConnected;
+			{
+				CAutoLock lock(m_cs);
+				if(m_bStop || m_bFailed)
+					break;
+				bConnected = m_bConnected;
+			}
+			if(!bConnected && !Reconnect(connectAttempt))
+				continue;
+
+			outgoing.clear();
+			{
+				CAutoLock lock(m_cs);
+				uint32_t now = GetTimeMs();
+
+				while(FormBatch(now))
+					;
+
+				uint32_t nextWake = now + 1000;
+				for(BatchMap::iterator it = m_inFlight.begin(); it != m_inFlight.end(); ++it) {
+					Batch& batch = it->second;
+					if(batch.bOnWire && IsDue(batch.deadlineMs, now)) {
+						// no acknowledgement in time, back off and resend the same id
+						if(batch.attempts >= m_options.maxAttempts) {
+							Fail();
+							break;
+						}
+						m_stats.retries++;
+						batch.bOnWire = false;
+						batch.deadlineMs = now + GetBackoffMs(batch.attempts);
+					}
+					if(!batch.bOnWire && IsDue(batch.deadlineMs, now)) {
+						batch.bOnWire = true;
+						batch.attempts++;
+						batch.deadlineMs = now + m_options.ackTimeoutMs;
+						outgoing.push_back(batch.frame);
+						m_stats.batchesSent++;
+						m_stats.bytesSent += batch.frame.size();
+					}
+					if((int32_t)(batch.deadlineMs - nextWake) < 0)
+						nextWake = batch.deadlineMs;
+				}
+				if(m_bFailed)
+					break;
+
+				if(!m_queue.empty() && m_inFlight.size() < m_options.maxInFlight) {
+					uint32_t lingerEnd = m_firstQueuedMs + m_options.lingerMs;
+					if((int32_t)(lingerEnd - nextWake) < 0)
+						nextWake = lingerEnd;
+				}
+				if(outgoing.empty()) {
+					int32_t wait = (int32_t)(nextWake - now);
+					m_cvSender.Wait(m_cs, wait > 0 ? wait : 0);
+					continue;
+				}
+			}
+
+			CTraceScope trace("sync.send", "sync");
+			for(size_t i = 0; i < outgoing.size(); i++) {
+				if(!m_socket.SendAll(outgoing[i].data(), outgoing[i].size())) {
+					CAutoLock lock(m_cs);
+					m_bConnected = false;
+					m_socket.Shutdown();
+					break;
+				}
+			}
+		}
+	}
+
+	void ReceiverLoop()
+	{
+		std::string body;
+		for(;;) {
+			{
+				CAutoLock lock(m_cs);
+				while(!m_bStop && !m_bConnected) {
+					m_bReceiverParked = true;
+					m_cvSender.Broadcast();
+					m_cvReceiver.Wait(m_cs);
+				}
+				if(m_bStop)
+					break;
+				m_bReceiverParked = false;
+			}
+
+			uint8_t type = 0;
+			uint64_t id = 0;
+			uint32_t status = 0;
+			bool bOk = CSyncWire::ReadFrame(m_socket, type, body) &&
+				type == CSyncWire::FrameAck && CSyncWire::DecodeAck(body, id, status);
+
+			CAutoLock lock(m_cs);
+			if(!bOk) {
+				m_bConnected = false;
+				m_cvSender.Broadcast();
+				continue;
+			}
+			BatchMap::iterator it = m_inFlight.find(id);
+			if(it == m_inFlight.end())
+				continue;   // late acknowledgement of a batch that was resent and already acknowledged
+			if(status == CSyncWire::AckBusy) {
+				it->second.bOnWire = false;
+				it->second.deadlineMs = GetTimeMs() + GetBackoffMs(it->second.attempts);
+				m_stats.retries++;
+				m_cvSender.Broadcast();
+				continue;
+			}
+			m_bufferedBytes -= it->second.bytes;
+			m_stats.changesAcked += it->second.changes;
+			m_stats.batchesAcked++;
+			TraceInstant("sync.ack", "sync");
+			m_inFlight.erase(it);
+			m_cvSpace.Broadcast();
+			m_cvSender.Broadcast();
+			if(m_queue.empty() && m_inFlight.empty())
+				m_cvIdle.Broadcast();
+		}
+	}
+
+	static void SenderProc(void* p)
+	{
+		CEventTracer::GetDefault().SetThreadName("sync sender");
+		static_cast<CSyncTransport*>(p)->SenderLoop();
+	}
+
+	static void ReceiverProc(void* p)
+	{
+		CEventTracer::GetDefault().SetThreadName("sync receiver");
+		static_cast<CSyncTransport*>(p)->ReceiverLoop();
+	}
+
+	CSyncTransport(const CSyncTransport&);
+	CSyncTransport& operator=(const CSyncTransport&);
+};
+
+}; // namespace Synrc
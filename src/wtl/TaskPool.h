@@ -0,0 +1,592 @@
+// TaskPool.h
+//
+//  Shared work-stealing thread pool for native background work. One pool
+//  sized to the machine replaces the per-job threads, so search, import,
+//  thumbnail decode and sync stop competing for cores.
+//
+//  Every worker owns one deque per priority. Work spawned on a worker goes
+//  to its own deque (LIFO for locality), work from other threads goes to a
+//  global queue, and idle workers steal the oldest task from their peers.
+//  Higher priorities are always drained first, wherever they are queued.
+//
+//  Tasks are expected to finish. Loops that block for their owner's life
+//  (the sync transport's socket threads, the log flusher) keep threads of
+//  their own, so no worker is reserved for them.
+
+#pragma once
+
+#include <deque>
+#include <string.h>
+
+#include "Platform.h"
+#include "EventTrace.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// TaskQueueStats - latency snapshot of one priority queue
+// CTaskGroup - completion counter and cancellation flag for related tasks
+// CTaskPool - work-stealing pool with per-priority queues
+
+namespace Synrc
+{
+
+enum TaskPriority
+{
+	PriorityPrefetch = 0,   // UI critical: row prefetch, thumbnails for visible items
+	PrioritySearch,
+	PriorityImport,
+	PrioritySync,
+	PriorityCount
+};
+
+typedef void (*TaskProc)(void* pParam);
+
+class CTaskPool;
+
+struct TaskQueueStats
+{
+	uint64_t tasks;             // tasks started
+	uint64_t cancelled;         // tasks skipped because their group was cancelled
+	uint64_t avgWaitUs;         // queued until started
+	uint64_t p50WaitUs;
+	uint64_t p99WaitUs;
+	uint64_t maxWaitUs;
+	uint64_t avgRunUs;
+
+	TaskQueueStats()
+	{
+		memset(this, 0, sizeof(*this));
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CTaskGroup - completion counter and cancellation flag for related tasks
+
+class CTaskGroup
+{
+public:
+	explicit CTaskGroup(CTaskPool& pool) : m_pool(pool), m_pending(0), m_cancelled(0)
+	{
+	}
+
+	~CTaskGroup()
+	{
+		Wait();
+	}
+
+	void Run(TaskProc pfnProc, void* pParam, TaskPriority priority);
+
+	template <class F>
+	void Run(const F& functor, TaskPriority priority);
+
+	// Tasks of the group that have not started yet are dropped; running ones can poll IsCancelled().
+	void Cancel()
+	{
+		AtomicStore(&m_cancelled, 1);
+	}
+
+	bool IsCancelled() const
+	{
+		return AtomicLoad(&m_cancelled) != 0;
+	}
+
+	bool IsDone() const
+	{
+		return AtomicLoad(&m_pending) == 0;
+	}
+
+	// On a pool thread this runs other queued work while waiting instead of blocking a worker.
+	void Wait();
+
+private:
+	friend class CTaskPool;
+
+	CTaskPool& m_pool;
+	volatile int32_t m_pending;
+	volatile int32_t m_cancelled;
+	CCritSec m_cs;
+	CCondVar m_cv;
+
+	// decremented under the lock so Wait() can tell when the last finisher has let go of the group
+	void OnTaskDone()
+	{
+		CAutoLock lock(m_cs);
+		if(AtomicDecrement(&m_pending) == 0)
+			m_cv.Broadcast();
+	}
+
+	CTaskGroup(const CTaskGroup&);
+	CTaskGroup& operator=(const CTaskGroup&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CTaskPool - work-stealing pool with per-priority queues
+
+class CTaskPool
+{
+public:
+	// threadCount 0 leaves one core for the UI thread
+	explicit CTaskPool(unsigned threadCount = 0) : m_bStop(false), m_idle(0)
+	{
+		if(threadCount == 0) {
+			unsigned cores = GetProcessorCount();
+			threadCount = cores > 1 ? cores - 1 : 1;
+		}
+		memset((void*)m_queued, 0, sizeof(m_queued));
+		memset((void*)m_stats, 0, sizeof(m_stats));
+		m_workerCount = threadCount;
+		m_pWorkers = new Worker[threadCount];
+		for(unsigned i = 0; i < threadCount; i++) {
+			m_pWorkers[i].pPool = this;
+			m_pWorkers[i].index = i;
+			m_pWorkers[i].random = 2654435761u * (i + 1);
+		}
+		for(unsigned i = 0; i < threadCount; i++)
+			m_pWorkers[i].thread.Start(WorkerProc, &m_pWorkers[i]);
+	}
+
+	~CTaskPool()
+	{
+		Stop();
+		delete[] m_pWorkers;
+	}
+
+	// Finishes running tasks, drops queued ones and joins the workers.
+	void Stop()
+	{
+		{
+			CAutoLock lock(m_csIdle);
+			if(m_bStop)
+				return;
+			m_bStop = true;
+			m_cvIdle.Broadcast();
+		}
+		for(unsigned i = 0; i < m_workerCount; i++)
+			m_pWorkers[i].thread.Join();
+		for(int p = 0; p < PriorityCount; p++) {
+			while(!m_global[p].empty()) {
+				Discard(m_global[p].front());
+				m_global[p].pop_front();
+			}
+			for(unsigned i = 0; i < m_workerCount; i++) {
+				std::deque<Task>& local = m_pWorkers[i].local[p];
+				while(!local.empty()) {
+					Discard(local.front());
+					local.pop_front();
+				}
+			}
+		}
+	}
+
+	unsigned GetThreadCount() const
+	{
+		return m_workerCount;
+	}
+
+	void Submit(TaskProc pfnProc, void* pParam, TaskPriority priority, CTaskGroup* pGroup = NULL)
+	{
+		Task task;
+		task.pfnProc = pfnProc;
+		task.pfnDiscard = NULL;
+		task.pParam = pParam;
+		task.pGroup = pGroup;
+		Enqueue(task, priority);
+	}
+
+	// functor is copied to the heap and released after it ran or was dropped
+	template <class F>
+	void Submit(const F& functor, TaskPriority priority, CTaskGroup* pGroup = NULL)
+	{
+		Task task;
+		task.pfnProc = &RunFunctor<F>;
+		task.pfnDiscard = &DeleteFunctor<F>;
+		task.pParam = new F(functor);
+		task.pGroup = pGroup;
+		Enqueue(task, priority);
+	}
+
+	// Splits [begin, end) into chunks of at least grain items and calls body(lo, hi) for each,
+	// returning when all chunks are done. The calling thread takes part.
+	template <class F>
+	void ParallelFor(size_t begin, size_t end, size_t grain, const F& body, TaskPriority priority)
+	{
+		if(end <= begin)
+			return;
+		if(grain == 0)
+			grain = 1;
+		size_t count = end - begin;
+		size_t chunks = (m_workerCount + 1) * 4;
+		size_t chunk = (count + chunks - 1) / chunks;
+		if(chunk < grain)
+			chunk = grain;
+		if(chunk >= count) {
+			body(begin, end);
+			return;
+		}
+		CTaskGroup group(*this);
+		for(size_t lo = begin + chunk; lo < end; lo += chunk) {
+			size_t hi = end - lo > chunk ? lo + chunk : end;
+			group.Run(RangeTask<F>(body, lo, hi), priority);
+		}
+		body(begin, begin + chunk);
+		group.Wait();
+	}
+
+	// Runs one queued task on the calling pool thread; false when nothing was found.
+	bool RunPending()
+	{
+		Worker* pSelf = GetCurrentWorker();
+		Task task;
+		int priority;
+		if(!FindTask(pSelf, task, priority))
+			return false;
+		Execute(task, priority);
+		return true;
+	}
+
+	bool IsPoolThread() const
+	{
+		Worker* pSelf = GetCurrentWorker();
+		return pSelf != NULL && pSelf->pPool == this;
+	}
+
+	TaskQueueStats GetStats(TaskPriority priority) const
+	{
+		const QueueCounters& c = m_stats[priority];
+		TaskQueueStats s;
+		s.tasks = (uint64_t)AtomicLoad64(&c.tasks);
+		s.cancelled = (uint64_t)AtomicLoad64(&c.cancelled);
+		if(s.tasks > 0) {
+			s.avgWaitUs = (uint64_t)AtomicLoad64(&c.waitNs) / s.tasks / 1000;
+			s.avgRunUs = (uint64_t)AtomicLoad64(&c.runNs) / s.tasks / 1000;
+		}
+		s.maxWaitUs = (uint64_t)AtomicLoad64(&c.maxWaitNs) / 1000;
+		s.p50WaitUs = Percentile(c, s.tasks, 50);
+		s.p99WaitUs = Percentile(c, s.tasks, 99);
+		return s;
+	}
+
+	size_t GetQueuedCount() const
+	{
+		size_t n = 0;
+		for(int p = 0; p < PriorityCount; p++)
+			n += AtomicLoad(&m_queued[p]);
+		return n;
+	}
+
+	// process wide pool, created on first use
+	static CTaskPool& GetDefault()
+	{
+		void* volatile& slot = DefaultSlot();
+		if(AtomicLoadPointer(&slot) == NULL) {
+			CTaskPool* pPool = new CTaskPool();
+			if(AtomicCompareExchangePointer(&slot, pPool, NULL) != NULL)
+				delete pPool;
+		}
+		return *static_cast<CTaskPool*>(AtomicLoadPointer(&slot));
+	}
+
+	static void ShutdownDefault()
+	{
+		void* volatile& slot = DefaultSlot();
+		void* pPool = AtomicLoadPointer(&slot);
+		if(pPool != NULL && AtomicCompareExchangePointer(&slot, NULL, pPool) == pPool)
+			delete static_cast<CTaskPool*>(pPool);
+	}
+
+private:
+	friend class CTaskGroup;
+
+	enum { HistogramBuckets = 32 };   // log2 of the wait in microseconds
+
+	struct Task
+	{
+		TaskProc pfnProc;
+		TaskProc pfnDiscard;
+		void* pParam;
+		CTaskGroup* pGroup;
+		uint64_t enqueuedNs;
+	};
+
+	struct Worker
+	{
+		CTaskPool* pPool;
+		unsigned index;
+		uint32_t random;
+		CCritSec cs;
+		std::deque<Task> local[PriorityCount];
+		CNativeThread thread;
+	};
+
+	struct QueueCounters
+	{
+		volatile int64_t tasks;
+		volatile int64_t cancelled;
+		volatile int64_t waitNs;
+		volatile int64_t runNs;
+		volatile int64_t maxWaitNs;
+		volatile int32_t histogram[HistogramBuckets];
+	};
+
+	template <class F>
+	struct RangeTask
+	{
+		const F* pBody;
+		size_t lo;
+		size_t hi;
+
+		RangeTask(const F& body, size_t lo_, size_t hi_) : pBody(&body), lo(lo_), hi(hi_)
+		{
+		}
+
+		void operator()() const
+		{
+			(*pBody)(lo, hi);
+		}
+	};
+
+	Worker* m_pWorkers;
+	unsigned m_workerCount;
+	CCritSec m_csGlobal;
+	std::deque<Task> m_global[PriorityCount];
+	volatile int32_t m_queued[PriorityCount];
+	QueueCounters m_stats[PriorityCount];
+	CCritSec m_csIdle;
+	CCondVar m_cvIdle;
+	bool m_bStop;
+	volatile int32_t m_idle;
+
+	static void* volatile& DefaultSlot()
+	{
+		static void* volatile s_pDefault = NULL;
+		return s_pDefault;
+	}
+
+	static Worker*& CurrentWorkerSlot()
+	{
+		static SYNRC_THREAD_LOCAL Worker* s_pWorker = NULL;
+		return s_pWorker;
+	}
+
+	static Worker* GetCurrentWorker()
+	{
+		return CurrentWorkerSlot();
+	}
+
+	template <class F>
+	static void RunFunctor(void* p)
+	{
+		F* pFunctor = static_cast<F*>(p);
+		(*pFunctor)();
+		delete pFunctor;
+	}
+
+	template <class F>
+	static void DeleteFunctor(void* p)
+	{
+		delete static_cast<F*>(p);
+	}
+
+	static void Discard(Task& task)
+	{
+		if(task.pfnDiscard != NULL)
+			task.pfnDiscard(task.pParam);
+		if(task.pGroup != NULL)
+			task.pGroup->OnTaskDone();
+	}
+
+	void Enqueue(Task& task, TaskPriority priority)
+	{
+		task.enqueuedNs = GetTimeNs();
+		if(task.pGroup != NULL)
+			AtomicIncrement(&task.pGroup->m_pending);
+
+		Worker* pSelf = GetCurrentWorker();
+		if(pSelf != NULL && pSelf->pPool == this) {
+			CAutoLock lock(pSelf->cs);
+			pSelf->local[priority].push_back(task);
+		}
+		else {
+			CAutoLock lock(m_csGlobal);
+			m_global[priority].push_back(task);
+		}
+		AtomicIncrement(&m_queued[priority]);
+
+		// pairs with the m_idle increment in WorkerLoop: one side always sees the other
+		if(AtomicLoad(&m_idle) > 0) {
+			CAutoLock lock(m_csIdle);
+			m_cvIdle.Signal();
+		}
+	}
+
+	bool PopLocal(Worker& worker, int priority, Task& task, bool bSteal)
+	{
+		CAutoLock lock(worker.cs);
+		std::deque<Task>& q = worker.local[priority];
+		if(q.empty())
+			return false;
+		if(bSteal) {
+			task = q.front();
+			q.pop_front();
+		}
+		else {
+			task = q.back();
+			q.pop_back();
+		}
+		return true;
+	}
+
+	bool FindTask(Worker* pSelf, Task& task, int& priority)
+	{
+		for(int p = 0; p < PriorityCount; p++) {
+			if(AtomicLoad(&m_queued[p]) == 0)
+				continue;
+			bool bFound = pSelf != NULL && PopLocal(*pSelf, p, task, false);
+			if(!bFound) {
+				CAutoLock lock(m_csGlobal);
+				if(!m_global[p].empty()) {
+					task = m_global[p].front();
+					m_global[p].pop_front();
+					bFound = true;
+				}
+			}
+			if(!bFound) {
+				unsigned start = 0;
+				if(pSelf != NULL) {
+					pSelf->random = pSelf->random * 1664525u + 1013904223u;
+					start = pSelf->random >> 8;
+				}
+				for(unsigned i = 0; i < m_workerCount && !bFound; i++) {
+					Worker& victim = m_pWorkers[(start + i) % m_workerCount];
+					if(&victim != pSelf)
+						bFound = PopLocal(victim, p, task, true);
+				}
+			}
+			if(bFound) {
+				AtomicDecrement(&m_queued[p]);
+				priority = p;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void Execute(Task& task, int priority)
+	{
+		QueueCounters& c = m_stats[priority];
+		if(task.pGroup != NULL && task.pGroup->IsCancelled()) {
+			AtomicAdd64(&c.cancelled, 1);
+			Discard(task);
+			return;
+		}
+
+		uint64_t startNs = GetTimeNs();
+		int64_t waitNs = (int64_t)(startNs - task.enqueuedNs);
+		AtomicAdd64(&c.tasks, 1);
+		AtomicAdd64(&c.waitNs, waitNs);
+		int64_t seen = AtomicLoad64(&c.maxWaitNs);
+		while(waitNs > seen) {
+			int64_t prev = AtomicCompareExchange64(&c.maxWaitNs, waitNs, seen);
+			if(prev == seen)
+				break;
+			seen = prev;
+		}
+		AtomicIncrement(&c.histogram[Bucket((uint64_t)waitNs / 1000)]);
+
+		task.pfnProc(task.pParam);
+
+		AtomicAdd64(&c.runNs, (int64_t)(GetTimeNs() - startNs));
+		if(task.pGroup != NULL)
+			task.pGroup->OnTaskDone();
+	}
+
+	static int Bucket(uint64_t us)
+	{
+		int b = 0;
+		while(us > 0 && b < HistogramBuckets - 1) {
+			us >>= 1;
+			b++;
+		}
+		return b;
+	}
+
+	// upper bound of the bucket holding the requested percentile
+	static uint64_t Percentile(const QueueCounters& c, uint64_t total, int percent)
+	{
+		if(total == 0)
+			return 0;
+		uint64_t target = (total * percent + 99) / 100;
+		uint64_t seen = 0;
+		for(int b = 0; b < HistogramBuckets; b++) {
+			seen += (uint32_t)AtomicLoad(&c.histogram[b]);
+			if(seen >= target)
+				return b == 0 ? 0 : (1ULL << b) - 1;
+		}
+		return (uint64_t)AtomicLoad64(&c.maxWaitNs) / 1000;
+	}
+
+	void WorkerLoop(Worker& self)
+	{
+		CurrentWorkerSlot() = &self;
+		CEventTracer::GetDefault().SetThreadName("pool worker");
+		Task task;
+		int priority;
+		for(;;) {
+			if(FindTask(&self, task, priority)) {
+				Execute(task, priority);
+				continue;
+			}
+			CAutoLock lock(m_csIdle);
+			if(m_bStop)
+				break;
+			AtomicIncrement(&m_idle);
+			if(GetQueuedCount() == 0)
+				m_cvIdle.Wait(m_csIdle);
+			AtomicDecrement(&m_idle);
+		}
+		CurrentWorkerSlot() = NULL;
+	}
+
+	static void WorkerProc(void* p)
+	{
+		Worker* pWorker = static_cast<Worker*>(p);
+		pWorker->pPool->WorkerLoop(*pWorker);
+	}
+
+	CTaskPool(const CTaskPool&);
+	CTaskPool& operator=(const CTaskPool&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CTaskGroup implementation
+
+inline void CTaskGroup::Run(TaskProc pfnProc, void* pParam, TaskPriority priority)
+{
+	m_pool.Submit(pfnProc, pParam, priority, this);
+}
+
+template <class F>
+inline void CTaskGroup::Run(const F& functor, TaskPriority priority)
+{
+	m_pool.Submit(functor, priority, this);
+}
+
+inline void CTaskGroup::Wait()
+{
+	if(m_pool.IsPoolThread()) {
+		while(!IsDone()) {
+			if(!m_pool.RunPending()) {
+				CAutoLock lock(m_cs);
+				if(!IsDone())
+					m_cv.Wait(m_cs, 1);
+			}
+		}
+	}
+	CAutoLock lock(m_cs);
+	while(!IsDone())
+		m_cv.Wait(m_cs);
+}
+
+}; // namespace Synrc
@@ -0,0 +1,511 @@
+// TranslitSearch.h
+//
+//  Search across scripts: "Maxim Sokhatsky" finds the contact stored in
+//  Cyrillic letters and the other way round. Every word of a field is
+//  folded to a Latin key: Cyrillic (Russian, Ukrainian, Belarusian and
+//  Serbian letters) and Greek are transliterated, accented Latin loses its
+//  accents, and then one set of rules folds the spellings people use for
+//  the same sound: "kh", "h" and "g" are one letter, as are "ts" and "c",
+//  "sh" and "s", "y", "j" and "i"; "x" is "ks", doubled letters are one and
+//  "ie" is "e". Both "Sokhatsky" and the Cyrillic spelling become
+//  "sohacki"; "Yulia", "Julia" and the Cyrillic "Yuliya" become "iulia".
+//  The folding is deliberately loose: it only has to make spellings meet,
+//  and the other indexes rank. Characters of other scripts end a word and
+//  are not indexed.
+//
+//  The keys of all rows are back to back in one buffer, as in CFieldIndex.
+//  An edit folds the row once when the store reports it: the row's old key
+//  is blanked in place and the new one kept aside, and once enough rows are
+//  kept aside they are merged into a new buffer without folding anything
+//  again.
+//
+//  Threading: the index has its own lock, then the store's.
+
+#pragma once
+
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "ContactStore.h"
+#include "EventTrace.h"
+#include "ProgressiveResults.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CTranslitIndex - folded Latin keys of a field, searched in either script
+// CTranslitCursor - the rows of a transliterated search as a result cursor
+
+namespace Synrc
+{
+
+struct TranslitSearchStats
+{
+	uint64_t searches;
+	uint64_t folds;             // rows folded for edits since the build
+	uint64_t merges;            // edited rows merged into the key buffer
+	uint64_t rebuilds;
+
+	TranslitSearchStats() : searches(0), folds(0), merges(0), rebuilds(0)
+	{
+	}
+};
+
+class CTranslitIndex : public IContactStoreObserver
+{
+public:
+	enum { MergeRows = 4096 };  // edited rows kept aside before a merge
+
+	CTranslitIndex(CContactStore& store, ContactField field) : m_store(store), m_field(field), m_bStale(true)
+	{
+		m_store.AddObserver(this);
+	}
+
+	~CTranslitIndex()
+	{
+		m_store.RemoveObserver(this);
+	}
+
+	// Appends the folded key of the text: its words, folded, separated by
+	// spaces.
+	static void Fold(const wchar_t* pText, size_t cch, std::string& key)
+	{
+		std::string word;
+		for(size_t i = 0; i <= cch; i++) {
+			const char* pLatin = i < cch ? GetLatin(pText[i]) : NULL;
+			if(pLatin != NULL) {
+				word += pLatin;
+				continue;
+			}
+			if(!word.empty()) {
+				if(!key.empty() && key[key.size() - 1] != ' ')
+					key.push_back(' ');
+				FoldWord(word, key);
+				word.clear();
+			}
+		}
+		if(!key.empty() && key[key.size() - 1] == ' ')
+			key.resize(key.size() - 1);
+	}
+
+	// Latin letters of a character, lower case; "" for characters inside
+	// a word that have none (accents, soft signs, apostrophes), NULL for
+	// those that end a word.
+	static const char* GetLatin(wchar_t c)
+	{
+		static const char* const s_letters[26] =
+		{
+			"a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m",
+			"n", "o", "p", "q", "r", "s", "t", "u", "v", "w", "x", "y", "z"
+		};
+		static const char* const s_digits[10] = { "0", "1", "2", "3", "4", "5", "6", "7", "8", "9" };
+		// U+00C0..U+00FF and U+0100..U+017F without their accents; '*' ends a word
+		static const char s_latin1[] = "aaaaaaaceeeeiiiidnooooo*ouuuuyts" "aaaaaaaceeeeiiiidnooooo*ouuuuyty";
+		static const char s_latinA[] =
+			"aaaaaaccccccccddddeeeeeeeeeegggggggghhhhiiiiiiiiiiiijjkkklllllll"
+			"lllnnnnnnnnnoooooooorrrrrrssssssssttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+		// U+0410..U+042F, the lower case letters at U+0430 the same
+		static const char* const s_cyrillic[32] =
+		{
+			"a", "b", "v", "g", "d", "e", "zh", "z", "i", "y", "k", "l", "m", "n", "o", "p",
+			"r", "s", "t", "u", "f", "kh", "ts", "ch", "sh", "shch", "", "y", "", "e", "yu", "ya"
+		};
+		// U+0400..U+040F, the lower case letters at U+0450 the same
+		static const char* const s_cyrillicExtra[16] =
+		{
+			"e", "e", "d", "g", "ye", "dz", "i", "yi", "j", "lj", "nj", "c", "k", "i", "u", "dz"
+		};
+		// U+0391..U+03A9, the lower case letters at U+03B1 the same
+		static const char* const s_greek[25] =
+		{
+			"a", "v", "g", "d", "e", "z", "i", "th", "i", "k", "l", "m", "n", "x", "o", "p",
+			"r", "s", "s", "t", "y", "f", "kh", "ps", "o"
+		};
+		uint32_t u = (uint32_t)c;
+		if(u < 0x80) {
+			if(u >= 'a' && u <= 'z')
+				return s_letters[u - 'a'];
+			if(u >= 'A' && u <= 'Z')
+				return s_letters[u - 'A'];
+			if(u >= '0' && u <= '9')
+				return s_digits[u - '0'];
+			return u == '\'' ? "" : NULL;
+		}
+		switch(u) {
+		case 0x00C6: case 0x00E6: return "ae";
+		case 0x00DE: case 0x00FE: return "th";
+		case 0x00DF: return "ss";
+		case 0x0132: case 0x0133: return "ij";
+		case 0x0152: case 0x0153: return "oe";
+		case 0x0490: case 0x0491: return "g";
+		case 0x03AC: return "a";
+		case 0x03AD: return "e";
+		case 0x03AE: case 0x03AF: case 0x03CA: case 0x0390: return "i";
+		case 0x03CC: case 0x03CE: return "o";
+		case 0x03CD: case 0x03CB: return "y";
+		case 0x02BC: case 0x2019: return "";    // apostrophes, as in Ukrainian names
+		}
+		if(u >= 0x0300 && u < 0x0370)
+			return "";          // combining accents
+		if(u >= 0x00C0 && u < 0x0180) {
+			char letter = u < 0x0100 ? s_latin1[u - 0x00C0] : s_latinA[u - 0x0100];
+			if(letter == '*')
+				return NULL;
+			return s_letters[letter - 'a'];
+		}
+		if(u >= 0x0410 && u < 0x0450)
+			return s_cyrillic[(u - 0x0410) & 31];
+		if(u >= 0x0400 && u < 0x0410)
+			return s_cyrillicExtra[u - 0x0400];
+		if(u >= 0x0450 && u < 0x0460)
+			return s_cyrillicExtra[u - 0x0450];
+		if(u >= 0x0391 && u <= 0x03A9 && u != 0x03A2)
+			return s_greek[u - 0x0391];
+		if(u >= 0x03B1 && u <= 0x03C9)
+			return s_greek[u - 0x03B1];
+		return NULL;
+	}
+
+	// Appends the folded spelling of a word of Latin letters.
+	// The folded words of a query. With bPrefixLast the last word is still
+	// being typed, and is cut to what its next letter cannot change: "Sok"
+	// searches for "so", as "Sokh" folds to "soh".
+	static void GetQueryWords(const std::wstring& text, std::vector<std::string>& words, bool bPrefixLast = true)
+	{
+		words.clear();
+		std::string key;
+		Fold(text.data(), text.size(), key);
+		size_t start = 0;
+		for(size_t i = 0; i <= key.size(); i++) {
+			if(i == key.size() || key[i] == ' ') {
+				if(i > start)
+					words.push_back(key.substr(start, i - start));
+				start = i + 1;
+			}
+		}
+		if(!bPrefixLast || words.empty() || text.empty() || GetLatin(text[text.size() - 1]) == NULL)
+			return;
+		static const wchar_t* const s_next[] = { L"h", L"e", L"c", L"k", L"s", L"z" };
+		std::string& last = words.back();
+		for(size_t n = 0; n < sizeof(s_next) / sizeof(s_next[0]); n++) {
+			key.clear();
+			std::wstring longer(text);
+			longer += s_next[n];
+			Fold(longer.data(), longer.size(), key);
+			size_t lastStart = key.rfind(' ');
+			lastStart = lastStart == std::string::npos ? 0 : lastStart + 1;
+			size_t same = 0;
+			while(same < last.size() && lastStart + same < key.size() && key[lastStart + same] == last[same])
+				same++;
+			last.resize(same);
+		}
+		if(last.empty())
+			words.pop_back();
+	}
+
+	void Rebuild()
+	{
+		CAutoLock lock(m_cs);
+		CAutoLock storeLock(m_store.GetLock());
+		Build();
+	}
+
+	// Appends the live rows, ascending, whose folded key contains every
+	// folded word of the text; nothing when the text folds to no words.
+	void Search(const std::wstring& text, std::vector<uint32_t>& rows, bool bPrefixLast = true)
+	{
+		CTraceScope trace("search.translit", "search");
+		std::vector<std::string> words;
+		GetQueryWords(text, words, bPrefixLast);
+		if(words.empty())
+			return;
+		std::sort(words.begin(), words.end(), CompareLength());
+
+		CAutoLock lock(m_cs);
+		CAutoLock storeLock(m_store.GetLock());
+		if(m_bStale)
+			Build();
+		m_stats.searches++;
+		size_t first = rows.size();
+		const std::string& word = words[0];
+		const char* pKeys = m_keys.data();
+		size_t size = m_keys.size();
+		size_t anchor = 0;
+		for(size_t i = 1; i < word.size(); i++) {
+			if(m_byteCounts[(uint8_t)word[i]] < m_byteCounts[(uint8_t)word[anchor]])
+				anchor = i;
+		}
+		size_t pos = 0;
+		while(pos + word.size() <= size) {
+			const char* pHit = (const char*)memchr(pKeys + pos + anchor, word[anchor], size - pos - word.size() + 1);
+			if(pHit == NULL)
+				break;
+			pos = pHit - pKeys - anchor;
+			if(memcmp(pKeys + pos, word.data(), word.size()) != 0) {
+				pos++;
+				continue;
+			}
+			uint32_t row = (uint32_t)(std::upper_bound(m_starts.begin(), m_starts.end(), (uint32_t)pos) - m_starts.begin() - 1);
+			if(pos + word.size() > m_starts[row + 1]) {
+				pos++;
+				continue;
+			}
+			if(m_store.IsLive(row) && ContainsAll(pKeys + m_starts[row], m_starts[row + 1] - m_starts[row], words))
+				rows.push_back(row);
+			pos = m_starts[row + 1];
+		}
+		size_t clean = rows.size();
+		for(size_t i = 0; i < m_aside.size(); i++) {
+			const std::string& key = m_asideKeys[i];
+			if(m_store.IsLive(m_aside[i]) && ContainsAll(key.data(), key.size(), words))
+				rows.push_back(m_aside[i]);
+		}
+		std::inplace_merge(rows.begin() + first, rows.begin() + clean, rows.end());
+	}
+
+	size_t GetMemoryUsage()
+	{
+		CAutoLock lock(m_cs);
+		size_t size = m_keys.capacity() + (m_starts.capacity() + m_aside.capacity()) * sizeof(uint32_t) +
+			m_asideKeys.capacity() * sizeof(std::string);
+		for(size_t i = 0; i < m_asideKeys.size(); i++)
+			size += m_asideKeys[i].capacity();
+		return size;
+	}
+
+	TranslitSearchStats GetStats()
+	{
+		CAutoLock lock(m_cs);
+		return m_stats;
+	}
+
+	// implementation of IContactStoreObserver
+	virtual void OnContactChanged(uint32_t row, ContactChange change)
+	{
+		CAutoLock lock(m_cs);
+		if(m_bStale)
+			return;
+		switch(change) {
+		case ContactAdded:
+		case ContactUpdated:
+			{
+				CAutoLock storeLock(m_store.GetLock());
+				if(!m_store.IsLive(row))
+					break;
+				Blank(row);
+				std::vector<uint32_t>::iterator it = std::lower_bound(m_aside.begin(), m_aside.end(), row);
+				size_t index = it - m_aside.begin();
+				if(it == m_aside.end() || *it != row) {
+					m_aside.insert(it, row);
+					m_asideKeys.insert(m_asideKeys.begin() + index, std::string());
+				}
+				m_asideKeys[index].clear();
+				const std::wstring& text = m_store.GetField(row, m_field);
+				Fold(text.data(), text.size(), m_asideKeys[index]);
+				m_stats.folds++;
+				if(m_aside.size() >= MergeRows)
+					Merge();
+			}
+			break;
+		case ContactRemoved:
+			Blank(row);
+			break;
+		case ContactsRemoved:
+			break;              // dead rows are skipped
+		case ContactsCleared:
+			m_bStale = true;
+			break;
+		}
+	}
+	// implementation of IContactStoreObserver
+
+private:
+	CContactStore& m_store;
+	ContactField m_field;
+	CCritSec m_cs;
+	bool m_bStale;
+	std::string m_keys;                     // folded keys of all rows, back to back
+	std::vector<uint32_t> m_starts;         // per row its key's offset, and the end
+	std::vector<uint32_t> m_aside;          // rows edited since, ascending
+	std::vector<std::string> m_asideKeys;   // their current keys
+	uint32_t m_byteCounts[256];             // of m_keys
+	TranslitSearchStats m_stats;
+
+	struct CompareLength
+	{
+		bool operator()(const std::string& a, const std::string& b) const
+		{
+			return a.size() > b.size();
+		}
+	};
+
+	// "shch", "sch" and "sh" are "s", "ch" "c", "zh" "z", "kh" "h", "ts" and
+	// "tz" "c", "ck" "k", "ph" "f", "th" "t".
+	static void FoldWord(const std::string& word, std::string& key)
+	{
+		size_t start = key.size();
+		for(size_t i = 0; i < word.size(); ) {
+			char c = word[i];
+			char next = i + 1 < word.size() ? word[i + 1] : 0;
+			char single[2] = { c, 0 };
+			const char* pOut = single;
+			size_t length = 1;
+			if(c == 's' && next == 'c' && i + 2 < word.size() && word[i + 2] == 'h') {
+				length = 3;
+			}
+			else if(c == 's' && next == 'h' && word.compare(i, 4, "shch") == 0) {
+				length = 4;
+			}
+			else if(next == 'h' && (c == 's' || c == 'c' || c == 'z' || c == 'k' || c == 'p' || c == 't')) {
+				single[0] = c == 'k' ? 'h' : c == 'p' ? 'f' : c;
+				length = 2;
+			}
+			else if((c == 't' && (next == 's' || next == 'z')) || (c == 'c' && next == 'k')) {
+				single[0] = c == 't' ? 'c' : 'k';
+				length = 2;
+			}
+			else {
+				switch(c) {
+				case 'x': pOut = "ks"; break;
+				case 'w': single[0] = 'v'; break;
+				case 'q': single[0] = 'k'; break;
+				case 'y':
+				case 'j': single[0] = 'i'; break;
+				case 'g': single[0] = 'h'; break;
+				}
+			}
+			for(; *pOut != 0; pOut++) {
+				char letter = *pOut;
+				if(key.size() > start && key[key.size() - 1] == letter)
+					continue;       // doubled letters
+				if(letter == 'e' && key.size() > start && key[key.size() - 1] == 'i')
+					key.resize(key.size() - 1);
+				if(letter == 'e' && key.size() > start && key[key.size() - 1] == 'e')
+					continue;
+				key.push_back(letter);
+			}
+			i += length;
+		}
+	}
+
+	static bool ContainsAll(const char* pKey, size_t cch, const std::vector<std::string>& words)
+	{
+		const char* pEnd = pKey + cch;
+		for(size_t i = 0; i < words.size(); i++) {
+			if(std::search(pKey, pEnd, words[i].begin(), words[i].end()) == pEnd)
+				return false;
+		}
+		return true;
+	}
+
+	// the row's key in the buffer can no longer match
+	void Blank(uint32_t row)
+	{
+		if(row + 1 < m_starts.size())
+			memset(&m_keys[m_starts[row]], 0, m_starts[row + 1] - m_starts[row]);
+	}
+
+	void Build()
+	{
+		CTraceScope trace("index.translit", "index");
+		uint32_t count = (uint32_t)m_store.GetRowCount();
+		m_keys.clear();
+		m_starts.resize(count + 1);
+		for(uint32_t row = 0; row < count; row++) {
+			m_starts[row] = (uint32_t)m_keys.size();
+			if(m_store.IsLive(row)) {
+				const std::wstring& text = m_store.GetField(row, m_field);
+				Fold(text.data(), text.size(), m_keys);
+			}
+		}
+		m_starts[count] = (uint32_t)m_keys.size();
+		CountBytes();
+		m_aside.clear();
+		m_asideKeys.clear();
+		m_stats.rebuilds++;
+		m_bStale = false;
+	}
+
+	// The keys put aside into a new buffer, with dead rows dropped; under
+	// the store lock.
+	void Merge()
+	{
+		CTraceScope trace("index.translit.merge", "index");
+		uint32_t count = (uint32_t)m_store.GetRowCount();
+		std::string keys;
+		keys.reserve(m_keys.size());
+		std::vector<uint32_t> starts(count + 1);
+		size_t aside = 0;
+		for(uint32_t row = 0; row < count; row++) {
+			starts[row] = (uint32_t)keys.size();
+			if(aside < m_aside.size() && m_aside[aside] == row) {
+				if(m_store.IsLive(row))
+					keys += m_asideKeys[aside];
+				aside++;
+			}
+			else if(row + 1 < m_starts.size() && m_store.IsLive(row)) {
+				keys.append(m_keys, m_starts[row], m_starts[row + 1] - m_starts[row]);
+			}
+		}
+		starts[count] = (uint32_t)keys.size();
+		m_keys.swap(keys);
+		m_starts.swap(starts);
+		CountBytes();
+		m_stats.merges += m_aside.size();
+		m_aside.clear();
+		m_asideKeys.clear();
+	}
+
+	void CountBytes()
+	{
+		memset(m_byteCounts, 0, sizeof(m_byteCounts));
+		for(size_t i = 0; i < m_keys.size(); i++)
+			m_byteCounts[(uint8_t)m_keys[i]]++;
+	}
+
+	CTranslitIndex(const CTranslitIndex&);
+	CTranslitIndex& operator=(const CTranslitIndex&);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// CTranslitCursor - the rows of a transliterated search as a result cursor
+
+class CTranslitCursor : public IResultCursor
+{
+public:
+	enum { FetchRows = 4096 };
+
+	CTranslitCursor(CTranslitIndex& index, const std::wstring& text) :
+		m_index(index), m_text(text), m_bSearched(false), m_next(0)
+	{
+	}
+
+	// the search runs on the first call, the rows come a batch at a time
+	virtual bool Fetch(std::vector<uint32_t>& rows)
+	{
+		if(!m_bSearched) {
+			m_index.Search(m_text, m_rows);
+			m_bSearched = true;
+		}
+		size_t end = m_rows.size() - m_next > FetchRows ? m_next + FetchRows : m_rows.size();
+		rows.insert(rows.end(), m_rows.begin() + m_next, m_rows.begin() + end);
+		m_next = end;
+		return m_next < m_rows.size();
+	}
+
+private:
+	CTranslitIndex& m_index;
+	std::wstring m_text;
+	bool m_bSearched;
+	std::vector<uint32_t> m_rows;
+	size_t m_next;
+
+	CTranslitCursor(const CTranslitCursor&);
+	CTranslitCursor& operator=(const CTranslitCursor&);
+};
+
+}; // namespace Synrc
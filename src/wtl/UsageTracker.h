@@ -0,0 +1,355 @@
+// UsageTracker.h
+//
+//  How much each contact is used - written to, called, picked - for the
+//  "Frequent" group at the top of the list and as the usage that breaks
+//  ties in search ranking. Counts decay by half every couple of weeks, as
+//  in CFrecency, and are kept as one float per store row: the log of the
+//  count at a fixed time, which a use only ever raises. So the order of two
+//  contacts never changes without a use of one of them, and the most used
+//  ones can be kept in a short sorted list that a use updates in O(k) and
+//  reading the top k copies.
+//
+//  The counts are saved by contact id, only those of used contacts, in a
+//  file written aside and swapped in; SaveIfDue() does it at most once a
+//  minute when something changed.
+//
+//  Threading: one lock, held briefly; the store's is taken inside it.
+
+#pragma once
+
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Platform.h"
+#include "AutoComplete.h"
+#include "BinaryStream.h"
+#include "ContactStore.h"
+#include "EventTrace.h"
+#include "SearchRanking.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CUsageTracker - decayed use counts per contact and the most used ones
+
+namespace Synrc
+{
+
+struct UsageTrackerStats
+{
+	uint64_t uses;
+	uint64_t topChanges;        // uses that changed the most used list
+	uint64_t rescans;           // the list made again from all rows
+	uint64_t saves;
+
+	UsageTrackerStats() : uses(0), topChanges(0), rescans(0), saves(0)
+	{
+	}
+};
+
+class CUsageTracker : public IUsageCounts, public IContactStoreObserver
+{
+public:
+	enum
+	{
+		TopCapacity = 64,           // most used contacts kept in order
+		CountScale = 16,            // GetUsageCount() units per use
+		DefaultSaveMs = 60000
+	};
+
+	enum
+	{
+		FileMagic = 0x53555953,     // "SYUS"
+		FileVersion = 1
+	};
+
+	explicit CUsageTracker(CContactStore& store) :
+		m_store(store), m_latest(0), m_version(0), m_bDirty(false), m_savedMs(GetTimeMs())
+	{
+		m_store.AddObserver(this);
+	}
+
+	~CUsageTracker()
+	{
+		m_store.RemoveObserver(this);
+	}
+
+	// The contact was used at time, seconds since 1970.
+	void RecordUse(uint32_t row, uint32_t time = CFrecency::GetNow())
+	{
+		CAutoLock lock(m_cs);
+		EnsureRow(row);
+		m_scores[row] = CFrecency::AddUse(m_scores[row], time);
+		if(time > m_latest)
+			m_latest = time;
+		m_bDirty = true;
+		m_stats.uses++;
+		if(Raise(row)) {
+			m_version++;
+			m_stats.topChanges++;
+		}
+	}
+
+	// Up to count of the most used contacts, most used first; count is at
+	// most TopCapacity. Contacts never used are not listed.
+	void GetTop(size_t count, std::vector<uint32_t>& rows)
+	{
+		CAutoLock lock(m_cs);
+		if(count > m_top.size())
+			count = m_top.size();
+		rows.assign(m_top.begin(), m_top.begin() + count);
+	}
+
+	// changes whenever GetTop() would return something else
+	uint32_t GetTopVersion()
+	{
+		CAutoLock lock(m_cs);
+		return m_version;
+	}
+
+	// decayed uses at time
+	double GetCount(uint32_t row, uint32_t time)
+	{
+		CAutoLock lock(m_cs);
+		return row < m_scores.size() ? CFrecency::GetCount(m_scores[row], time) : 0.0;
+	}
+
+	// implementation of IUsageCounts
+	virtual uint32_t GetUsageCount(uint32_t row) const
+	{
+		CAutoLock lock(m_cs);
+		if(row >= m_scores.size())
+			return 0;
+		// decayed to the latest use, so it moves only when something is used
+		double count = CFrecency::GetCount(m_scores[row], m_latest) * CountScale;
+		return count < 0xFFFFFFFF ? (uint32_t)count : 0xFFFFFFFF;
+	}
+	// implementation of IUsageCounts
+
+	// Writes the counts of the used contacts to path, through a file
+	// beside it; false when it could not.
+	bool Save(const std::string& path)
+	{
+		CTraceScope trace("usage.save", "save");
+		std::string data;
+		CByteWriter writer(data);
+		writer.PutU32(FileMagic);
+		writer.PutU32(FileVersion);
+		{
+			CAutoLock lock(m_cs);
+			CAutoLock storeLock(m_store.GetLock());
+			writer.PutU32(m_latest);
+			size_t countAt = data.size();
+			writer.PutU32(0);
+			uint32_t count = 0;
+			for(uint32_t row = 0; row < m_scores.size(); row++) {
+				if(m_scores[row] == CFrecency::GetNone() || !m_store.IsLive(row))
+					continue;
+				writer.PutWString(m_store.GetId(row));
+				uint32_t bits;
+				memcpy(&bits, &m_scores[row], sizeof(bits));
+				writer.PutU32(bits);
+				count++;
+			}
+			std::string countBytes;
+			CByteWriter(countBytes).PutU32(count);
+			data.replace(countAt, countBytes.size(), countBytes);
+			m_bDirty = false;
+			m_savedMs = GetTimeMs();
+		}
+		writer.PutU32(Crc32(data.data(), data.size()));
+
+		std::string tmpPath = path + ".tmp";
+		CNativeFile file;
+		bool bOk = file.Open(tmpPath, CNativeFile::OpenCreate) && file.Write(data.data(), data.size()) && file.Sync();
+		file.Close();
+		bOk = bOk && CNativeFile::Replace(tmpPath, path);
+		CAutoLock lock(m_cs);
+		if(bOk)
+			m_stats.saves++;
+		else
+			m_bDirty = true;    // the next call tries again
+		return bOk;
+	}
+
+	// Saves when something changed and the last save is intervalMs old.
+	bool SaveIfDue(const std::string& path, uint32_t intervalMs = DefaultSaveMs)
+	{
+		{
+			CAutoLock lock(m_cs);
+			if(!m_bDirty || GetTimeMs() - m_savedMs < intervalMs)
+				return true;
+		}
+		return Save(path);
+	}
+
+	// Replaces the counts with those saved at path, for the contacts the
+	// store has; false for a missing or damaged file, counts left alone.
+	bool Load(const std::string& path)
+	{
+		CTraceScope trace("usage.load", "load");
+		CNativeFile file;
+		std::string data;
+		if(!file.Open(path, CNativeFile::OpenRead) || !file.ReadAll(data) || data.size() < 4)
+			return false;
+		CByteReader tail(data.data() + data.size() - 4, 4);
+		if(Crc32(data.data(), data.size() - 4) != tail.GetU32())
+			return false;
+		CByteReader reader(data.data(), data.size() - 4);
+		if(reader.GetU32() != FileMagic || reader.GetU32() != FileVersion)
+			return false;
+
+		CAutoLock lock(m_cs);
+		CAutoLock storeLock(m_store.GetLock());
+		m_scores.assign(m_store.GetRowCount(), CFrecency::GetNone());
+		m_latest = reader.GetU32();
+		std::wstring id;
+		for(uint32_t count = reader.GetU32(); count > 0 && reader.GetWString(id); count--) {
+			uint32_t bits = reader.GetU32();
+			uint32_t row = m_store.FindRow(id);
+			if(row != CContactStore::NoRow)
+				memcpy(&m_scores[row], &bits, sizeof(bits));
+		}
+		Rescan();
+		m_bDirty = false;
+		return true;
+	}
+
+	size_t GetMemoryUsage()
+	{
+		CAutoLock lock(m_cs);
+		return m_scores.capacity() * sizeof(float) + m_top.capacity() * sizeof(uint32_t);
+	}
+
+	UsageTrackerStats GetStats()
+	{
+		CAutoLock lock(m_cs);
+		return m_stats;
+	}
+
+	// implementation of IContactStoreObserver
+	virtual void OnContactChanged(uint32_t row, ContactChange change)
+	{
+		CAutoLock lock(m_cs);
+		switch(change) {
+		case ContactAdded:
+		case ContactRemoved:
+			// a removed contact's uses go with it; rows are not handed out
+			// again before ContactsCleared, so an added one has none
+			EnsureRow(row);
+			if(m_scores[row] == CFrecency::GetNone())
+				break;
+			m_scores[row] = CFrecency::GetNone();
+			m_bDirty = true;
+			if(std::find(m_top.begin(), m_top.end(), row) != m_top.end())
+				Rescan();
+			break;
+		case ContactUpdated:
+			break;
+		case ContactsRemoved:
+			{
+				CAutoLock storeLock(m_store.GetLock());
+				for(uint32_t i = 0; i < m_scores.size(); i++) {
+					if(m_scores[i] != CFrecency::GetNone() && !m_store.IsLive(i))
+						m_scores[i] = CFrecency::GetNone();
+				}
+			}
+			m_bDirty = true;
+			Rescan();
+			break;
+		case ContactsCleared:
+			m_scores.assign(m_scores.size(), CFrecency::GetNone());
+			m_bDirty = true;
+			Rescan();
+			break;
+		}
+	}
+	// implementation of IContactStoreObserver
+
+private:
+	CContactStore& m_store;
+	mutable CCritSec m_cs;
+	std::vector<float> m_scores;        // per row, CFrecency::GetNone() if never used
+	std::vector<uint32_t> m_top;        // the most used rows, most used first
+	uint32_t m_latest;                  // time of the latest use
+	uint32_t m_version;
+	bool m_bDirty;
+	uint32_t m_savedMs;
+	UsageTrackerStats m_stats;
+
+	// ranks rows: higher score, then lower row
+	bool IsBetter(uint32_t a, uint32_t b) const
+	{
+		return m_scores[a] > m_scores[b] || (m_scores[a] == m_scores[b] && a < b);
+	}
+
+	struct BetterRow
+	{
+		const CUsageTracker& tracker;
+
+		explicit BetterRow(const CUsageTracker& t) : tracker(t)
+		{
+		}
+
+		bool operator()(uint32_t a, uint32_t b) const
+		{
+			return tracker.IsBetter(a, b);
+		}
+
+	private:
+		BetterRow& operator=(const BetterRow&);
+	};
+
+	void EnsureRow(uint32_t row)
+	{
+		if(row >= m_scores.size())
+			m_scores.resize(row + 1, CFrecency::GetNone());
+	}
+
+	// The row's score went up: moves it up the list, or in when it now
+	// beats the last one. True when the list changed.
+	bool Raise(uint32_t row)
+	{
+		size_t i = std::find(m_top.begin(), m_top.end(), row) - m_top.begin();
+		bool bChanged = false;
+		if(i == m_top.size()) {
+			if(m_top.size() < TopCapacity)
+				m_top.push_back(row);
+			else if(IsBetter(row, m_top.back()))
+				m_top.back() = row;
+			else
+				return false;
+			i = m_top.size() - 1;
+			bChanged = true;
+		}
+		for(; i > 0 && IsBetter(m_top[i], m_top[i - 1]); i--) {
+			std::swap(m_top[i], m_top[i - 1]);
+			bChanged = true;
+		}
+		return bChanged;
+	}
+
+	// after a score went down: the list from every row, O(rows)
+	void Rescan()
+	{
+		CTraceScope trace("usage.rescan", "index");
+		std::vector<uint32_t> used;
+		for(uint32_t row = 0; row < m_scores.size(); row++) {
+			if(m_scores[row] != CFrecency::GetNone())
+				used.push_back(row);
+		}
+		size_t keep = used.size() < TopCapacity ? used.size() : (size_t)TopCapacity;
+		std::partial_sort(used.begin(), used.begin() + keep, used.end(), BetterRow(*this));
+		m_top.assign(used.begin(), used.begin() + keep);
+		m_version++;
+		m_stats.rescans++;
+	}
+
+	CUsageTracker(const CUsageTracker&);
+	CUsageTracker& operator=(const CUsageTracker&);
+};
+
+}; // namespace Synrc
@@ -2,6 +2,14 @@
 
 
 #include "IListView.h"
+#include "IListViewFooter.h"
+#include "DateIndex.h"
+#include "EventTrace.h"
+#include "FindService.h"
+#include "Latency.h"
+#include "ListDataSource.h"
+#include "Selection.h"
+#include "UsageTracker.h"
 
 
 // {A08A0F2D-0647-4443-9450-C460F4791046}
@@ -13,13 +21,187 @@ class CGroupedVirtualModeView :
 	public CComCoClass<CGroupedVirtualModeView, &CLSID_CGroupedVirtualModeView>,
 	public CWindowImpl<CGroupedVirtualModeView, CListViewCtrl>,
 	public CCustomDraw<CGroupedVirtualModeView>, //   WM_NOTIFY, NM_CUSTOMDRAW
-	public IOwnerDataCallback
+	public IOwnerDataCallback,
+	public IListViewFooterCallback,
+	public Synrc::IProgressiveResultsObserver,
+	public Synrc::IListHost
 {
 #define ITEMCOUNT 9
 #define ITEMSPERGROUP 3
 
 public:
 	DECLARE_WND_SUPERCLASS(NULL, CListViewCtrl::GetWndClassName())
+
+	enum { WM_RESULTSAVAILABLE = WM_APP + 1 };
+	enum { REMAP_SELECTION_ROWS = 4096 };  // bigger selections are dropped when grouped items move
+
+	// slots of the groups pinned above the others, in display order
+	enum
+	{
+		PinnedFrequent,
+		PinnedUpcoming
+	};
+
+	// handlers timed into the default latency registry
+	enum
+	{
+		LatencyGetDispInfo,
+		LatencyPrePaint,
+		LatencyItemPrePaint,
+		LatencySubItemPrePaint,
+		LatencySize,
+		LatencyResults,
+		LatencyCount
+	};
+
+	CGroupedVirtualModeView() : m_pFind(NULL), m_pResults(NULL), m_bFooter(false), m_bPainted(false), m_pUsage(NULL),
+		m_usageVersion(0), m_frequentCount(0), m_pUpcoming(NULL), m_selectionLayout(0), m_bRemapping(false)
+	{
+		m_source.SetHost(this);
+		static const char* const s_latencyNames[LatencyCount] =
+		{
+			"list.getdispinfo", "list.prepaint", "list.itemprepaint", "list.subitemprepaint",
+			"list.size", "list.results"
+		};
+		for(int i = 0; i < LatencyCount; i++)
+			m_pLatency[i] = Synrc::CLatencyRegistry::GetDefault().Get(s_latencyNames[i]);
+	}
+
+	// answers type-to-jump; its matches are mapped to the items shown
+	void SetFindService(Synrc::CFindService* pFind)
+	{
+		m_pFind = pFind;
+	}
+
+	// Shows a progressive result set: the item count follows its visible
+	// rows and the footer offers the rest. NULL detaches.
+	void SetResults(Synrc::CProgressiveResults* pResults)
+	{
+		ResetSelection();
+		if(m_pResults != NULL)
+			m_pResults->SetObserver(NULL);
+		m_pResults = pResults;
+		m_source.SetResults(pResults);
+		if(m_pResults != NULL) {
+			m_pResults->SetObserver(this);
+			m_pResults->Poll();
+		}
+		UpdateResults();
+	}
+
+	// Item text comes from the pool for rows of the group model or result
+	// set, whichever is attached; a copy per item, nothing formatted.
+	void SetDisplayStrings(Synrc::CDisplayStringPool* pStrings, Synrc::DisplayString text = Synrc::DisplayName)
+	{
+		m_source.SetDisplayStrings(pStrings, text);
+		Invalidate();
+	}
+
+	// records the data callbacks and type-to-jump for replay; NULL stops
+	void SetTraceRecorder(Synrc::CListTraceRecorder* pTrace)
+	{
+		m_source.SetTraceRecorder(pTrace);
+	}
+
+	// store row shown at an item, NoRow when the list is not data backed
+	uint32_t GetItemRow(int item) const
+	{
+		return item < 0 ? (uint32_t)Synrc::CContactStore::NoRow : m_source.GetItemRow((uint32_t)item);
+	}
+
+	// Groups the list by a model instead of the demo groups. Headers are
+	// created as groups scroll into view; call RefreshGroups() after edits.
+	void SetGroupModel(Synrc::CGroupModel* pGroups)
+	{
+		ResetSelection();
+		RemoveAllGroups();
+		m_source.SetGroupModel(pGroups);
+		// in group view items outside any group are not shown
+		EnableGroupView(pGroups != NULL);
+		RefreshGroups();
+	}
+
+	// Pins the count most used contacts of the tracker in a "Frequent" group
+	// above the others, kept current by RefreshGroups(); NULL removes it.
+	void SetFrequentContacts(Synrc::CUsageTracker* pUsage, uint32_t count = 10)
+	{
+		m_pUsage = pUsage;
+		m_frequentCount = count;
+		Synrc::CGroupModel* pGroups = m_source.GetGroupModel();
+		if(pGroups == NULL)
+			return;
+		if(pUsage == NULL)
+			pGroups->SetPinnedRows(PinnedFrequent, std::wstring(), std::vector<uint32_t>());
+		else
+			m_usageVersion = pUsage->GetTopVersion() - 1;
+		RefreshGroups();
+		Invalidate();
+	}
+
+	// Shows the contacts with a birthday or anniversary soon in a group
+	// under "Frequent"; made over the attached group model with the slot
+	// PinnedUpcoming. NULL removes it.
+	void SetUpcomingGroup(Synrc::CUpcomingGroup* pUpcoming)
+	{
+		if(m_pUpcoming != NULL && m_pUpcoming != pUpcoming)
+			m_pUpcoming->Hide();
+		m_pUpcoming = pUpcoming;
+		RefreshGroups();
+		Invalidate();
+	}
+
+	void RefreshGroups()
+	{
+		Synrc::CGroupModel* pGroups = m_source.GetGroupModel();
+		if(pGroups == NULL)
+			return;
+		if(m_pUsage != NULL && m_pUsage->GetTopVersion() != m_usageVersion) {
+			// a use that reorders the most used is rare; others cost a lock
+			m_usageVersion = m_pUsage->GetTopVersion();
+			std::vector<uint32_t> rows;
+			m_pUsage->GetTop(m_frequentCount, rows);
+			pGroups->SetPinnedRows(PinnedFrequent, L"Frequent", rows);
+			Invalidate();
+		}
+		// follows date edits and the day turning over
+		if(m_pUpcoming != NULL && &m_pUpcoming->GetGroupModel() == pGroups && m_pUpcoming->Update())
+			Invalidate();
+		int top = GetTopIndex();
+		m_source.CacheHint(top < 0 ? 0 : (uint32_t)top, (uint32_t)(top + GetCountPerPage()));
+		RemapSelection();
+	}
+
+	// collapse or expand by group position; only the item mapping changes
+	void SetGroupCollapsed(uint32_t position, bool bCollapsed)
+	{
+		Synrc::CGroupModel* pGroups = m_source.GetGroupModel();
+		if(pGroups == NULL || position >= pGroups->GetGroupCount())
+			return;
+		pGroups->SetCollapsed(position, bCollapsed);
+		if(pGroups->HasHeader(position)) {
+			LVGROUP group = {0};
+			group.cbSize = RunTimeHelper::SizeOf_LVGROUP();
+			group.mask = LVGF_STATE;
+			group.stateMask = LVGS_COLLAPSED;
+			group.state = bCollapsed ? LVGS_COLLAPSED : 0;
+			SetGroupInfo(pGroups->GetGroupId(position) + 1, &group);
+		}
+		RefreshGroups();
+	}
+
+	// mirrors the control's selection, by list position; when grouped items
+	// move the selected contacts are selected where they went, other
+	// changes of what the positions mean clear it
+	const Synrc::CSelectionSet& GetSelection() const
+	{
+		return m_selection;
+	}
+
+	// store rows of the selected items, in list order
+	void GetSelectedRows(std::vector<uint32_t>& rows)
+	{
+		m_source.GetSelectedRows(m_selection, rows);
+	}
 /*
 	BOOL PreTranslateMessage(MSG* pMsg)
 	{
@@ -29,11 +211,17 @@ public:
 */
 	BEGIN_COM_MAP(CGroupedVirtualModeView)
 		COM_INTERFACE_ENTRY_IID(IID_IOwnerDataCallback, IOwnerDataCallback)
+		COM_INTERFACE_ENTRY_IID(IID_IListViewFooterCallback, IListViewFooterCallback)
 	END_COM_MAP()
 
 	BEGIN_MSG_MAP(CGroupedVirtualModeView)
 		REFLECTED_NOTIFY_CODE_HANDLER(LVN_GETDISPINFO, OnGetDispInfo)
+		REFLECTED_NOTIFY_CODE_HANDLER(LVN_ODFINDITEM, OnFindItem)
+		REFLECTED_NOTIFY_CODE_HANDLER(LVN_ITEMCHANGED, OnItemChanged)
+		REFLECTED_NOTIFY_CODE_HANDLER(LVN_ITEMACTIVATE, OnItemActivate)
+		REFLECTED_NOTIFY_CODE_HANDLER(LVN_ODSTATECHANGED, OnStateChanged)
 		MESSAGE_HANDLER(WM_CREATE, OnCreate)
+		MESSAGE_HANDLER(WM_RESULTSAVAILABLE, OnResultsAvailableMessage)
 		MESSAGE_HANDLER(WM_SIZE, OnSize)
 		MESSAGE_HANDLER(WM_NCCALCSIZE, OnNonClientCalcSize)
 		CHAIN_MSG_MAP_ALT(CCustomDraw<CGroupedVirtualModeView>, 1)
@@ -48,6 +236,7 @@ public:
 
 	LRESULT OnSize(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& /* bHandle */)
 	{
+		Synrc::CLatencyScope latency(m_pLatency[LatencySize]);
 		CRect rect;
 		GetClientRect(&rect);
 		SetColumnWidth(0, rect.Width());
@@ -62,12 +251,18 @@ public:
 
 	DWORD OnPrePaint(int idCtrl, LPNMCUSTOMDRAW nmdc)
 	{
+		Synrc::CLatencyScope latency(m_pLatency[LatencyPrePaint]);
+		if(!m_bPainted) {
+			m_bPainted = true;
+			Synrc::TraceInstant("list.firstpaint", "paint");
+		}
 		//   NM_CUSTOMDRAW    .
 		return CDRF_NOTIFYITEMDRAW;
 	}
 
 	DWORD OnItemPrePaint(int idCtrl, LPNMCUSTOMDRAW nmdc)
 	{
+		Synrc::CLatencyScope latency(m_pLatency[LatencyItemPrePaint]);
 		return CDRF_NOTIFYSUBITEMDRAW;
 	}
 
@@ -99,6 +294,7 @@ public:
 
 	DWORD OnSubItemPrePaint (int /*idCtrl*/, LPNMCUSTOMDRAW nmcd)
 	{
+		Synrc::CLatencyScope latency(m_pLatency[LatencySubItemPrePaint]);
 		NMLVCUSTOMDRAW* lvcd = reinterpret_cast<NMLVCUSTOMDRAW*>(nmcd);
 		long row=nmcd->dwItemSpec;
 		
@@ -121,20 +317,63 @@ public:
     		//FillRect(nmcd->hdc, &iconRect,(HBRUSH)(COLOR_WINDOW));
     	//Invalidate();
 		rect.OffsetRect(70,4);
-		DrawText(nmcd->hdc, ss1, wcslen(ss1), rect, 
-			DT_END_ELLIPSIS | DT_TOP);
-
-		rect.OffsetRect(0,17);
-		DrawText(nmcd->hdc, ss2, wcslen(ss2), rect, 
-			DT_END_ELLIPSIS | DT_TOP | DT_SINGLELINE);
 
-		rect.OffsetRect(0,17);
-		DrawText(nmcd->hdc, ss3, wcslen(ss3), rect, 
-			DT_END_ELLIPSIS | DT_TOP | DT_SINGLELINE);
+		// name, email and phone of the contact, search hits highlighted
+		// from the spans the result set keeps; the sample lines otherwise
+		static const Synrc::DisplayString s_strings[Synrc::HighlightTextCount] =
+			{ Synrc::DisplayName, Synrc::DisplayEmail, Synrc::DisplayPhone };
+		LPCWSTR samples[Synrc::HighlightTextCount] = { ss1, ss2, ss3 };
+		for(int text = 0; text < Synrc::HighlightTextCount; text++) {
+			if(text > 0)
+				rect.OffsetRect(0,17);
+			UINT format = text > 0 ? DT_END_ELLIPSIS | DT_TOP | DT_SINGLELINE : DT_END_ELLIPSIS | DT_TOP;
+			const wchar_t* pText = NULL;
+			uint32_t cch = 0;
+			if(!m_source.GetItemText((uint32_t)row, s_strings[text], pText, cch)) {
+				DrawText(nmcd->hdc, samples[text], wcslen(samples[text]), rect, format);
+				continue;
+			}
+			uint32_t count = 0;
+			const Synrc::MatchSpan* pSpans = m_source.GetItemSpans((uint32_t)row, (Synrc::HighlightText)text, count);
+			DrawHighlighted(nmcd->hdc, pText, cch, pSpans, count, rect, format);
+		}
 
 		return CDRF_SKIPDEFAULT;
 	}
 
+	// Draws the text, then paints the spans over it in the selection
+	// colours; spans past what fits are clipped at the right edge.
+	void DrawHighlighted(HDC hdc, const wchar_t* pText, uint32_t cch, const Synrc::MatchSpan* pSpans, uint32_t count,
+		const CRect& rect, UINT format)
+	{
+		CRect textRect(rect);
+		DrawText(hdc, pText, (int)cch, textRect, format);
+		if(count == 0)
+			return;
+		COLORREF oldText = ::SetTextColor(hdc, GetSysColor(COLOR_HIGHLIGHTTEXT));
+		COLORREF oldBack = ::SetBkColor(hdc, GetSysColor(COLOR_HIGHLIGHT));
+		for(uint32_t i = 0; i < count; i++) {
+			uint32_t start = pSpans[i].start;
+			uint32_t length = pSpans[i].length;
+			if(start >= cch)
+				break;
+			if(length > cch - start)
+				length = cch - start;
+			SIZE before = { 0, 0 };
+			SIZE span = { 0, 0 };
+			GetTextExtentPoint32W(hdc, pText, (int)start, &before);
+			GetTextExtentPoint32W(hdc, pText + start, (int)length, &span);
+			CRect spanRect(rect.left + before.cx, rect.top, rect.left + before.cx + span.cx, rect.top + span.cy);
+			if(spanRect.left >= rect.right)
+				break;
+			if(spanRect.right > rect.right)
+				spanRect.right = rect.right;
+			ExtTextOutW(hdc, spanRect.left, spanRect.top, ETO_OPAQUE | ETO_CLIPPED, spanRect, pText + start, length, NULL);
+		}
+		::SetBkColor(hdc, oldBack);
+		::SetTextColor(hdc, oldText);
+	}
+
 	// implementation of IOwnerDataCallback
 	virtual STDMETHODIMP GetItemPosition(int itemIndex, LPPOINT pPosition)
 	{
@@ -148,6 +387,11 @@ public:
 
 	virtual STDMETHODIMP GetItemInGroup(int groupIndex, int groupWideItemIndex, PINT pTotalItemIndex)
 	{
+		uint32_t item = 0;
+		if(m_source.GetItemInGroup((uint32_t)groupIndex, (uint32_t)groupWideItemIndex, item)) {
+			*pTotalItemIndex = (int)item;
+			return S_OK;
+		}
 		// we want group 0 to contain items 0, 3, 6...
 		//         group 1            items 1, 4, 7...
 		//         group 2            items 2, 5, 8...
@@ -157,6 +401,13 @@ public:
 
 	virtual STDMETHODIMP GetItemGroup(int itemIndex, int occurenceIndex, PINT pGroupIndex)
 	{
+		if(m_source.GetGroupModel() != NULL) {
+			uint32_t headerIndex = 0;
+			if(!m_source.GetItemGroup((uint32_t)itemIndex, headerIndex))
+				return E_INVALIDARG;
+			*pGroupIndex = (int)headerIndex;
+			return S_OK;
+		}
 		// group 0 contains items 0, 3, 6...
 		// group 1 contains items 1, 4, 7...
 		// group 2 contains items 2, 5, 8...
@@ -173,12 +424,80 @@ public:
 
 	virtual STDMETHODIMP OnCacheHint(LVITEMINDEX firstItem, LVITEMINDEX lastItem)
 	{
-		return E_NOTIMPL;
+		if(m_source.GetGroupModel() == NULL)
+			return E_NOTIMPL;
+		m_source.CacheHint((uint32_t)firstItem.iItem, (uint32_t)lastItem.iItem);
+		return S_OK;
 	}
 	// implementation of IOwnerDataCallback
 
+	// implementation of IListViewFooterCallback
+	virtual STDMETHODIMP OnButtonClicked(int /*itemIndex*/, LPARAM /*lParam*/, PINT pRemoveFooter)
+	{
+		if(m_pResults != NULL)
+			m_pResults->LoadAll();
+		m_bFooter = false;
+		*pRemoveFooter = TRUE;
+		UpdateResults();
+		return S_OK;
+	}
+
+	virtual STDMETHODIMP OnDestroyButton(int /*itemIndex*/, LPARAM /*lParam*/)
+	{
+		return S_OK;
+	}
+	// implementation of IListViewFooterCallback
+
+	// pool thread: hand over to the window's thread
+	virtual void OnResultsAvailable()
+	{
+		PostMessage(WM_RESULTSAVAILABLE);
+	}
+
+	LRESULT OnResultsAvailableMessage(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /*bHandled*/)
+	{
+		Synrc::CLatencyScope latency(m_pLatency[LatencyResults]);
+		if(m_pResults != NULL && m_pResults->Poll())
+			UpdateResults();
+		return 0;
+	}
+
+	// grows the item count in place and keeps the footer's "N more" current
+	void UpdateResults()
+	{
+		m_source.UpdateItemCount();
+
+		IListViewFooter* pFooter = NULL;
+		SendMessage(LVM_QUERYINTERFACE, reinterpret_cast<WPARAM>(&IID_IListViewFooter), reinterpret_cast<LPARAM>(&pFooter));
+		if(!pFooter)
+			return;
+		uint32_t more = m_pResults != NULL ? m_pResults->GetMoreCount() : 0;
+		if(more > 0) {
+			WCHAR szText[64];
+			StringCchPrintfW(szText, _countof(szText), m_pResults->IsComplete() ? L"%u more" : L"%u more so far", more);
+			pFooter->SetIntroText(szText);
+			if(!m_bFooter) {
+				IListViewFooterCallback* pCallback = NULL;
+				QueryInterface(IID_IListViewFooterCallback, reinterpret_cast<LPVOID*>(&pCallback));
+				pFooter->RemoveAllButtons();
+				pFooter->InsertButton(0, L"Load all", NULL, 0, 0);
+				pFooter->Show(pCallback);
+				if(pCallback)
+					pCallback->Release();
+				m_bFooter = true;
+			}
+		}
+		else if(m_bFooter) {
+			pFooter->RemoveAllButtons();
+			pFooter->SetIntroText(L"");
+			m_bFooter = false;
+		}
+		pFooter->Release();
+	}
+
 	LRESULT OnCreate(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& /*bHandled*/)
 	{
+		Synrc::CTraceScope trace("list.OnCreate", "startup");
 		LRESULT lr = DefWindowProc(uMsg, wParam, lParam);
 
 		InsertColumn(0, _T("Item Name"), LVCFMT_LEFT, 300);
@@ -221,10 +540,15 @@ public:
 
 	LRESULT OnGetDispInfo(int /*idCtrl*/, LPNMHDR pnmh, BOOL& /*bHandled*/)
 	{
+		Synrc::CLatencyScope latency(m_pLatency[LatencyGetDispInfo]);
 		NMLVDISPINFO* pDetails = reinterpret_cast<NMLVDISPINFO*>(pnmh);
 		if(pDetails->item.mask & LVIF_TEXT) {
-			StringCchPrintf(pDetails->item.pszText, 
-				pDetails->item.cchTextMax, _T("Item %i"), pDetails->item.iItem + 1);
+			bool bPooled = pDetails->item.iItem >= 0 &&
+				m_source.GetText((uint32_t)pDetails->item.iItem, pDetails->item.pszText, pDetails->item.cchTextMax);
+			if(!bPooled) {
+				StringCchPrintf(pDetails->item.pszText, 
+					pDetails->item.cchTextMax, _T("Item %i"), pDetails->item.iItem + 1);
+			}
 		}
 		if(pDetails->item.mask & LVIF_IMAGE) {
 			pDetails->item.iImage = pDetails->item.iItem % 3;
@@ -232,6 +556,154 @@ public:
 		return 0;
 	}
 
+	// Owner-data lists ask for every incremental search keystroke; the
+	// find service binary-searches the sorted keys for the matching rows and
+	// the source finds the first of them in the order the items are shown.
+	LRESULT OnFindItem(int /*idCtrl*/, LPNMHDR pnmh, BOOL& /*bHandled*/)
+	{
+		NMLVFINDITEM* pFindItem = reinterpret_cast<NMLVFINDITEM*>(pnmh);
+		const LVFINDINFO& info = pFindItem->lvfi;
+		if(m_pFind == NULL || !(info.flags & (LVFI_STRING | LVFI_PARTIAL)) || info.psz == NULL)
+			return -1;
+
+		uint32_t flags = 0;
+		if(info.flags & LVFI_PARTIAL)
+			flags |= Synrc::CFindService::FindPartial;
+		if(info.flags & LVFI_WRAP)
+			flags |= Synrc::CFindService::FindWrap;
+		uint32_t start = pFindItem->iStart > 0 ? (uint32_t)pFindItem->iStart : 0;
+		uint32_t item = m_source.FindItem(*m_pFind, info.psz, wcslen(info.psz), start, flags);
+		return item == Synrc::CListDataSource::NoItem ? -1 : (LRESULT)item;
+	}
+
+	// Single items and select-all (iItem == -1) arrive here, shift ranges
+	// through LVN_ODSTATECHANGED; both update the run set, never per item.
+	LRESULT OnItemChanged(int /*idCtrl*/, LPNMHDR pnmh, BOOL& /*bHandled*/)
+	{
+		NMLISTVIEW* pChange = reinterpret_cast<NMLISTVIEW*>(pnmh);
+		if(!(pChange->uChanged & LVIF_STATE) || !((pChange->uNewState ^ pChange->uOldState) & LVIS_SELECTED))
+			return 0;
+		uint32_t first = pChange->iItem < 0 ? 0 : (uint32_t)pChange->iItem;
+		uint32_t end = pChange->iItem < 0 ? (uint32_t)GetItemCount() : first + 1;
+		UpdateSelection(first, end, (pChange->uNewState & LVIS_SELECTED) != 0);
+		return 0;
+	}
+
+	// opening a contact is a use of it, see SetFrequentContacts()
+	LRESULT OnItemActivate(int /*idCtrl*/, LPNMHDR pnmh, BOOL& bHandled)
+	{
+		NMITEMACTIVATE* pActivate = reinterpret_cast<NMITEMACTIVATE*>(pnmh);
+		uint32_t row = GetItemRow(pActivate->iItem);
+		if(m_pUsage != NULL && row != Synrc::CContactStore::NoRow) {
+			m_pUsage->RecordUse(row);
+			RefreshGroups();
+		}
+		bHandled = FALSE;
+		return 0;
+	}
+
+	LRESULT OnStateChanged(int /*idCtrl*/, LPNMHDR pnmh, BOOL& /*bHandled*/)
+	{
+		NMLVODSTATECHANGE* pChange = reinterpret_cast<NMLVODSTATECHANGE*>(pnmh);
+		if(((pChange->uNewState ^ pChange->uOldState) & LVIS_SELECTED) && pChange->iFrom >= 0 && pChange->iTo >= pChange->iFrom)
+			UpdateSelection((uint32_t)pChange->iFrom, (uint32_t)pChange->iTo + 1, (pChange->uNewState & LVIS_SELECTED) != 0);
+		return 0;
+	}
+
+	void UpdateSelection(uint32_t first, uint32_t end, bool bSelected)
+	{
+		if(bSelected)
+			m_selection.SelectRange(first, end);
+		else
+			m_selection.DeselectRange(first, end);
+		if(!m_bRemapping)
+			KeepSelectedRows();
+	}
+
+	// the control's selection too, it is by index as well
+	void ResetSelection()
+	{
+		if(IsWindow())
+			SetItemState(-1, 0, LVIS_SELECTED);
+		m_selection.Clear();
+		m_selectedRows.clear();
+	}
+
+	// rows of a grouped selection small enough to select again after the
+	// group model moved the items
+	void KeepSelectedRows()
+	{
+		Synrc::CGroupModel* pGroups = m_source.GetGroupModel();
+		m_selectedRows.clear();
+		if(pGroups == NULL || m_selection.GetCount() > REMAP_SELECTION_ROWS)
+			return;
+		m_source.GetSelectedRows(m_selection, m_selectedRows);
+		m_selectionLayout = pGroups->GetLayoutVersion();
+	}
+
+	// Once the group model's layout changed, selects the kept rows at their
+	// items now; rows no longer shown, or a selection too big to keep, drop.
+	void RemapSelection()
+	{
+		Synrc::CGroupModel* pGroups = m_source.GetGroupModel();
+		if(pGroups == NULL || m_selection.IsEmpty() || pGroups->GetLayoutVersion() == m_selectionLayout)
+			return;
+		std::vector<uint32_t> rows;
+		rows.swap(m_selectedRows);
+		m_bRemapping = true;
+		ResetSelection();
+		for(size_t i = 0; i < rows.size(); i++) {
+			uint32_t item = pGroups->GetRowItem(rows[i]);
+			if(item != Synrc::CGroupModel::NoGroup)
+				SetItemState((int)item, LVIS_SELECTED, LVIS_SELECTED);
+		}
+		m_bRemapping = false;
+		KeepSelectedRows();
+	}
+
+	// implementation of IListHost
+	virtual void OnItemCountChanged(uint32_t count)
+	{
+		// streamed results only append; fewer results are other ones
+		if(m_source.GetGroupModel() == NULL && (int)count < GetItemCount())
+			ResetSelection();
+		if((int)count != GetItemCount())
+			SetItemCountEx(count, LVSICF_NOINVALIDATEALL | LVSICF_NOSCROLL);
+		RemapSelection();
+	}
+
+	virtual void OnGroupHeaderCreated(uint32_t position)
+	{
+		Synrc::CGroupModel* pGroups = m_source.GetGroupModel();
+		const std::wstring& label = pGroups->GetGroupLabel(position);
+		LVGROUP group = {0};
+		group.cbSize = RunTimeHelper::SizeOf_LVGROUP();
+		group.mask = LVGF_ALIGN | LVGF_GROUPID | LVGF_HEADER | LVGF_ITEMS | LVGF_STATE;
+		group.iGroupId = (int)pGroups->GetGroupId(position) + 1;
+		group.uAlign = LVGA_HEADER_LEFT;
+		group.cItems = (int)pGroups->GetGroupSize(position);
+		group.pszHeader = const_cast<LPWSTR>(label.empty() ? L"(none)" : label.c_str());
+		group.stateMask = LVGS_COLLAPSIBLE | LVGS_COLLAPSED;
+		group.state = LVGS_COLLAPSIBLE | (pGroups->IsCollapsed(position) ? LVGS_COLLAPSED : 0);
+		InsertGroup((int)pGroups->GetHeaderIndex(position), &group);
+	}
+
+	virtual void OnGroupHeaderRemoved(uint32_t id)
+	{
+		RemoveGroup(id + 1);
+	}
+
+	virtual void OnGroupHeaderResized(uint32_t position)
+	{
+		Synrc::CGroupModel* pGroups = m_source.GetGroupModel();
+		LVGROUP group = {0};
+		group.cbSize = RunTimeHelper::SizeOf_LVGROUP();
+		group.mask = LVGF_ITEMS;
+		group.cItems = (int)pGroups->GetGroupSize(position);
+		SetGroupInfo(pGroups->GetGroupId(position) + 1, &group);
+	}
+	// implementation of IListHost
+
 	void InsertGroups(void)
 	{
 		// insert 3 groups
@@ -256,4 +728,19 @@ public:
 		EnableGroupView(TRUE);
 	}
 
+private:
+	Synrc::CFindService* m_pFind;
+	Synrc::CProgressiveResults* m_pResults;
+	bool m_bFooter;
+	bool m_bPainted;
+	Synrc::CSelectionSet m_selection;
+	Synrc::CListDataSource m_source;
+	Synrc::CLatencyHistogram* m_pLatency[LatencyCount];
+	Synrc::CUsageTracker* m_pUsage;
+	uint32_t m_usageVersion;
+	uint32_t m_frequentCount;
+	Synrc::CUpcomingGroup* m_pUpcoming;
+	std::vector<uint32_t> m_selectedRows;   // of m_selection, see KeepSelectedRows()
+	uint32_t m_selectionLayout;             // group model layout m_selectedRows were taken in
+	bool m_bRemapping;
 };
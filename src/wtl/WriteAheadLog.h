@@ -0,0 +1,333 @@
+// WriteAheadLog.h
+//
+//  Append-only redo log in front of the contact store. Writers append a
+//  record and get its log sequence number (LSN) back at once; a flusher
+//  thread writes everything appended since its last pass with a single
+//  write and a single fsync (group commit), then wakes every writer whose
+//  LSN became durable. Many concurrent or back-to-back edits therefore
+//  share one disk flush instead of paying one each.
+//
+//  Frame layout, little-endian:
+//      u32 payload length | u32 crc of the rest | u64 lsn | u8 type | payload
+//  A crash can leave a partial frame at the end; Replay() stops at the
+//  first frame that does not check out and cuts the file there.
+//
+//  The flusher is a thread of its own, not a CTaskPool task: it waits on
+//  fsync and for appends for the life of the log, and a writer blocked on
+//  durability, possibly a pool task itself, must not wait for a worker.
+
+#pragma once
+
+#include <string>
+
+#include "Platform.h"
+#include "BinaryStream.h"
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Classes in this file:
+//
+// CWriteAheadLog - group-committed append log with replay
+
+namespace Synrc
+{
+
+struct WriteAheadLogStats
+{
+	uint64_t records;       // appended
+	uint64_t bytes;         // written, framing included
+	uint64_t syncs;         // flushes to stable storage
+	uint64_t maxGroup;      // most records made durable by one sync
+
+	WriteAheadLogStats()
+	{
+		memset(this, 0, sizeof(*this));
+	}
+};
+
+class CWriteAheadLog
+{
+public:
+	enum
+	{
+		HeaderSize = 17,
+		MaxRecordSize = 64 * 1024 * 1024,
+		DefaultMaxBuffered = 16 * 1024 * 1024
+	};
+
+	CWriteAheadLog() :
+		m_pendingRecords(0), m_nextLsn(1), m_lastLsn(0), m_durableLsn(0), m_maxBuffered(DefaultMaxBuffered),
+		m_bOpen(false), m_bStop(false), m_bFailed(false)
+	{
+	}
+
+	~CWriteAheadLog()
+	{
+		Close();
+	}
+
+	// Opens (or creates) path for appending; lastLsn is the highest LSN
+	// already persisted anywhere, numbering continues after it.
+	bool Open(const std::string& path, uint64_t lastLsn)
+	{
+		if(m_bOpen)
+			return false;
+		if(!m_file.Open(path, CNativeFile::OpenAppend))
+			return false;
+		m_path = path;
+		m_nextLsn = lastLsn + 1;
+		m_lastLsn = m_durableLsn = lastLsn;
+		m_bStop = false;
+		m_bFailed = false;
+		m_bOpen = true;
+		m_flusher.Start(FlusherProc, this);
+		return true;
+	}
+
+	// flushes what was appended and stops the flusher
+	void Close()
+	{
+		if(!m_bOpen)
+			return;
+		{
+			CAutoLock lock(m_cs);
+			m_bStop = true;
+			m_cvWork.Signal();
+		}
+		m_flusher.Join();
+		m_file.Close();
+		m_bOpen = false;
+	}
+
+	// Queues one record and returns its LSN, 0 if the log has failed.
+	// Blocks only while more than the buffering limit waits for the disk.
+	uint64_t Append(uint8_t type, const void* pPayload, size_t cb)
+	{
+		if(cb > MaxRecordSize)
+			return 0;
+		CAutoLock lock(m_cs);
+		while(m_pending.size() > m_maxBuffered && !m_bFailed && !m_bStop)
+			m_cvDurable.Wait(m_cs);
+		if(m_bFailed || !m_bOpen || m_bStop)
+			return 0;
+
+		uint64_t lsn = m_nextLsn++;
+		size_t start = m_pending.size();
+		CByteWriter writer(m_pending);
+		writer.PutU32((uint32_t)cb);
+		writer.PutU32(0);
+		writer.PutU64(lsn);
+		writer.PutU8(type);
+		writer.PutBytes(pPayload, cb);
+		uint32_t crc = Crc32(&m_pending[start + 8], HeaderSize - 8 + cb);
+		for(int i = 0; i < 4; i++)
+			m_pending[start + 4 + i] = (char)(crc >> (8 * i));
+
+		m_lastLsn = lsn;
+		m_pendingRecords++;
+		m_stats.records++;
+		m_cvWork.Signal();
+		return lsn;
+	}
+
+	uint64_t Append(uint8_t type, const std::string& payload)
+	{
+		return Append(type, payload.data(), payload.size());
+	}
+
+	// true once lsn is on stable storage, false on failure or timeout
+	bool WaitDurable(uint64_t lsn, uint32_t timeoutMs = CCondVar::INFINITE_WAIT)
+	{
+		CAutoLock lock(m_cs);
+		if(lsn > m_lastLsn)
+			return false;
+		uint64_t deadline = timeoutMs == CCondVar::INFINITE_WAIT ? 0 : GetTimeMs() + timeoutMs;
+		while(m_durableLsn < lsn) {
+			if(m_bFailed)
+				return false;
+			if(timeoutMs == CCondVar::INFINITE_WAIT)
+				m_cvDurable.Wait(m_cs);
+			else {
+				uint64_t now = GetTimeMs();
+				if(now >= deadline)
+					return false;
+				m_cvDurable.Wait(m_cs, (uint32_t)(deadline - now));
+			}
+		}
+		return true;
+	}
+
+	// waits for everything appended so far
+	bool Flush(uint32_t timeoutMs = CCondVar::INFINITE_WAIT)
+	{
+		uint64_t lsn;
+		{
+			CAutoLock lock(m_cs);
+			lsn = m_lastLsn;
+		}
+		return WaitDurable(lsn, timeoutMs);
+	}
+
+	// Makes everything appended so far durable, then continues in newPath.
+	// Returns the last LSN that went to the old file, 0 on failure.
+	uint64_t Rotate(const std::string& newPath)
+	{
+		CAutoLock lock(m_cs);
+		// with nothing left to make durable the flusher is idle and stays
+		// parked on m_cvWork until the lock is released
+		while(m_durableLsn < m_lastLsn && !m_bFailed)
+			m_cvDurable.Wait(m_cs);
+		if(m_bFailed)
+			return 0;
+		if(!m_file.Open(newPath, CNativeFile::OpenAppend)) {
+			m_bFailed = true;
+			m_cvDurable.Broadcast();
+			return 0;
+		}
+		m_path = newPath;
+		return m_lastLsn;
+	}
+
+	uint64_t GetLastLsn()
+	{
+		CAutoLock lock(m_cs);
+		return m_lastLsn;
+	}
+
+	uint64_t GetDurableLsn()
+	{
+		CAutoLock lock(m_cs);
+		return m_durableLsn;
+	}
+
+	bool IsFailed()
+	{
+		CAutoLock lock(m_cs);
+		return m_bFailed;
+	}
+
+	WriteAheadLogStats GetStats()
+	{
+		CAutoLock lock(m_cs);
+		return m_stats;
+	}
+
+	void SetMaxBuffered(size_t cb)
+	{
+		CAutoLock lock(m_cs);
+		m_maxBuffered = cb;
+	}
+
+	// Calls handler(lsn, type, pPayload, cb) for every intact record with an
+	// LSN above afterLsn and truncates a torn tail. pLastLsn receives the
+	// highest LSN found. Returns false only if the file cannot be read.
+	template <class H>
+	static bool Replay(const std::string& path, uint64_t afterLsn, H& handler, uint64_t* pLastLsn = NULL)
+	{
+		CNativeFile file;
+		if(!file.Open(path, CNativeFile::OpenRead))
+			return false;
+		std::string data;
+		if(!file.ReadAll(data))
+			return false;
+		file.Close();
+
+		size_t pos = 0;
+		uint64_t lastLsn = 0;
+		while(data.size() - pos >= HeaderSize) {
+			CByteReader reader(data.data() + pos, data.size() - pos);
+			uint32_t cb = reader.GetU32();
+			uint32_t crc = reader.GetU32();
+			if(cb > MaxRecordSize || data.size() - pos - HeaderSize < cb)
+				break;
+			if(Crc32(data.data() + pos + 8, HeaderSize - 8 + cb) != crc)
+				break;
+			uint64_t lsn = reader.GetU64();
+			uint8_t type = reader.GetU8();
+			if(lsn > afterLsn)
+				handler(lsn, type, data.data() + pos + HeaderSize, (size_t)cb);
+			if(lsn > lastLsn)
+				lastLsn = lsn;
+			pos += HeaderSize + cb;
+		}
+
+		if(pos < data.size()) {
+			// torn write from a crash, drop it so appends start on a frame boundary
+			if(file.Open(path, CNativeFile::OpenAppend)) {
+				file.Truncate((int64_t)pos);
+				file.Sync();
+			}
+		}
+		if(pLastLsn)
+			*pLastLsn = lastLsn;
+		return true;
+	}
+
+private:
+	CCritSec m_cs;
+	CCondVar m_cvWork;          // flusher: something was appended or stop
+	CCondVar m_cvDurable;       // writers: durable LSN moved or buffer space freed
+	CNativeThread m_flusher;    // not a pool task, see above
+	CNativeFile m_file;
+	std::string m_path;
+	std::string m_pending;      // frames appended since the last flusher pass
+	std::string m_writing;      // frames being written, flusher only
+	uint64_t m_pendingRecords;
+	uint64_t m_nextLsn;
+	uint64_t m_lastLsn;
+	uint64_t m_durableLsn;
+	size_t m_maxBuffered;
+	bool m_bOpen;
+	bool m_bStop;
+	bool m_bFailed;
+	WriteAheadLogStats m_stats;
+
+	void FlusherLoop()
+	{
+		for(;;) {
+			uint64_t groupLsn;
+			uint64_t groupRecords;
+			{
+				CAutoLock lock(m_cs);
+				while(m_pending.empty() && !m_bStop)
+					m_cvWork.Wait(m_cs);
+				if(m_pending.empty() || m_bFailed)
+					return;
+				m_writing.swap(m_pending);
+				m_pending.clear();
+				groupLsn = m_lastLsn;
+				groupRecords = m_pendingRecords;
+				m_pendingRecords = 0;
+				// buffer space is free again
+				m_cvDurable.Broadcast();
+			}
+
+			// the file is only swapped by Rotate() while no pass is running
+			bool bOk = m_file.Write(m_writing.data(), m_writing.size()) && m_file.Sync();
+
+			CAutoLock lock(m_cs);
+			if(!bOk)
+				m_bFailed = true;
+			else {
+				m_durableLsn = groupLsn;
+				m_stats.syncs++;
+				m_stats.bytes += m_writing.size();
+				if(groupRecords > m_stats.maxGroup)
+					m_stats.maxGroup = groupRecords;
+			}
+			m_cvDurable.Broadcast();
+			if(m_bFailed)
+				return;
+		}
+	}
+
+	static void FlusherProc(void* p)
+	{
+		static_cast<CWriteAheadLog*>(p)->FlusherLoop();
+	}
+
+	CWriteAheadLog(const CWriteAheadLog&);
+	CWriteAheadLog& operator=(const CWriteAheadLog&);
+};
+
+}; // namespace Synrc
@@ -15,6 +15,12 @@
 #define IDC_SEARCHDROP2                  2030
 #define IDS_SEARCH                      158
 #define ID_SEARCH_DROPDOWN              32784
+#define ID_SEARCH_SCOPE_ALL             32785
+#define ID_SEARCH_SCOPE_NAME            32786
+#define ID_SEARCH_SCOPE_EMAIL           32787
+#define ID_SEARCH_SCOPE_PHONE           32788
+#define ID_SEARCH_SCOPE_COMPANY         32789
+#define ID_SEARCH_SCOPE_LABEL           32790
 
 
 // Next default values for new objects
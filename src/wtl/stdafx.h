@@ -6,6 +6,7 @@
 #define _RICHEDIT_VER	0x0100
 #define NTDDI_VERSION NTDDI_WIN7
 
+#include <winsock2.h> // before windows.h, for the native sync transport
 #include <atlbase.h>
 #include <atlapp.h>
 
@@ -25,6 +26,7 @@ extern CAppModule _Module;
 
 
 #include <commoncontrols.h>
+#include <shlobj.h>
 #include <strsafe.h>
 #include <uxtheme.h>
 